@@ -1,6 +1,17 @@
 var API_BASE = "/api/"
 
-var transport_status_interval = 5000;
+// The server holds a status request open until something changes,
+//  for up to 25 seconds. If a request fails, we wait this long before
+//  trying again
+var transport_status_retry = 5000;
+var transport_status_timeout = 30000;
+// Generation number of the status currently shown, or -1 if none
+var transport_status_generation = -1;
+// The status currently shown, used to advance the playback position
+//  between updates
+var transport_status = null;
+// Playlist generation when the page was loaded, or -1 if not yet known
+var playlist_generation = -1;
 var scanner_status_interval = 2000;
 
 var timeout_msg = 0;
@@ -139,8 +150,8 @@ function do_http_request_complete (callback, http_request)
   }
 
 // Make an HTTP request on the specified uri, and call callback with
-//  the results when complete
-function make_request (uri, callback)
+//  the results when complete. The timeout, in msec, is optional
+function make_request (uri, callback, timeout)
   {
   var http_request = false;
   if (window.XMLHttpRequest)
@@ -177,12 +188,13 @@ if (!http_request)
     do_http_request_complete (callback, http_request);
     };
   http_request.open('GET', uri, true);
-  http_request.timeout = 10000; // Got to have _some_ value
+  // Got to have _some_ value
+  http_request.timeout = timeout ? timeout : 10000;
   //http_request.timeout = show_server_timeout();
   http_request.send (null);
   }
 
-function make_fn_request (fn, callback)
+function make_fn_request (fn, callback, timeout)
   {
   self_uri = parse_uri (window.location.href);
 
@@ -191,7 +203,7 @@ function make_fn_request (fn, callback)
   fn_uri = "http://" + self_uri.host  + ":" + self_uri.port +
     fn + "&random=" + Math.random();
 
-  make_request (fn_uri, callback);
+  make_request (fn_uri, callback, timeout);
   }
 
 // Called on loading main page
@@ -200,7 +212,8 @@ function onload_transport ()
   var slider = document.getElementById("volumeslider");
   slider.oninput = function() 
     { set_volume (this.value); }
-  setInterval (transport_status_tick, transport_status_interval);
+  refresh_playback_status();
+  setInterval (transport_status_tick, 1000);
   }
 
 // Called on loading scanner.html, to initialize the scanner
@@ -240,10 +253,15 @@ parse_uri.options = {
         }
 };
 
+// Ask the server for the playback status. If we already have a status,
+//  the server does not answer until it has changed
 function refresh_playback_status()
   {
   var apiFn = API_BASE + "status?dummy";
-  make_fn_request (apiFn, response_callback_refresh_playback_status);
+  if (transport_status_generation >= 0)
+    apiFn = API_BASE + "status?since=" + transport_status_generation;
+  make_fn_request (apiFn, response_callback_refresh_playback_status,
+    transport_status_timeout);
   }
 
 function refresh_scanner_status()
@@ -268,17 +286,50 @@ function response_callback_null (response_text)
   }
 
 // response_callback_refresh_playback_status 
-// Called in response to the timed status update tick
+// Called when a status request completes. Shows the new status, and
+//  then waits for the next change
 function response_callback_refresh_playback_status (response_text)
   {
-  var obj = eval ('(' + response_text + ')'); 
+  var obj = null;
+  try
+    {
+    obj = eval ('(' + response_text + ')'); 
+    }
+  catch (e)
+    {
+    // The request failed or timed out
+    }
 
-  if (obj.status != "0")
+  if (!obj || obj.status != "0" || !obj.generation)
     {
-    // Should we take some action here? It should never happen
+    // Server unreachable or xine-server not responding. Start again
+    //  with an ordinary request, after a pause
+    transport_status_generation = -1;
+    if (obj && obj.status == "0") show_playback_status (obj);
+    setTimeout (refresh_playback_status, transport_status_retry);
     return;
     }
 
+  transport_status_generation = obj.generation;
+  show_playback_status (obj);
+  refresh_playback_status();
+  }
+
+// Show the playback position, which the server only reports when
+//  something else changes
+function show_playback_pos (obj)
+  {
+  if (obj.pos > 0)
+    document.getElementById ("streamposspan").innerHTML = 
+       sec_to_minsec (obj.pos);
+  else
+    document.getElementById ("streamposspan").innerHTML = ("00:00"); 
+  }
+
+function show_playback_status (obj)
+  {
+  transport_status = obj;
+
   if (obj.transport_status == TRANSPORT_STOPPED)
     {
     document.getElementById ("transportstatusspan").innerHTML = "stopped";
@@ -295,11 +346,7 @@ function response_callback_refresh_playback_status (response_text)
     else if (obj.transport_status == TRANSPORT_BUFFERING)
       document.getElementById ("transportstatusspan").innerHTML = "buffering"
 
-    if (obj.pos > 0)
-      document.getElementById ("streamposspan").innerHTML = 
-         sec_to_minsec (obj.pos);
-    else
-      document.getElementById ("streamposspan").innerHTML = ("00:00"); 
+    show_playback_pos (obj);
 
     if (obj.len > 0)
       document.getElementById ("streamlenspan").innerHTML = 
@@ -317,6 +364,21 @@ function response_callback_refresh_playback_status (response_text)
     document.getElementById ("playlistindexspan").innerHTML = "?";
   document.getElementById ("playlistlengthspan").innerHTML 
     = obj.playlist_length; 
+
+  // If the playlist is on show, and has changed, show the new one
+  if (obj.playlist_generation)
+    {
+    if (playlist_generation >= 0 
+        && obj.playlist_generation != playlist_generation
+        && document.getElementById ("playlist"))
+      location.reload();
+    playlist_generation = obj.playlist_generation;
+    }
+
+  // Don't move the volume slider while the user is moving it
+  var slider = document.getElementById ("volumeslider");
+  if (obj.volume >= 0 && slider && document.activeElement != slider)
+    slider.value = obj.volume;
   }
 
 // response_callback_refresh_playback_status 
@@ -379,9 +441,16 @@ function set_volume (volume)
   make_fn_request (apiFn, response_callback_null);
   }
 
+// Called every second, to advance the playback position while
+//  playing. The server sends the real position with every change
 function transport_status_tick()
   {
-  refresh_playback_status();
+  var obj = transport_status;
+  if (obj && obj.transport_status == TRANSPORT_PLAYING)
+    {
+    if (obj.len <= 0 || obj.pos < obj.len) obj.pos++;
+    show_playback_pos (obj);
+    }
   }
 
 
@@ -11,11 +11,13 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
 #include "defs.h" 
 #include "log.h" 
 #include "props.h" 
 #include "path.h" 
 #include "facade.h" 
+#include "request_handler.h" 
 #include "template_manager.h" 
 #include "htmlutil.h" 
 #include "gui_request_handler.h" 
@@ -53,7 +55,7 @@ static String *albums_request_handler_album_cell (const char *album)
       
   char *image_uri = facade_get_cover_image_for_album (album); 
   if (!image_uri) 
-     asprintf (&image_uri, "%s%s", INT_FILE_BASE, "default_cover.png");
+     image_uri = strdup (request_handler_get_int_uri ("default_cover.png"));
   char *imagehtml = albums_request_handler_make_img_html (image_uri);
 
   char *album_expand_image_link = htmlutil_make_href 
@@ -67,12 +69,27 @@ static String *albums_request_handler_album_cell (const char *album)
 
   char *play_album_text_link = htmlutil_make_href (play_album_uri, "[play]");
 
+  char *error = NULL;
+  int error_code = 0;
+  int64_t duration = facade_get_album_duration (album, &error_code, &error);
+  if (duration < 0)
+    {
+    log_warning (error);
+    free (error);
+    }
+
   String *ret = string_create ("<div class=\"albumlistcell\">");
   string_append (ret, "<span class=\"albumlisttext\">\n");
 
   string_append (ret, album_expand_text_link);
   string_append (ret, " ");
   string_append (ret, play_album_text_link);
+  if (duration > 0)
+    {
+    char *length = htmlutil_format_duration (duration);
+    string_append_printf (ret, " (%s)", length);
+    free (length);
+    }
 
   string_append (ret, "</span>\n");
   string_append (ret, "<p>\n");
@@ -109,6 +126,9 @@ String *albums_request_handler_albumlist (List *list)
   if (l > 0)
     {
     ret = string_create ("<div class=\"albumlist\">\n");
+    // Each cell looks up the album's cover and length in the index, so
+    //  share one connection between them
+    facade_begin_batch ();
     for (int i = 0; i < l; i++)
        {
        const char *album = list_get (list, i);
@@ -116,6 +136,7 @@ String *albums_request_handler_albumlist (List *list)
        string_append (ret, string_cstr (cell));
        string_destroy (cell);
        } 
+    facade_end_batch ();
     string_append (ret, "</div>\n");
     }
   else
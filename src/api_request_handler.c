@@ -25,10 +25,14 @@
 #include "request_handler.h" 
 #include "api_request_handler.h" 
 #include "xine-server-x-api.h" 
+#include "xine-server-api.h" 
 #include "wstring.h" 
 #include "facade.h" 
 #include "htmlutil.h" 
 #include "searchconstraints.h" 
+#include "status_poller.h" 
+#include "playlist_mirror.h" 
+#include "metrics.h" 
 
 struct _APIRequestHandler
   {
@@ -86,45 +90,74 @@ void api_request_handler_play_matching (APIRequestHandler *self,
        const Props *arguments, int *code, char **result);
 void api_request_handler_clear (APIRequestHandler *self, 
        const Props *arguments, int *code, char **result);
+void api_request_handler_list_playlist (APIRequestHandler *self, 
+       const Props *arguments, int *code, char **result);
+void api_request_handler_batch (APIRequestHandler *self, 
+       const Props *arguments, int *code, char **result);
+
+BOOL api_request_handler_status_validator (APIRequestHandler *self, 
+       const Props *arguments, uint64_t *validator);
+BOOL api_request_handler_dirs_validator (APIRequestHandler *self, 
+       const Props *arguments, uint64_t *validator);
+BOOL api_request_handler_index_validator (APIRequestHandler *self, 
+       const Props *arguments, uint64_t *validator);
+BOOL api_request_handler_playlist_validator (APIRequestHandler *self, 
+       const Props *arguments, uint64_t *validator);
 
 // Definition of function table
 typedef void (*ApiFn) (APIRequestHandler *self, const Props *arguments, 
   int *code, char **result);
 
+typedef BOOL (*ApiValidatorFn) (APIRequestHandler *self, 
+  const Props *arguments, uint64_t *validator);
+
+// If poke is TRUE, the function may change the playback status, so the
+//   status poller is asked to poll again as soon as it has been called.
+//   If validatorFn is not NULL, it gives a number that changes whenever
+//   the function's response would, so that clients can be sent 304 
+//   responses -- see request_handler_api_etag()
 typedef struct 
   {
   ApiFn apiFn;
   const char *name;
+  BOOL poke;
+  ApiValidatorFn validatorFn;
   } ApiFnData;
 
 ApiFnData apiFnData[] = 
   {
-  { api_request_handler_status, XINESERVER_X_FN_STATUS },
-  { api_request_handler_play_dir, XINESERVER_X_FN_PLAY_DIR },
-  { api_request_handler_add_dir, XINESERVER_X_FN_ADD_DIR },
-  { api_request_handler_add_file, XINESERVER_X_FN_ADD_FILE },
-  { api_request_handler_play_file, XINESERVER_X_FN_PLAY_FILE },
-  { api_request_handler_shutdown, XINESERVER_X_FN_SHUTDOWN },
-  { api_request_handler_stop, XINESERVER_X_FN_STOP },
-  { api_request_handler_play, XINESERVER_X_FN_PLAY },
-  { api_request_handler_pause, XINESERVER_X_FN_PAUSE },
-  { api_request_handler_next, XINESERVER_X_FN_NEXT },
-  { api_request_handler_prev, XINESERVER_X_FN_PREV },
-  { api_request_handler_play_index, XINESERVER_X_FN_PLAY_INDEX },
-  { api_request_handler_set_volume, XINESERVER_X_FN_SET_VOLUME },
-  { api_request_handler_play_station, XINESERVER_X_FN_PLAY_STATION },
-  { api_request_handler_list_dirs, XINESERVER_X_FN_LIST_DIRS },
-  { api_request_handler_list_station_lists, XINESERVER_X_FN_LIST_STATION_LISTS },
-  { api_request_handler_list_station_names, XINESERVER_X_FN_LIST_STATION_NAMES },
-  { api_request_handler_scanner_status, XINESERVER_X_FN_SCANNER_STATUS },
-  { api_request_handler_quick_scan, XINESERVER_X_FN_QUICK_SCAN },
-  { api_request_handler_full_scan, XINESERVER_X_FN_FULL_SCAN },
-  { api_request_handler_play_album, XINESERVER_X_FN_PLAY_ALBUM },
-  { api_request_handler_list_albums, XINESERVER_X_FN_LIST_ALBUMS },
-  { api_request_handler_add_matching, XINESERVER_X_FN_ADD_MATCHING },
-  { api_request_handler_play_matching, XINESERVER_X_FN_PLAY_MATCHING },
-  { api_request_handler_clear, XINESERVER_X_FN_CLEAR },
-  { NULL, NULL }
+  { api_request_handler_status, XINESERVER_X_FN_STATUS, FALSE,
+      api_request_handler_status_validator },
+  { api_request_handler_play_dir, XINESERVER_X_FN_PLAY_DIR, TRUE, NULL },
+  { api_request_handler_add_dir, XINESERVER_X_FN_ADD_DIR, TRUE, NULL },
+  { api_request_handler_add_file, XINESERVER_X_FN_ADD_FILE, TRUE, NULL },
+  { api_request_handler_play_file, XINESERVER_X_FN_PLAY_FILE, TRUE, NULL },
+  { api_request_handler_shutdown, XINESERVER_X_FN_SHUTDOWN, FALSE, NULL },
+  { api_request_handler_stop, XINESERVER_X_FN_STOP, TRUE, NULL },
+  { api_request_handler_play, XINESERVER_X_FN_PLAY, TRUE, NULL },
+  { api_request_handler_pause, XINESERVER_X_FN_PAUSE, TRUE, NULL },
+  { api_request_handler_next, XINESERVER_X_FN_NEXT, TRUE, NULL },
+  { api_request_handler_prev, XINESERVER_X_FN_PREV, TRUE, NULL },
+  { api_request_handler_play_index, XINESERVER_X_FN_PLAY_INDEX, TRUE, NULL },
+  { api_request_handler_set_volume, XINESERVER_X_FN_SET_VOLUME, TRUE, NULL },
+  { api_request_handler_play_station, XINESERVER_X_FN_PLAY_STATION, TRUE, NULL },
+  { api_request_handler_list_dirs, XINESERVER_X_FN_LIST_DIRS, FALSE,
+      api_request_handler_dirs_validator },
+  { api_request_handler_list_station_lists, XINESERVER_X_FN_LIST_STATION_LISTS, FALSE, NULL },
+  { api_request_handler_list_station_names, XINESERVER_X_FN_LIST_STATION_NAMES, FALSE, NULL },
+  { api_request_handler_scanner_status, XINESERVER_X_FN_SCANNER_STATUS, FALSE, NULL },
+  { api_request_handler_quick_scan, XINESERVER_X_FN_QUICK_SCAN, FALSE, NULL },
+  { api_request_handler_full_scan, XINESERVER_X_FN_FULL_SCAN, FALSE, NULL },
+  { api_request_handler_play_album, XINESERVER_X_FN_PLAY_ALBUM, TRUE, NULL },
+  { api_request_handler_list_albums, XINESERVER_X_FN_LIST_ALBUMS, FALSE,
+      api_request_handler_index_validator },
+  { api_request_handler_add_matching, XINESERVER_X_FN_ADD_MATCHING, TRUE, NULL },
+  { api_request_handler_play_matching, XINESERVER_X_FN_PLAY_MATCHING, TRUE, NULL },
+  { api_request_handler_clear, XINESERVER_X_FN_CLEAR, TRUE, NULL },
+  { api_request_handler_list_playlist, XINESERVER_X_FN_LIST_PLAYLIST, FALSE,
+      api_request_handler_playlist_validator },
+  { api_request_handler_batch, XINESERVER_X_FN_BATCH, FALSE, NULL },
+  { NULL, NULL, FALSE, NULL }
   };
 
 /*============================================================================
@@ -138,6 +171,8 @@ APIRequestHandler *api_request_handler_create
   LOG_IN
   APIRequestHandler *self = malloc (sizeof (APIRequestHandler)); 
   self->request_handler = request_handler;
+  for (ApiFnData *afd = apiFnData; afd->apiFn; afd++)
+    metrics_add_route (METRICS_ROUTE_API, afd->name);
   LOG_OUT 
   return self;
   }
@@ -200,6 +235,41 @@ char *api_request_handler_json_sanitize (const char *s)
   return ret;
   }
 
+/*============================================================================
+
+ What a status response is made from, apart from the playback status
+ itself. api_request_handler_status_validator() keeps what it made its
+ validator from, on the thread that handles the request, and 
+ api_request_handler_status() reports exactly that, so that a response
+ always matches its entity tag
+
+============================================================================*/
+typedef struct _ApiStatusInputs
+  {
+  StatusSnapshot *snapshot; // NULL if nothing is kept
+  XSBreakerState breaker;
+  int breaker_failures;
+  uint64_t playlist_generation;
+  } ApiStatusInputs;
+
+static __thread ApiStatusInputs api_request_handler_kept_status;
+
+/*============================================================================
+
+ api_request_handler_discard
+
+============================================================================*/
+void api_request_handler_discard (APIRequestHandler *self)
+  {
+  LOG_IN
+  if (api_request_handler_kept_status.snapshot)
+    {
+    status_poller_release (api_request_handler_kept_status.snapshot);
+    api_request_handler_kept_status.snapshot = NULL;
+    }
+  LOG_OUT
+  }
+
 /*============================================================================
 
  api_request_handler_status
@@ -211,8 +281,44 @@ void api_request_handler_status (APIRequestHandler *self,
   LOG_IN
   char *error_message = NULL;
   int error_code = 0;
-  PlaybackStatus *status = NULL;
-  facade_get_playback_status (&error_code, &error_message, &status);
+  const PlaybackStatus *status = NULL;
+  PlaybackStatus *own_status = NULL;
+  ApiStatusInputs in;
+  if (api_request_handler_kept_status.snapshot)
+    {
+    // The validator has already chosen the snapshot
+    in = api_request_handler_kept_status;
+    api_request_handler_kept_status.snapshot = NULL;
+    }
+  else
+    {
+    // Serve from the poller's snapshot if there is one; otherwise ask
+    //   xine-server directly. A client that passes the generation it
+    //   last saw is kept waiting until something changes
+    const char *since = props_get (arguments, "since");
+    in.snapshot = since 
+      ? status_poller_wait (strtoull (since, NULL, 10), 
+          STATUS_POLLER_LONG_POLL_WAIT)
+      : status_poller_get ();
+    // The breaker state is reported live, not from the snapshot, and
+    //   in error responses too -- that is when it is most interesting
+    xineserver_breaker_get_state (&in.breaker, &in.breaker_failures);
+    in.playlist_generation = playlist_mirror_get_generation ();
+    }
+  StatusSnapshot *snapshot = in.snapshot;
+  if (snapshot)
+    {
+    error_code = status_snapshot_get_error_code (snapshot);
+    if (error_code == 0)
+      status = status_snapshot_get_status (snapshot);
+    else if (status_snapshot_get_error_message (snapshot))
+      error_message = strdup (status_snapshot_get_error_message (snapshot));
+    }
+  else
+    {
+    facade_get_playback_status (&error_code, &error_message, &own_status);
+    status = own_status;
+    }
   if (error_code == 0)
     {
     char *composer = api_request_handler_json_sanitize 
@@ -231,7 +337,9 @@ void api_request_handler_status (APIRequestHandler *self,
        "\"playlist_index\": %d, \"playlist_length\": %d, "
        "\"bitrate\": %d, \"composer\": \"%s\", \"album\": \"%s\", "
        "\"artist\": \"%s\", \"genre\": \"%s\", \"title\": \"%s\", "
-       "\"seekable\": %d "
+       "\"seekable\": %d, \"volume\": %d, \"generation\": %llu, "
+       "\"playlist_generation\": %llu, "
+       "\"breaker\": \"%s\", \"breaker_failures\": %d "
        "}",
       playback_status_get_pos (status),
       playback_status_get_len (status),
@@ -240,9 +348,14 @@ void api_request_handler_status (APIRequestHandler *self,
       playback_status_get_playlist_length (status),
       playback_status_get_bitrate (status),
       composer, album, artist, genre, title,
-      playback_status_is_seekable (status)
+      playback_status_is_seekable (status),
+      playback_status_get_volume (status),
+      snapshot ? (unsigned long long)status_snapshot_get_generation (snapshot)
+        : 0ULL,
+      (unsigned long long)in.playlist_generation,
+      xineserver_breaker_state_name (in.breaker), in.breaker_failures
       );
-    playback_status_destroy (status);
+    if (own_status) playback_status_destroy (own_status);
     free (composer);
     free (album);
     free (artist);
@@ -251,9 +364,16 @@ void api_request_handler_status (APIRequestHandler *self,
     }
   else
     {
-    api_request_handler_stock_error (error_code, error_message, result);
+    char *message = api_request_handler_json_sanitize (error_message 
+      ? error_message : xineserver_x_perror (error_code));
+    asprintf (result, "{ \"status\": %d, \"message\": \"%s\", "
+       "\"breaker\": \"%s\", \"breaker_failures\": %d }",
+       error_code, message, xineserver_breaker_state_name (in.breaker), 
+       in.breaker_failures);
+    free (message);
     free (error_message);
     } 
+  if (snapshot) status_poller_release (snapshot);
   *code = 200;
   LOG_OUT
   }
@@ -928,6 +1048,54 @@ void api_request_handler_list_dirs (APIRequestHandler *self,
   LOG_OUT
   }
 
+/*============================================================================
+
+ api_request_handler_list_playlist
+
+============================================================================*/
+void api_request_handler_list_playlist (APIRequestHandler *self,
+       const Props *arguments, int *code, char **result)
+  {
+  LOG_IN
+
+  char *error_message = NULL;
+  int error_code = 0;
+  uint64_t generation = 0;
+  List *list = facade_get_playlist (&generation, &error_code, 
+    &error_message);
+  if (error_code == 0)
+    {
+    String *response = string_create_empty();
+    string_append_printf (response, 
+      "{\"status\": 0, \"generation\": %llu, \"list\": [", 
+      (unsigned long long)generation);
+    int l = list_length (list);
+    for (int i = 0; i < l; i++)
+      {
+      const char *name = list_get (list, i);
+      string_append (response, "\"");
+      char *escaped_name = htmlutil_escape_dquote_json (name);
+      string_append (response, escaped_name);
+      free (escaped_name);
+      string_append (response, "\"");
+      if (i != l - 1)
+        string_append (response, ",");
+      }
+    string_append (response, "]}");
+    list_destroy (list);
+    *code = 200;
+    *result = strdup (string_cstr (response)); 
+    string_destroy (response);
+    }
+  else
+    {
+    api_request_handler_stock_error (error_code, error_message, result);
+    free (error_message);
+    }
+
+  LOG_OUT
+  }
+
 /*============================================================================
 
  api_request_handler_handle 
@@ -949,6 +1117,7 @@ void api_request_handler_handle (APIRequestHandler *self, const char *uri,
      done = TRUE;
      *code = 200;
      afd->apiFn (self, arguments, code, page);
+     if (afd->poke) status_poller_poke ();
      }
    i++;
    afd = &apiFnData[i];
@@ -963,6 +1132,128 @@ void api_request_handler_handle (APIRequestHandler *self, const char *uri,
   LOG_OUT
   }
 
+/*============================================================================
+
+ api_request_handler_validator
+
+============================================================================*/
+BOOL api_request_handler_validator (APIRequestHandler *self, 
+       const char *uri, const Props *arguments, uint64_t *validator)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  for (ApiFnData *afd = apiFnData; afd->apiFn; afd++)
+    {
+    if (strcmp (uri, afd->name) == 0)
+      {
+      if (afd->validatorFn)
+        ret = afd->validatorFn (self, arguments, validator);
+      break;
+      }
+    }
+  LOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+ api_request_handler_status_validator
+
+ The status is only validated when it comes from the poller's snapshot,
+ and then it depends on the snapshot, the playlist generation, and the
+ breaker -- everything that api_request_handler_status() reports. The
+ snapshot generation does not change as the playback position moves, 
+ so that is included as well. A long poll is never validated. All of
+ these are kept for api_request_handler_status(), so that the response
+ is made from the same ones
+
+============================================================================*/
+BOOL api_request_handler_status_validator (APIRequestHandler *self, 
+       const Props *arguments, uint64_t *validator)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  api_request_handler_discard (self);
+  StatusSnapshot *snapshot = props_get (arguments, "since") 
+    ? NULL : status_poller_get ();
+  if (snapshot)
+    {
+    ApiStatusInputs *in = &api_request_handler_kept_status;
+    const PlaybackStatus *status = status_snapshot_get_status (snapshot);
+    xineserver_breaker_get_state (&in->breaker, &in->breaker_failures);
+    in->playlist_generation = playlist_mirror_get_generation ();
+    uint64_t v[] = 
+      {
+      status_snapshot_get_generation (snapshot),
+      status_snapshot_get_error_code (snapshot),
+      status ? playback_status_get_pos (status) : 0,
+      status ? playback_status_get_len (status) : 0,
+      in->playlist_generation,
+      in->breaker,
+      in->breaker_failures
+      };
+    *validator = request_handler_hash (REQUEST_HANDLER_HASH_INIT, 
+      v, sizeof (v));
+    in->snapshot = snapshot;
+    ret = TRUE;
+    }
+  LOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+ api_request_handler_dirs_validator
+
+============================================================================*/
+BOOL api_request_handler_dirs_validator (APIRequestHandler *self, 
+       const Props *arguments, uint64_t *validator)
+  {
+  LOG_IN
+  const char *dir = props_get (arguments, "dir");
+  if (!dir) dir = "";
+  BOOL ret = request_handler_get_dir_generation (self->request_handler, 
+    dir, validator);
+  LOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+ api_request_handler_index_validator
+
+============================================================================*/
+BOOL api_request_handler_index_validator (APIRequestHandler *self, 
+       const Props *arguments, uint64_t *validator)
+  {
+  LOG_IN
+  *validator = request_handler_get_index_generation (self->request_handler);
+  LOG_OUT
+  return TRUE;
+  }
+
+/*============================================================================
+
+ api_request_handler_playlist_validator
+
+ The playlist is only validated when it will be read from the mirror.
+ Otherwise it comes from xine-server, which has no generation number
+
+============================================================================*/
+BOOL api_request_handler_playlist_validator (APIRequestHandler *self, 
+       const Props *arguments, uint64_t *validator)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  if (playlist_mirror_get_length () >= 0)
+    {
+    *validator = playlist_mirror_get_generation ();
+    ret = TRUE;
+    }
+  LOG_OUT
+  return ret;
+  }
+
 /*============================================================================
 
  api_request_handler_list_albums
@@ -1108,3 +1399,462 @@ void api_request_handler_play_matching (APIRequestHandler *self,
 
 
 
+/*============================================================================
+
+ Batches
+
+ A batch is a JSON array of calls, each of the form
+
+   {"fn": "add_dir", "args": {"dir": "/Bach"}}
+
+ where args may be left out, and each argument may be a string, a 
+ number, true, false, or null. The parser below accepts only that --
+ nothing else would be meaningful as a function's arguments
+
+============================================================================*/
+typedef struct _ApiBatchCall
+  {
+  char *fn;
+  Props *args;
+  } ApiBatchCall;
+
+/*============================================================================
+
+ api_request_handler_batch_call_free
+
+============================================================================*/
+static void api_request_handler_batch_call_free (void *data)
+  {
+  ApiBatchCall *call = data;
+  free (call->fn);
+  props_destroy (call->args);
+  free (call);
+  }
+
+/*============================================================================
+
+ api_request_handler_json_skip
+
+============================================================================*/
+static void api_request_handler_json_skip (const char **p)
+  {
+  while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r') (*p)++;
+  }
+
+/*============================================================================
+
+ api_request_handler_json_hex4
+
+============================================================================*/
+static int api_request_handler_json_hex4 (const char *s)
+  {
+  int ret = 0;
+  for (int i = 0; i < 4; i++)
+    {
+    char c = s[i];
+    ret <<= 4;
+    if (c >= '0' && c <= '9') ret |= c - '0';
+    else if (c >= 'a' && c <= 'f') ret |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') ret |= c - 'A' + 10;
+    else return -1;
+    }
+  return ret;
+  }
+
+/*============================================================================
+
+ api_request_handler_json_string
+
+ Parse the JSON string at *p, and return it in UTF-8, or NULL if it is
+ not valid. No escape makes the text longer, so the result fits in as
+ many bytes as the string took in the JSON
+
+============================================================================*/
+static char *api_request_handler_json_string (const char **p)
+  {
+  const char *s = *p;
+  if (*s++ != '"') return NULL;
+  const char *end = s;
+  while (*end && *end != '"')
+    end += (*end == '\\' && end[1]) ? 2 : 1;
+  if (*end != '"') return NULL;
+
+  char *ret = malloc (end - s + 1);
+  char *o = ret;
+  while (s < end)
+    {
+    unsigned char c = *s++;
+    if (c < ' ') goto fail;
+    if (c != '\\')
+      {
+      *o++ = c;
+      continue;
+      }
+    c = *s++;
+    switch (c)
+      {
+      case '"': case '\\': case '/': *o++ = c; break;
+      case 'b': *o++ = '\b'; break;
+      case 'f': *o++ = '\f'; break;
+      case 'n': *o++ = '\n'; break;
+      case 'r': *o++ = '\r'; break;
+      case 't': *o++ = '\t'; break;
+      case 'u':
+        {
+        if (end - s < 4) goto fail;
+        int cp = api_request_handler_json_hex4 (s);
+        s += 4;
+        if (cp <= 0 || (cp >= 0xDC00 && cp <= 0xDFFF)) goto fail;
+        if (cp >= 0xD800 && cp <= 0xDBFF)
+          {
+          // A UTF-16 surrogate pair
+          if (end - s < 6 || s[0] != '\\' || s[1] != 'u') goto fail;
+          int low = api_request_handler_json_hex4 (s + 2);
+          if (low < 0xDC00 || low > 0xDFFF) goto fail;
+          s += 6;
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+          }
+        if (cp < 0x80)
+          *o++ = cp;
+        else if (cp < 0x800)
+          {
+          *o++ = 0xC0 | (cp >> 6);
+          *o++ = 0x80 | (cp & 0x3F);
+          }
+        else if (cp < 0x10000)
+          {
+          *o++ = 0xE0 | (cp >> 12);
+          *o++ = 0x80 | ((cp >> 6) & 0x3F);
+          *o++ = 0x80 | (cp & 0x3F);
+          }
+        else
+          {
+          *o++ = 0xF0 | (cp >> 18);
+          *o++ = 0x80 | ((cp >> 12) & 0x3F);
+          *o++ = 0x80 | ((cp >> 6) & 0x3F);
+          *o++ = 0x80 | (cp & 0x3F);
+          }
+        }
+        break;
+      default:
+        goto fail;
+      }
+    }
+  *o = 0;
+  *p = end + 1;
+  return ret;
+
+fail:
+  free (ret);
+  return NULL;
+  }
+
+/*============================================================================
+
+ api_request_handler_json_value
+
+ Parse an argument value, setting *value to its text, or to NULL if it
+ is null. Returns FALSE if it is not valid, or not a scalar
+
+============================================================================*/
+static BOOL api_request_handler_json_value (const char **p, char **value)
+  {
+  const char *s = *p;
+  *value = NULL;
+  if (*s == '"')
+    return (*value = api_request_handler_json_string (p)) != NULL;
+  if (strncmp (s, "true", 4) == 0)
+    {
+    *value = strdup ("1");
+    *p += 4;
+    return TRUE;
+    }
+  if (strncmp (s, "false", 5) == 0)
+    {
+    *value = strdup ("0");
+    *p += 5;
+    return TRUE;
+    }
+  if (strncmp (s, "null", 4) == 0)
+    {
+    *p += 4;
+    return TRUE;
+    }
+  const char *end = s;
+  BOOL digits = FALSE;
+  while (*end && strchr ("+-.eE0123456789", *end))
+    {
+    if (isdigit (*end)) digits = TRUE;
+    end++;
+    }
+  if (!digits) return FALSE;
+  *value = strndup (s, end - s);
+  *p = end;
+  return TRUE;
+  }
+
+/*============================================================================
+
+ api_request_handler_json_args
+
+============================================================================*/
+static BOOL api_request_handler_json_args (const char **p, Props *args)
+  {
+  if (**p != '{') return FALSE;
+  (*p)++;
+  api_request_handler_json_skip (p);
+  if (**p == '}')
+    {
+    (*p)++;
+    return TRUE;
+    }
+  for (;;)
+    {
+    char *name = api_request_handler_json_string (p);
+    if (!name) return FALSE;
+    char *value = NULL;
+    api_request_handler_json_skip (p);
+    BOOL ok = **p == ':';
+    if (ok)
+      {
+      (*p)++;
+      api_request_handler_json_skip (p);
+      ok = api_request_handler_json_value (p, &value);
+      }
+    if (value) props_put (args, name, value);
+    free (name);
+    free (value);
+    if (!ok) return FALSE;
+    api_request_handler_json_skip (p);
+    if (**p == '}')
+      {
+      (*p)++;
+      return TRUE;
+      }
+    if (**p != ',') return FALSE;
+    (*p)++;
+    api_request_handler_json_skip (p);
+    }
+  }
+
+/*============================================================================
+
+ api_request_handler_json_call
+
+============================================================================*/
+static ApiBatchCall *api_request_handler_json_call (const char **p)
+  {
+  if (**p != '{') return NULL;
+  (*p)++;
+  ApiBatchCall *call = malloc (sizeof (ApiBatchCall));
+  call->fn = NULL;
+  call->args = props_create ();
+  BOOL ok = TRUE;
+  api_request_handler_json_skip (p);
+  if (**p == '}')
+    ok = FALSE; // No function
+  while (ok)
+    {
+    char *name = api_request_handler_json_string (p);
+    api_request_handler_json_skip (p);
+    ok = name && **p == ':';
+    if (ok)
+      {
+      (*p)++;
+      api_request_handler_json_skip (p);
+      if (strcmp (name, "fn") == 0 && !call->fn)
+        ok = (call->fn = api_request_handler_json_string (p)) != NULL;
+      else if (strcmp (name, "args") == 0)
+        ok = api_request_handler_json_args (p, call->args);
+      else
+        ok = FALSE;
+      }
+    free (name);
+    api_request_handler_json_skip (p);
+    if (ok && **p == '}')
+      {
+      (*p)++;
+      break;
+      }
+    if (ok && **p == ',')
+      {
+      (*p)++;
+      api_request_handler_json_skip (p);
+      }
+    else
+      ok = FALSE;
+    }
+  if (!ok || !call->fn)
+    {
+    api_request_handler_batch_call_free (call);
+    return NULL;
+    }
+  return call;
+  }
+
+/*============================================================================
+
+ api_request_handler_parse_batch
+
+ Returns a List of ApiBatchCall, or NULL if the text is not a valid 
+ batch
+
+============================================================================*/
+static List *api_request_handler_parse_batch (const char *json)
+  {
+  const char *p = json;
+  List *ret = list_create (api_request_handler_batch_call_free);
+  api_request_handler_json_skip (&p);
+  BOOL ok = *p == '[';
+  if (ok)
+    {
+    p++;
+    api_request_handler_json_skip (&p);
+    if (*p == ']')
+      p++;
+    else while (ok)
+      {
+      ApiBatchCall *call = api_request_handler_json_call (&p);
+      if (call && list_length (ret) < API_REQUEST_HANDLER_BATCH_MAX)
+        list_append (ret, call);
+      else
+        {
+        if (call) api_request_handler_batch_call_free (call);
+        ok = FALSE;
+        break;
+        }
+      api_request_handler_json_skip (&p);
+      if (*p == ']')
+        {
+        p++;
+        break;
+        }
+      ok = *p == ',';
+      if (ok)
+        {
+        p++;
+        api_request_handler_json_skip (&p);
+        }
+      }
+    }
+  if (ok) api_request_handler_json_skip (&p);
+  if (!ok || *p)
+    {
+    list_destroy (ret);
+    ret = NULL;
+    }
+  return ret;
+  }
+
+/*============================================================================
+
+ api_request_handler_result_status
+
+ Get the status from a function's response. Every response is an 
+ object whose first member is the status
+
+============================================================================*/
+static int api_request_handler_result_status (const char *result)
+  {
+  const char *s = strstr (result, "\"status\"");
+  if (!s) return 0;
+  s = strchr (s, ':');
+  return s ? atoi (s + 1) : 0;
+  }
+
+/*============================================================================
+
+ api_request_handler_batch
+
+ Call each function in the batch, in order, and return all their
+ responses, as they would have been returned separately. The calls 
+ share one connection to the index, and follow one another on the 
+ same thread, so they reuse the same pooled xine-server connection as 
+ well. The status poller is poked after each run of calls that change
+ the playback status, rather than after each call. The status of the
+ batch is that of the first call to fail, or zero. If stop_on_error is
+ set, no calls are made after that one. Each response carries the HTTP
+ code the call would have had
+
+============================================================================*/
+void api_request_handler_batch (APIRequestHandler *self,
+       const Props *arguments, int *code, char **result)
+  {
+  LOG_IN
+  const char *commands = props_get (arguments, "commands");
+  List *batch = commands ? api_request_handler_parse_batch (commands) : NULL;
+  if (batch)
+    {
+    BOOL stop_on_error = props_get_boolean (arguments, "stop_on_error", 
+      FALSE);
+    int l = list_length (batch);
+    log_debug ("%s: %d calls", __PRETTY_FUNCTION__, l);
+    int status = 0;
+    int completed = 0;
+    BOOL poke = FALSE;
+    String *response = string_create_empty ();
+    facade_begin_batch ();
+    for (int i = 0; i < l; i++)
+      {
+      ApiBatchCall *call = list_get (batch, i);
+      // A long poll would hold up the rest of the batch
+      props_delete (call->args, "since");
+      int call_code = 200;
+      char *call_result = NULL;
+      ApiFnData *afd = apiFnData;
+      while (afd->apiFn && strcmp (call->fn, afd->name) != 0) afd++;
+      if (afd->apiFn && afd->apiFn != api_request_handler_batch)
+        {
+        // A run of calls that change the playback status needs only
+        //  one poke, but it must come before any other call, which might
+        //  read the status, so that the call sees the changes
+        if (poke && !afd->poke)
+          {
+          status_poller_poke ();
+          poke = FALSE;
+          }
+        afd->apiFn (self, call->args, &call_code, &call_result);
+        if (afd->poke) poke = TRUE;
+        }
+      else
+        {
+        call_code = 400;
+        api_request_handler_stock_error (XINESERVER_X_ERR_UNKNOWN_FN, NULL,
+          &call_result); 
+        }
+
+      char *escaped_fn = htmlutil_escape_dquote_json (call->fn);
+      string_append_printf (response, 
+        "%s{\"fn\": \"%s\", \"code\": %d, \"result\": ", 
+        i ? ", " : "", escaped_fn, call_code);
+      string_append (response, call_result);
+      string_append (response, "}");
+      free (escaped_fn);
+      completed++;
+
+      int call_status = api_request_handler_result_status (call_result);
+      free (call_result);
+      if (call_status != 0 || call_code != 200)
+        {
+        if (status == 0) 
+          status = call_status ? call_status : XINESERVER_X_ERR_ARG;
+        if (stop_on_error) break;
+        }
+      }
+    facade_end_batch ();
+    if (poke) status_poller_poke ();
+
+    asprintf (result, "{\"status\": %d, \"completed\": %d, \"results\": [%s]}",
+      status, completed, string_cstr (response));
+    string_destroy (response);
+    list_destroy (batch);
+    }
+  else
+    {
+    log_warning ("batch API call without a valid list of calls");
+    api_request_handler_stock_error (XINESERVER_X_ERR_ARG, NULL, result);
+    *code = 400;
+    }
+  LOG_OUT
+  }
+
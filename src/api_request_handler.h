@@ -8,9 +8,13 @@
 
 #pragma once
 
+#include <stdint.h>
 #include "defs.h"
 #include "props.h"
 
+// Most functions that can be called in one batch request
+#define API_REQUEST_HANDLER_BATCH_MAX 100
+
 struct _APIRequestHandler;
 typedef struct _APIRequestHandler APIRequestHandler;
 
@@ -25,6 +29,20 @@ void               api_request_handler_handle (APIRequestHandler *self,
                      const char *uri, const Props *arguments, int *code, 
                      char **page);
 
+/** Get a validator for the response to uri, without producing the 
+    response -- see request_handler_api_etag(). Returns FALSE if the
+    function has no validator. What the validator was made from may be
+    kept, on this thread, so that api_request_handler_handle() makes
+    the response from the same data; if the response is not produced,
+    call api_request_handler_discard(). */
+BOOL               api_request_handler_validator (APIRequestHandler *self,
+                     const char *uri, const Props *arguments, 
+                     uint64_t *validator);
+
+/** Let go of anything that api_request_handler_validator() kept on this
+    thread. It does nothing if nothing was kept. */
+void               api_request_handler_discard (APIRequestHandler *self);
+
 END_DECLS
 
 
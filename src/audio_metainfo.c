@@ -27,6 +27,7 @@
 #include "audio_metainfo.h" 
 #include "tag_reader.h" 
 #include "mimebuffer.h" 
+#include "parse_cache.h" 
 
 struct _AudioMetaInfo
   {
@@ -40,6 +41,10 @@ struct _AudioMetaInfo
   char *year;
   time_t mtime;
   size_t size;
+  int duration;
+  int bitrate;
+  int sample_rate;
+  int channels;
   MimeBuffer *cover;
   }; 
 
@@ -67,6 +72,10 @@ AudioMetaInfo *audio_metainfo_create ()
   self->cover = NULL;
   self->mtime = 0;
   self->size = 0;
+  self->duration = 0;
+  self->bitrate = 0;
+  self->sample_rate = 0;
+  self->channels = 0;
   LOG_OUT 
   return self;
   }
@@ -204,6 +213,98 @@ size_t audio_metainfo_get_size (const AudioMetaInfo *self)
   return self->size;
   }
 
+/*==========================================================================
+
+  audio_metainfo_get_duration
+
+  Duration in msec, or zero if it is not known
+
+==========================================================================*/
+int audio_metainfo_get_duration (const AudioMetaInfo *self)
+  {
+  return self->duration;
+  }
+
+/*==========================================================================
+
+  audio_metainfo_get_bitrate
+
+  Average bitrate in bits per second, or zero if it is not known
+
+==========================================================================*/
+int audio_metainfo_get_bitrate (const AudioMetaInfo *self)
+  {
+  return self->bitrate;
+  }
+
+/*==========================================================================
+
+  audio_metainfo_get_sample_rate
+
+==========================================================================*/
+int audio_metainfo_get_sample_rate (const AudioMetaInfo *self)
+  {
+  return self->sample_rate;
+  }
+
+/*==========================================================================
+
+  audio_metainfo_get_channels
+
+==========================================================================*/
+int audio_metainfo_get_channels (const AudioMetaInfo *self)
+  {
+  return self->channels;
+  }
+
+/*==========================================================================
+
+  audio_metainfo_read_tags
+
+  Fill in the tags and stream properties from the file itself. Returns
+  TRUE if the tag reader could read the file
+
+==========================================================================*/
+static BOOL audio_metainfo_read_tags (AudioMetaInfo *self, const char *path)
+  {
+  LOG_IN
+  TagData *tag_data = NULL;
+  int r = tag_get_tags (path, &tag_data);
+  if (r == TAG_OK)
+    {
+    self->album = strdup (SAFE((char *)tag_get_common 
+	    (tag_data, TAG_COMMON_ALBUM)));
+    self->artist = strdup (SAFE((char *)tag_get_common 
+	    (tag_data, TAG_COMMON_ARTIST)));
+    self->composer = strdup (SAFE((char *)tag_get_common 
+	    (tag_data, TAG_COMMON_COMPOSER)));
+    self->genre = strdup (SAFE((char *)tag_get_common 
+	    (tag_data, TAG_COMMON_GENRE)));
+    self->title = strdup (SAFE((char *)tag_get_common 
+	    (tag_data, TAG_COMMON_TITLE)));
+    self->track = strdup (SAFE((char *)tag_get_common 
+	    (tag_data, TAG_COMMON_TRACK)));
+    self->comment = strdup (SAFE((char *)tag_get_common 
+	    (tag_data, TAG_COMMON_COMMENT)));
+    self->year = strdup (SAFE((char *)tag_get_common 
+	    (tag_data, TAG_COMMON_YEAR)));
+
+    if (tag_data->cover)
+      {
+      self->cover = mimebuffer_create (tag_data->cover, tag_data->cover_len,
+	tag_data->cover_mime);
+      }
+
+    self->duration = tag_data->duration;
+    self->bitrate = tag_data->bitrate;
+    self->sample_rate = tag_data->sample_rate;
+    self->channels = tag_data->channels;
+    }
+  if (tag_data) tag_free_tag_data (tag_data);
+  LOG_OUT
+  return r == TAG_OK;
+  }
+
 /*==========================================================================
 
   audio_metainfo_get_from_path
@@ -213,6 +314,21 @@ BOOL audio_metainfo_get_from_path (AudioMetaInfo *self, const char *path,
       char **error)
   {
   LOG_IN
+  BOOL ret = audio_metainfo_get_from_path_cached (self, path, NULL, 
+    FALSE, error);
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  audio_metainfo_get_from_path_cached
+
+==========================================================================*/
+BOOL audio_metainfo_get_from_path_cached (AudioMetaInfo *self, 
+      const char *path, ParseCache *cache, BOOL need_cover, char **error)
+  {
+  LOG_IN
   BOOL ret;
 
   struct stat sb;
@@ -222,35 +338,53 @@ BOOL audio_metainfo_get_from_path (AudioMetaInfo *self, const char *path,
     self->mtime = sb.st_mtime;
     self->size = sb.st_size;
 
-    TagData *tag_data = NULL;
-    int r = tag_get_tags (path, &tag_data);
-    if (r == TAG_OK)
+    ParseCacheEntry entry;
+    // A cache hit is no use if the caller wants the cover image, and
+    //   the file has one, because the cache does not store images
+    BOOL hit = cache && parse_cache_lookup (cache, &sb, &entry);
+    if (hit && !(need_cover && entry.has_cover))
       {
-      self->album = strdup (SAFE((char *)tag_get_common 
-	      (tag_data, TAG_COMMON_ALBUM)));
-      self->artist = strdup (SAFE((char *)tag_get_common 
-	      (tag_data, TAG_COMMON_ARTIST)));
-      self->composer = strdup (SAFE((char *)tag_get_common 
-	      (tag_data, TAG_COMMON_COMPOSER)));
-      self->genre = strdup (SAFE((char *)tag_get_common 
-	      (tag_data, TAG_COMMON_GENRE)));
-      self->title = strdup (SAFE((char *)tag_get_common 
-	      (tag_data, TAG_COMMON_TITLE)));
-      self->track = strdup (SAFE((char *)tag_get_common 
-	      (tag_data, TAG_COMMON_TRACK)));
-      self->comment = strdup (SAFE((char *)tag_get_common 
-	      (tag_data, TAG_COMMON_COMMENT)));
-      self->year = strdup (SAFE((char *)tag_get_common 
-	      (tag_data, TAG_COMMON_YEAR)));
-
-      if (tag_data->cover)
+      if (entry.has_tags)
         {
-        self->cover = mimebuffer_create (tag_data->cover, tag_data->cover_len,
-	  tag_data->cover_mime);
-	}
-
+        self->album = strdup (entry.album);
+        self->artist = strdup (entry.artist);
+        self->composer = strdup (entry.composer);
+        self->genre = strdup (entry.genre);
+        self->title = strdup (entry.title);
+        self->track = strdup (entry.track);
+        self->comment = strdup (entry.comment);
+        self->year = strdup (entry.year);
+        }
+      self->duration = entry.duration;
+      self->bitrate = entry.bitrate;
+      self->sample_rate = entry.sample_rate;
+      self->channels = entry.channels;
+      }
+    else
+      {
+      BOOL has_tags = audio_metainfo_read_tags (self, path);
+      // If the file was only read again for its cover, the cache
+      //   already holds what was read, and inserting it would just 
+      //   add another copy
+      if (cache && !hit)
+        {
+        entry.has_tags = has_tags;
+        entry.has_cover = self->cover != NULL;
+        entry.duration = self->duration;
+        entry.bitrate = self->bitrate;
+        entry.sample_rate = self->sample_rate;
+        entry.channels = self->channels;
+        entry.title = self->title;
+        entry.album = self->album;
+        entry.genre = self->genre;
+        entry.composer = self->composer;
+        entry.artist = self->artist;
+        entry.track = self->track;
+        entry.comment = self->comment;
+        entry.year = self->year;
+        parse_cache_insert (cache, &sb, &entry);
+        }
       }
-    if (tag_data) tag_free_tag_data (tag_data);
     }
   else
     {
@@ -276,15 +410,21 @@ BOOL audio_metainfo_get_from_database (AudioMetaInfo *self, Database *db,
 
   time_t mtime = 0;
   size_t size = 0;
+  int duration = 0, bitrate = 0, sample_rate = 0, channels = 0;
   char *title = NULL, *album = NULL, *genre = NULL, *composer = NULL,
           *artist = NULL, *track = NULL, *comment = NULL, *year = NULL;
   
   if (database_get_by_path (db, path, &size, &mtime, &title,  &album,  
-        &genre,  &composer,  &artist,  &track,  &comment,  &year,  error))
+        &genre,  &composer,  &artist,  &track,  &comment,  &year,  
+        &duration, &bitrate, &sample_rate, &channels, error))
     {
     ret = TRUE;
     self->mtime = mtime;
     self->size = size;
+    self->duration = duration;
+    self->bitrate = bitrate;
+    self->sample_rate = sample_rate;
+    self->channels = channels;
     self->title = title;
     self->album = album;
     self->genre = genre;
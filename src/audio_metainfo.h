@@ -12,6 +12,7 @@
 #include "defs.h"
 #include "mimebuffer.h"
 #include "database.h"
+#include "parse_cache.h"
 
 struct _AudioMetaInfo;
 typedef struct _AudioMetaInfo AudioMetaInfo;
@@ -25,6 +26,15 @@ void              audio_metainfo_destroy (AudioMetaInfo *self);
 BOOL              audio_metainfo_get_from_path (AudioMetaInfo *self, 
                     const char *path, char **error);
 
+/** As audio_metainfo_get_from_path(), but the tags and stream properties
+    are taken from the cache if it has an entry for the file, and added
+    to the cache if not. The cache does not hold cover images; if
+    need_cover is TRUE, and the file has a cover, the file is read. The
+    cache may be NULL. */
+BOOL              audio_metainfo_get_from_path_cached (AudioMetaInfo *self, 
+                    const char *path, ParseCache *cache, BOOL need_cover,
+                    char **error);
+
 /** Note: 'path' is the relative path, as it would appear in the database,
  * _not_ the filesystem path */
 BOOL              audio_metainfo_get_from_database (AudioMetaInfo *self, 
@@ -40,6 +50,13 @@ const char       *audio_metainfo_get_comment (const AudioMetaInfo *self);
 const char       *audio_metainfo_get_year (const AudioMetaInfo *self);
 size_t            audio_metainfo_get_size (const AudioMetaInfo *self);
 time_t            audio_metainfo_get_mtime (const AudioMetaInfo *self);
+/** Stream properties, as far as they could be determined from the file
+    headers. Zero means 'unknown'. Duration is in msec, bitrate in
+    bits per second */
+int               audio_metainfo_get_duration (const AudioMetaInfo *self);
+int               audio_metainfo_get_bitrate (const AudioMetaInfo *self);
+int               audio_metainfo_get_sample_rate (const AudioMetaInfo *self);
+int               audio_metainfo_get_channels (const AudioMetaInfo *self);
 const MimeBuffer *audio_metainfo_get_cover (const AudioMetaInfo *self);
 
 END_DECLS
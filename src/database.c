@@ -17,6 +17,7 @@
 #include "defs.h" 
 #include "log.h" 
 #include "database.h" 
+#include "metrics.h" 
 #include "sqlite3.h" 
 #include "searchconstraints.h" 
 
@@ -127,7 +128,9 @@ BOOL database_exec (Database *self, const char *sql, char **error)
   BOOL ret = FALSE;
   char *e = NULL;
   log_debug ("%s: executing SQL %s", __PRETTY_FUNCTION__, sql);
+  int64_t started = metrics_start ();
   sqlite3_exec (self->sqlite, sql, NULL, 0, &e); 
+  metrics_record_op (METRICS_OP_DB_QUERY, started);
   if (e)
     {
     if (error) (*error) = strdup (e);
@@ -161,7 +164,9 @@ List *database_query (Database *self, const char *sql, BOOL include_empty,
   int hits;
   int cols;
   log_debug ("%s: executing SQL %s", __PRETTY_FUNCTION__, sql);
+  int64_t started = metrics_start ();
   sqlite3_get_table (self->sqlite, sql, &result, &hits, &cols, &e); 
+  metrics_record_op (METRICS_OP_DB_QUERY, started);
   if (e)
     {
     if (error) (*error) = strdup (e);
@@ -224,6 +229,34 @@ void database_regexp (sqlite3_context* context, int argc,
   }
 
 
+/*==========================================================================
+
+  database_upgrade
+
+  Add any columns that are missing from an index created by an earlier
+  version. Existing rows get zero for the new values -- which means 
+  'unknown' -- until a full scan is done.
+
+==========================================================================*/
+static void database_upgrade (Database *self)
+  {
+  LOG_IN
+  if (!database_exec (self, "select duration from files limit 0", NULL))
+    {
+    log_info ("Adding stream property columns to database %s", self->file);
+    database_exec (self, "alter table files add column "
+      "duration integer default 0", NULL);
+    database_exec (self, "alter table files add column "
+      "bitrate integer default 0", NULL);
+    database_exec (self, "alter table files add column "
+      "samplerate integer default 0", NULL);
+    database_exec (self, "alter table files add column "
+      "channels integer default 0", NULL);
+    }
+  LOG_OUT
+  }
+
+
 /*==========================================================================
 
   database_open
@@ -243,6 +276,7 @@ BOOL database_open (Database *self, char **error)
       {
       sqlite3_create_function(self->sqlite, "regexp", 2, SQLITE_ANY, 0,
         database_regexp, 0, 0);
+      database_upgrade (self);
       ret = TRUE;
       }
    else
@@ -282,7 +316,9 @@ BOOL database_make (Database *self, char **error)
        "(path varchar not null, size integer, mtime integer, "
        "title varchar, album varchar, genre varchar, "
        "composer varchar, artist varchar, track varchar, "
-       "comment varchar, year varchar, exist integer)", error);
+       "comment varchar, year varchar, exist integer, "
+       "duration integer default 0, bitrate integer default 0, "
+       "samplerate integer default 0, channels integer default 0)", error);
 
     if (ret)   
       ret = database_exec (self, "create index albumindex on files (album)", 
@@ -319,7 +355,8 @@ BOOL database_make (Database *self, char **error)
 void database_insert (Database *database, const char *path, size_t size,
     time_t mtime, const char *title,  const char *album,  const char *genre,  
     const char *composer,  const char *artist,  const char *track,  
-    const char *comment,  const char *year,  char **error)
+    const char *comment,  const char *year,  int duration, int bitrate,
+    int sample_rate, int channels, char **error)
   {
   LOG_IN
 
@@ -336,8 +373,9 @@ void database_insert (Database *database, const char *path, size_t size,
   String *sql = string_create_empty ();
   string_append_printf (sql, "insert into files "
      "(path,size,mtime,title,album,genre,composer,"
-     "artist,track,comment,year,exist) values "
-     "('%s',%d,%d,'%s','%s','%s','%s','%s','%s','%s','%s',1)",
+     "artist,track,comment,year,exist,duration,bitrate,samplerate,"
+     "channels) values "
+     "('%s',%d,%d,'%s','%s','%s','%s','%s','%s','%s','%s',1,%d,%d,%d,%d)",
      esc_path,
      size,
      mtime,
@@ -348,7 +386,11 @@ void database_insert (Database *database, const char *path, size_t size,
      esc_artist,
      esc_track,
      esc_comment,
-     esc_year);
+     esc_year,
+     duration,
+     bitrate,
+     sample_rate,
+     channels);
 
   database_exec (database, string_cstr(sql), error);
 
@@ -374,7 +416,8 @@ void database_insert (Database *database, const char *path, size_t size,
 BOOL database_get_by_path (Database *db, const char *path, size_t *size, 
         time_t *mtime, char **title,  char **album,  char **genre,  
 	char **composer,  char **artist,  char **track,  char **comment,  
-	char **year,  char **error)
+	char **year,  int *duration, int *bitrate, int *sample_rate, 
+	int *channels, char **error)
   {
   LOG_IN
   BOOL ret = FALSE;
@@ -382,13 +425,14 @@ BOOL database_get_by_path (Database *db, const char *path, size_t *size,
 
   char *sql;
   asprintf (&sql, "select size,mtime,title,album,genre,composer,artist,"
-                    "track,comment,year from files where path='%s'", esc_path); 
+                    "track,comment,year,duration,bitrate,samplerate,channels "
+		    "from files where path='%s'", esc_path); 
 
   List *list = database_query (db, sql, TRUE, 0, error);
   if (list)
     {
     int l = list_length (list);
-    if (l == 10)
+    if (l == 14)
       {
       *size = atoi (SAFE (list_get (list, 0)));
       *mtime = atoi (SAFE (list_get (list, 1)));
@@ -400,6 +444,10 @@ BOOL database_get_by_path (Database *db, const char *path, size_t *size,
       *track = strdup (SAFE (list_get (list, 7)));
       *comment = strdup (SAFE (list_get (list, 8)));
       *year = strdup (SAFE (list_get (list, 9)));
+      *duration = atoi (SAFE (list_get (list, 10)));
+      *bitrate = atoi (SAFE (list_get (list, 11)));
+      *sample_rate = atoi (SAFE (list_get (list, 12)));
+      *channels = atoi (SAFE (list_get (list, 13)));
       ret = TRUE;
       }
     else
@@ -647,6 +695,41 @@ char *database_get_first_track_for_album (Database *self, const char *album,
   }
 
 
+/*==========================================================================
+ 
+  database_get_album_duration
+
+*==========================================================================*/
+int64_t database_get_album_duration (Database *self, const char *album,
+        char **error)
+  {
+  int64_t ret = -1;
+  LOG_IN
+
+  char *esc_album = database_escape_sql (album);
+  char *sql;
+  // sum() is NULL, rather than zero, if no file matches
+  asprintf (&sql, 
+    "select coalesce(sum(duration),0) from files where album='%s'", 
+    esc_album);
+  List *list = database_query (self, sql, TRUE, 1, error);
+  if (list)
+    {
+    ret = list_length (list) > 0 ? atoll (list_get (list, 0)) : 0;
+    list_destroy (list);
+    }
+  else
+    {
+    // Do nothing -- error already set
+    }
+
+  free (esc_album);
+  free (sql);
+  LOG_OUT
+  return ret;
+  }
+
+
 /*==========================================================================
  
   database_get_paths_by_album
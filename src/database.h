@@ -39,12 +39,14 @@ void database_insert (Database *database, const char *path, size_t size,
             time_t mtime, const char *title,  const char *album,  
 	    const char *genre,  const char *composer,  const char *artist,  
 	    const char *track,  const char *comment,  const char *year,  
+	    int duration, int bitrate, int sample_rate, int channels,
 	    char **error);
 
 BOOL database_get_by_path (Database *db, const char *path, size_t *size, 
         time_t *mtime, char **title,  char **album,  char **genre,  
 	char **composer,  char **artist,  char **track,  char **comment,  
-	char **year,  char **error);
+	char **year,  int *duration, int *bitrate, int *sample_rate, 
+	int *channels, char **error);
 
 BOOL database_delete_path (Database *db, const char *path, char **error);
 
@@ -68,6 +70,12 @@ List *database_get_composers (Database *self, int from, int limit,
 char *database_get_first_track_for_album (Database *self, const char *album,
         char **error);
 
+/** Returns the total length of the tracks in the specified album, in
+    msec, or -1 on error. Tracks whose length is not known count as 
+    zero */
+int64_t database_get_album_duration (Database *self, const char *album,
+        char **error);
+
 /** Returns a List of char* representing the paths in a specific
     album. The list might be empty, even if the operation succeeds.
     Paths are relative to the media root */
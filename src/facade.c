@@ -24,6 +24,8 @@
 #include "xine-server-x-api.h" 
 #include "searchconstraints.h" 
 #include "database.h" 
+#include "playlist_mirror.h" 
+#include "metrics.h" 
 
 struct _Facade
   {
@@ -36,6 +38,137 @@ struct _Facade
 
 static Facade *facade_instance = NULL;
 
+// The index connection shared by the calls of a batch on this thread, 
+//   if one is running -- see facade_begin_batch()
+static __thread BOOL facade_in_batch = FALSE;
+static __thread Database *facade_batch_db = NULL;
+static __thread BOOL facade_batch_db_open = FALSE;
+
+/*============================================================================
+
+  facade_xs_clear, facade_xs_add, facade_xs_add_single, 
+  facade_xs_play_streams
+
+  Wrappers for the xine-server functions that change the playlist, 
+  which keep the playlist mirror up to date. If an operation fails, 
+  it may have been partly carried out, so the mirror is invalidated
+
+============================================================================*/
+static BOOL facade_xs_clear (Facade *self, int *error_code, 
+      char **error_message)
+  {
+  BOOL ok = xineserver_clear (self->xshost, self->xsport, 
+           error_code, error_message);
+  if (ok)
+    playlist_mirror_clear ();
+  else
+    playlist_mirror_invalidate ();
+  return ok;
+  }
+
+static BOOL facade_xs_add (Facade *self, int nstreams, 
+      const char *const *streams, int *error_code, char **error_message)
+  {
+  BOOL ok = xineserver_add (self->xshost, self->xsport, nstreams, streams,
+           error_code, error_message);
+  if (ok)
+    playlist_mirror_append (nstreams, streams);
+  else
+    playlist_mirror_invalidate ();
+  return ok;
+  }
+
+static BOOL facade_xs_add_single (Facade *self, const char *stream, 
+      int *error_code, char **error_message)
+  {
+  return facade_xs_add (self, 1, &stream, error_code, error_message);
+  }
+
+static BOOL facade_xs_play_streams (Facade *self, int nstreams, 
+      const char *const *streams, int *error_code, char **error_message)
+  {
+  BOOL ok = xineserver_play_streams (self->xshost, self->xsport, nstreams, 
+           streams, error_code, error_message);
+  if (ok)
+    {
+    playlist_mirror_clear ();
+    playlist_mirror_append (nstreams, streams);
+    }
+  else
+    playlist_mirror_invalidate ();
+  return ok;
+  }
+
+/*============================================================================
+
+  facade_database_create, facade_database_open, facade_database_close,
+  facade_database_destroy
+
+  Wrappers for the functions that open and close the index. In a batch,
+  the first call opens it, and the others use the same connection, 
+  which is only closed when the batch ends. If it can't be opened, the
+  caller destroys it as usual, and the next call tries again
+
+============================================================================*/
+static Database *facade_database_create (Facade *self)
+  {
+  if (!facade_in_batch)
+    return database_create (self->index_file);
+  if (!facade_batch_db)
+    facade_batch_db = database_create (self->index_file);
+  return facade_batch_db;
+  }
+
+static BOOL facade_database_open (Database *db, char **error_message)
+  {
+  if (db != facade_batch_db)
+    return database_open (db, error_message);
+  if (!facade_batch_db_open)
+    {
+    facade_batch_db_open = database_open (db, error_message);
+    if (!facade_batch_db_open)
+      facade_batch_db = NULL;
+    }
+  return facade_batch_db_open;
+  }
+
+static void facade_database_close (Database *db)
+  {
+  if (db != facade_batch_db) database_close (db);
+  }
+
+static void facade_database_destroy (Database *db)
+  {
+  if (db != facade_batch_db) database_destroy (db);
+  }
+
+/*============================================================================
+
+  facade_begin_batch
+
+============================================================================*/
+void facade_begin_batch (void)
+  {
+  LOG_IN
+  facade_in_batch = TRUE;
+  LOG_OUT
+  }
+
+/*============================================================================
+
+  facade_end_batch
+
+============================================================================*/
+void facade_end_batch (void)
+  {
+  LOG_IN
+  database_destroy (facade_batch_db);
+  facade_batch_db = NULL;
+  facade_batch_db_open = FALSE;
+  facade_in_batch = FALSE;
+  LOG_OUT
+  }
+
 /*============================================================================
 
   facade_create
@@ -50,6 +183,13 @@ void facade_create (const char *root, const char *xshost, int xsport,
   self->xshost = strdup (xshost);
   self->gxsradio_dir = strdup (gxsradio_dir);
   self->xsport = xsport;
+  // Resolve now, so that every command does not have to
+  char *error = NULL;
+  if (!xineserver_resolve (xshost, xsport, &error))
+    {
+    log_warning ("%s -- will try again when needed", error);
+    free (error);
+    }
   self->root = path_create (root);
   if (index_file)
     self->index_file = strdup (index_file);
@@ -266,19 +406,59 @@ char *facade_get_first_track_for_album (const char *album, int *error_code,
 
   if (self->index_file)
     {
-    Database *db = database_create (self->index_file);
+    Database *db = facade_database_create (self);
     
-    if (database_open (db, error_message))
+    if (facade_database_open (db, error_message))
       {
       ret = database_get_first_track_for_album (db, album, error_message);
-      database_close (db);
+      facade_database_close (db);
+      } 
+    else
+      {
+      *error_code = XINESERVER_X_ERR_GEN_DATABASE;
+      }
+
+    facade_database_destroy (db);
+    }
+  else
+    {
+    *error_message = strdup (xineserver_x_perror (XINESERVER_X_ERR_NO_INDEX));
+    *error_code = XINESERVER_X_ERR_NO_INDEX;
+    }
+
+  LOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  facade_get_album_duration
+
+============================================================================*/
+int64_t facade_get_album_duration (const char *album, int *error_code, 
+        char **error_message)
+  {
+  LOG_IN
+  int64_t ret = -1; 
+
+  Facade *self = facade_get_instance();
+
+  if (self->index_file)
+    {
+    Database *db = facade_database_create (self);
+    
+    if (facade_database_open (db, error_message))
+      {
+      ret = database_get_album_duration (db, album, error_message);
+      if (ret < 0) *error_code = XINESERVER_X_ERR_GEN_DATABASE;
+      facade_database_close (db);
       } 
     else
       {
       *error_code = XINESERVER_X_ERR_GEN_DATABASE;
       }
 
-    database_destroy (db);
+    facade_database_destroy (db);
     }
   else
     {
@@ -361,6 +541,7 @@ char *facade_get_cover_image_for_album (const char *album)
 char *facade_get_cover_image_for_dir (const char *path)
   {
   LOG_IN
+  int64_t started = metrics_start ();
   char *ret = NULL;
   char *fspath = facade_make_os_path_from_media_path (path);
 
@@ -404,6 +585,7 @@ char *facade_get_cover_image_for_dir (const char *path)
     }
 
   free (fspath);
+  metrics_record_op (METRICS_OP_COVER_LOOKUP, started);
   LOG_OUT
   return ret;
   }
@@ -423,12 +605,10 @@ void facade_play_stream (const char *stream, int *error_code,
   BOOL ok = TRUE;
 
   if (ok)
-    ok = xineserver_clear (self->xshost, self->xsport, 
-           error_code, error_message);
+    ok = facade_xs_clear (self, error_code, error_message);
 
   if (ok)
-    ok = xineserver_add_single (self->xshost, self->xsport, 
-           stream, error_code, error_message);
+    ok = facade_xs_add_single (self, stream, error_code, error_message);
 
   if (ok)
     ok = xineserver_play (self->xshost, self->xsport, 
@@ -471,8 +651,7 @@ void facade_add_file (const char *file, int *error_code,
   log_debug ("%s: %s", __PRETTY_FUNCTION__, file);
   Facade *self = facade_get_instance();
   char *ospath = facade_make_os_path_from_media_path (file);
-  xineserver_add_single (self->xshost, self->xsport, 
-	ospath, error_code, error_message);
+  facade_xs_add_single (self, ospath, error_code, error_message);
   free (ospath);
   LOG_OUT
   }
@@ -492,9 +671,9 @@ void facade_play_album (const char *album, int *error_code,
 
   if (self->index_file)
     {
-    Database *db = database_create (self->index_file);
+    Database *db = facade_database_create (self);
     
-    if (database_open (db, error))
+    if (facade_database_open (db, error))
       {
       List *list = database_get_paths_by_album (db, album, error);
       if (list)
@@ -511,19 +690,8 @@ void facade_play_album (const char *album, int *error_code,
           path_destroy (path);
           }
 
-        BOOL ok = xineserver_clear (self->xshost, self->xsport, 
-              error_code, error);
-        if (ok)
-          {
-          ok = xineserver_add (self->xshost, self->xsport, 
+        BOOL ok = facade_xs_play_streams (self, 
              l, (const char *const *)streams, error_code, error);
-	  }
-      
-        if (ok)
-          {
-          ok = xineserver_play (self->xshost, self->xsport, 
-             0, error_code, error);
-	  }
 
         if (ok) *error_code = 0;
 
@@ -536,14 +704,14 @@ void facade_play_album (const char *album, int *error_code,
         *error_code = XINESERVER_X_ERR_GEN_DATABASE; 
         }
 
-      database_close (db);
+      facade_database_close (db);
       } 
     else
       {
       // Nothing to do -- error already set
       }
 
-    database_destroy (db);
+    facade_database_destroy (db);
     }
   else
     {
@@ -605,19 +773,8 @@ void facade_play_dir (const char *dir, int *error_code,
         streams[i] = strdup (s_file);
         }
 
-      BOOL ok = xineserver_clear (self->xshost, self->xsport, 
-           error_code, error_message);
-      if (ok)
-        {
-        ok = xineserver_add (self->xshost, self->xsport, 
+      BOOL ok = facade_xs_play_streams (self, 
            total, (const char *const *)streams, error_code, error_message);
-	}
-      
-      if (ok)
-        {
-        ok = xineserver_play (self->xshost, self->xsport, 
-           0, error_code, error_message);
-	}
 
       for (int i = 0; i < total; i++) free (streams[i]);
       free (streams);
@@ -695,7 +852,7 @@ void facade_add_dir (const char *dir, int *error_code,
         streams[i] = strdup (s_file);
         }
 
-      BOOL ok = xineserver_add (self->xshost, self->xsport, 
+      BOOL ok = facade_xs_add (self, 
              total, (const char *const *)streams, error_code, error_message);
 
       for (int i = 0; i < total; i++) free (streams[i]);
@@ -740,8 +897,7 @@ void facade_clear (int *error_code, char **error_message)
   BOOL ok = TRUE;
 
   if (ok)
-    ok = xineserver_clear (self->xshost, self->xsport, 
-           error_code, error_message);
+    ok = facade_xs_clear (self, error_code, error_message);
 
   if (ok)
     {
@@ -825,6 +981,17 @@ void facade_get_playback_status (int *error_code, char **error_message,
       playback_status_set_title (s, xsmetainfo_get_title (xsmi));
       playback_status_set_seekable (s, xsmetainfo_is_seekable (xsmi));
 
+      // Not all audio drivers support volume control, so failing to
+      //   get the volume is not an error
+      int volume = -1;
+      int volume_error_code = 0;
+      char *volume_error = NULL;
+      if (xineserver_get_volume (self->xshost, self->xsport, &volume,
+            &volume_error_code, &volume_error))
+        playback_status_set_volume (s, volume);
+      else
+        free (volume_error);
+
       xsmetainfo_destroy (xsmi);
       *status = s;
       *error_code = 0;
@@ -1031,46 +1198,71 @@ void facade_play (int *error_code, char **error_message)
   facade_get_playlist
 
 ============================================================================*/
-List *facade_get_playlist (int *error_code, char **error_message)
+List *facade_get_playlist (uint64_t *generation, int *error_code, 
+      char **error_message)
   {
   LOG_IN
 
-  List *ret = NULL;
-
   log_debug ("%s", __PRETTY_FUNCTION__);
   Facade *self = facade_instance;
 
-  BOOL ok = TRUE;
-  XSPlaylist *playlist = NULL;
+  // Usually the mirror is valid, and xine-server need not be asked
+  List *list = playlist_mirror_get (generation);
+  if (!list && facade_verify_playlist (error_code, error_message))
+    list = playlist_mirror_get (generation);
 
-  ok = xineserver_playlist (self->xshost, self->xsport, &playlist,
-           error_code, error_message);
-
-  if (ok)
+  List *ret = NULL;
+  if (list)
     {
     char *root_s = (char *)path_to_utf8 (self->root);
     int ls = strlen (root_s);
-    int n = xsplaylist_get_nentries (playlist);
-    char **const entries = xsplaylist_get_entries (playlist);
+    int n = list_length (list);
     ret = list_create (free);
     for (int i = 0; i < n; i++)
       {
-      if (strstr (entries[i], root_s) == entries[i])
-        list_append (ret, strdup (entries[i] + ls));
+      const char *entry = list_get (list, i);
+      if (strstr (entry, root_s) == entry)
+        list_append (ret, strdup (entry + ls));
       else
-        list_append (ret, strdup (entries[i]));
+        list_append (ret, strdup (entry));
       }
-
-    xsplaylist_destroy (playlist);
+    list_destroy (list);
+    free (root_s);
     *error_message = NULL;
     *error_code = 0;
-    free (root_s);
     }
 
   LOG_OUT;
   return ret;
   }
 
+/*============================================================================
+
+  facade_verify_playlist
+
+============================================================================*/
+BOOL facade_verify_playlist (int *error_code, char **error_message)
+  {
+  LOG_IN
+
+  Facade *self = facade_instance;
+  XSPlaylist *playlist = NULL;
+
+  BOOL ok = xineserver_playlist (self->xshost, self->xsport, &playlist,
+           error_code, error_message);
+
+  if (ok)
+    {
+    if (playlist_mirror_replace (xsplaylist_get_nentries (playlist),
+          xsplaylist_get_entries (playlist)))
+      log_debug ("Playlist mirror updated from xine-server");
+    xsplaylist_destroy (playlist);
+    }
+
+  LOG_OUT;
+  return ok;
+  }
+
 /*============================================================================
 
   facade_set_volume
@@ -1266,8 +1458,9 @@ void facade_play_station (const char *list, const char *name,
            *p = 0;
            if (strcmp (name, line) == 0)
              {
-             strtok (p + 1, "\t");
-             uri = strdup (strtok (NULL, "\t"));
+             char *saveptr;
+             strtok_r (p + 1, "\t", &saveptr);
+             uri = strdup (strtok_r (NULL, "\t", &saveptr));
              }
            }
          }
@@ -1429,19 +1622,19 @@ List *facade_get_albums (int from, int limit, const SearchConstraints *sc,
 
   if (self->index_file)
     {
-    Database *db = database_create (self->index_file);
+    Database *db = facade_database_create (self);
     
-    if (database_open (db, error_message))
+    if (facade_database_open (db, error_message))
       {
       ret = database_get_albums (db, from, limit, sc, match, error_message); 
-      database_close (db);
+      facade_database_close (db);
       } 
     else
       {
       *error_code = XINESERVER_X_ERR_GEN_DATABASE;
       }
 
-    database_destroy (db);
+    facade_database_destroy (db);
     }
   else
     {
@@ -1470,19 +1663,19 @@ List *facade_get_genres (int from, int limit, const SearchConstraints *sc,
 
   if (self->index_file)
     {
-    Database *db = database_create (self->index_file);
+    Database *db = facade_database_create (self);
     
-    if (database_open (db, error_message))
+    if (facade_database_open (db, error_message))
       {
       ret = database_get_genres (db, from, limit, sc, match, error_message); 
-      database_close (db);
+      facade_database_close (db);
       } 
     else
       {
       *error_code = XINESERVER_X_ERR_GEN_DATABASE;
       }
 
-    database_destroy (db);
+    facade_database_destroy (db);
     }
   else
     {
@@ -1511,20 +1704,20 @@ List *facade_get_composers (int from, int limit, const SearchConstraints *sc,
 
   if (self->index_file)
     {
-    Database *db = database_create (self->index_file);
+    Database *db = facade_database_create (self);
     
-    if (database_open (db, error_message))
+    if (facade_database_open (db, error_message))
       {
       ret = database_get_composers (db, from, limit, sc, match, 
         error_message); 
-      database_close (db);
+      facade_database_close (db);
       } 
     else
       {
       *error_code = XINESERVER_X_ERR_GEN_DATABASE;
       }
 
-    database_destroy (db);
+    facade_database_destroy (db);
     }
   else
     {
@@ -1553,19 +1746,19 @@ List *facade_get_artists (int from, int limit, const SearchConstraints *sc,
 
   if (self->index_file)
     {
-    Database *db = database_create (self->index_file);
+    Database *db = facade_database_create (self);
     
-    if (database_open (db, error_message))
+    if (facade_database_open (db, error_message))
       {
       ret = database_get_artists (db, from, limit, sc, match, error_message); 
-      database_close (db);
+      facade_database_close (db);
       } 
     else
       {
       *error_code = XINESERVER_X_ERR_GEN_DATABASE;
       }
 
-    database_destroy (db);
+    facade_database_destroy (db);
     }
   else
     {
@@ -1594,19 +1787,19 @@ List *facade_get_paths (int from, int limit, const SearchConstraints *sc,
 
   if (self->index_file)
     {
-    Database *db = database_create (self->index_file);
+    Database *db = facade_database_create (self);
     
-    if (database_open (db, error_message))
+    if (facade_database_open (db, error_message))
       {
       ret = database_get_paths (db, from, limit, sc, match, error_message); 
-      database_close (db);
+      facade_database_close (db);
       } 
     else
       {
       *error_code = XINESERVER_X_ERR_GEN_DATABASE;
       }
 
-    database_destroy (db);
+    facade_database_destroy (db);
     }
   else
     {
@@ -1636,9 +1829,9 @@ AudioMetaInfo *facade_get_metainfo_from_database (const char *path,
 
   if (self->index_file)
     {
-    Database *db = database_create (self->index_file);
+    Database *db = facade_database_create (self);
     
-    if (database_open (db, error_message))
+    if (facade_database_open (db, error_message))
       {
       ret = audio_metainfo_create();
       
@@ -1653,14 +1846,14 @@ AudioMetaInfo *facade_get_metainfo_from_database (const char *path,
         *error_code = XINESERVER_X_ERR_GEN_DATABASE;
         }
 
-      database_close (db);
+      facade_database_close (db);
       } 
     else
       {
       *error_code = XINESERVER_X_ERR_GEN_DATABASE;
       }
 
-    database_destroy (db);
+    facade_database_destroy (db);
     }
   else
     {
@@ -1704,7 +1897,7 @@ void facade_add_matching (const SearchConstraints *sc, int *error_code,
 	path_destroy (path);
 	}
 
-      ok = xineserver_add (self->xshost, self->xsport, 
+      ok = facade_xs_add (self, 
 	l, (const char *const *)streams, error_code, error_message);
 
       for (int i = 0; i < l; i++) free (streams[i]);
@@ -34,6 +34,15 @@ void        facade_create (const char *root, const char *xshost, int xsport,
 Facade     *facade_get_instance (void);
 void        facade_destroy (void);
 
+/** Start a batch of calls on this thread, which share one connection to
+    the index, rather than each opening its own. Calls on other threads
+    are not affected. */
+void        facade_begin_batch (void);
+
+/** End the batch, closing the connection to the index, if one was
+    opened. */
+void        facade_end_batch (void);
+
 /** Get a list of files (not directories) at the specific path, 
     relative to the media root. The list only includes playable
     audio files. Names are sorted into ASCII order, and returned as
@@ -41,8 +50,16 @@ void        facade_destroy (void);
 List       *facade_get_file_list (const char  *path, int *error_code, 
                  char **error);
 
-/** Get the playlust as a List of char* */
-List       *facade_get_playlist (int *error_code, char **error);
+/** Get the playlist as a List of char*. This normally comes from the
+    playlist mirror, without asking xine-server. If generation is not
+    NULL, it is set to the playlist generation (see playlist_mirror.h) */
+List       *facade_get_playlist (uint64_t *generation, int *error_code, 
+                 char **error);
+
+/** Compare the playlist mirror with the playlist that xine-server has,
+    and replace the mirror if they are different. Returns FALSE, with
+    the error set, if xine-server can't be asked. */
+BOOL        facade_verify_playlist (int *error_code, char **error);
 
 /** Get a list of directories (not files) at the specific path, 
     relative to the media root. 
@@ -210,6 +227,11 @@ List *facade_get_composers (int from, int limit, const SearchConstraints *sc,
 char *facade_get_first_track_for_album (const char *album, int *error_code, 
         char **error_message);
 
+/** Returns the total length of the tracks in the album, in msec, or -1
+    on error */
+int64_t facade_get_album_duration (const char *album, int *error_code, 
+        char **error_message);
+
 List *facade_get_paths (int from, int limit, const SearchConstraints *sc, 
         int *match, int *error_code, char **error_message);
 
@@ -16,8 +16,20 @@
 #include "props.h" 
 #include "path.h" 
 #include "facade.h" 
+#include "request_handler.h" 
 #include "template_manager.h" 
 #include "htmlutil.h" 
+#include "page_stream.h" 
+#include "gui_request_handler.h" 
+#include "files_request_handler.h" 
+
+// The names in a directory, for making a list of cells as they are 
+//   needed
+typedef struct _FilesCells
+  {
+  Path *base;
+  List *names;
+  } FilesCells;
 
 /*============================================================================
 
@@ -138,7 +150,7 @@ static String *files_request_handler_dir_cell (const Path *base,
   //   is one. If there is not, we provide a default
   char *image_uri = facade_get_cover_image_for_dir (s_p2);
   if (!image_uri) 
-     asprintf (&image_uri, "%s%s", INT_FILE_BASE, "default_cover.png");
+     image_uri = strdup (request_handler_get_int_uri ("default_cover.png"));
 
   //char *escaped_image_uri = htmlutil_escape (image_uri);
   char *escaped_image_uri = strdup (image_uri); 
@@ -180,92 +192,80 @@ static String *files_request_handler_dir_cell (const Path *base,
 
 /*============================================================================
 
- files_request_handler_dirlist
+ files_request_handler_dir_item
 
 ============================================================================*/
-static String *files_request_handler_dirlist (const char *path) 
+static void files_request_handler_dir_item (void *data, int index, 
+    String *out) 
   {
-  LOG_IN
-  String *ret = NULL;
+  FilesCells *cells = data;
+  String *cell = files_request_handler_dir_cell (cells->base, 
+    list_get (cells->names, index));
+  string_append (out, string_cstr (cell));
+  string_destroy (cell);
+  }
 
-  int error_code = 0;
-  char *error = NULL;
-  List *dirlist = facade_get_dir_list (path, &error_code, &error);
+/*============================================================================
 
-  if (dirlist)
-    {
-    // Directory list
-    Path *base = path_create (path);
-    ret = string_create ("<div class=\"dirlist\">\n");
-    int l = list_length (dirlist); 
-    for (int i = 0; i < l; i++)
-      {
-      char *p = list_get (dirlist, i);
-      String *cell = files_request_handler_dir_cell (base, p);
-      string_append (ret, string_cstr(cell));
-      string_destroy (cell);
-      }
-    
-    string_append (ret, "</div>\n");
-    list_destroy (dirlist);
-    path_destroy (base);
-    }
-  else
-    {
-    ret = string_create (error);
-    free (error);
-    }
+ files_request_handler_file_item
 
-  LOG_OUT
-  return ret;
+============================================================================*/
+static void files_request_handler_file_item (void *data, int index, 
+    String *out) 
+  {
+  FilesCells *cells = data;
+  String *cell = files_request_handler_file_cell (cells->base, 
+    list_get (cells->names, index));
+  string_append (out, string_cstr (cell));
+  string_destroy (cell);
+  }
+
+/*============================================================================
+
+ files_request_handler_free_cells
+
+============================================================================*/
+static void files_request_handler_free_cells (void *data)
+  {
+  FilesCells *cells = data;
+  path_destroy (cells->base);
+  list_destroy (cells->names);
+  free (cells);
   }
 
 /*============================================================================
 
- files_request_handler_filelist
+ files_request_handler_add_list
 
-  The has_files argument is set if the path has any playable files, in
-  addition to creating the display. This is so that the caller can
-  know without additional work whether to display the parts of the
-  page that only make sense if the path is not empty of files
+ Add a list of directory or file cells to the page, which takes
+ ownership of the list of names. If there is no list, error is added
+ instead, and freed
 
 ============================================================================*/
-static String *files_request_handler_filelist (const char *path, 
-     BOOL *has_files) 
+static void files_request_handler_add_list (PageStream *stream, 
+     const char *path, List *names, char *error, const char *div_class,
+     PageStreamItemFn fn) 
   {
   LOG_IN
-  
-  String *ret = NULL;
-  char *error = NULL;
-  int error_code;
-  *has_files = FALSE;
-  List *filelist = facade_get_file_list (path, &error_code, &error);
-  if (filelist)
+  if (names)
     {
-    ret = string_create ("<div class=\"filelist\">\n");
-    Path *base = path_create (path);
-    int l = list_length (filelist); 
-    if (l > 0) *has_files = TRUE;
-    for (int i = 0; i < l; i++)
-      {
-      char *p = list_get (filelist, i);
-      String *cell = files_request_handler_file_cell (base, p);
-      string_append (ret, string_cstr(cell));
-      string_destroy (cell);
-      }
-
-    string_append (ret, "</div>\n");
-    list_destroy (filelist);
-    path_destroy (base);
+    FilesCells *cells = malloc (sizeof (FilesCells));
+    cells->base = path_create (path);
+    cells->names = names;
+    char *div;
+    asprintf (&div, "<div class=\"%s\">\n", div_class);
+    page_stream_add_text (stream, div);
+    free (div);
+    page_stream_add_items (stream, list_length (names), fn, cells, 
+      files_request_handler_free_cells);
+    page_stream_add_text (stream, "</div>\n");
     }
-  else
+  else if (error)
     {
-    ret = string_create (error);
+    page_stream_add_text (stream, error);
     free (error);
     }
-
   LOG_OUT
-  return ret;
   }
 
 /*============================================================================
@@ -280,7 +280,7 @@ static String *files_request_handler_dir_image (const char *path)
 
   char *image_uri = facade_get_cover_image_for_dir (path);
   if (!image_uri) 
-       asprintf (&image_uri, "%s%s", INT_FILE_BASE, "default_cover.png");
+       image_uri = strdup (request_handler_get_int_uri ("default_cover.png"));
   string_append (ret, "<img class=\"filepageimage\" src=\"");
   string_append (ret, image_uri);
   string_append (ret, "\">\n");
@@ -350,8 +350,15 @@ static String *files_request_handler_add_all_link (const char *path)
 
   files_request_handler_page 
 
+  The lists of names are read at once, but the cells, which need a 
+  database lookup for each directory's cover image, are made only when
+  the page is. If stream is not NULL, and there are many cells, the
+  page is returned as a stream for the caller to send as it is made,
+  and page is not set
+
 ============================================================================*/
-void files_request_handler_page (const Props *arguments, char **page)
+void files_request_handler_page (const Props *arguments, char **page,
+       PageStream **stream)
   {
   LOG_IN
   const char *path = props_get (arguments, "path");
@@ -362,25 +369,17 @@ void files_request_handler_page (const Props *arguments, char **page)
 
   template_manager_substitute_placeholder (generic, "path", path);
   
-  /*
-  String *body = files_request_handler_body (path);
-  template_manager_substitute_placeholder (generic, "body", 
-     string_cstr (body));
-  string_destroy (body);
-  */
-  
-  String *dirlist = files_request_handler_dirlist (path);
-  template_manager_substitute_placeholder (generic, "dirlist", 
-     string_cstr (dirlist));
-  string_destroy (dirlist);
+  int error_code = 0;
+  char *dir_error = NULL;
+  List *dirlist = facade_get_dir_list (path, &error_code, &dir_error);
+  char *file_error = NULL;
+  List *filelist = facade_get_file_list (path, &error_code, &file_error);
+  BOOL has_files = filelist && list_length (filelist) > 0;
+  int cells = (dirlist ? list_length (dirlist) : 0) 
+    + (has_files ? list_length (filelist) : 0);
 
-  BOOL has_files = FALSE;
-  String *filelist = files_request_handler_filelist (path, &has_files);
   if (has_files)
     {
-    template_manager_substitute_placeholder (generic, "filelist", 
-       string_cstr (filelist));
-  
     String *dirimage = files_request_handler_dir_image (path);
     template_manager_substitute_placeholder (generic, "dirimage", 
       string_cstr (dirimage));
@@ -397,19 +396,42 @@ void files_request_handler_page (const Props *arguments, char **page)
     }
   else
     {
-    template_manager_substitute_placeholder (generic, "filelist", ""); 
     template_manager_substitute_placeholder (generic, "dirimage", ""); 
     template_manager_substitute_placeholder (generic, "playalllink", ""); 
     }
-  if (filelist) string_destroy (filelist);
 
   template_manager_substitute_placeholder (generic, "title", "Files");
   // TODO others 
 
-  *page = strdup (string_cstr (generic));
+  PageStream *s = page_stream_create ();
+  const char *p = page_stream_add_text_until (s, string_cstr (generic), 
+    "dirlist");
+  files_request_handler_add_list (s, path, dirlist, dir_error, 
+    "dirlist", files_request_handler_dir_item);
+  p = page_stream_add_text_until (s, p, "filelist");
+  if (has_files)
+    {
+    files_request_handler_add_list (s, path, filelist, NULL, 
+      "filelist", files_request_handler_file_item);
+    }
+  else
+    {
+    if (filelist) list_destroy (filelist);
+    free (file_error);
+    }
+  page_stream_add_text (s, p);
   string_destroy (generic);
+
+  if (stream && cells >= GUI_STREAM_MIN_ITEMS)
+    {
+    *stream = s;
+    }
+  else
+    {
+    *page = page_stream_read_all (s);
+    page_stream_destroy (s);
+    }
   
   LOG_OUT
   }
 
-
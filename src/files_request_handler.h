@@ -10,10 +10,12 @@
 
 #include "defs.h"
 #include "props.h"
+#include "page_stream.h"
 
 BEGIN_DECLS
 
-void files_request_handler_page (const Props *arguments, char **page);
+void files_request_handler_page (const Props *arguments, char **page,
+       PageStream **stream);
 
 END_DECLS
 
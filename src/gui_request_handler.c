@@ -38,6 +38,8 @@
 #include "template_manager.h" 
 #include "facade.h" 
 #include "htmlutil.h" 
+#include "playlist_mirror.h" 
+#include "metrics.h" 
 
 
 struct _GUIRequestHandler
@@ -45,6 +47,15 @@ struct _GUIRequestHandler
   RequestHandler *request_handler;
   }; 
 
+// The pages that gui_request_handler_handle() knows, for recording 
+//   metrics
+static const char *gui_request_handler_pages[] =
+  {
+  URI_PLAYLIST, URI_RADIO, URI_ALBUMS, URI_FILES, URI_ADMIN, URI_BROWSE,
+  URI_SCANNER, URI_SEARCH, URI_TRACKS, URI_ARTISTS, URI_GENRES, 
+  URI_COMPOSERS, URI_SEARCHRES, NULL
+  };
+
 /*============================================================================
 
   gui_request_handler_create
@@ -56,6 +67,8 @@ GUIRequestHandler *gui_request_handler_create
   LOG_IN
   GUIRequestHandler *self = malloc (sizeof (GUIRequestHandler)); 
   self->request_handler = request_handler;
+  for (const char **page = gui_request_handler_pages; *page; page++)
+    metrics_add_route (METRICS_ROUTE_GUI, *page);
   LOG_OUT 
   return self;
   }
@@ -189,7 +202,7 @@ void gui_request_handler_scanner_page (GUIRequestHandler *self,
 
 ============================================================================*/
 void gui_request_handler_handle (GUIRequestHandler *self, const char *uri, 
-      const Props *arguments, int *code,  char **page)
+      const Props *arguments, int *code,  char **page, PageStream **stream)
   {
   LOG_IN
   log_debug ("GUI request: %s", uri);
@@ -211,7 +224,7 @@ void gui_request_handler_handle (GUIRequestHandler *self, const char *uri,
     }
   else if (strcmp (uri, URI_FILES) == 0)
     {
-    files_request_handler_page (arguments, page);
+    files_request_handler_page (arguments, page, stream);
     *code = 200;
     }
   else if (strcmp (uri, URI_ADMIN) == 0)
@@ -236,7 +249,7 @@ void gui_request_handler_handle (GUIRequestHandler *self, const char *uri,
     }
   else if (strcmp (uri, URI_TRACKS) == 0)
     {
-    tracks_request_handler_page (arguments, page);
+    tracks_request_handler_page (arguments, page, stream);
     *code = 200;
     }
   else if (strcmp (uri, URI_ARTISTS) == 0)
@@ -269,6 +282,58 @@ void gui_request_handler_handle (GUIRequestHandler *self, const char *uri,
   LOG_OUT
   }
 
+/*============================================================================
+
+ gui_request_handler_validator
+
+ The pages that are made from the index depend only on the index, and
+ the ones that are made only from a template don't change at all while
+ the program runs. The radio page is never validated: it is made from
+ station list files that could be changed at any time
+
+============================================================================*/
+BOOL gui_request_handler_validator (GUIRequestHandler *self, 
+      const char *uri, const Props *arguments, uint64_t *validator)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+
+  if (strcmp (uri, URI_ALBUMS) == 0 || strcmp (uri, URI_TRACKS) == 0
+      || strcmp (uri, URI_ARTISTS) == 0 || strcmp (uri, URI_GENRES) == 0
+      || strcmp (uri, URI_COMPOSERS) == 0 
+      || strcmp (uri, URI_SEARCHRES) == 0)
+    {
+    *validator = request_handler_get_index_generation 
+      (self->request_handler);
+    ret = TRUE;
+    }
+  else if (strcmp (uri, URI_ADMIN) == 0 || strcmp (uri, URI_BROWSE) == 0
+      || strcmp (uri, URI_SCANNER) == 0 || strcmp (uri, URI_SEARCH) == 0)
+    {
+    *validator = 0;
+    ret = TRUE;
+    }
+  else if (strcmp (uri, URI_FILES) == 0)
+    {
+    const char *path = props_get (arguments, "path");
+    if (!path) path = "/";
+    ret = request_handler_get_dir_generation (self->request_handler, 
+      path, validator);
+    }
+  else if (strcmp (uri, URI_PLAYLIST) == 0)
+    {
+    // Only when the page will be made from the playlist mirror
+    if (playlist_mirror_get_length () >= 0)
+      {
+      *validator = playlist_mirror_get_generation ();
+      ret = TRUE;
+      }
+    }
+
+  LOG_OUT
+  return ret;
+  }
+
 /*============================================================================
 
   gui_request_handler_summary
@@ -14,6 +14,7 @@
 #include "props.h"
 #include "request_handler.h"
 #include "searchconstraints.h"
+#include "page_stream.h"
 
 struct _GUIRequestHandler;
 typedef struct _GUIRequestHandler GUIRequestHandler;
@@ -44,6 +45,10 @@ typedef struct _GUIRequestHandler GUIRequestHandler;
 //   same broker logic many times in the program :/
 #define MAX_LIMIT             10000000
 
+// A page with at least this many cells is streamed to the client as it
+//   is made, rather than being made in full first, if the caller allows
+#define GUI_STREAM_MIN_ITEMS  200
+
 BEGIN_DECLS
 
 GUIRequestHandler *gui_request_handler_create 
@@ -51,9 +56,19 @@ GUIRequestHandler *gui_request_handler_create
 
 void               gui_request_handler_destroy (GUIRequestHandler *self);
 
+/** Make the page uri. If stream is not NULL, a page that would be
+    large may be returned as a PageStream instead, which the caller
+    must send and destroy, and page is not set. */
 void               gui_request_handler_handle (GUIRequestHandler *self, 
                     const char *uri, const Props* arguments, int *code, 
-                    char **page);
+                    char **page, PageStream **stream);
+
+/** Get a validator for the page uri, without producing the page -- see
+    request_handler_gui_etag(). Returns FALSE if the page has no 
+    validator. */
+BOOL               gui_request_handler_validator (GUIRequestHandler *self,
+                    const char *uri, const Props *arguments, 
+                    uint64_t *validator);
 
 void               gui_request_handler_error_page (const char *text, 
                      char **page);
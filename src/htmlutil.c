@@ -12,6 +12,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
 #include "defs.h" 
 #include "log.h" 
 
@@ -177,3 +178,20 @@ char *htmlutil_make_href (const char *href, const char *text)
 
 
 
+
+/*============================================================================
+
+  htmlutil_format_duration
+
+============================================================================*/
+char *htmlutil_format_duration (int64_t msec)
+  {
+  char *ret;
+  int64_t secs = msec / 1000;
+  if (secs >= 3600)
+    asprintf (&ret, "%lld:%02d:%02d", (long long)(secs / 3600), 
+      (int)((secs / 60) % 60), (int)(secs % 60));
+  else
+    asprintf (&ret, "%d:%02d", (int)(secs / 60), (int)(secs % 60));
+  return ret;
+  }
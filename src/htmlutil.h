@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include "defs.h"
 
 BEGIN_DECLS
@@ -19,6 +20,10 @@ char *htmlutil_escape_dquote_js (const char *str);
 char *htmlutil_escape_sdquote_js (const char *str);
 char *htmlutil_escape_dquote_json (const char *str);
 
+/** Format a length in msec as m:ss, or h:mm:ss if it is an hour or 
+    more. */
+char *htmlutil_format_duration (int64_t msec);
+
 END_DECLS
 
 
@@ -7,14 +7,18 @@
 
 ==========================================================================*/
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <getopt.h>
 #include <wchar.h>
 #include <time.h>
 #include <microhttpd.h>
+#include <zlib.h>
 #include "defs.h" 
 #include "log.h" 
 #include "httputil.h" 
@@ -75,4 +79,329 @@ void httputil_make_http_time (time_t t, char * buf, int buf_len)
   LOG_OUT
   }
 
+/*============================================================================
+
+  httputil_parse_range
+
+  Byte range specifiers are "first-last", "first-" (to the end), or 
+  "-count" (the last count bytes). A last byte beyond the end of the
+  file is taken to be the end of the file. Ranges that start beyond the
+  end are dropped, but a syntax error anywhere means the whole header
+  is ignored, as RFC 7233 requires
+
+============================================================================*/
+int httputil_parse_range (const char *header, uint64_t size, 
+       HttpRange *ranges, int max_ranges)
+  {
+  LOG_IN
+  const char *p = header;
+  while (*p == ' ' || *p == '\t') p++;
+  if (strncasecmp (p, "bytes=", 6) != 0) 
+    {
+    LOG_OUT
+    return 0;
+    }
+  p += 6;
+
+  int n = 0;
+  BOOL any = FALSE;
+  for (;;)
+    {
+    while (*p == ' ' || *p == '\t' || *p == ',') p++;
+    if (*p == 0) break;
+
+    uint64_t first = 0, last = 0;
+    BOOL has_first = FALSE, has_last = FALSE;
+    char *end;
+    if (isdigit ((unsigned char)*p))
+      {
+      first = strtoull (p, &end, 10);
+      p = end;
+      has_first = TRUE;
+      }
+    if (*p != '-') goto bad;
+    p++;
+    if (isdigit ((unsigned char)*p))
+      {
+      last = strtoull (p, &end, 10);
+      p = end;
+      has_last = TRUE;
+      }
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p != ',' && *p != 0) goto bad;
+    if (!has_first && !has_last) goto bad;
+    if (has_first && has_last && last < first) goto bad;
+    any = TRUE;
+
+    uint64_t start, stop; // stop is one past the last byte
+    if (has_first)
+      {
+      if (first >= size) continue; // Not satisfiable
+      start = first;
+      stop = (has_last && last < size) ? last + 1 : size;
+      }
+    else
+      {
+      if (last == 0) continue; // Not satisfiable
+      start = last >= size ? 0 : size - last;
+      stop = size;
+      }
+    if (n == max_ranges) goto bad;
+    ranges[n].start = start;
+    ranges[n].length = stop - start;
+    n++;
+    }
+
+  LOG_OUT
+  if (!any) return 0;
+  return n > 0 ? n : -1;
+
+bad:
+  LOG_OUT
+  return 0;
+  }
+
+/*============================================================================
+
+  Multipart byte range responses
+
+  The body is a sequence of segments, each of which is either some
+  text -- a part boundary and part headers -- or a range of the file.
+  The file ranges are read with pread(), so this does not have the
+  zero-copy path that a single range has, but requests for more than
+  one range are rare
+
+============================================================================*/
+typedef struct _HttpSegment
+  {
+  char *text;       // NULL for a range of the file
+  uint64_t offset;  // Offset in the file
+  uint64_t length;
+  } HttpSegment;
+
+typedef struct _HttpMultiRange
+  {
+  int fd;
+  int nsegments;
+  HttpSegment *segments;
+  // The segment that the last read was in, and the position in the
+  //   body at which it starts
+  int current;
+  uint64_t current_pos;
+  } HttpMultiRange;
+
+/*============================================================================
+
+  httputil_multirange_read
+
+============================================================================*/
+static ssize_t httputil_multirange_read (void *cls, uint64_t pos, 
+       char *buf, size_t max)
+  {
+  HttpMultiRange *self = cls;
+  // MHD reads in order, so the segment is nearly always the current one
+  //   or the next
+  if (pos < self->current_pos)
+    {
+    self->current = 0;
+    self->current_pos = 0;
+    }
+  while (self->current < self->nsegments && pos >= self->current_pos 
+      + self->segments[self->current].length)
+    {
+    self->current_pos += self->segments[self->current].length;
+    self->current++;
+    }
+  if (self->current == self->nsegments) 
+    return MHD_CONTENT_READER_END_OF_STREAM;
+
+  const HttpSegment *seg = &self->segments[self->current];
+  uint64_t off = pos - self->current_pos;
+  uint64_t n = seg->length - off;
+  if (n > max) n = max;
+  if (seg->text)
+    {
+    memcpy (buf, seg->text + off, n);
+    return n;
+    }
+  ssize_t r = pread (self->fd, buf, n, seg->offset + off);
+  if (r <= 0) return MHD_CONTENT_READER_END_WITH_ERROR;
+  return r;
+  }
+
+/*============================================================================
 
+  httputil_multirange_free
+
+============================================================================*/
+static void httputil_multirange_free (void *cls)
+  {
+  HttpMultiRange *self = cls;
+  for (int i = 0; i < self->nsegments; i++)
+    free (self->segments[i].text);
+  free (self->segments);
+  close (self->fd);
+  free (self);
+  }
+
+/*============================================================================
+
+  httputil_create_multirange_response
+
+============================================================================*/
+struct MHD_Response *httputil_create_multirange_response (int fd, 
+       uint64_t size, const HttpRange *ranges, int nranges, 
+       const char *content_type)
+  {
+  LOG_IN
+  char boundary[40];
+  snprintf (boundary, sizeof (boundary), "xsx-%08lx%08lx", 
+    (unsigned long)random (), (unsigned long)random ());
+
+  HttpMultiRange *self = malloc (sizeof (HttpMultiRange));
+  self->fd = fd;
+  self->nsegments = 0;
+  self->segments = malloc ((2 * nranges + 1) * sizeof (HttpSegment));
+  self->current = 0;
+  self->current_pos = 0;
+
+  uint64_t total = 0;
+  for (int i = 0; i < nranges; i++)
+    {
+    HttpSegment *seg = &self->segments[self->nsegments++];
+    int len = asprintf (&seg->text, "\r\n--%s\r\nContent-Type: %s\r\n"
+      "Content-Range: bytes %llu-%llu/%llu\r\n\r\n", boundary, 
+      content_type, (unsigned long long)ranges[i].start, 
+      (unsigned long long)(ranges[i].start + ranges[i].length - 1),
+      (unsigned long long)size);
+    seg->offset = 0;
+    seg->length = len;
+    total += len;
+
+    seg = &self->segments[self->nsegments++];
+    seg->text = NULL;
+    seg->offset = ranges[i].start;
+    seg->length = ranges[i].length;
+    total += ranges[i].length;
+    }
+  HttpSegment *seg = &self->segments[self->nsegments++];
+  int len = asprintf (&seg->text, "\r\n--%s--\r\n", boundary);
+  seg->offset = 0;
+  seg->length = len;
+  total += len;
+
+  struct MHD_Response *response = MHD_create_response_from_callback 
+    (total, 32 * 1024, httputil_multirange_read, self, 
+     httputil_multirange_free);
+  if (response)
+    {
+    char *type = NULL;
+    asprintf (&type, "multipart/byteranges; boundary=%s", boundary);
+    MHD_add_response_header (response, "Content-Type", type);
+    free (type);
+    }
+  else
+    httputil_multirange_free (self);
+  LOG_OUT
+  return response;
+  }
+
+/*==========================================================================
+
+  httputil_etag_matches
+
+  The header is "*", or a list of entity tags separated by commas, any
+  of which may be weak
+
+==========================================================================*/
+BOOL httputil_etag_matches (const char *if_none_match, const char *etag)
+  {
+  const char *p = if_none_match;
+  size_t len = strlen (etag);
+  while (*p)
+    {
+    while (*p == ' ' || *p == '\t' || *p == ',') p++;
+    if (*p == '*') return TRUE;
+    if (strncmp (p, "W/", 2) == 0) p += 2;
+    if (*p != '"') return FALSE;
+    const char *end = strchr (p + 1, '"');
+    if (!end) return FALSE;
+    if ((size_t)(end + 1 - p) == len && strncmp (p, etag, len) == 0) 
+      return TRUE;
+    p = end + 1;
+    }
+  return FALSE;
+  }
+
+/*==========================================================================
+
+  httputil_accepts_encoding
+
+  The header is a list of codings, separated by commas, each perhaps 
+  followed by a quality, e.g., "gzip;q=0.8". A quality of zero means
+  that the coding is not acceptable
+
+==========================================================================*/
+BOOL httputil_accepts_encoding (const char *accept_encoding, 
+       const char *coding)
+  {
+  int coding_len = strlen (coding);
+  int star = -1; // Whether "*" allows it, if it was given
+  const char *p = accept_encoding;
+  while (*p)
+    {
+    while (*p == ' ' || *p == '\t' || *p == ',') p++;
+    const char *name = p;
+    while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') p++;
+    int name_len = p - name;
+    BOOL acceptable = TRUE;
+    while (*p && *p != ',')
+      {
+      if (*p == ';')
+        {
+        p++;
+        while (*p == ' ' || *p == '\t') p++;
+        if (tolower (*p) == 'q' && p[1] == '=')
+          acceptable = atof (p + 2) > 0;
+        }
+      else
+        p++;
+      }
+    if (name_len == coding_len && strncasecmp (name, coding, name_len) == 0)
+      return acceptable;
+    if (name_len == 1 && name[0] == '*')
+      star = acceptable;
+    }
+  return star == 1;
+  }
+
+/*==========================================================================
+
+  httputil_gzip
+
+==========================================================================*/
+char *httputil_gzip (const char *data, size_t len, int level, 
+       size_t *out_len)
+  {
+  z_stream zs;
+  memset (&zs, 0, sizeof (zs));
+  // 16 + the window size selects a gzip header, rather than zlib's own
+  if (deflateInit2 (&zs, level, Z_DEFLATED, 16 + MAX_WBITS, 8, 
+        Z_DEFAULT_STRATEGY) != Z_OK)
+    return NULL;
+  uLong bound = deflateBound (&zs, len);
+  char *out = malloc (bound);
+  zs.next_in = (Bytef *)data;
+  zs.avail_in = len;
+  zs.next_out = (Bytef *)out;
+  zs.avail_out = bound;
+  int rc = deflate (&zs, Z_FINISH);
+  *out_len = zs.total_out;
+  deflateEnd (&zs);
+  if (rc != Z_STREAM_END)
+    {
+    free (out);
+    return NULL;
+    }
+  return out;
+  }
@@ -12,11 +12,55 @@
 #include <time.h>
 #include "defs.h"
 
+// Most byte ranges that will be served from a single request. A request
+//   for more is answered with the whole file
+#define HTTPUTIL_MAX_RANGES 16
+
+struct MHD_Response;
+
+// One byte range, resolved against the size of the file
+typedef struct _HttpRange
+  {
+  uint64_t start;
+  uint64_t length;
+  } HttpRange;
+
 BEGIN_DECLS
 
 BOOL httputil_parse_http_time (const char * buf, time_t *t);
 
 void httputil_make_http_time (time_t t, char * buf, int buf_len);
 
+/** Returns TRUE if the value of an Accept-Encoding header allows the
+    content coding coding, e.g., "gzip". A coding that is not mentioned
+    is allowed only if "*" is. */
+BOOL httputil_accepts_encoding (const char *accept_encoding, 
+       const char *coding);
+
+/** Compress len bytes of data in gzip format. Returns a newly-allocated
+    buffer, and sets *out_len to its length; or returns NULL if the data
+    could not be compressed. */
+char *httputil_gzip (const char *data, size_t len, int level, 
+       size_t *out_len);
+
+/** Returns TRUE if the value of an If-None-Match header matches etag,
+    using the weak comparison that RFC 7232 specifies for that header. */
+BOOL httputil_etag_matches (const char *if_none_match, const char *etag);
+
+/** Parse the value of a Range header, for a file of the given size,
+    into at most max_ranges ranges. Returns the number of satisfiable
+    ranges; or zero if the header is not a byte range request that can
+    be understood, in which case it should be ignored; or -1 if none of
+    the ranges can be satisfied, when the response should be 416. */
+int  httputil_parse_range (const char *header, uint64_t size, 
+       HttpRange *ranges, int max_ranges);
+
+/** Create a multipart/byteranges response for more than one range of
+    the open file fd. The response takes ownership of fd, and closes it
+    when it is destroyed. */
+struct MHD_Response *httputil_create_multirange_response (int fd, 
+       uint64_t size, const HttpRange *ranges, int nranges, 
+       const char *content_type);
+
 END_DECLS
 
@@ -32,6 +32,7 @@ struct _List
   pthread_mutex_t mutex;
   ListItemFreeFn free_fn; 
   ListItem *head;
+  ListItem *tail;
   };
 
 /*==========================================================================
@@ -108,6 +109,7 @@ void list_prepend (List *self, void *item)
   else
     {
     self->head = i;
+    self->tail = i;
     }
   pthread_mutex_unlock (&self->mutex);
   LOG_OUT
@@ -128,17 +130,13 @@ void list_append (List *self, void *item)
   i->data = item;
   i->next = NULL;
 
-  if (self->head)
-    {
-    ListItem *l = self->head;
-    while (l->next)
-      l = l->next;
-    l->next = i;
-    }
+  // Keeping a tail pointer means that building a list by appending is
+  //   not quadratic in its length
+  if (self->tail)
+    self->tail->next = i;
   else
-    {
     self->head = i;
-    }
+  self->tail = i;
   pthread_mutex_unlock (&self->mutex);
   LOG_OUT
   }
@@ -266,6 +264,7 @@ void list_remove_object (List *self, const void *item)
       l = l->next;
       }
     }
+  self->tail = last_good;
   pthread_mutex_unlock (&self->mutex);
   LOG_OUT
   }
@@ -314,6 +313,7 @@ void list_remove (List *self, const void *item, ListCompareFn fn)
       l = l->next;
       }
     }
+  self->tail = last_good;
   pthread_mutex_unlock (&self->mutex);
   LOG_OUT
   }
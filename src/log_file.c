@@ -0,0 +1,537 @@
+/*============================================================================
+
+  xine-server-x
+  log_file.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Log messages, and an access log of the requests that have been
+  answered, written to files. Request threads must not wait for each
+  other, or for the disk, to log something, and lines from different
+  threads must not be mixed up. So a thread that logs something only
+  copies it, with the time, into a fixed-size record in a ring buffer,
+  and a single writer thread takes the records out, in order, and
+  formats and writes them. Since only the writer touches the files,
+  each line is written whole, and a file can be rotated without
+  anything else knowing.
+
+  Any number of threads can add records at once, without a lock. Each
+  slot of the ring has a sequence number, which says whether it is
+  free for the record at a particular position, or holds it: a thread
+  claims the next position with a compare-and-swap, fills in the slot,
+  and then publishes it by moving its sequence number on. If the ring
+  is full, because the writer has fallen a long way behind, the record
+  is discarded and counted, rather than waiting for room; the writer
+  notes how many were lost in the file.
+
+  When there is nothing to write, the writer waits on a semaphore, for
+  at most LOG_FILE_IDLE_MSEC. A thread that adds a record posts the
+  semaphore only if the writer is waiting, and posting never blocks.
+
+  The ring is statically allocated, and is never freed, so that a
+  thread that is logging while the writer stops can't touch freed
+  memory. Records that are added after that are not written.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include "defs.h"
+#include "log.h"
+#include "log_file.h"
+
+#define LOG_FILE_MESSAGE 0
+#define LOG_FILE_ACCESS 1
+
+typedef struct _LogFileRecord
+  {
+  uint64_t seq;      // Position the slot is free for, or holds, plus one
+  int kind;          // LOG_FILE_MESSAGE or LOG_FILE_ACCESS
+  int level;         // Message level, or response code
+  int64_t bytes;
+  int64_t usec;
+  struct timespec time;
+  char method[12];
+  char text[LOG_FILE_TEXT_MAX + 1];
+  } LogFileRecord;
+
+typedef struct _LogFileOut
+  {
+  char *path; // NULL if this file is not written
+  FILE *f;
+  int64_t size;
+  } LogFileOut;
+
+static LogFileRecord log_file_ring[LOG_FILE_RING_SIZE];
+static uint64_t log_file_tail = 0; // Next position to be claimed
+static uint64_t log_file_head = 0; // Next position to be written
+static uint64_t log_file_dropped[2];
+static uint64_t log_file_reported[2];
+static BOOL log_file_running = FALSE;
+static BOOL log_file_stop_requested = FALSE;
+static BOOL log_file_waiting = FALSE;
+static sem_t log_file_wake;
+static pthread_t log_file_thread;
+static LogFileOut log_file_out[2];
+static BOOL log_file_has[2]; // Whether each file is written
+static int64_t log_file_max_size = 0;
+static int log_file_keep = 0;
+
+/*==========================================================================
+
+  log_file_claim
+
+  Claim the next free slot of the ring, or return NULL if there is none
+
+==========================================================================*/
+static LogFileRecord *log_file_claim (int kind)
+  {
+  uint64_t pos = __atomic_load_n (&log_file_tail, __ATOMIC_RELAXED);
+  for (;;)
+    {
+    LogFileRecord *r = &log_file_ring[pos & (LOG_FILE_RING_SIZE - 1)];
+    uint64_t seq = __atomic_load_n (&r->seq, __ATOMIC_ACQUIRE);
+    int64_t diff = (int64_t)seq - (int64_t)pos;
+    if (diff == 0)
+      {
+      if (__atomic_compare_exchange_n (&log_file_tail, &pos, pos + 1,
+            TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return r;
+      }
+    else if (diff < 0)
+      {
+      __atomic_add_fetch (&log_file_dropped[kind], 1, __ATOMIC_RELAXED);
+      return NULL;
+      }
+    else
+      pos = __atomic_load_n (&log_file_tail, __ATOMIC_RELAXED);
+    }
+  }
+
+/*==========================================================================
+
+  log_file_publish
+
+==========================================================================*/
+static void log_file_publish (LogFileRecord *r)
+  {
+  uint64_t pos = r->seq;
+  __atomic_store_n (&r->seq, pos + 1, __ATOMIC_RELEASE);
+  if (__atomic_exchange_n (&log_file_waiting, FALSE, __ATOMIC_SEQ_CST))
+    sem_post (&log_file_wake);
+  }
+
+/*==========================================================================
+
+  log_file_copy_text
+
+  Copy text into a record, marking it if it has to be cut short
+
+==========================================================================*/
+static void log_file_copy_text (char *dest, const char *text)
+  {
+  size_t len = strlen (text);
+  if (len > LOG_FILE_TEXT_MAX)
+    {
+    memcpy (dest, text, LOG_FILE_TEXT_MAX - 3);
+    strcpy (dest + LOG_FILE_TEXT_MAX - 3, "...");
+    }
+  else
+    memcpy (dest, text, len + 1);
+  }
+
+/*==========================================================================
+
+  log_file_handler
+
+==========================================================================*/
+void log_file_handler (int level, const char *message)
+  {
+  if (!__atomic_load_n (&log_file_running, __ATOMIC_ACQUIRE)
+      || !log_file_has[LOG_FILE_MESSAGE])
+    {
+    fprintf (stderr, NAME ": %s\n", message);
+    return;
+    }
+  LogFileRecord *r = log_file_claim (LOG_FILE_MESSAGE);
+  if (r)
+    {
+    r->kind = LOG_FILE_MESSAGE;
+    r->level = level;
+    clock_gettime (CLOCK_REALTIME, &r->time);
+    log_file_copy_text (r->text, message);
+    log_file_publish (r);
+    }
+  }
+
+/*==========================================================================
+
+  log_file_access_start
+
+==========================================================================*/
+int64_t log_file_access_start (void)
+  {
+  if (!__atomic_load_n (&log_file_running, __ATOMIC_ACQUIRE)
+      || !log_file_has[LOG_FILE_ACCESS])
+    return 0;
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+/*==========================================================================
+
+  log_file_access
+
+==========================================================================*/
+void log_file_access (const char *method, const char *uri, int code,
+       int64_t bytes, int64_t start)
+  {
+  if (start == 0 || !__atomic_load_n (&log_file_running, __ATOMIC_ACQUIRE))
+    return;
+  LogFileRecord *r = log_file_claim (LOG_FILE_ACCESS);
+  if (r)
+    {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    r->kind = LOG_FILE_ACCESS;
+    r->level = code;
+    r->bytes = bytes;
+    r->usec = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - start;
+    clock_gettime (CLOCK_REALTIME, &r->time);
+    snprintf (r->method, sizeof (r->method), "%s", method);
+    log_file_copy_text (r->text, uri);
+    log_file_publish (r);
+    }
+  }
+
+/*==========================================================================
+
+  log_file_rotate
+
+  Move file to file.1, file.1 to file.2, and so on, discarding the
+  oldest, and start a new file
+
+==========================================================================*/
+static void log_file_rotate (LogFileOut *out)
+  {
+  fclose (out->f);
+  if (log_file_keep > 0)
+    {
+    for (int i = log_file_keep - 1; i >= 0; i--)
+      {
+      char *from, *to;
+      if (i == 0)
+        from = strdup (out->path);
+      else
+        asprintf (&from, "%s.%d", out->path, i);
+      asprintf (&to, "%s.%d", out->path, i + 1);
+      rename (from, to);
+      free (from);
+      free (to);
+      }
+    }
+  else
+    unlink (out->path);
+  out->f = fopen (out->path, "ae");
+  out->size = 0;
+  }
+
+/*==========================================================================
+
+  log_file_write
+
+  Write a line, which must end with a newline, rotating the file first
+  if it would get too big. If the file could not be reopened when it
+  was last rotated, the line is lost
+
+==========================================================================*/
+static void log_file_write (LogFileOut *out, const char *line)
+  {
+  int64_t len = strlen (line);
+  if (out->f && log_file_max_size > 0 && out->size > 0
+      && out->size + len > log_file_max_size)
+    log_file_rotate (out);
+  if (out->f)
+    {
+    fputs (line, out->f);
+    out->size += len;
+    }
+  }
+
+/*==========================================================================
+
+  log_file_clean
+
+  Replace anything in the text that would break the line, or, in a
+  URI, the quotes around it
+
+==========================================================================*/
+static void log_file_clean (char *text, BOOL quoted)
+  {
+  for (unsigned char *p = (unsigned char *)text; *p; p++)
+    {
+    if (*p < ' ' || *p == 0x7f || (quoted && *p == '"'))
+      *p = '?';
+    }
+  }
+
+/*==========================================================================
+
+  log_file_format_record
+
+==========================================================================*/
+static void log_file_format_record (LogFileRecord *r, char *line,
+       size_t len)
+  {
+  struct tm tm;
+  char stamp[32];
+  localtime_r (&r->time.tv_sec, &tm);
+  strftime (stamp, sizeof (stamp), "%Y-%m-%d %H:%M:%S", &tm);
+
+  if (r->kind == LOG_FILE_ACCESS)
+    {
+    log_file_clean (r->method, TRUE);
+    log_file_clean (r->text, TRUE);
+    char bytes[24];
+    if (r->bytes >= 0)
+      snprintf (bytes, sizeof (bytes), "%lld", (long long)r->bytes);
+    else
+      strcpy (bytes, "-");
+    snprintf (line, len, "%s.%03ld \"%s %s\" %d %s %lld.%03lld\n", stamp,
+      r->time.tv_nsec / 1000000, r->method, r->text, r->level, bytes,
+      (long long)(r->usec / 1000), (long long)(r->usec % 1000));
+    }
+  else
+    {
+    const char *s_level = "ERROR";
+    switch (r->level)
+      {
+      case LOG_ERROR: s_level = "ERROR"; break;
+      case LOG_WARNING: s_level = "WARN"; break;
+      case LOG_INFO: s_level = "INFO"; break;
+      case LOG_DEBUG: s_level = "DEBUG"; break;
+      case LOG_TRACE: s_level = "TRACE"; break;
+      }
+    log_file_clean (r->text, FALSE);
+    snprintf (line, len, "%s.%03ld %s: %s\n", stamp,
+      r->time.tv_nsec / 1000000, s_level, r->text);
+    }
+  }
+
+/*==========================================================================
+
+  log_file_drain
+
+  Write every record that has been published, and return how many
+  there were
+
+==========================================================================*/
+static int log_file_drain (void)
+  {
+  int n = 0;
+  char line[LOG_FILE_TEXT_MAX + 128];
+  for (;;)
+    {
+    LogFileRecord *r =
+      &log_file_ring[log_file_head & (LOG_FILE_RING_SIZE - 1)];
+    if (__atomic_load_n (&r->seq, __ATOMIC_ACQUIRE) != log_file_head + 1)
+      break;
+    log_file_format_record (r, line, sizeof (line));
+    log_file_write (&log_file_out[r->kind], line);
+    __atomic_store_n (&r->seq, log_file_head + LOG_FILE_RING_SIZE,
+      __ATOMIC_RELEASE);
+    log_file_head++;
+    n++;
+    }
+  return n;
+  }
+
+/*==========================================================================
+
+  log_file_flush
+
+  Note any records that had to be discarded, and flush the files
+
+==========================================================================*/
+static void log_file_flush (void)
+  {
+  for (int kind = LOG_FILE_MESSAGE; kind <= LOG_FILE_ACCESS; kind++)
+    {
+    LogFileOut *out = &log_file_out[kind];
+    if (!out->path) continue;
+    uint64_t dropped = __atomic_load_n (&log_file_dropped[kind],
+      __ATOMIC_RELAXED);
+    if (dropped != log_file_reported[kind])
+      {
+      char line[80];
+      snprintf (line, sizeof (line),
+        "%llu lines were discarded, because the log was too busy\n",
+        (unsigned long long)(dropped - log_file_reported[kind]));
+      log_file_write (out, line);
+      log_file_reported[kind] = dropped;
+      }
+    if (out->f) fflush (out->f);
+    }
+  }
+
+/*==========================================================================
+
+  log_file_wait
+
+  Wait for a record to be published, or for a while. The ring is 
+  checked again after the flag is set, so that a record published just
+  before it was set is not left until the wait times out
+
+==========================================================================*/
+static void log_file_wait (void)
+  {
+  __atomic_store_n (&log_file_waiting, TRUE, __ATOMIC_SEQ_CST);
+  LogFileRecord *r = 
+    &log_file_ring[log_file_head & (LOG_FILE_RING_SIZE - 1)];
+  if (__atomic_load_n (&r->seq, __ATOMIC_SEQ_CST) != log_file_head + 1)
+    {
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_nsec += LOG_FILE_IDLE_MSEC * 1000000L;
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    while (sem_timedwait (&log_file_wake, &ts) != 0 && errno == EINTR)
+      ;
+    }
+  __atomic_store_n (&log_file_waiting, FALSE, __ATOMIC_RELAXED);
+  }
+
+/*==========================================================================
+
+  log_file_run
+
+  The writer thread. It checks for a request to stop before it writes
+  what is waiting, so that everything logged before the request is
+  written
+
+==========================================================================*/
+static void *log_file_run (void *data)
+  {
+  (void)data;
+  for (;;)
+    {
+    BOOL stopping = __atomic_load_n (&log_file_stop_requested,
+      __ATOMIC_ACQUIRE);
+    if (log_file_drain () == 0)
+      {
+      log_file_flush ();
+      if (stopping) break;
+      log_file_wait ();
+      }
+    }
+  return NULL;
+  }
+
+/*==========================================================================
+
+  log_file_open_out
+
+==========================================================================*/
+static BOOL log_file_open_out (LogFileOut *out, const char *path)
+  {
+  memset (out, 0, sizeof (LogFileOut));
+  if (!path) return TRUE;
+  // Close on exec, so the scanner does not inherit it
+  out->f = fopen (path, "ae");
+  if (!out->f)
+    {
+    log_error ("Can't open log file %s: %s", path, strerror (errno));
+    return FALSE;
+    }
+  struct stat sb;
+  if (fstat (fileno (out->f), &sb) == 0)
+    out->size = sb.st_size;
+  out->path = strdup (path);
+  return TRUE;
+  }
+
+/*==========================================================================
+
+  log_file_close_out
+
+==========================================================================*/
+static void log_file_close_out (LogFileOut *out)
+  {
+  if (out->f) fclose (out->f);
+  free (out->path);
+  memset (out, 0, sizeof (LogFileOut));
+  }
+
+/*==========================================================================
+
+  log_file_open
+
+==========================================================================*/
+BOOL log_file_open (const char *log_path, const char *access_path,
+       int64_t max_size, int keep)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  if (!log_file_running)
+    {
+    if (log_file_open_out (&log_file_out[LOG_FILE_MESSAGE], log_path)
+        && log_file_open_out (&log_file_out[LOG_FILE_ACCESS], access_path))
+      {
+      log_file_max_size = max_size;
+      log_file_keep = keep;
+      log_file_has[LOG_FILE_MESSAGE] = log_path != NULL;
+      log_file_has[LOG_FILE_ACCESS] = access_path != NULL;
+      // The position that each slot is free for is the next one, from
+      //  where the last writer stopped, that maps to it
+      for (int i = 0; i < LOG_FILE_RING_SIZE; i++)
+        log_file_ring[(log_file_head + i) & (LOG_FILE_RING_SIZE - 1)].seq 
+          = log_file_head + i;
+      log_file_tail = log_file_head;
+      log_file_stop_requested = FALSE;
+      sem_init (&log_file_wake, 0, 0);
+      if (pthread_create (&log_file_thread, NULL, log_file_run, NULL) == 0)
+        {
+        __atomic_store_n (&log_file_running, TRUE, __ATOMIC_RELEASE);
+        ret = TRUE;
+        }
+      else
+        log_error ("Can't start log writer thread");
+      }
+    if (!ret)
+      {
+      log_file_close_out (&log_file_out[LOG_FILE_MESSAGE]);
+      log_file_close_out (&log_file_out[LOG_FILE_ACCESS]);
+      }
+    }
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  log_file_close
+
+==========================================================================*/
+void log_file_close (void)
+  {
+  LOG_IN
+  if (log_file_running)
+    {
+    __atomic_store_n (&log_file_running, FALSE, __ATOMIC_RELEASE);
+    __atomic_store_n (&log_file_stop_requested, TRUE, __ATOMIC_RELEASE);
+    sem_post (&log_file_wake);
+    pthread_join (log_file_thread, NULL);
+    log_file_close_out (&log_file_out[LOG_FILE_MESSAGE]);
+    log_file_close_out (&log_file_out[LOG_FILE_ACCESS]);
+    }
+  LOG_OUT
+  }
+
@@ -0,0 +1,64 @@
+/*============================================================================
+
+  xine-server-x
+  log_file.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Log messages and an access log, written to files that are rotated
+  when they get too big, by a thread of their own, so that a request
+  never waits for the disk. See log_file.c for details.
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+
+// Records that can be waiting to be written. Must be a power of two
+#define LOG_FILE_RING_SIZE 1024
+
+// Longest message, or request URI, that is logged in full
+#define LOG_FILE_TEXT_MAX 440
+
+// Default size, in kB, at which a log file is rotated
+#define LOG_FILE_DEF_SIZE 10240
+
+// Default number of rotated files that are kept
+#define LOG_FILE_DEF_KEEP 4
+
+// Longest the writer waits when there is nothing to write, msec
+#define LOG_FILE_IDLE_MSEC 100
+
+BEGIN_DECLS
+
+/** Start writing log messages to log_path, and the access log to
+    access_path, either of which may be NULL. A file is rotated when it
+    would grow beyond max_size bytes, or never if max_size is zero, and
+    keep older files are kept, as log_path.1, log_path.2, and so on.
+    Returns FALSE, having logged the reason, if either file can't be
+    opened, in which case nothing is started. */
+BOOL     log_file_open (const char *log_path, const char *access_path,
+           int64_t max_size, int keep);
+
+/** Write everything that is waiting, and stop the writer. */
+void     log_file_close (void);
+
+/** A LogHandler -- see log_set_handler() -- that adds a message to the
+    log file. It never waits: if the writer has fallen so far behind
+    that there is no room, the message is counted and discarded. */
+void     log_file_handler (int level, const char *message);
+
+/** Get the time at which a request starts, for log_file_access(), or
+    zero if there is no access log. */
+int64_t  log_file_access_start (void);
+
+/** Add a request to the access log, if there is one. bytes is the size
+    of the response body, or -1 if it is not known in advance. start is
+    the value of log_file_access_start() when the request arrived. Like
+    log_file_handler(), this never waits. */
+void     log_file_access (const char *method, const char *uri, int code,
+           int64_t bytes, int64_t start);
+
+END_DECLS
+
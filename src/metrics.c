@@ -0,0 +1,413 @@
+/*============================================================================
+
+  xine-server-x
+  metrics.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Counters and latency histograms for each REST API function and web
+  interface page, and for the things that requests wait for: index
+  database queries, round trips to xine-server, and cover image
+  lookups. A count of the files examined by the scanner, which runs in
+  another process, is kept by sampling its status file.
+
+  Recording must not slow the requests it records, so nothing here
+  takes a lock after start-up. The routes are all added before the
+  HTTP server starts, and are then only read, and every counter is
+  updated with an atomic add.
+
+  Each histogram has four buckets for every doubling of the time, from
+  one microsecond to a few minutes, in the manner of an HDR histogram,
+  so that its resolution is 25% or better at any scale. /api/metrics
+  reports only the bucket boundaries that are powers of two, which is
+  plenty for Prometheus to work out percentiles from.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "defs.h"
+#include "log.h"
+#include "string.h"
+#include "metrics.h"
+
+// Buckets per doubling of time, as a power of two
+#define METRICS_SUB_BITS 2
+#define METRICS_SUB (1 << METRICS_SUB_BITS)
+// Times are recorded in microseconds, up to 2^METRICS_MAX_OCTAVE. Longer
+//   times go in the last bucket
+#define METRICS_MAX_OCTAVE 28
+#define METRICS_BUCKETS ((METRICS_MAX_OCTAVE - 1) * METRICS_SUB)
+// The range of bucket boundaries reported, as powers of two microseconds
+#define METRICS_LE_MIN 5
+#define METRICS_LE_MAX 26
+
+typedef struct _MetricsHistogram
+  {
+  uint64_t buckets[METRICS_BUCKETS];
+  uint64_t sum; // Microseconds
+  } MetricsHistogram;
+
+typedef struct _MetricsRoute
+  {
+  const char *kind;
+  const char *name;
+  MetricsHistogram histogram;
+  uint64_t responses[5]; // 1xx to 5xx
+  } MetricsRoute;
+
+typedef struct _MetricsOpInfo
+  {
+  const char *name;
+  const char *help;
+  } MetricsOpInfo;
+
+static const MetricsOpInfo metrics_op_info[METRICS_NOPS] =
+  {
+  { "xsx_db_query_duration_seconds",
+    "Time taken by queries on the index database" },
+  { "xsx_xine_server_request_duration_seconds",
+    "Round-trip time of requests to xine-server" },
+  { "xsx_cover_lookup_duration_seconds",
+    "Time taken to find the cover image for a directory" },
+  };
+
+static int metrics_on = FALSE;
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static MetricsRoute metrics_routes[METRICS_MAX_ROUTES];
+static int metrics_nroutes = 0;
+static MetricsHistogram metrics_ops[METRICS_NOPS];
+static int metrics_scanner_running = FALSE;
+static uint64_t metrics_scanner_files = 0;
+// Only the main loop samples the scanner, so this needs no protection
+static int metrics_scanner_last = 0;
+
+/*==========================================================================
+
+  metrics_now
+
+==========================================================================*/
+static int64_t metrics_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+/*==========================================================================
+
+  metrics_bucket
+
+  Values less than METRICS_SUB have a bucket each. Above that, the
+  bucket is given by the position of the highest bit set, and the
+  METRICS_SUB_BITS bits that follow it
+
+==========================================================================*/
+static int metrics_bucket (uint64_t usec)
+  {
+  if (usec < METRICS_SUB) return (int)usec;
+  int octave = 63 - __builtin_clzll (usec);
+  int sub = (usec >> (octave - METRICS_SUB_BITS)) & (METRICS_SUB - 1);
+  int ret = (octave - METRICS_SUB_BITS + 1) * METRICS_SUB + sub;
+  if (ret >= METRICS_BUCKETS) ret = METRICS_BUCKETS - 1;
+  return ret;
+  }
+
+/*==========================================================================
+
+  metrics_observe
+
+  A time goes in the bucket that holds one microsecond less, so that
+  each bucket includes its upper boundary, as Prometheus expects
+
+==========================================================================*/
+static void metrics_observe (MetricsHistogram *h, int64_t usec)
+  {
+  if (usec < 0) usec = 0;
+  __atomic_add_fetch (&h->buckets[metrics_bucket (usec ? usec - 1 : 0)], 1,
+    __ATOMIC_RELAXED);
+  __atomic_add_fetch (&h->sum, usec, __ATOMIC_RELAXED);
+  }
+
+/*==========================================================================
+
+  metrics_set_enabled
+
+==========================================================================*/
+void metrics_set_enabled (BOOL enabled)
+  {
+  __atomic_store_n (&metrics_on, enabled, __ATOMIC_RELAXED);
+  }
+
+/*==========================================================================
+
+  metrics_enabled
+
+==========================================================================*/
+BOOL metrics_enabled (void)
+  {
+  return __atomic_load_n (&metrics_on, __ATOMIC_RELAXED);
+  }
+
+/*==========================================================================
+
+  metrics_append_route
+
+  Must be called with the mutex held
+
+==========================================================================*/
+static void metrics_append_route (const char *kind, const char *name)
+  {
+  if (metrics_nroutes < METRICS_MAX_ROUTES)
+    {
+    MetricsRoute *route = &metrics_routes[metrics_nroutes];
+    memset (route, 0, sizeof (MetricsRoute));
+    route->kind = kind;
+    route->name = name;
+    // Readers don't lock, so the route must be complete before they
+    //   can see it
+    __atomic_store_n (&metrics_nroutes, metrics_nroutes + 1,
+      __ATOMIC_RELEASE);
+    }
+  else
+    log_warning ("Too many routes for metrics: %s", name);
+  }
+
+/*==========================================================================
+
+  metrics_add_route
+
+  The first route added brings with it the routes for requests whose
+  names are not known
+
+==========================================================================*/
+void metrics_add_route (const char *kind, const char *name)
+  {
+  LOG_IN
+  pthread_mutex_lock (&metrics_mutex);
+  if (metrics_nroutes == 0)
+    {
+    metrics_append_route (METRICS_ROUTE_API, "other");
+    metrics_append_route (METRICS_ROUTE_GUI, "other");
+    }
+  metrics_append_route (kind, name);
+  pthread_mutex_unlock (&metrics_mutex);
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  metrics_find_route
+
+==========================================================================*/
+static MetricsRoute *metrics_find_route (const char *kind, const char *name)
+  {
+  int n = __atomic_load_n (&metrics_nroutes, __ATOMIC_ACQUIRE);
+  MetricsRoute *other = NULL;
+  for (int i = 0; i < n; i++)
+    {
+    MetricsRoute *route = &metrics_routes[i];
+    if (strcmp (route->kind, kind) == 0)
+      {
+      if (strcmp (route->name, name) == 0) return route;
+      if (!other && strcmp (route->name, "other") == 0) other = route;
+      }
+    }
+  return other;
+  }
+
+/*==========================================================================
+
+  metrics_start
+
+==========================================================================*/
+int64_t metrics_start (void)
+  {
+  if (!metrics_enabled ()) return 0;
+  return metrics_now ();
+  }
+
+/*==========================================================================
+
+  metrics_record_request
+
+==========================================================================*/
+void metrics_record_request (const char *kind, const char *name,
+      int code, int64_t start)
+  {
+  if (start == 0) return;
+  MetricsRoute *route = metrics_find_route (kind, name);
+  if (!route) return;
+  metrics_observe (&route->histogram, metrics_now () - start);
+  int cls = code / 100 - 1;
+  if (cls < 0) cls = 0;
+  if (cls > 4) cls = 4;
+  __atomic_add_fetch (&route->responses[cls], 1, __ATOMIC_RELAXED);
+  }
+
+/*==========================================================================
+
+  metrics_record_op
+
+==========================================================================*/
+void metrics_record_op (MetricsOp op, int64_t start)
+  {
+  if (start == 0) return;
+  metrics_observe (&metrics_ops[op], metrics_now () - start);
+  }
+
+/*==========================================================================
+
+  metrics_record_op_time
+
+==========================================================================*/
+void metrics_record_op_time (MetricsOp op, int64_t usec)
+  {
+  if (!metrics_enabled ()) return;
+  metrics_observe (&metrics_ops[op], usec);
+  }
+
+/*==========================================================================
+
+  metrics_sample_scanner
+
+  A new scan starts counting from zero, so a count lower than the last
+  one means that the files counted so far are all new
+
+==========================================================================*/
+void metrics_sample_scanner (BOOL running, int scanned)
+  {
+  if (!metrics_enabled ()) return;
+  if (running)
+    {
+    int added = scanned >= metrics_scanner_last
+      ? scanned - metrics_scanner_last : scanned;
+    __atomic_add_fetch (&metrics_scanner_files, added, __ATOMIC_RELAXED);
+    metrics_scanner_last = scanned;
+    }
+  else
+    metrics_scanner_last = 0;
+  __atomic_store_n (&metrics_scanner_running, running, __ATOMIC_RELAXED);
+  }
+
+/*==========================================================================
+
+  metrics_format_histogram
+
+  labels is a list of labels, which may be empty. Each bucket is read
+  separately, so a histogram that is being updated may be slightly
+  inconsistent, but the count is always the total of the buckets
+
+==========================================================================*/
+static void metrics_format_histogram (String *s, const char *name,
+      const char *labels, const MetricsHistogram *h)
+  {
+  uint64_t buckets[METRICS_BUCKETS];
+  uint64_t count = 0;
+  for (int i = 0; i < METRICS_BUCKETS; i++)
+    {
+    buckets[i] = __atomic_load_n (&h->buckets[i], __ATOMIC_RELAXED);
+    count += buckets[i];
+    }
+  if (count == 0) return;
+  uint64_t sum = __atomic_load_n (&h->sum, __ATOMIC_RELAXED);
+  const char *sep = labels[0] ? "," : "";
+
+  uint64_t cumulative = 0;
+  int i = 0;
+  for (int octave = METRICS_LE_MIN; octave <= METRICS_LE_MAX; octave++)
+    {
+    // The first bucket of this octave starts at 2^octave microseconds
+    int end = metrics_bucket ((uint64_t)1 << octave);
+    for (; i < end; i++)
+      cumulative += buckets[i];
+    string_append_printf (s, "%s_bucket{%s%sle=\"%.6f\"} %llu\n", name,
+      labels, sep, ((uint64_t)1 << octave) / 1e6,
+      (unsigned long long)cumulative);
+    }
+  string_append_printf (s, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name,
+    labels, sep, (unsigned long long)count);
+  if (labels[0])
+    {
+    string_append_printf (s, "%s_sum{%s} %.6f\n", name, labels, sum / 1e6);
+    string_append_printf (s, "%s_count{%s} %llu\n", name, labels,
+      (unsigned long long)count);
+    }
+  else
+    {
+    string_append_printf (s, "%s_sum %.6f\n", name, sum / 1e6);
+    string_append_printf (s, "%s_count %llu\n", name,
+      (unsigned long long)count);
+    }
+  }
+
+/*==========================================================================
+
+  metrics_format
+
+==========================================================================*/
+char *metrics_format (void)
+  {
+  LOG_IN
+  String *s = string_create_empty ();
+  int n = __atomic_load_n (&metrics_nroutes, __ATOMIC_ACQUIRE);
+
+  string_append (s, "# HELP xsx_http_request_duration_seconds Time taken "
+    "to answer requests, by REST API function or web interface page\n");
+  string_append (s, "# TYPE xsx_http_request_duration_seconds histogram\n");
+  for (int i = 0; i < n; i++)
+    {
+    const MetricsRoute *route = &metrics_routes[i];
+    char *labels;
+    asprintf (&labels, "route=\"/%s/%s\"", route->kind, route->name);
+    metrics_format_histogram (s, "xsx_http_request_duration_seconds",
+      labels, &route->histogram);
+    free (labels);
+    }
+
+  string_append (s, "# HELP xsx_http_responses_total Responses sent, by "
+    "route and class of status code\n");
+  string_append (s, "# TYPE xsx_http_responses_total counter\n");
+  for (int i = 0; i < n; i++)
+    {
+    const MetricsRoute *route = &metrics_routes[i];
+    for (int cls = 0; cls < 5; cls++)
+      {
+      uint64_t count = __atomic_load_n (&route->responses[cls],
+        __ATOMIC_RELAXED);
+      if (count)
+        string_append_printf (s, "xsx_http_responses_total"
+          "{route=\"/%s/%s\",code=\"%dxx\"} %llu\n", route->kind,
+          route->name, cls + 1, (unsigned long long)count);
+      }
+    }
+
+  for (int op = 0; op < METRICS_NOPS; op++)
+    {
+    const MetricsOpInfo *info = &metrics_op_info[op];
+    string_append_printf (s, "# HELP %s %s\n", info->name, info->help);
+    string_append_printf (s, "# TYPE %s histogram\n", info->name);
+    metrics_format_histogram (s, info->name, "", &metrics_ops[op]);
+    }
+
+  string_append (s, "# HELP xsx_scanner_running Whether a scan of the "
+    "audio files is running\n");
+  string_append (s, "# TYPE xsx_scanner_running gauge\n");
+  string_append_printf (s, "xsx_scanner_running %d\n",
+    __atomic_load_n (&metrics_scanner_running, __ATOMIC_RELAXED) ? 1 : 0);
+  string_append (s, "# HELP xsx_scanner_files_total Files examined by "
+    "the scanner\n");
+  string_append (s, "# TYPE xsx_scanner_files_total counter\n");
+  string_append_printf (s, "xsx_scanner_files_total %llu\n",
+    (unsigned long long)__atomic_load_n (&metrics_scanner_files,
+    __ATOMIC_RELAXED));
+
+  char *ret = strdup (string_cstr (s));
+  string_destroy (s);
+  LOG_OUT
+  return ret;
+  }
+
@@ -0,0 +1,77 @@
+/*============================================================================
+
+  xine-server-x
+  metrics.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Request counts and latency histograms, for each REST API function and
+  web interface page, and for the slow things they depend on, reported
+  in the Prometheus text format. See metrics.c for details.
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+
+// Most routes -- API functions plus GUI pages -- that can be recorded
+#define METRICS_MAX_ROUTES 64
+
+#define METRICS_ROUTE_API "api"
+#define METRICS_ROUTE_GUI "gui"
+
+// Operations that requests spend their time waiting for
+typedef enum
+  {
+  METRICS_OP_DB_QUERY = 0,
+  METRICS_OP_XS_REQUEST,
+  METRICS_OP_COVER_LOOKUP,
+  METRICS_NOPS
+  } MetricsOp;
+
+BEGIN_DECLS
+
+/** Turn recording on or off. It starts off, in which case the cost of
+    each of the calls below is a test of a flag. */
+void      metrics_set_enabled (BOOL enabled);
+
+BOOL      metrics_enabled (void);
+
+/** Add a route that requests can be recorded against. kind is
+    METRICS_ROUTE_API or METRICS_ROUTE_GUI, and name is the function or
+    page name, which the caller must keep. Routes must be added before
+    the HTTP server starts; requests for any other name are recorded
+    against "other". */
+void      metrics_add_route (const char *kind, const char *name);
+
+/** Get the time at which something to be recorded starts, or zero if
+    recording is off. */
+int64_t   metrics_start (void);
+
+/** Record a request that began at start, as returned by metrics_start(),
+    and was answered with the HTTP status code. Does nothing if start is
+    zero. */
+void      metrics_record_request (const char *kind, const char *name,
+            int code, int64_t start);
+
+/** Record an operation that began at start. Does nothing if start is
+    zero. */
+void      metrics_record_op (MetricsOp op, int64_t start);
+
+/** Record an operation that took usec microseconds, for callers that
+    time it themselves. Does nothing if recording is off. */
+void      metrics_record_op_time (MetricsOp op, int64_t usec);
+
+/** Tell the metrics whether a scan is running, and how many files it
+    has examined so far. This is called regularly from the main loop,
+    and the files counted between calls are added to the scanner's
+    total. */
+void      metrics_sample_scanner (BOOL running, int scanned);
+
+/** Format everything recorded so far in the Prometheus text exposition
+    format. The caller must free the result. */
+char     *metrics_format (void);
+
+END_DECLS
+
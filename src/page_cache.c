@@ -0,0 +1,264 @@
+/*============================================================================
+
+  xine-server-x
+  page_cache.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Most pages of the web interface are made from the index, which only
+  changes when a scan runs, and most requests are for the same few
+  browse pages. This cache keeps rendered pages, keyed by the request
+  -- see request_handler_gui() -- up to a fixed total size. When it is
+  full, the least recently used pages are discarded.
+
+  Each page is stored with its entity tag, which includes the index
+  generation, or whatever else the page depends on -- see
+  request_handler_gui_etag(). A page whose tag no longer matches is
+  out of date, and is never returned. So the cache does not need to be
+  told when things change for it to be correct, although it is cleared
+  when a scan finishes, to make room for the new pages.
+
+  There will rarely be more than a few hundred pages, so they are kept
+  in a single list, most recently used first, and searched in order.
+  Comparing a hash of the key first makes the search cheap.
+
+============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "defs.h"
+#include "log.h"
+#include "page_cache.h"
+
+typedef struct _PageCacheEntry
+  {
+  struct _PageCacheEntry *prev;
+  struct _PageCacheEntry *next;
+  uint64_t hash;
+  char *key;
+  char *etag;
+  char *page;
+  size_t size; // Everything this entry accounts for
+  } PageCacheEntry;
+
+static pthread_mutex_t page_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PageCacheEntry *page_cache_head = NULL; // Most recently used
+static PageCacheEntry *page_cache_tail = NULL;
+static size_t page_cache_size = 0;
+static size_t page_cache_used = 0;
+
+/*==========================================================================
+
+  page_cache_hash
+
+==========================================================================*/
+static uint64_t page_cache_hash (const char *key)
+  {
+  uint64_t h = 14695981039346656037ULL;
+  for (const unsigned char *p = (const unsigned char *)key; *p; p++)
+    {
+    h ^= *p;
+    h *= 1099511628211ULL;
+    }
+  return h;
+  }
+
+/*==========================================================================
+
+  page_cache_unlink
+
+  Must be called with the mutex held
+
+==========================================================================*/
+static void page_cache_unlink (PageCacheEntry *e)
+  {
+  if (e->prev) e->prev->next = e->next; else page_cache_head = e->next;
+  if (e->next) e->next->prev = e->prev; else page_cache_tail = e->prev;
+  e->prev = e->next = NULL;
+  }
+
+/*==========================================================================
+
+  page_cache_push_front
+
+  Must be called with the mutex held
+
+==========================================================================*/
+static void page_cache_push_front (PageCacheEntry *e)
+  {
+  e->prev = NULL;
+  e->next = page_cache_head;
+  if (page_cache_head) page_cache_head->prev = e; else page_cache_tail = e;
+  page_cache_head = e;
+  }
+
+/*==========================================================================
+
+  page_cache_remove
+
+  Must be called with the mutex held
+
+==========================================================================*/
+static void page_cache_remove (PageCacheEntry *e)
+  {
+  page_cache_unlink (e);
+  page_cache_used -= e->size;
+  free (e->key);
+  free (e->etag);
+  free (e->page);
+  free (e);
+  }
+
+/*==========================================================================
+
+  page_cache_find
+
+  Must be called with the mutex held
+
+==========================================================================*/
+static PageCacheEntry *page_cache_find (const char *key, uint64_t hash)
+  {
+  for (PageCacheEntry *e = page_cache_head; e; e = e->next)
+    {
+    if (e->hash == hash && strcmp (e->key, key) == 0)
+      return e;
+    }
+  return NULL;
+  }
+
+/*==========================================================================
+
+  page_cache_trim
+
+  Discard the least recently used pages until the cache is within its
+  size. Must be called with the mutex held
+
+==========================================================================*/
+static void page_cache_trim (void)
+  {
+  while (page_cache_tail && page_cache_used > page_cache_size)
+    page_cache_remove (page_cache_tail);
+  }
+
+/*==========================================================================
+
+  page_cache_set_size
+
+==========================================================================*/
+void page_cache_set_size (size_t size)
+  {
+  LOG_IN
+  pthread_mutex_lock (&page_cache_mutex);
+  page_cache_size = size;
+  page_cache_trim ();
+  pthread_mutex_unlock (&page_cache_mutex);
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  page_cache_enabled
+
+==========================================================================*/
+BOOL page_cache_enabled (void)
+  {
+  pthread_mutex_lock (&page_cache_mutex);
+  BOOL ret = page_cache_size > 0;
+  pthread_mutex_unlock (&page_cache_mutex);
+  return ret;
+  }
+
+/*==========================================================================
+
+  page_cache_get
+
+==========================================================================*/
+char *page_cache_get (const char *key, const char *etag)
+  {
+  LOG_IN
+  char *ret = NULL;
+  uint64_t hash = page_cache_hash (key);
+  pthread_mutex_lock (&page_cache_mutex);
+  PageCacheEntry *e = page_cache_find (key, hash);
+  if (e)
+    {
+    if (strcmp (e->etag, etag) == 0)
+      {
+      page_cache_unlink (e);
+      page_cache_push_front (e);
+      ret = strdup (e->page);
+      }
+    else
+      page_cache_remove (e);
+    }
+  pthread_mutex_unlock (&page_cache_mutex);
+  log_debug ("Page cache %s: %s", ret ? "hit" : "miss", key);
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  page_cache_put
+
+  A single page may not take more than a quarter of the cache, so that
+  one huge directory listing can't push out everything else
+
+==========================================================================*/
+void page_cache_put (const char *key, const char *etag, const char *page)
+  {
+  LOG_IN
+  size_t size = sizeof (PageCacheEntry) + strlen (key) + strlen (etag)
+    + strlen (page) + 3;
+  uint64_t hash = page_cache_hash (key);
+  pthread_mutex_lock (&page_cache_mutex);
+  if (size <= page_cache_size / 4)
+    {
+    PageCacheEntry *e = page_cache_find (key, hash);
+    if (e) page_cache_remove (e);
+    e = malloc (sizeof (PageCacheEntry));
+    e->hash = hash;
+    e->key = strdup (key);
+    e->etag = strdup (etag);
+    e->page = strdup (page);
+    e->size = size;
+    page_cache_push_front (e);
+    page_cache_used += size;
+    page_cache_trim ();
+    }
+  pthread_mutex_unlock (&page_cache_mutex);
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  page_cache_clear
+
+==========================================================================*/
+void page_cache_clear (void)
+  {
+  LOG_IN
+  pthread_mutex_lock (&page_cache_mutex);
+  while (page_cache_head)
+    page_cache_remove (page_cache_head);
+  pthread_mutex_unlock (&page_cache_mutex);
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  page_cache_destroy
+
+==========================================================================*/
+void page_cache_destroy (void)
+  {
+  LOG_IN
+  page_cache_clear ();
+  pthread_mutex_lock (&page_cache_mutex);
+  page_cache_size = 0;
+  pthread_mutex_unlock (&page_cache_mutex);
+  LOG_OUT
+  }
+
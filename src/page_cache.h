@@ -0,0 +1,49 @@
+/*============================================================================
+
+  xine-server-x
+  page_cache.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  A cache of rendered pages, with a limit on the memory it uses, so that
+  the same browse pages need not be made from the index over and over
+  again. See page_cache.c for details.
+
+============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include "defs.h"
+
+// Default size of the cache, in kilobytes
+#define PAGE_CACHE_DEF_SIZE 4096
+
+BEGIN_DECLS
+
+/** Set the most memory, in bytes, that the cached pages may use. Zero
+    turns the cache off, which is how it starts. Reducing the size
+    discards pages as necessary. */
+void      page_cache_set_size (size_t size);
+
+/** Returns TRUE if the cache has a non-zero size. */
+BOOL      page_cache_enabled (void);
+
+/** Get a copy of the page cached under key, which the caller must free,
+    or NULL if there is none. etag is the entity tag of the page as it
+    is now. If the cached page has a different tag, it is out of date,
+    and is discarded. */
+char     *page_cache_get (const char *key, const char *etag);
+
+/** Add a page to the cache, replacing any page with the same key. The
+    cache takes a copy. Pages too big to be worth caching are ignored. */
+void      page_cache_put (const char *key, const char *etag,
+            const char *page);
+
+/** Discard all the cached pages. */
+void      page_cache_clear (void);
+
+/** Free the cache's memory, at shutdown. */
+void      page_cache_destroy (void);
+
+END_DECLS
+
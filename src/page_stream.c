@@ -0,0 +1,316 @@
+/*============================================================================
+
+  xine-server-x
+  page_stream.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  A page that is made as it is sent. Pages such as the file list of a
+  large directory, or an unlimited track list, are mostly made of a
+  long run of cells, each of which is cheap to make on its own, but
+  which together can take a long time and a lot of memory. So such a
+  page is described as a sequence of parts -- fixed text, such as the
+  head and foot of a template, and runs of items, which are made by a
+  callback when they are needed.
+
+  page_stream_read() makes the page a batch of about PAGE_STREAM_BATCH
+  bytes at a time, so the client gets the start of the page at once,
+  and no more than one batch is held in memory at a time, whatever the
+  size of the page. The page may also be compressed as it is read, in
+  which case each batch is flushed from the compressor as it is
+  made, so that the client can display it without waiting for more.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "defs.h"
+#include "log.h"
+#include "page_stream.h"
+
+typedef struct _PageStreamPart
+  {
+  char *text; // NULL for a run of items
+  int count;
+  PageStreamItemFn fn;
+  void *data;
+  PageStreamFreeFn free_fn;
+  } PageStreamPart;
+
+struct _PageStream
+  {
+  PageStreamPart *parts;
+  int nparts;
+  int part;     // The part being made
+  int item;     // The next item of that part
+  String *batch;
+  size_t batch_pos; // How much of the batch has been read
+  BOOL gzip;
+  BOOL input_done;
+  BOOL finished;
+  z_stream zs;
+  };
+
+/*==========================================================================
+
+  page_stream_create
+
+==========================================================================*/
+PageStream *page_stream_create (void)
+  {
+  LOG_IN
+  PageStream *self = malloc (sizeof (PageStream));
+  memset (self, 0, sizeof (PageStream));
+  self->batch = string_create_empty ();
+  LOG_OUT
+  return self;
+  }
+
+/*==========================================================================
+
+  page_stream_destroy
+
+==========================================================================*/
+void page_stream_destroy (PageStream *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    for (int i = 0; i < self->nparts; i++)
+      {
+      PageStreamPart *part = &self->parts[i];
+      free (part->text);
+      if (part->free_fn) part->free_fn (part->data);
+      }
+    free (self->parts);
+    string_destroy (self->batch);
+    if (self->gzip) deflateEnd (&self->zs);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  page_stream_add_part
+
+==========================================================================*/
+static PageStreamPart *page_stream_add_part (PageStream *self)
+  {
+  self->parts = realloc (self->parts,
+    (self->nparts + 1) * sizeof (PageStreamPart));
+  PageStreamPart *part = &self->parts[self->nparts++];
+  memset (part, 0, sizeof (PageStreamPart));
+  return part;
+  }
+
+/*==========================================================================
+
+  page_stream_add_text_len
+
+==========================================================================*/
+void page_stream_add_text_len (PageStream *self, const char *text,
+       size_t len)
+  {
+  LOG_IN
+  if (len > 0)
+    {
+    PageStreamPart *part = page_stream_add_part (self);
+    part->text = strndup (text, len);
+    }
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  page_stream_add_text
+
+==========================================================================*/
+void page_stream_add_text (PageStream *self, const char *text)
+  {
+  page_stream_add_text_len (self, text, strlen (text));
+  }
+
+/*==========================================================================
+
+  page_stream_add_text_until
+
+==========================================================================*/
+const char *page_stream_add_text_until (PageStream *self, const char *text,
+       const char *placeholder)
+  {
+  LOG_IN
+  char *pl;
+  asprintf (&pl, "%%%%%s%%%%", placeholder);
+  const char *ret;
+  const char *p = strstr (text, pl);
+  if (p)
+    {
+    page_stream_add_text_len (self, text, p - text);
+    ret = p + strlen (pl);
+    }
+  else
+    {
+    page_stream_add_text (self, text);
+    ret = text + strlen (text);
+    }
+  free (pl);
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  page_stream_add_items
+
+==========================================================================*/
+void page_stream_add_items (PageStream *self, int count,
+       PageStreamItemFn fn, void *data, PageStreamFreeFn free_fn)
+  {
+  LOG_IN
+  PageStreamPart *part = page_stream_add_part (self);
+  part->count = count;
+  part->fn = fn;
+  part->data = data;
+  part->free_fn = free_fn;
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  page_stream_set_gzip
+
+==========================================================================*/
+BOOL page_stream_set_gzip (PageStream *self, int level)
+  {
+  LOG_IN
+  if (!self->gzip)
+    {
+    memset (&self->zs, 0, sizeof (z_stream));
+    // 16 + MAX_WBITS selects a gzip header, rather than zlib
+    if (deflateInit2 (&self->zs, level, Z_DEFLATED, 16 + MAX_WBITS, 8,
+          Z_DEFAULT_STRATEGY) == Z_OK)
+      self->gzip = TRUE;
+    else
+      log_warning ("Can't initialize gzip stream");
+    }
+  LOG_OUT
+  return self->gzip;
+  }
+
+/*==========================================================================
+
+  page_stream_refill
+
+  Make the next batch of the page. The batch is empty only when the
+  page is complete
+
+==========================================================================*/
+static void page_stream_refill (PageStream *self)
+  {
+  string_destroy (self->batch);
+  self->batch = string_create_empty ();
+  self->batch_pos = 0;
+  while (self->part < self->nparts
+      && string_length (self->batch) < PAGE_STREAM_BATCH)
+    {
+    PageStreamPart *part = &self->parts[self->part];
+    if (part->text)
+      {
+      string_append (self->batch, part->text);
+      self->part++;
+      }
+    else if (self->item < part->count)
+      {
+      part->fn (part->data, self->item, self->batch);
+      self->item++;
+      }
+    else
+      {
+      self->part++;
+      self->item = 0;
+      }
+    }
+  }
+
+/*==========================================================================
+
+  page_stream_read_gzip
+
+  Each batch is compressed with Z_SYNC_FLUSH, so that everything made
+  so far can be sent. At the end, Z_FINISH writes the gzip trailer
+
+==========================================================================*/
+static ssize_t page_stream_read_gzip (PageStream *self, char *buf,
+       size_t max)
+  {
+  self->zs.next_out = (Bytef *)buf;
+  self->zs.avail_out = max;
+  while (!self->finished && self->zs.avail_out == max)
+    {
+    if (self->zs.avail_in == 0 && !self->input_done)
+      {
+      page_stream_refill (self);
+      int len = string_length (self->batch);
+      if (len == 0)
+        self->input_done = TRUE;
+      self->zs.next_in = (Bytef *)string_cstr (self->batch);
+      self->zs.avail_in = len;
+      }
+    int rc = deflate (&self->zs, self->input_done ? Z_FINISH : Z_SYNC_FLUSH);
+    if (rc == Z_STREAM_END)
+      self->finished = TRUE;
+    else if (rc != Z_OK && rc != Z_BUF_ERROR)
+      {
+      log_warning ("gzip stream failed: %d", rc);
+      return -1;
+      }
+    }
+  return max - self->zs.avail_out;
+  }
+
+/*==========================================================================
+
+  page_stream_read
+
+==========================================================================*/
+ssize_t page_stream_read (PageStream *self, char *buf, size_t max)
+  {
+  LOG_IN
+  ssize_t ret = 0;
+  if (self->gzip)
+    ret = page_stream_read_gzip (self, buf, max);
+  else
+    {
+    if (self->batch_pos == (size_t)string_length (self->batch))
+      page_stream_refill (self);
+    size_t n = string_length (self->batch) - self->batch_pos;
+    if (n > max) n = max;
+    memcpy (buf, string_cstr (self->batch) + self->batch_pos, n);
+    self->batch_pos += n;
+    ret = n;
+    }
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  page_stream_read_all
+
+==========================================================================*/
+char *page_stream_read_all (PageStream *self)
+  {
+  LOG_IN
+  String *page = string_create_empty ();
+  for (page_stream_refill (self); string_length (self->batch) > 0;
+      page_stream_refill (self))
+    string_append (page, string_cstr (self->batch));
+  char *ret = strdup (string_cstr (page));
+  string_destroy (page);
+  LOG_OUT
+  return ret;
+  }
+
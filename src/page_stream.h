@@ -0,0 +1,73 @@
+/*============================================================================
+
+  xine-server-x
+  page_stream.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  A page that is made as it is sent, rather than all at once, so that
+  long lists need not be held in memory in full. See page_stream.c for
+  details.
+
+============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "defs.h"
+#include "string.h"
+
+// The page is made in batches of about this many bytes
+#define PAGE_STREAM_BATCH (16 * 1024)
+
+struct _PageStream;
+typedef struct _PageStream PageStream;
+
+// Append the HTML for item number index to out
+typedef void (*PageStreamItemFn) (void *data, int index, String *out);
+// Free the data passed to page_stream_add_items()
+typedef void (*PageStreamFreeFn) (void *data);
+
+BEGIN_DECLS
+
+PageStream  *page_stream_create (void);
+
+void         page_stream_destroy (PageStream *self);
+
+/** Add fixed text to the page. The stream takes a copy. */
+void         page_stream_add_text (PageStream *self, const char *text);
+
+/** Add text to the page, up to len bytes of it. */
+void         page_stream_add_text_len (PageStream *self, const char *text,
+               size_t len);
+
+/** Add text to the page up to the template placeholder %%name%%, and
+    return a pointer to the text after the placeholder, so that whatever
+    replaces it can be added next. If there is no such placeholder, all
+    the text is added, and the return value points to its end. */
+const char  *page_stream_add_text_until (PageStream *self, const char *text,
+               const char *placeholder);
+
+/** Add count items to the page, each of which will be made by calling
+    fn, in order, when it is needed. free_fn, if it is not NULL, is
+    called on data when the stream is destroyed. */
+void         page_stream_add_items (PageStream *self, int count,
+               PageStreamItemFn fn, void *data, PageStreamFreeFn free_fn);
+
+/** Compress the page with gzip as it is read. This must be called
+    before the first page_stream_read(). Returns FALSE if the compressor
+    could not be set up, in which case the page will not be compressed. */
+BOOL         page_stream_set_gzip (PageStream *self, int level);
+
+/** Read up to max bytes of the page into buf. Returns the number of
+    bytes read, which is zero only at the end of the page, or -1 if the
+    page could not be compressed. */
+ssize_t      page_stream_read (PageStream *self, char *buf, size_t max);
+
+/** Make the whole page at once, for a caller that needs it in memory.
+    The caller must free the result. This can't be used on a stream that
+    is being compressed, or has been partly read. */
+char        *page_stream_read_all (PageStream *self);
+
+END_DECLS
+
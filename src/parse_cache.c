@@ -0,0 +1,728 @@
+/*============================================================================
+
+  xine-server-x
+  parse_cache.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  The parse cache is a single file, which is memory-mapped. It has
+  three parts: a header, a hash table of fixed-size slots, and a heap
+  of variable-length records. Each slot holds a key -- the device,
+  inode, size and modification time of an audio file -- and the offset
+  of that file's record in the heap. A record is a small fixed header
+  holding the stream properties, followed by the eight common tags as
+  consecutive null-terminated strings.
+
+  The hash table uses linear probing. There are no deletions, except
+  by parse_cache_compact(), which rewrites the whole file. When the
+  table gets half full, or the heap runs out of space, the file is
+  rewritten at double the size. Rewriting is done to a new file, which
+  is then renamed over the old one, so the cache is never left
+  half-rewritten.
+
+  The header has a 'clean' flag, which is cleared when the file is
+  opened and set when it is closed. A cache that was not closed
+  cleanly -- because the scanner crashed, for example -- is not
+  trusted, and is discarded. The cache is only a performance
+  optimization, so the worst effect of losing it is a slow scan.
+
+  The header also records the version of the tag reader that filled
+  the cache. Since a record is found only by the file's identity, a
+  cache filled by a different version, which might have read the file
+  differently, is discarded.
+
+  Only one process may have the cache open at a time; this is
+  enforced using flock().
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include "string.h"
+#include "defs.h"
+#include "log.h"
+#include "tag_reader.h"
+#include "parse_cache.h"
+
+#define PARSE_CACHE_MAGIC "XSXPCACH"
+#define PARSE_CACHE_VERSION 1
+#define PARSE_CACHE_HEADER_SIZE 64
+#define PARSE_CACHE_INITIAL_SLOTS 4096
+#define PARSE_CACHE_INITIAL_DATA (256 * 1024)
+// Records hold four int32 stream properties and a flags word
+#define PARSE_CACHE_RECORD_HEADER 20
+#define PARSE_CACHE_RECORD_STRINGS 8
+
+#define PARSE_CACHE_FLAG_TAGS  0x0001
+#define PARSE_CACHE_FLAG_COVER 0x0002
+
+typedef struct _ParseCacheHeader
+  {
+  char magic[8];
+  uint32_t version;
+  uint32_t clean;
+  uint32_t nslots;
+  uint32_t nentries;
+  uint32_t generation;
+  uint32_t reader_version; // TAG_READER_VERSION of the reader that filled it
+  uint64_t data_used;
+  uint64_t data_cap;
+  } ParseCacheHeader;
+
+typedef struct _ParseCacheSlot
+  {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  uint64_t mtime; // nsec
+  uint64_t data_off;
+  uint32_t data_len; // Zero for an empty slot
+  uint32_t generation;
+  } ParseCacheSlot;
+
+struct _ParseCache
+  {
+  char *file;
+  int fd;
+  BYTE *map;
+  size_t map_len;
+  ParseCacheHeader *header;
+  ParseCacheSlot *slots;
+  BYTE *data;
+  int hits;
+  int misses;
+  };
+
+/*==========================================================================
+
+  parse_cache_create
+
+*==========================================================================*/
+ParseCache *parse_cache_create (const char *file)
+  {
+  LOG_IN
+  ParseCache *self = malloc (sizeof (ParseCache));
+  self->file = strdup (file);
+  self->fd = -1;
+  self->map = NULL;
+  self->map_len = 0;
+  self->header = NULL;
+  self->slots = NULL;
+  self->data = NULL;
+  self->hits = 0;
+  self->misses = 0;
+  LOG_OUT
+  return self;
+  }
+
+/*==========================================================================
+
+  parse_cache_destroy
+
+*==========================================================================*/
+void parse_cache_destroy (ParseCache *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    parse_cache_close (self);
+    if (self->file) free (self->file);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  parse_cache_file_size
+
+  The total size of a cache file with the specified dimensions
+
+*==========================================================================*/
+static size_t parse_cache_file_size (uint32_t nslots, uint64_t data_cap)
+  {
+  return PARSE_CACHE_HEADER_SIZE + (size_t)nslots * sizeof (ParseCacheSlot)
+    + data_cap;
+  }
+
+/*==========================================================================
+
+  parse_cache_set_map
+
+  Point the header, slot and data pointers into a new mapping
+
+*==========================================================================*/
+static void parse_cache_set_map (ParseCache *self, int fd, BYTE *map,
+    size_t map_len)
+  {
+  self->fd = fd;
+  self->map = map;
+  self->map_len = map_len;
+  self->header = (ParseCacheHeader *)map;
+  self->slots = (ParseCacheSlot *)(map + PARSE_CACHE_HEADER_SIZE);
+  self->data = map + PARSE_CACHE_HEADER_SIZE
+    + (size_t)self->header->nslots * sizeof (ParseCacheSlot);
+  }
+
+/*==========================================================================
+
+  parse_cache_unmap
+
+*==========================================================================*/
+static void parse_cache_unmap (ParseCache *self)
+  {
+  if (self->map) munmap (self->map, self->map_len);
+  if (self->fd >= 0) close (self->fd); // Also releases the lock
+  self->fd = -1;
+  self->map = NULL;
+  self->map_len = 0;
+  self->header = NULL;
+  self->slots = NULL;
+  self->data = NULL;
+  }
+
+/*==========================================================================
+
+  parse_cache_init_file
+
+  Size an open file for the specified dimensions, map it, and write an
+  empty header. The file's existing contents are discarded. Returns
+  the mapping, or NULL on error.
+
+*==========================================================================*/
+static BYTE *parse_cache_init_file (int fd, uint32_t nslots,
+    uint64_t data_cap, uint32_t generation, char **error)
+  {
+  size_t len = parse_cache_file_size (nslots, data_cap);
+  if (ftruncate (fd, 0) != 0 || ftruncate (fd, len) != 0)
+    {
+    asprintf (error, "Can't resize parse cache: %s", strerror (errno));
+    return NULL;
+    }
+  BYTE *map = mmap (NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    {
+    asprintf (error, "Can't map parse cache: %s", strerror (errno));
+    return NULL;
+    }
+  // ftruncate() has zeroed the file, so all slots are already empty
+  ParseCacheHeader *header = (ParseCacheHeader *)map;
+  memcpy (header->magic, PARSE_CACHE_MAGIC, sizeof (header->magic));
+  header->version = PARSE_CACHE_VERSION;
+  header->clean = 0;
+  header->nslots = nslots;
+  header->nentries = 0;
+  header->generation = generation;
+  header->reader_version = TAG_READER_VERSION;
+  header->data_used = 0;
+  header->data_cap = data_cap;
+  return map;
+  }
+
+/*==========================================================================
+
+  parse_cache_hash
+
+*==========================================================================*/
+static uint64_t parse_cache_hash (uint64_t dev, uint64_t ino, uint64_t size,
+    uint64_t mtime)
+  {
+  uint64_t h = ino;
+  h = (h ^ dev) * 0x9e3779b97f4a7c15ULL;
+  h = (h ^ size) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ mtime) * 0x94d049bb133111ebULL;
+  return h ^ (h >> 31);
+  }
+
+/*==========================================================================
+
+  parse_cache_find_slot
+
+  Returns the slot that holds the key, or the empty slot where it
+  should be inserted. The table is never allowed to get more than half
+  full, so NULL is only returned if the file has been damaged.
+
+*==========================================================================*/
+static ParseCacheSlot *parse_cache_find_slot (ParseCacheSlot *slots,
+    uint32_t nslots, uint64_t dev, uint64_t ino, uint64_t size,
+    uint64_t mtime)
+  {
+  uint32_t mask = nslots - 1;
+  uint32_t i = parse_cache_hash (dev, ino, size, mtime) & mask;
+  for (uint32_t n = 0; n < nslots; n++)
+    {
+    ParseCacheSlot *slot = &slots[i];
+    if (slot->data_len == 0) return slot;
+    if (slot->ino == ino && slot->dev == dev && slot->size == size
+         && slot->mtime == mtime)
+      return slot;
+    i = (i + 1) & mask;
+    }
+  return NULL;
+  }
+
+/*==========================================================================
+
+  parse_cache_key
+
+*==========================================================================*/
+static void parse_cache_key (const struct stat *sb, uint64_t *dev,
+    uint64_t *ino, uint64_t *size, uint64_t *mtime)
+  {
+  *dev = sb->st_dev;
+  *ino = sb->st_ino;
+  *size = sb->st_size;
+  *mtime = (uint64_t)sb->st_mtim.tv_sec * 1000000000ULL
+    + sb->st_mtim.tv_nsec;
+  }
+
+/*==========================================================================
+
+  parse_cache_rebuild
+
+  Write a new cache file with the specified dimensions, copy the
+  entries into it, and replace the current file with it. If
+  current_only is set, only entries used since the cache was opened
+  are copied.
+
+*==========================================================================*/
+static BOOL parse_cache_rebuild (ParseCache *self, uint32_t nslots,
+    uint64_t data_cap, BOOL current_only, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  char *newfile;
+  asprintf (&newfile, "%s.new", self->file);
+  int fd = open (newfile, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd >= 0)
+    {
+    flock (fd, LOCK_EX | LOCK_NB);
+    uint32_t generation = self->header->generation;
+    BYTE *map = parse_cache_init_file (fd, nslots, data_cap,
+      generation, error);
+    if (map)
+      {
+      ParseCacheHeader *header = (ParseCacheHeader *)map;
+      ParseCacheSlot *slots = (ParseCacheSlot *)
+        (map + PARSE_CACHE_HEADER_SIZE);
+      BYTE *data = map + PARSE_CACHE_HEADER_SIZE
+        + (size_t)nslots * sizeof (ParseCacheSlot);
+
+      for (uint32_t i = 0; i < self->header->nslots; i++)
+        {
+        const ParseCacheSlot *old = &self->slots[i];
+        if (old->data_len == 0) continue;
+        if (current_only && old->generation != generation) continue;
+        ParseCacheSlot *slot = parse_cache_find_slot (slots, nslots,
+          old->dev, old->ino, old->size, old->mtime);
+        *slot = *old;
+        slot->data_off = header->data_used;
+        memcpy (data + header->data_used, self->data + old->data_off,
+          old->data_len);
+        header->data_used += old->data_len;
+        header->nentries++;
+        }
+
+      if (rename (newfile, self->file) == 0)
+        {
+        log_debug ("Rebuilt parse cache: %u slots, %lu bytes, %u entries",
+          nslots, (unsigned long)data_cap, header->nentries);
+        parse_cache_unmap (self);
+        parse_cache_set_map (self, fd, map,
+          parse_cache_file_size (nslots, data_cap));
+        ret = TRUE;
+        }
+      else
+        {
+        asprintf (error, "Can't rename %s: %s", newfile, strerror (errno));
+        munmap (map, parse_cache_file_size (nslots, data_cap));
+        }
+      }
+    if (!ret)
+      {
+      close (fd);
+      unlink (newfile);
+      }
+    }
+  else
+    asprintf (error, "Can't open %s: %s", newfile, strerror (errno));
+
+  free (newfile);
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  parse_cache_validate
+
+  Check that the header of a mapped file is plausible
+
+*==========================================================================*/
+static BOOL parse_cache_validate (const BYTE *map, size_t len)
+  {
+  if (len < PARSE_CACHE_HEADER_SIZE) return FALSE;
+  const ParseCacheHeader *header = (const ParseCacheHeader *)map;
+  if (memcmp (header->magic, PARSE_CACHE_MAGIC, sizeof (header->magic)))
+    return FALSE;
+  if (header->version != PARSE_CACHE_VERSION) return FALSE;
+  if (!header->clean) return FALSE;
+  if (header->nslots == 0 || (header->nslots & (header->nslots - 1)))
+    return FALSE;
+  if (header->nentries >= header->nslots) return FALSE;
+  if (header->data_used > header->data_cap) return FALSE;
+  if (parse_cache_file_size (header->nslots, header->data_cap) != len)
+    return FALSE;
+  return TRUE;
+  }
+
+/*==========================================================================
+
+  parse_cache_open
+
+*==========================================================================*/
+BOOL parse_cache_open (ParseCache *self, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  parse_cache_close (self);
+
+  int fd = open (self->file, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd >= 0)
+    {
+    if (flock (fd, LOCK_EX | LOCK_NB) == 0)
+      {
+      struct stat sb;
+      BYTE *map = NULL;
+      size_t len = 0;
+      if (fstat (fd, &sb) == 0 && sb.st_size > 0)
+        {
+        len = sb.st_size;
+        map = mmap (NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+          map = NULL;
+        else if (!parse_cache_validate (map, len))
+          {
+          log_warning ("Parse cache %s is damaged or was not closed "
+            "cleanly -- starting a new one", self->file);
+          munmap (map, len);
+          map = NULL;
+          }
+        else if (((ParseCacheHeader *)map)->reader_version 
+            != TAG_READER_VERSION)
+          {
+          log_info ("Parse cache %s was filled by a different version of "
+            "the tag reader -- starting a new one", self->file);
+          munmap (map, len);
+          map = NULL;
+          }
+        }
+
+      if (!map)
+        {
+        len = parse_cache_file_size (PARSE_CACHE_INITIAL_SLOTS,
+          PARSE_CACHE_INITIAL_DATA);
+        map = parse_cache_init_file (fd, PARSE_CACHE_INITIAL_SLOTS,
+          PARSE_CACHE_INITIAL_DATA, 0, error);
+        }
+
+      if (map)
+        {
+        parse_cache_set_map (self, fd, map, len);
+        // Until the file is closed, it isn't trustworthy. Make sure that
+        //  this is on disk before anything else is written
+        self->header->clean = 0;
+        self->header->generation++;
+        msync (self->map, PARSE_CACHE_HEADER_SIZE, MS_SYNC);
+        log_debug ("Opened parse cache %s: %u entries", self->file,
+          self->header->nentries);
+        ret = TRUE;
+        }
+      else
+        close (fd);
+      }
+    else
+      {
+      asprintf (error, "Parse cache %s is in use", self->file);
+      close (fd);
+      }
+    }
+  else
+    asprintf (error, "Can't open parse cache %s: %s", self->file,
+      strerror (errno));
+
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  parse_cache_close
+
+*==========================================================================*/
+void parse_cache_close (ParseCache *self)
+  {
+  LOG_IN
+  if (self->map)
+    {
+    msync (self->map, self->map_len, MS_SYNC);
+    self->header->clean = 1;
+    msync (self->map, PARSE_CACHE_HEADER_SIZE, MS_SYNC);
+    }
+  parse_cache_unmap (self);
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  parse_cache_lookup
+
+*==========================================================================*/
+BOOL parse_cache_lookup (ParseCache *self, const struct stat *sb,
+      ParseCacheEntry *entry)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  if (self->map)
+    {
+    uint64_t dev, ino, size, mtime;
+    parse_cache_key (sb, &dev, &ino, &size, &mtime);
+    ParseCacheSlot *slot = parse_cache_find_slot (self->slots,
+      self->header->nslots, dev, ino, size, mtime);
+    if (slot && slot->data_len >= PARSE_CACHE_RECORD_HEADER
+         && slot->data_off + slot->data_len <= self->header->data_used)
+      {
+      const char *p = (const char *)self->data + slot->data_off;
+      const char *end = p + slot->data_len;
+      uint32_t flags;
+      int32_t props[4];
+      memcpy (&flags, p, sizeof (flags));
+      memcpy (props, p + sizeof (flags), sizeof (props));
+      p += PARSE_CACHE_RECORD_HEADER;
+
+      const char *strings[PARSE_CACHE_RECORD_STRINGS];
+      int i;
+      for (i = 0; i < PARSE_CACHE_RECORD_STRINGS; i++)
+        {
+        const char *nul = memchr (p, 0, end - p);
+        if (!nul) break;
+        strings[i] = p;
+        p = nul + 1;
+        }
+
+      if (i == PARSE_CACHE_RECORD_STRINGS)
+        {
+        BOOL has_tags = (flags & PARSE_CACHE_FLAG_TAGS) != 0;
+        entry->has_tags = has_tags;
+        entry->has_cover = (flags & PARSE_CACHE_FLAG_COVER) != 0;
+        entry->duration = props[0];
+        entry->bitrate = props[1];
+        entry->sample_rate = props[2];
+        entry->channels = props[3];
+        entry->title = has_tags ? strings[0] : NULL;
+        entry->album = has_tags ? strings[1] : NULL;
+        entry->genre = has_tags ? strings[2] : NULL;
+        entry->composer = has_tags ? strings[3] : NULL;
+        entry->artist = has_tags ? strings[4] : NULL;
+        entry->track = has_tags ? strings[5] : NULL;
+        entry->comment = has_tags ? strings[6] : NULL;
+        entry->year = has_tags ? strings[7] : NULL;
+        slot->generation = self->header->generation;
+        ret = TRUE;
+        }
+      }
+    }
+  if (ret)
+    self->hits++;
+  else
+    self->misses++;
+  LOG_OUT
+  return ret;
+  }
+
+#define SAFE(x) (x != NULL ? (x) : "")
+
+/*==========================================================================
+
+  parse_cache_insert
+
+*==========================================================================*/
+BOOL parse_cache_insert (ParseCache *self, const struct stat *sb,
+      const ParseCacheEntry *entry)
+  {
+  LOG_IN
+  if (!self->map)
+    {
+    LOG_OUT
+    return FALSE;
+    }
+
+  const char *strings[PARSE_CACHE_RECORD_STRINGS] =
+    {
+    SAFE (entry->title), SAFE (entry->album), SAFE (entry->genre),
+    SAFE (entry->composer), SAFE (entry->artist), SAFE (entry->track),
+    SAFE (entry->comment), SAFE (entry->year)
+    };
+  size_t lens[PARSE_CACHE_RECORD_STRINGS];
+  size_t len = PARSE_CACHE_RECORD_HEADER;
+  for (int i = 0; i < PARSE_CACHE_RECORD_STRINGS; i++)
+    {
+    lens[i] = strlen (strings[i]) + 1;
+    len += lens[i];
+    }
+  if (len > UINT32_MAX)
+    {
+    LOG_OUT
+    return FALSE;
+    }
+
+  ParseCacheHeader *header = self->header;
+  BOOL ok = TRUE;
+  char *error = NULL;
+  if ((header->nentries + 1) * 2 > header->nslots)
+    {
+    ok = parse_cache_rebuild (self, header->nslots * 2, header->data_cap,
+      FALSE, &error);
+    header = self->header; // The rebuild may have moved everything
+    }
+  if (ok && header->data_used + len > header->data_cap)
+    {
+    uint64_t data_cap = header->data_cap * 2;
+    while (header->data_used + len > data_cap) data_cap *= 2;
+    ok = parse_cache_rebuild (self, header->nslots, data_cap, FALSE, &error);
+    header = self->header;
+    }
+
+  ParseCacheSlot *slot = NULL;
+  uint64_t dev, ino, size, mtime;
+  if (ok)
+    {
+    parse_cache_key (sb, &dev, &ino, &size, &mtime);
+    slot = parse_cache_find_slot (self->slots, header->nslots, dev, ino,
+      size, mtime);
+    if (!slot) asprintf (&error, "hash table is full");
+    }
+
+  if (slot)
+    {
+    BYTE *p = self->data + header->data_used;
+    uint32_t flags = 0;
+    if (entry->has_tags) flags |= PARSE_CACHE_FLAG_TAGS;
+    if (entry->has_cover) flags |= PARSE_CACHE_FLAG_COVER;
+    int32_t props[4] = { entry->duration, entry->bitrate,
+      entry->sample_rate, entry->channels };
+    memcpy (p, &flags, sizeof (flags));
+    memcpy (p + sizeof (flags), props, sizeof (props));
+    p += PARSE_CACHE_RECORD_HEADER;
+    for (int i = 0; i < PARSE_CACHE_RECORD_STRINGS; i++)
+      {
+      memcpy (p, strings[i], lens[i]);
+      p += lens[i];
+      }
+
+    // If the key is already present, the slot is reused, and its old
+    //   record is left as garbage until the next compaction
+    if (slot->data_len == 0) header->nentries++;
+    slot->dev = dev;
+    slot->ino = ino;
+    slot->size = size;
+    slot->mtime = mtime;
+    slot->data_off = header->data_used;
+    slot->data_len = len;
+    slot->generation = header->generation;
+    header->data_used += len;
+    }
+  else
+    {
+    log_warning ("Can't add to parse cache: %s", error);
+    free (error);
+    }
+
+  LOG_OUT
+  return slot != NULL;
+  }
+
+/*==========================================================================
+
+  parse_cache_compact
+
+*==========================================================================*/
+BOOL parse_cache_compact (ParseCache *self)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  if (self->map)
+    {
+    ParseCacheHeader *header = self->header;
+    uint32_t live = 0;
+    uint64_t live_data = 0;
+    for (uint32_t i = 0; i < header->nslots; i++)
+      {
+      const ParseCacheSlot *slot = &self->slots[i];
+      if (slot->data_len && slot->generation == header->generation)
+        {
+        live++;
+        live_data += slot->data_len;
+        }
+      }
+
+    if (live == header->nentries && live_data == header->data_used)
+      ret = TRUE; // Nothing to remove
+    else
+      {
+      uint32_t nslots = PARSE_CACHE_INITIAL_SLOTS;
+      while ((uint64_t)live * 4 > nslots) nslots *= 2;
+      uint64_t data_cap = PARSE_CACHE_INITIAL_DATA;
+      while (live_data + live_data / 2 > data_cap) data_cap *= 2;
+      log_debug ("Compacting parse cache: %u of %u entries in use",
+        live, header->nentries);
+      char *error = NULL;
+      ret = parse_cache_rebuild (self, nslots, data_cap, TRUE, &error);
+      if (!ret)
+        {
+        log_warning ("Can't compact parse cache: %s", error);
+        free (error);
+        }
+      }
+    }
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  parse_cache_get_hits
+
+*==========================================================================*/
+int parse_cache_get_hits (const ParseCache *self)
+  {
+  return self->hits;
+  }
+
+/*==========================================================================
+
+  parse_cache_get_misses
+
+*==========================================================================*/
+int parse_cache_get_misses (const ParseCache *self)
+  {
+  return self->misses;
+  }
+
+/*==========================================================================
+
+  parse_cache_get_entries
+
+*==========================================================================*/
+int parse_cache_get_entries (const ParseCache *self)
+  {
+  return self->header ? (int)self->header->nentries : 0;
+  }
@@ -0,0 +1,81 @@
+/*============================================================================
+
+  xine-server-x
+  parse_cache.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  A persistent cache of the results of parsing audio files, so that the
+  scanner does not have to open files it has seen before. See
+  parse_cache.c for the file format.
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include "defs.h"
+
+struct _ParseCache;
+typedef struct _ParseCache ParseCache;
+
+/** The information stored for one audio file. In an entry returned by
+    parse_cache_lookup(), the strings point into the cache itself, and
+    remain valid only until the next call to parse_cache_insert() or
+    parse_cache_compact(). If has_tags is FALSE, the tag reader could
+    not read the file, and the strings are NULL. */
+typedef struct _ParseCacheEntry
+  {
+  BOOL has_tags;
+  /** TRUE if the file contains a cover image. The image itself is not
+      cached */
+  BOOL has_cover;
+  int duration;
+  int bitrate;
+  int sample_rate;
+  int channels;
+  const char *title;
+  const char *album;
+  const char *genre;
+  const char *composer;
+  const char *artist;
+  const char *track;
+  const char *comment;
+  const char *year;
+  } ParseCacheEntry;
+
+BEGIN_DECLS
+
+ParseCache *parse_cache_create (const char *file);
+
+void        parse_cache_destroy (ParseCache *self);
+
+/** Open the cache file, creating it if necessary. A file that is
+    damaged, or was not closed cleanly, is discarded and a new one
+    started. The file stays locked until parse_cache_close() is called;
+    this fails if another process already has it open. */
+BOOL        parse_cache_open (ParseCache *self, char **error);
+
+void        parse_cache_close (ParseCache *self);
+
+/** Look up the file described by sb, which should come from stat().
+    Entries are keyed on device, inode, size and modification time, so
+    any change to the file makes its old entry unreachable. */
+BOOL        parse_cache_lookup (ParseCache *self, const struct stat *sb,
+              ParseCacheEntry *entry);
+
+BOOL        parse_cache_insert (ParseCache *self, const struct stat *sb,
+              const ParseCacheEntry *entry);
+
+/** Remove all entries that have not been looked up or inserted since
+    the cache was opened. This should only be called after a full
+    scan, which will have visited every file that still exists. */
+BOOL        parse_cache_compact (ParseCache *self);
+
+int         parse_cache_get_hits (const ParseCache *self);
+
+int         parse_cache_get_misses (const ParseCache *self);
+
+int         parse_cache_get_entries (const ParseCache *self);
+
+END_DECLS
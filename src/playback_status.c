@@ -21,6 +21,7 @@ struct _PlaybackStatus
   int playlist_index;
   int playlist_length;
   int bitrate;
+  int volume;
   BOOL seekable;
   XSXTransportStatus ts;
   char *composer;
@@ -46,6 +47,7 @@ PlaybackStatus *playback_status_create (void)
   self->playlist_length = -1;
   self->ts = XINESERVER_X_TRANSPORT_STOPPED;
   self->bitrate = 0;
+  self->volume = -1;
   self->seekable = FALSE;
   self->composer = NULL;
   self->album = NULL;
@@ -384,5 +386,28 @@ void playback_status_set_ts (PlaybackStatus *self, XSXTransportStatus value)
   LOG_OUT 
   }
 
+/*==========================================================================
+
+  playback_status_get_volume
+
+*==========================================================================*/
+int playback_status_get_volume (const PlaybackStatus *self)
+  {
+  LOG_IN
+  int ret = self->volume;
+  LOG_OUT 
+  return ret;
+  }
 
+/*==========================================================================
+
+  playback_status_set_volume
+
+*==========================================================================*/
+void playback_status_set_volume (PlaybackStatus *self, int value)
+  {
+  LOG_IN
+  self->volume = value;
+  LOG_OUT 
+  }
 
@@ -31,6 +31,9 @@ BOOL            playback_status_is_seekable (const PlaybackStatus *self);
 
 int             playback_status_get_bitrate (const PlaybackStatus *self);
 
+/** Volume in the range 0-100, or -1 if xine-server did not report it */
+int             playback_status_get_volume (const PlaybackStatus *self);
+
 int             playback_status_get_len (const PlaybackStatus *self);
 
 int             playback_status_get_pos (const PlaybackStatus *self);
@@ -58,6 +61,8 @@ void            playback_status_set_seekable (PlaybackStatus *self, BOOL value);
 
 void            playback_status_set_bitrate (PlaybackStatus *self, int value);
 
+void            playback_status_set_volume (PlaybackStatus *self, int value);
+
 void            playback_status_set_len (PlaybackStatus *self, int value);
 
 void            playback_status_set_pos (PlaybackStatus *self, int value);
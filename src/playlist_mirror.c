@@ -0,0 +1,249 @@
+/*============================================================================
+
+  xine-server-x
+  playlist_mirror.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Showing the playlist used to mean asking xine-server for the whole
+  thing, and parsing the response, on every page view. Instead, the
+  facade records every change that it makes to the playlist here, and
+  the playlist is read from this copy.
+
+  Other clients of xine-server can change the playlist too, and some
+  operations can fail part way through, so the copy is not trusted
+  blindly. It starts out invalid, and is filled from xine-server the
+  first time it is needed. The status poller compares its length with
+  the playlist length that xine-server reports on every poll, and
+  compares a hash of its contents with xine-server's playlist every
+  PLAYLIST_MIRROR_VERIFY_INTERVAL seconds. Any difference causes the
+  copy to be replaced.
+
+  Every change to the contents increases the generation number, which
+  clients can use to tell whether they need to fetch the playlist
+  again.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "defs.h"
+#include "log.h"
+#include "list.h"
+#include "playlist_mirror.h"
+
+static pthread_mutex_t playlist_mirror_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char **playlist_mirror_entries = NULL;
+static int playlist_mirror_nentries = 0;
+static int playlist_mirror_cap = 0;
+static BOOL playlist_mirror_valid = FALSE;
+static uint64_t playlist_mirror_generation = 1;
+
+/*==========================================================================
+
+  playlist_mirror_hash
+
+  FNV-1a over all the entries, with a separator that can't appear in
+  an entry, so that ["ab"] and ["a","b"] hash differently
+
+==========================================================================*/
+static uint64_t playlist_mirror_hash (int nentries, char *const *entries)
+  {
+  uint64_t h = 14695981039346656037ULL;
+  for (int i = 0; i < nentries; i++)
+    {
+    for (const unsigned char *p = (const unsigned char *)entries[i];
+          *p; p++)
+      {
+      h ^= *p;
+      h *= 1099511628211ULL;
+      }
+    // The terminating zero
+    h *= 1099511628211ULL;
+    }
+  return h;
+  }
+
+/*==========================================================================
+
+  playlist_mirror_free_entries
+
+  Must be called with the mutex held
+
+==========================================================================*/
+static void playlist_mirror_free_entries (void)
+  {
+  for (int i = 0; i < playlist_mirror_nentries; i++)
+    free (playlist_mirror_entries[i]);
+  playlist_mirror_nentries = 0;
+  }
+
+/*==========================================================================
+
+  playlist_mirror_push
+
+  Must be called with the mutex held
+
+==========================================================================*/
+static void playlist_mirror_push (const char *entry)
+  {
+  if (playlist_mirror_nentries == playlist_mirror_cap)
+    {
+    playlist_mirror_cap = playlist_mirror_cap ? playlist_mirror_cap * 2 : 64;
+    playlist_mirror_entries = realloc (playlist_mirror_entries,
+      playlist_mirror_cap * sizeof (char *));
+    }
+  playlist_mirror_entries[playlist_mirror_nentries++] = strdup (entry);
+  }
+
+/*==========================================================================
+
+  playlist_mirror_clear
+
+==========================================================================*/
+void playlist_mirror_clear (void)
+  {
+  LOG_IN
+  pthread_mutex_lock (&playlist_mirror_mutex);
+  if (!playlist_mirror_valid || playlist_mirror_nentries > 0)
+    playlist_mirror_generation++;
+  playlist_mirror_free_entries ();
+  // Whatever was there before, an empty playlist is known to be right
+  playlist_mirror_valid = TRUE;
+  pthread_mutex_unlock (&playlist_mirror_mutex);
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  playlist_mirror_append
+
+==========================================================================*/
+void playlist_mirror_append (int nstreams, const char *const *streams)
+  {
+  LOG_IN
+  pthread_mutex_lock (&playlist_mirror_mutex);
+  // Appending to an invalid mirror leaves it invalid, but the
+  //   generation must still change
+  if (playlist_mirror_valid)
+    {
+    for (int i = 0; i < nstreams; i++)
+      playlist_mirror_push (streams[i]);
+    }
+  if (nstreams > 0) playlist_mirror_generation++;
+  pthread_mutex_unlock (&playlist_mirror_mutex);
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  playlist_mirror_invalidate
+
+==========================================================================*/
+void playlist_mirror_invalidate (void)
+  {
+  LOG_IN
+  pthread_mutex_lock (&playlist_mirror_mutex);
+  if (playlist_mirror_valid)
+    {
+    playlist_mirror_valid = FALSE;
+    playlist_mirror_generation++;
+    }
+  pthread_mutex_unlock (&playlist_mirror_mutex);
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  playlist_mirror_replace
+
+==========================================================================*/
+BOOL playlist_mirror_replace (int nentries, char *const *entries)
+  {
+  LOG_IN
+  BOOL changed = FALSE;
+  pthread_mutex_lock (&playlist_mirror_mutex);
+  if (!playlist_mirror_valid || nentries != playlist_mirror_nentries
+       || playlist_mirror_hash (nentries, entries) != playlist_mirror_hash
+            (playlist_mirror_nentries, playlist_mirror_entries))
+    {
+    changed = TRUE;
+    playlist_mirror_generation++;
+    playlist_mirror_free_entries ();
+    for (int i = 0; i < nentries; i++)
+      playlist_mirror_push (entries[i]);
+    playlist_mirror_valid = TRUE;
+    }
+  pthread_mutex_unlock (&playlist_mirror_mutex);
+  LOG_OUT
+  return changed;
+  }
+
+/*==========================================================================
+
+  playlist_mirror_get
+
+==========================================================================*/
+List *playlist_mirror_get (uint64_t *generation)
+  {
+  LOG_IN
+  List *ret = NULL;
+  pthread_mutex_lock (&playlist_mirror_mutex);
+  if (playlist_mirror_valid)
+    {
+    ret = list_create (free);
+    for (int i = 0; i < playlist_mirror_nentries; i++)
+      list_append (ret, strdup (playlist_mirror_entries[i]));
+    }
+  if (generation) *generation = playlist_mirror_generation;
+  pthread_mutex_unlock (&playlist_mirror_mutex);
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  playlist_mirror_get_generation
+
+==========================================================================*/
+uint64_t playlist_mirror_get_generation (void)
+  {
+  pthread_mutex_lock (&playlist_mirror_mutex);
+  uint64_t ret = playlist_mirror_generation;
+  pthread_mutex_unlock (&playlist_mirror_mutex);
+  return ret;
+  }
+
+/*==========================================================================
+
+  playlist_mirror_get_length
+
+==========================================================================*/
+int playlist_mirror_get_length (void)
+  {
+  pthread_mutex_lock (&playlist_mirror_mutex);
+  int ret = playlist_mirror_valid ? playlist_mirror_nentries : -1;
+  pthread_mutex_unlock (&playlist_mirror_mutex);
+  return ret;
+  }
+
+/*==========================================================================
+
+  playlist_mirror_destroy
+
+==========================================================================*/
+void playlist_mirror_destroy (void)
+  {
+  LOG_IN
+  pthread_mutex_lock (&playlist_mirror_mutex);
+  playlist_mirror_free_entries ();
+  free (playlist_mirror_entries);
+  playlist_mirror_entries = NULL;
+  playlist_mirror_cap = 0;
+  playlist_mirror_valid = FALSE;
+  pthread_mutex_unlock (&playlist_mirror_mutex);
+  LOG_OUT
+  }
+
@@ -0,0 +1,56 @@
+/*============================================================================
+
+  xine-server-x
+  playlist_mirror.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  A copy of the xine-server playlist, kept up to date from the changes
+  that XSX itself makes, so that the playlist can be shown without
+  asking xine-server for it. See playlist_mirror.c for details.
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+#include "list.h"
+
+// How often, in seconds, the mirror is checked against xine-server
+#define PLAYLIST_MIRROR_VERIFY_INTERVAL 30
+
+BEGIN_DECLS
+
+/** Record that the playlist has been cleared. */
+void      playlist_mirror_clear (void);
+
+/** Record that streams have been added to the end of the playlist. */
+void      playlist_mirror_append (int nstreams, const char *const *streams);
+
+/** Record that the playlist may have changed in some unknown way --
+    because an operation on it failed part way through, for example.
+    The next call to playlist_mirror_get() will return NULL. */
+void      playlist_mirror_invalidate (void);
+
+/** Replace the mirror with the playlist as xine-server reports it. The
+    generation changes only if the new contents are different. Returns
+    TRUE if they were. */
+BOOL      playlist_mirror_replace (int nentries, char *const *entries);
+
+/** Get a copy of the playlist, as a List of char*, or NULL if the
+    mirror is not known to be valid. If generation is not NULL, it
+    is set to the generation of the copy. */
+List     *playlist_mirror_get (uint64_t *generation);
+
+/** The generation increases each time the contents of the playlist
+    change. It is never zero. */
+uint64_t  playlist_mirror_get_generation (void);
+
+/** Get the number of entries, or -1 if the mirror is not valid. */
+int       playlist_mirror_get_length (void);
+
+/** Free the mirror's memory, at shutdown. */
+void      playlist_mirror_destroy (void);
+
+END_DECLS
+
@@ -34,7 +34,7 @@ void playlist_request_handler_page (const Props *arguments, char **page)
 
   int error_code = 0;
   char *error_message = NULL;
-  List *entries = facade_get_playlist (&error_code, &error_message);
+  List *entries = facade_get_playlist (NULL, &error_code, &error_message);
   String *table = string_create_empty();
 
   if (error_code == 0)
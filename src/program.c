@@ -25,6 +25,26 @@
 #include "httputil.h" 
 #include "facade.h" 
 #include "xine-server-x-api.h" 
+#include "xine-server-api.h" 
+#include "status_poller.h" 
+#include "playlist_mirror.h" 
+#include "page_cache.h" 
+#include "page_stream.h" 
+#include "metrics.h" 
+#include "log_file.h" 
+
+// In the event-driven mode, a long-polling status request is suspended
+//   rather than holding a worker thread, and this is set as its
+//   con_cls when it is, so that it can be recognized when it resumes
+static int program_long_poll_resumed;
+
+// The body of a POST, kept as the request's con_cls while it arrives
+typedef struct _ProgramUpload
+  {
+  char *data;
+  size_t len;
+  BOOL too_big;
+  } ProgramUpload;
 
 
 /*============================================================================
@@ -58,6 +78,366 @@ static int program_argument_iterator (void *data, enum MHD_ValueKind kind,
   return MHD_YES;
   }
 
+/*============================================================================
+
+  program_upload_free
+
+============================================================================*/
+static void program_upload_free (ProgramUpload *upload)
+  {
+  free (upload->data);
+  free (upload);
+  }
+
+/*============================================================================
+
+  program_collect_upload
+
+  MHD passes the body of a POST in pieces, over several calls, and then
+  calls once more with none when it is complete. This returns TRUE 
+  until then, and then adds the body to the arguments as name, unless 
+  it was too long
+
+============================================================================*/
+static BOOL program_collect_upload (void **con_cls, const char *upload_data,
+       size_t *upload_data_size, Props *arguments, const char *name)
+  {
+  ProgramUpload *upload = *con_cls;
+  if (!upload)
+    {
+    upload = malloc (sizeof (ProgramUpload));
+    memset (upload, 0, sizeof (ProgramUpload));
+    *con_cls = upload;
+    return TRUE;
+    }
+  if (*upload_data_size > 0)
+    {
+    if (upload->len + *upload_data_size <= PROGRAM_MAX_UPLOAD)
+      {
+      upload->data = realloc (upload->data, 
+        upload->len + *upload_data_size + 1);
+      memcpy (upload->data + upload->len, upload_data, *upload_data_size);
+      upload->len += *upload_data_size;
+      upload->data[upload->len] = 0;
+      }
+    else
+      upload->too_big = TRUE;
+    *upload_data_size = 0;
+    return TRUE;
+    }
+  if (upload->too_big)
+    log_warning ("Ignoring request body of more than %d bytes", 
+      PROGRAM_MAX_UPLOAD);
+  else if (upload->data)
+    props_put (arguments, name, upload->data);
+  program_upload_free (upload);
+  *con_cls = NULL;
+  return FALSE;
+  }
+
+/*============================================================================
+
+  program_request_completed
+
+  Called by MHD when it has finished with a request, however it ended,
+  so that the body of a POST that was never completed is not lost
+
+============================================================================*/
+static void program_request_completed (void *cls, 
+       struct MHD_Connection *connection, void **con_cls, 
+       enum MHD_RequestTerminationCode toe)
+  {
+  if (*con_cls && *con_cls != &program_long_poll_resumed)
+    program_upload_free ((ProgramUpload *)*con_cls);
+  *con_cls = NULL;
+  }
+
+/*============================================================================
+
+  program_resume_connection
+
+  Called by the status poller when a suspended long poll should be
+  answered
+
+============================================================================*/
+static void program_resume_connection (void *data)
+  {
+  MHD_resume_connection ((struct MHD_Connection *)data);
+  }
+
+/*============================================================================
+
+  program_if_range_matches
+
+  A range request with an If-Range header is honoured only if the
+  validator it gives -- an entity tag or a date -- matches the file 
+  as it is now. Otherwise the whole file is sent. Weak entity tags 
+  never match
+
+============================================================================*/
+static BOOL program_if_range_matches (const char *if_range, 
+       const char *etag, time_t timestamp)
+  {
+  if (!if_range) return TRUE;
+  if (if_range[0] == '"') return strcmp (if_range, etag) == 0;
+  if (strncmp (if_range, "W/", 2) == 0) return FALSE;
+  time_t t = 0;
+  httputil_parse_http_time (if_range, &t);
+  return t == timestamp;
+  }
+
+/*============================================================================
+
+  program_gzip_min
+
+============================================================================*/
+static int program_gzip_min (const RequestHandler *request_handler)
+  {
+  return program_context_get_integer (request_handler_get_program_context 
+    (request_handler), "http-gzip-min", PROGRAM_DEF_HTTP_GZIP_MIN);
+  }
+
+/*============================================================================
+
+  program_gzip_etag
+
+  A compressed page is a different representation, so it needs its own
+  entity tag -- the page's tag, with -gz added inside the quotes
+
+============================================================================*/
+static void program_gzip_etag (const char *etag, char *gz_etag)
+  {
+  snprintf (gz_etag, REQUEST_HANDLER_ETAG_LEN, "%.*s-gz\"", 
+    (int)strlen (etag) - 1, etag);
+  }
+
+/*============================================================================
+
+  program_not_modified
+
+  If the client sent an If-None-Match header that matches etag, or the
+  tag of the compressed page, answer the request with 304, and return 
+  TRUE. The response must still carry the tag that matched, and the 
+  same Cache-Control and Vary headers as a full response. A page with
+  the same tag as before is the same length as before, so if it was 
+  compressed then, it would be compressed again
+
+============================================================================*/
+static BOOL program_not_modified (struct MHD_Connection *connection, 
+       const RequestHandler *request_handler, const char *etag, int *ret)
+  {
+  const char *if_none_match = MHD_lookup_connection_value (connection, 
+    MHD_HEADER_KIND, "If-None-Match");
+  if (!if_none_match) return FALSE;
+  char gz_etag[REQUEST_HANDLER_ETAG_LEN];
+  program_gzip_etag (etag, gz_etag);
+  const char *matched = NULL;
+  if (httputil_etag_matches (if_none_match, etag))
+    matched = etag;
+  else if (httputil_etag_matches (if_none_match, gz_etag))
+    matched = gz_etag;
+  else
+    return FALSE;
+  struct MHD_Response *response = MHD_create_response_from_buffer (0,
+     (void*) "", MHD_RESPMEM_PERSISTENT);
+  MHD_add_response_header (response, "ETag", matched);
+  MHD_add_response_header (response, "Cache-Control", "no-cache");
+  if (program_gzip_min (request_handler) > 0)
+    MHD_add_response_header (response, "Vary", "Accept-Encoding");
+  *ret = MHD_queue_response (connection, 304, response);
+  MHD_destroy_response (response);
+  return TRUE;
+  }
+
+/*============================================================================
+
+  program_queue_page
+
+  Send a page produced by the GUI or API handler, taking ownership of
+  it. The page is gzipped if it is long enough, and the client accepts
+  that. etag may be NULL if the page has none. The size of what is sent
+  is stored in bytes, for the access log
+
+============================================================================*/
+static int program_queue_page (struct MHD_Connection *connection, 
+       const RequestHandler *request_handler, int code, char *page, 
+       const char *content_type, const char *etag, int64_t *bytes)
+  {
+  size_t len = strlen (page);
+  int gzip_min = program_gzip_min (request_handler);
+  BOOL gzipped = FALSE;
+  if (gzip_min > 0 && len >= gzip_min)
+    {
+    const char *accept_encoding = MHD_lookup_connection_value (connection, 
+      MHD_HEADER_KIND, "Accept-Encoding");
+    if (accept_encoding && httputil_accepts_encoding (accept_encoding, 
+          "gzip"))
+      {
+      size_t gz_len;
+      char *gz_page = httputil_gzip (page, len, PROGRAM_GZIP_LEVEL, &gz_len);
+      if (gz_page)
+        {
+        free (page);
+        page = gz_page;
+        len = gz_len;
+        gzipped = TRUE;
+        }
+      }
+    }
+
+  *bytes = len;
+  struct MHD_Response *response = MHD_create_response_from_buffer (len,
+       (void*) page, MHD_RESPMEM_MUST_FREE);
+  MHD_add_response_header (response, "Content-Type", content_type); 
+  MHD_add_response_header (response, "Cache-Control", "no-cache");
+  if (gzip_min > 0)
+    MHD_add_response_header (response, "Vary", "Accept-Encoding");
+  if (gzipped)
+    MHD_add_response_header (response, "Content-Encoding", "gzip");
+  if (etag && code == 200)
+    {
+    char gz_etag[REQUEST_HANDLER_ETAG_LEN];
+    program_gzip_etag (etag, gz_etag);
+    MHD_add_response_header (response, "ETag", gzipped ? gz_etag : etag);
+    }
+  int ret = MHD_queue_response (connection, code, response);
+  MHD_destroy_response (response);
+  return ret;
+  }
+
+/*============================================================================
+
+  program_stream_read
+
+============================================================================*/
+static ssize_t program_stream_read (void *cls, uint64_t pos, char *buf, 
+       size_t max)
+  {
+  ssize_t n = page_stream_read ((PageStream *)cls, buf, max);
+  if (n < 0) return MHD_CONTENT_READER_END_WITH_ERROR;
+  if (n == 0) return MHD_CONTENT_READER_END_OF_STREAM;
+  return n;
+  }
+
+/*============================================================================
+
+  program_stream_free
+
+============================================================================*/
+static void program_stream_free (void *cls)
+  {
+  page_stream_destroy ((PageStream *)cls);
+  }
+
+/*============================================================================
+
+  program_queue_stream
+
+  Send a page that is made as it is sent, taking ownership of the 
+  stream. The length is not known in advance, so HTTP/1.1 clients get
+  it chunked. It is compressed as it goes, if the client accepts that, 
+  since a page big enough to be streamed is certainly big enough to be
+  worth compressing
+
+============================================================================*/
+static int program_queue_stream (struct MHD_Connection *connection, 
+       const RequestHandler *request_handler, int code, PageStream *stream,
+       const char *content_type, const char *etag)
+  {
+  int gzip_min = program_gzip_min (request_handler);
+  BOOL gzipped = FALSE;
+  if (gzip_min > 0)
+    {
+    const char *accept_encoding = MHD_lookup_connection_value (connection, 
+      MHD_HEADER_KIND, "Accept-Encoding");
+    if (accept_encoding && httputil_accepts_encoding (accept_encoding, 
+          "gzip"))
+      gzipped = page_stream_set_gzip (stream, PROGRAM_GZIP_LEVEL);
+    }
+
+  struct MHD_Response *response = MHD_create_response_from_callback 
+    (MHD_SIZE_UNKNOWN, PAGE_STREAM_BATCH, program_stream_read, stream, 
+     program_stream_free);
+  if (!response)
+    {
+    page_stream_destroy (stream);
+    return MHD_NO;
+    }
+  MHD_add_response_header (response, "Content-Type", content_type); 
+  MHD_add_response_header (response, "Cache-Control", "no-cache");
+  if (gzip_min > 0)
+    MHD_add_response_header (response, "Vary", "Accept-Encoding");
+  if (gzipped)
+    MHD_add_response_header (response, "Content-Encoding", "gzip");
+  if (etag && code == 200)
+    {
+    char gz_etag[REQUEST_HANDLER_ETAG_LEN];
+    program_gzip_etag (etag, gz_etag);
+    MHD_add_response_header (response, "ETag", gzipped ? gz_etag : etag);
+    }
+  int ret = MHD_queue_response (connection, code, response);
+  MHD_destroy_response (response);
+  return ret;
+  }
+
+/*============================================================================
+
+  program_queue_metrics
+
+============================================================================*/
+static int program_queue_metrics (struct MHD_Connection *connection,
+       int *code, int64_t *bytes)
+  {
+  struct MHD_Response *response;
+  if (metrics_enabled ())
+    {
+    char *page = metrics_format ();
+    *bytes = strlen (page);
+    response = MHD_create_response_from_buffer (strlen (page),
+       (void*) page, MHD_RESPMEM_MUST_FREE);
+    MHD_add_response_header (response, "Content-Type", 
+      "text/plain; version=0.0.4; charset=utf-8");
+    *code = 200;
+    }
+  else
+    {
+    const char *page = "Metrics are not enabled: use --metrics\n";
+    *bytes = strlen (page);
+    response = MHD_create_response_from_buffer (strlen (page),
+       (void*) page, MHD_RESPMEM_PERSISTENT);
+    MHD_add_response_header (response, "Content-Type", "text/plain");
+    *code = 404;
+    }
+  MHD_add_response_header (response, "Cache-Control", "no-cache");
+  int ret = MHD_queue_response (connection, *code, response);
+  MHD_destroy_response (response);
+  return ret;
+  }
+
+/*============================================================================
+
+  program_xs_observer
+
+============================================================================*/
+static void program_xs_observer (int64_t usec)
+  {
+  metrics_record_op_time (METRICS_OP_XS_REQUEST, usec);
+  }
+
+/*============================================================================
+
+  program_sample_scanner
+
+============================================================================*/
+static void program_sample_scanner (void)
+  {
+  int error_code = 0;
+  BOOL running, scanned, added, modified, deleted, extracted;
+  facade_scanner_status (&error_code, NULL, &running, &scanned, &added, 
+    &modified, &deleted, &extracted);
+  metrics_sample_scanner (running, scanned);
+  }
+
 /*============================================================================
 
   program_handle_request 
@@ -74,6 +454,13 @@ int program_handle_request (void *_request_handler,
 
   log_debug ("request: %s", url);
 
+  // What is sent, for the access log. Nothing is logged if no response
+  //   is queued here -- a redirected or suspended request is logged 
+  //   when it is answered
+  int64_t access_start = log_file_access_start ();
+  int access_code = 0;
+  int64_t access_bytes = 0;
+
   Props *headers = props_create();
   MHD_get_connection_values (connection, MHD_HEADER_KIND, 
        program_header_iterator, headers);
@@ -82,7 +469,18 @@ int program_handle_request (void *_request_handler,
   MHD_get_connection_values (connection, MHD_GET_ARGUMENT_KIND, 
        program_argument_iterator, arguments);
 
-  if (strlen (url) == 0 || strcmp (url, "/") == 0)
+  // The calls for a batch can be sent as the body of a POST, as well as
+  //   in an argument
+  BOOL uploading = strcmp (method, "POST") == 0
+    && strcmp (url, API_BASE XINESERVER_X_FN_BATCH) == 0
+    && program_collect_upload (con_cls, upload_data, upload_data_size, 
+         arguments, "commands");
+
+  if (uploading)
+    {
+    // Nothing to send until the body is complete
+    }
+  else if (strlen (url) == 0 || strcmp (url, "/") == 0)
     {
     const ProgramContext *context = request_handler_get_program_context 
         (request_handler);
@@ -117,8 +515,66 @@ int program_handle_request (void *_request_handler,
     if (request_handler_ext_file (request_handler, url + 4, &code, if_modified,
           &timestamp, &size, &fd, &content_type, &error))
       {
-      response = MHD_create_response_from_fd (size, fd);
-      MHD_add_response_header (response, "Content-Type", content_type);
+      // The size and modification time make a validator for If-Range,
+      //   as they do for most servers of static files
+      char etag[48];
+      snprintf (etag, sizeof (etag), "\"%llx-%llx\"", 
+        (unsigned long long)size, (unsigned long long)timestamp);
+
+      // Audio players seek, and download managers resume, by asking 
+      //   for part of the file. A single range is sent from the file
+      //   as it is, so the zero-copy path is kept
+      HttpRange ranges[HTTPUTIL_MAX_RANGES];
+      int nranges = 0;
+      const char *range = MHD_lookup_connection_value (connection, 
+        MHD_HEADER_KIND, "Range");
+      if (range && program_if_range_matches (MHD_lookup_connection_value 
+            (connection, MHD_HEADER_KIND, "If-Range"), etag, timestamp))
+        nranges = httputil_parse_range (range, size, ranges, 
+          HTTPUTIL_MAX_RANGES);
+
+      char content_range[80];
+      if (nranges < 0)
+        {
+        close (fd);
+        const char *page = "Requested range not satisfiable\n";
+        response = MHD_create_response_from_buffer (strlen (page),
+          (void*) page, MHD_RESPMEM_PERSISTENT);
+        MHD_add_response_header (response, "Content-Type", "text/plain");
+        snprintf (content_range, sizeof (content_range), "bytes */%llu",
+          (unsigned long long)size);
+        MHD_add_response_header (response, "Content-Range", content_range);
+        code = 416;
+        access_bytes = strlen (page);
+        }
+      else if (nranges == 1)
+        {
+        response = MHD_create_response_from_fd_at_offset64 
+          (ranges[0].length, fd, ranges[0].start);
+        MHD_add_response_header (response, "Content-Type", content_type);
+        snprintf (content_range, sizeof (content_range), 
+          "bytes %llu-%llu/%llu", (unsigned long long)ranges[0].start,
+          (unsigned long long)(ranges[0].start + ranges[0].length - 1),
+          (unsigned long long)size);
+        MHD_add_response_header (response, "Content-Range", content_range);
+        code = 206;
+        access_bytes = ranges[0].length;
+        }
+      else if (nranges > 1)
+        {
+        response = httputil_create_multirange_response (fd, size, ranges,
+          nranges, content_type);
+        code = 206;
+        access_bytes = -1;
+        }
+      else
+        {
+        response = MHD_create_response_from_fd (size, fd);
+        access_bytes = size;
+        MHD_add_response_header (response, "Content-Type", content_type);
+        }
+      MHD_add_response_header (response, "Accept-Ranges", "bytes");
+      MHD_add_response_header (response, "ETag", etag);
       MHD_add_response_header (response, "Cache-Control", "max-age=0");
       MHD_add_response_header (response, "Cache-Control", "public");
       char last_modified [40];
@@ -131,27 +587,65 @@ int program_handle_request (void *_request_handler,
       }
     else
       {
+      access_bytes = strlen (error);
       response = MHD_create_response_from_buffer (strlen (error),
          (void*) error, MHD_RESPMEM_MUST_FREE);
       MHD_add_response_header (response, "Content-Type", "text/plain");
       ret = MHD_queue_response (connection, code, response);
       MHD_destroy_response (response);
       }
+    access_code = code;
+    }
+  else if (strcmp (url, API_BASE XINESERVER_X_FN_METRICS) == 0)
+    {
+    ret = program_queue_metrics (connection, &access_code, &access_bytes);
+    }
+  else if (strncmp (url, API_BASE, 5) == 0 
+      && strcmp (url + 5, XINESERVER_X_FN_STATUS) == 0
+      && props_get (arguments, "since") && *con_cls == NULL
+      && program_context_get_integer (request_handler_get_program_context 
+           (request_handler), "http-threads", PROGRAM_DEF_HTTP_THREADS) > 0)
+    {
+    // A long poll, in the event-driven mode. The connection is parked
+    //   until the status poller wakes it, and this function is then 
+    //   called again to answer it. If the status has already changed,
+    //   it is woken straight away
+    *con_cls = &program_long_poll_resumed;
+    MHD_suspend_connection (connection);
+    if (!status_poller_add_waiter (strtoull (props_get (arguments, "since"),
+          NULL, 10), STATUS_POLLER_LONG_POLL_WAIT, 
+          program_resume_connection, connection))
+      MHD_resume_connection (connection);
     }
   else if (strncmp (url, API_BASE, 5) == 0) // TODO
     {
-    struct MHD_Response *response;
-
-    char *page;
-    int code;
-    request_handler_api (request_handler, url + 5, arguments, &code, &page);
-    response = MHD_create_response_from_buffer (strlen (page),
-         (void*) page, MHD_RESPMEM_MUST_FREE);
-    MHD_add_response_header (response, "Content-Type", 
-            "application/json; charset=utf8");
-    MHD_add_response_header (response, "Cache-Control", "no-cache");
-    ret = MHD_queue_response (connection, code, response);
-    MHD_destroy_response (response);
+    // A long poll that has been woken must not wait again
+    if (*con_cls == &program_long_poll_resumed)
+      props_delete (arguments, "since");
+
+    // A long poll that blocks this thread is not timed: it would only 
+    //   measure how long the status took to change
+    int64_t started = props_get (arguments, "since") ? 0 : metrics_start ();
+
+    // The tag is worked out first, so that a client that already has 
+    //   the response gets a 304 without it being produced at all
+    char etag[REQUEST_HANDLER_ETAG_LEN];
+    BOOL has_etag = request_handler_api_etag (request_handler, url + 5, 
+      arguments, etag);
+    int code = 304;
+    if (!has_etag || !program_not_modified (connection, request_handler,
+          etag, &ret))
+      {
+      char *page;
+      request_handler_api (request_handler, url + 5, arguments, &code, 
+        &page);
+      ret = program_queue_page (connection, request_handler, code, page,
+        "application/json; charset=utf8", has_etag ? etag : NULL, 
+        &access_bytes);
+      }
+    request_handler_api_done (request_handler);
+    metrics_record_request (METRICS_ROUTE_API, url + 5, code, started);
+    access_code = code;
     }
   else if (strncmp (url, INT_FILE_BASE, 5) == 0) // TODO
     {
@@ -171,15 +665,32 @@ int program_handle_request (void *_request_handler,
       httputil_parse_http_time (s_if_modified, &if_modified);
       }
 
+    const char *accept_encoding = MHD_lookup_connection_value (connection, 
+      MHD_HEADER_KIND, "Accept-Encoding");
+    const char *content_encoding;
+    BOOL immutable;
     if (request_handler_int_file (request_handler, url + 5, 
-        &code, if_modified, &timestamp, &size, 
-        &buff, &content_type, &error))
+        accept_encoding, &code, if_modified, &timestamp, &size, 
+        &buff, &content_type, &content_encoding, &immutable, &error))
       {
       response = MHD_create_response_from_buffer (size,
            (void*) buff, MHD_RESPMEM_PERSISTENT);
       MHD_add_response_header (response, "Content-Type", content_type);
-      MHD_add_response_header (response, "Cache-Control", "max-age=0");
-      MHD_add_response_header (response, "Cache-Control", "public");
+      if (content_encoding)
+        MHD_add_response_header (response, "Content-Encoding", 
+          content_encoding);
+      MHD_add_response_header (response, "Vary", "Accept-Encoding");
+      if (immutable)
+        {
+        // A year is the longest that RFC 7234 suggests
+        MHD_add_response_header (response, "Cache-Control", 
+          "public, max-age=31536000, immutable");
+        }
+      else
+        {
+        MHD_add_response_header (response, "Cache-Control", "max-age=0");
+        MHD_add_response_header (response, "Cache-Control", "public");
+        }
       char last_modified [40];
       httputil_make_http_time (timestamp, last_modified, 
         sizeof (last_modified) - 1);
@@ -187,30 +698,46 @@ int program_handle_request (void *_request_handler,
       ret = MHD_queue_response (connection, code, response);
       MHD_destroy_response (response);
       free (content_type);
+      access_bytes = size;
       }
     else
       {
+      access_bytes = strlen (error);
       response = MHD_create_response_from_buffer (strlen (error),
          (void*) error, MHD_RESPMEM_MUST_FREE);
       MHD_add_response_header (response, "Content-Type", "text/plain");
       ret = MHD_queue_response (connection, code, response);
       MHD_destroy_response (response);
       }
+    access_code = code;
     }
   else if (strncmp (url, GUI_BASE, 5) == 0) // TODO
     {
-    struct MHD_Response *response;
-    char *buff;
-    int code;
-
-    request_handler_gui (request_handler, url + 5, arguments, &code, &buff);
-    response = MHD_create_response_from_buffer (strlen (buff),
-           (void*) buff, MHD_RESPMEM_MUST_FREE);
-    MHD_add_response_header (response, "Content-Type", 
-            "text/html; charset=utf8");
-    MHD_add_response_header (response, "Cache-Control", "no-cache");
-    ret = MHD_queue_response (connection, code, response);
-    MHD_destroy_response (response);
+    int64_t started = metrics_start ();
+    char etag[REQUEST_HANDLER_ETAG_LEN];
+    BOOL has_etag = request_handler_gui_etag (request_handler, url + 5, 
+      arguments, etag);
+    int code = 304;
+    if (!has_etag || !program_not_modified (connection, request_handler,
+          etag, &ret))
+      {
+      char *buff;
+      PageStream *stream;
+      request_handler_gui (request_handler, url + 5, arguments, 
+        has_etag ? etag : NULL, &code, &buff, &stream);
+      if (stream)
+        {
+        ret = program_queue_stream (connection, request_handler, code, 
+          stream, "text/html; charset=utf8", has_etag ? etag : NULL);
+        access_bytes = -1;
+        }
+      else
+        ret = program_queue_page (connection, request_handler, code, buff,
+          "text/html; charset=utf8", has_etag ? etag : NULL, 
+          &access_bytes);
+      }
+    metrics_record_request (METRICS_ROUTE_GUI, url + 5, code, started);
+    access_code = code;
     }
   else
     {
@@ -222,8 +749,13 @@ int program_handle_request (void *_request_handler,
 
     ret = MHD_queue_response (connection, MHD_HTTP_BAD_REQUEST, response);
     MHD_destroy_response (response);
+    access_code = MHD_HTTP_BAD_REQUEST;
+    access_bytes = strlen (page);
     }
 
+  if (access_code)
+    log_file_access (method, url, access_code, access_bytes, access_start);
+
   props_destroy (headers);
   props_destroy (arguments);
   LOG_OUT
@@ -310,10 +842,50 @@ int program_run (ProgramContext *context)
     daemon (0, 1); // TODO -- /dev/null when we have a log file 
     }
 
-  log_info ("Using xine-server instance at %s:%d", xshost, xsport);
+  // The writer thread is started after daemon(), which would lose it
+  const char *log_path = program_context_get (context, "log-file");
+  const char *access_path = program_context_get (context, "access-log");
+  if (log_path || access_path)
+    {
+    if (log_file_open (log_path, access_path, 
+          (int64_t)program_context_get_integer (context, "log-size", 
+            LOG_FILE_DEF_SIZE) * 1024, 
+          program_context_get_integer (context, "log-keep", 
+            LOG_FILE_DEF_KEEP)) && log_path)
+      log_set_handler (log_file_handler);
+    }
+
+  if (xshost[0] == '/')
+    log_info ("Using xine-server instance at %s", xshost);
+  else
+    log_info ("Using xine-server instance at %s:%d", xshost, xsport);
+
+  xineserver_pool_set_limits (program_context_get_integer (context, 
+     "xspool", XINESERVER_POOL_DEF_SIZE), XINESERVER_POOL_DEF_IDLE_TIMEOUT);
+  xineserver_set_timeouts (program_context_get_integer (context, 
+     "xsconnecttimeout", XINESERVER_DEF_CONNECT_TIMEOUT),
+     program_context_get_integer (context, "xstimeout", 
+     XINESERVER_DEF_IO_TIMEOUT));
+  xineserver_breaker_set_limits (program_context_get_integer (context, 
+     "xsbreaker", XINESERVER_BREAKER_DEF_THRESHOLD), 
+     XINESERVER_BREAKER_DEF_COOLDOWN);
+
+  if (program_context_get_boolean (context, "metrics", FALSE))
+    {
+    metrics_set_enabled (TRUE);
+    xineserver_set_request_observer (program_xs_observer);
+    }
 
   facade_create (root, xshost, xsport, gxsradio_dir, index);
 
+  status_poller_start (program_context_get_integer (context, 
+     "status-interval", STATUS_POLLER_DEF_INTERVAL));
+
+  int page_cache_kb = program_context_get_integer (context, "page-cache", 
+     PAGE_CACHE_DEF_SIZE);
+  if (page_cache_kb > 0)
+    page_cache_set_size ((size_t)page_cache_kb * 1024);
+
   RequestHandler *request_handler = request_handler_create (root, 
      context);
 
@@ -337,15 +909,58 @@ int program_run (ProgramContext *context)
   int xsxport = program_context_get_integer (context, "port", 
          XINESERVER_X_DEF_PORT);
 
-  struct MHD_Daemon *daemon = MHD_start_daemon 
+  int http_threads = program_context_get_integer (context, "http-threads",
+         PROGRAM_DEF_HTTP_THREADS);
+  int http_connections = program_context_get_integer (context, 
+         "http-connections", PROGRAM_DEF_HTTP_CONNECTIONS);
+  int http_timeout = program_context_get_integer (context, "http-timeout",
+         PROGRAM_DEF_HTTP_TIMEOUT);
+
+  // Options common to both modes. Zero means no XSX limit, and MHD's
+  //   defaults apply
+  struct MHD_OptionItem options[5];
+  int noptions = 0;
+  options[noptions++] = (struct MHD_OptionItem) 
+    { MHD_OPTION_NOTIFY_COMPLETED, (intptr_t)program_request_completed, 
+      NULL };
+  if (http_connections > 0)
+    options[noptions++] = (struct MHD_OptionItem) 
+      { MHD_OPTION_CONNECTION_LIMIT, http_connections, NULL };
+  if (http_timeout > 0)
+    options[noptions++] = (struct MHD_OptionItem) 
+      { MHD_OPTION_CONNECTION_TIMEOUT, http_timeout, NULL };
+
+  struct MHD_Daemon *daemon;
+  if (http_threads > 0)
+    {
+    // A fixed pool of threads, each handling many connections with 
+    //   epoll. Idle keep-alive connections and long polls cost a little
+    //   memory, but no thread
+    options[noptions++] = (struct MHD_OptionItem) 
+      { MHD_OPTION_THREAD_POOL_SIZE, http_threads, NULL };
+    options[noptions] = (struct MHD_OptionItem) { MHD_OPTION_END, 0, NULL };
+    log_info ("HTTP server using %d worker threads", http_threads);
+    daemon = MHD_start_daemon 
+        (MHD_USE_EPOLL_INTERNAL_THREAD | MHD_ALLOW_SUSPEND_RESUME, 
+         xsxport, NULL, NULL, program_handle_request, request_handler, 
+         MHD_OPTION_ARRAY, options, MHD_OPTION_END);
+    }
+  else
+    {
+    options[noptions] = (struct MHD_OptionItem) { MHD_OPTION_END, 0, NULL };
+    daemon = MHD_start_daemon 
         (MHD_USE_THREAD_PER_CONNECTION, xsxport, NULL, NULL,
-         program_handle_request, request_handler, MHD_OPTION_END);
+         program_handle_request, request_handler, 
+         MHD_OPTION_ARRAY, options, MHD_OPTION_END);
+    }
 
   if (daemon)
     {
     while (!request_handler_shutdown_requested (request_handler))
        {
        usleep (1000000);
+       request_handler_warm_pages (request_handler);
+       if (metrics_enabled ()) program_sample_scanner ();
        sigpending (&waiting_mask);
        if (sigismember (&waiting_mask, SIGINT) ||
 	   sigismember (&waiting_mask, SIGTSTP) ||
@@ -359,6 +974,12 @@ int program_run (ProgramContext *context)
 
     log_info ("HTTP server stopping");
 
+    // Stop the poller first, so that clients waiting for a status
+    //   change are answered at once, and MHD does not wait for them.
+    //   This also resumes any suspended long polls, which MHD requires
+    //   before it can stop
+    status_poller_stop ();
+
     if (xslaunch)
        facade_shut_down_xine_server ();
 
@@ -371,7 +992,12 @@ int program_run (ProgramContext *context)
    }
 
   request_handler_destroy (request_handler);
+  status_poller_stop ();
   facade_destroy();
+  playlist_mirror_destroy ();
+  page_cache_destroy ();
+  xineserver_pool_close_all ();
+  log_file_close ();
 
   return 0;
   }
@@ -6,6 +6,23 @@
 
 #pragma once
 
+// Zero HTTP worker threads means a thread for each connection
+#define PROGRAM_DEF_HTTP_THREADS 0
+// Zero means MHD's own limit
+#define PROGRAM_DEF_HTTP_CONNECTIONS 0
+// Seconds an idle connection is kept open. This must be longer than
+//   a long poll, STATUS_POLLER_LONG_POLL_WAIT
+#define PROGRAM_DEF_HTTP_TIMEOUT 60
+// GUI pages and API responses at least this many bytes long are gzipped,
+//   if the client accepts it. Zero means never
+#define PROGRAM_DEF_HTTP_GZIP_MIN 1024
+// zlib compression level for them -- low, because the pages are made 
+//   fresh for each request, often on a small CPU
+#define PROGRAM_GZIP_LEVEL 4
+// Most bytes accepted in the body of a POST, which only a batch of API
+//   calls uses
+#define PROGRAM_MAX_UPLOAD (64 * 1024)
+
 BEGIN_DECLS
 
 int program_run (ProgramContext *context);
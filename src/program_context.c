@@ -123,6 +123,21 @@ BOOL program_context_parse_command_line (ProgramContext *self,
       {"port", required_argument, NULL, 'p'},
       {"xsport", required_argument, NULL, 0},
       {"xshost", required_argument, NULL, 0},
+      {"xspool", required_argument, NULL, 0},
+      {"xstimeout", required_argument, NULL, 0},
+      {"xsconnecttimeout", required_argument, NULL, 0},
+      {"xsbreaker", required_argument, NULL, 0},
+      {"status-interval", required_argument, NULL, 0},
+      {"http-threads", required_argument, NULL, 0},
+      {"http-connections", required_argument, NULL, 0},
+      {"http-timeout", required_argument, NULL, 0},
+      {"http-gzip-min", required_argument, NULL, 0},
+      {"page-cache", required_argument, NULL, 0},
+      {"metrics", no_argument, NULL, 0},
+      {"log-file", required_argument, NULL, 0},
+      {"access-log", required_argument, NULL, 0},
+      {"log-size", required_argument, NULL, 0},
+      {"log-keep", required_argument, NULL, 0},
       {"xslaunch", required_argument, NULL, 'x'},
       {"gxsradio", required_argument, NULL, 'g'},
       {"index", required_argument, NULL, 'i'},
@@ -151,6 +166,8 @@ BOOL program_context_parse_command_line (ProgramContext *self,
            program_context_put_boolean (self, "quickscan", TRUE);
          else if (strcmp (long_options[option_index].name, "debug") == 0)
            program_context_put_boolean (self, "debug", TRUE);
+         else if (strcmp (long_options[option_index].name, "metrics") == 0)
+           program_context_put_boolean (self, "metrics", TRUE);
          else if (strcmp (long_options[option_index].name, "log-level") == 0)
            program_context_put_integer (self, "log-level", atoi (optarg)); 
          else if (strcmp (long_options[option_index].name, "width") == 0)
@@ -159,8 +176,51 @@ BOOL program_context_parse_command_line (ProgramContext *self,
            program_context_put_integer (self, "port", atoi (optarg)); 
          else if (strcmp (long_options[option_index].name, "xsport") == 0)
            program_context_put_integer (self, "xsport", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "xspool") == 0)
+           program_context_put_integer (self, "xspool", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "xstimeout") == 0)
+           program_context_put_integer (self, "xstimeout", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, 
+             "xsconnecttimeout") == 0)
+           program_context_put_integer (self, "xsconnecttimeout", 
+             atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "xsbreaker") == 0)
+           program_context_put_integer (self, "xsbreaker", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, 
+             "status-interval") == 0)
+           program_context_put_integer (self, "status-interval", 
+             atoi (optarg));
+         else if (strcmp (long_options[option_index].name, 
+             "http-threads") == 0)
+           program_context_put_integer (self, "http-threads", 
+             atoi (optarg));
+         else if (strcmp (long_options[option_index].name, 
+             "http-connections") == 0)
+           program_context_put_integer (self, "http-connections", 
+             atoi (optarg));
+         else if (strcmp (long_options[option_index].name, 
+             "http-timeout") == 0)
+           program_context_put_integer (self, "http-timeout", 
+             atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, 
+             "http-gzip-min") == 0)
+           program_context_put_integer (self, "http-gzip-min", 
+             atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, 
+             "page-cache") == 0)
+           program_context_put_integer (self, "page-cache", 
+             atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "log-size") == 0)
+           program_context_put_integer (self, "log-size", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "log-keep") == 0)
+           program_context_put_integer (self, "log-keep", atoi (optarg)); 
          else if (strcmp (long_options[option_index].name, "root") == 0)
            program_context_put (self, "root", optarg); 
+         else if (strcmp (long_options[option_index].name, "log-file") == 0)
+           program_context_put (self, "log-file", optarg); 
+         else if (strcmp (long_options[option_index].name, 
+             "access-log") == 0)
+           program_context_put (self, "access-log", optarg); 
          else if (strcmp (long_options[option_index].name, "xshost") == 0)
            program_context_put (self, "xshost", optarg); 
          else if (strcmp (long_options[option_index].name, "gxsradio") == 0)
@@ -18,14 +18,19 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <microhttpd.h>
 #include "defs.h" 
 #include "log.h" 
 #include "path.h" 
 #include "request_handler.h" 
+#include "httputil.h" 
 #include "api_request_handler.h" 
 #include "gui_request_handler.h" 
 #include "wstring.h" 
+#include "facade.h" 
+#include "page_cache.h" 
+#include "scanner.h" 
 
 #define ERR_NOT_FOUND    "Not found\n"
 #define ERR_NOT_MODIFIED "Not changed\n"
@@ -41,14 +46,23 @@ struct _RequestHandler
   const ProgramContext *context;
   const char *index_file;
   time_t build_datetime;
+  uint64_t warm_index_generation;
   }; 
 
 
+// Some files are also embedded compressed -- see ZIPDOCS in the 
+//   Makefile -- in which case gz_start, and perhaps br_start, are not NULL.
+//   uri is filled in by request_handler_make_int_uris()
 typedef struct 
   {
   const char *filename;
   const uint8_t *start;
   const uint8_t *end;
+  const uint8_t *gz_start;
+  const uint8_t *gz_end;
+  const uint8_t *br_start;
+  const uint8_t *br_end;
+  char *uri;
   } FileData;
 
 extern uint8_t default_cover_png_start[] asm("_binary_docroot_default_cover_png_start");
@@ -80,26 +94,59 @@ extern uint8_t menu_icon_png_end[]   asm("_binary_docroot_menu_icon_png_end");
 extern uint8_t spk_png_start[] asm("_binary_docroot_spk_png_start");
 extern uint8_t spk_png_end[]   asm("_binary_docroot_spk_png_end");
 
+extern uint8_t favicon_ico_gz_start[] asm("_binary_build_docroot_favicon_ico_gz_start");
+extern uint8_t favicon_ico_gz_end[]   asm("_binary_build_docroot_favicon_ico_gz_end");
+extern uint8_t main_css_gz_start[] asm("_binary_build_docroot_main_css_gz_start");
+extern uint8_t main_css_gz_end[]   asm("_binary_build_docroot_main_css_gz_end");
+extern uint8_t functions_js_gz_start[] asm("_binary_build_docroot_functions_js_gz_start");
+extern uint8_t functions_js_gz_end[]   asm("_binary_build_docroot_functions_js_gz_end");
+
+#ifdef XSX_BROTLI_DOCS
+extern uint8_t favicon_ico_br_start[] asm("_binary_build_docroot_favicon_ico_br_start");
+extern uint8_t favicon_ico_br_end[]   asm("_binary_build_docroot_favicon_ico_br_end");
+extern uint8_t main_css_br_start[] asm("_binary_build_docroot_main_css_br_start");
+extern uint8_t main_css_br_end[]   asm("_binary_build_docroot_main_css_br_end");
+extern uint8_t functions_js_br_start[] asm("_binary_build_docroot_functions_js_br_start");
+extern uint8_t functions_js_br_end[]   asm("_binary_build_docroot_functions_js_br_end");
+#define BR(name) name##_br_start, name##_br_end
+#else
+#define BR(name) NULL, NULL
+#endif
+
 
 static FileData fileData[] = 
   {
-  { "default_cover.png", default_cover_png_start, default_cover_png_end },
-  { "logo.png", logo_png_start, logo_png_end },
-  { "index.html", index_html_start, index_html_end },
-  { "favico.ico", favicon_ico_start, favicon_ico_end },
-  { "main.css", main_css_start, main_css_end },
-  { "functions.js", functions_js_start, functions_js_end },
-  { "stopbutton.png", stopbutton_png_start, stopbutton_png_end },
-  { "playbutton.png", playbutton_png_start, playbutton_png_end },
-  { "pausebutton.png", pausebutton_png_start, pausebutton_png_end },
-  { "nextbutton.png", nextbutton_png_start, nextbutton_png_end },
-  { "prevbutton.png", prevbutton_png_start, prevbutton_png_end },
-  { "caption_logo.png", caption_logo_png_start, caption_logo_png_end },
-  { "menu_icon.png", menu_icon_png_start, menu_icon_png_end },
-  { "spk.png", spk_png_start, spk_png_end },
-  { NULL, NULL, NULL } 
+  { "default_cover.png", default_cover_png_start, default_cover_png_end,
+    NULL, NULL, NULL, NULL },
+  { "logo.png", logo_png_start, logo_png_end, NULL, NULL, NULL, NULL },
+  { "index.html", index_html_start, index_html_end, 
+    NULL, NULL, NULL, NULL },
+  { "favicon.ico", favicon_ico_start, favicon_ico_end,
+    favicon_ico_gz_start, favicon_ico_gz_end, BR(favicon_ico) },
+  { "main.css", main_css_start, main_css_end,
+    main_css_gz_start, main_css_gz_end, BR(main_css) },
+  { "functions.js", functions_js_start, functions_js_end,
+    functions_js_gz_start, functions_js_gz_end, BR(functions_js) },
+  { "stopbutton.png", stopbutton_png_start, stopbutton_png_end, 
+    NULL, NULL, NULL, NULL },
+  { "playbutton.png", playbutton_png_start, playbutton_png_end, 
+    NULL, NULL, NULL, NULL },
+  { "pausebutton.png", pausebutton_png_start, pausebutton_png_end, 
+    NULL, NULL, NULL, NULL },
+  { "nextbutton.png", nextbutton_png_start, nextbutton_png_end, 
+    NULL, NULL, NULL, NULL },
+  { "prevbutton.png", prevbutton_png_start, prevbutton_png_end, 
+    NULL, NULL, NULL, NULL },
+  { "caption_logo.png", caption_logo_png_start, caption_logo_png_end, 
+    NULL, NULL, NULL, NULL },
+  { "menu_icon.png", menu_icon_png_start, menu_icon_png_end, 
+    NULL, NULL, NULL, NULL },
+  { "spk.png", spk_png_start, spk_png_end, NULL, NULL, NULL, NULL },
+  { NULL, NULL, NULL, NULL, NULL, NULL, NULL } 
   };
 
+static pthread_once_t request_handler_int_uris_once = PTHREAD_ONCE_INIT;
+
 /*============================================================================
 
   request_handler_create
@@ -117,6 +164,7 @@ RequestHandler *request_handler_create (const char *_root,
   self->context = context;
   self->index_file = program_context_get (context, "index");
   self->build_datetime = atol (BUILD_DATETIME);
+  self->warm_index_generation = 0;
   LOG_OUT 
   return self;
   }
@@ -185,26 +233,101 @@ const char *request_handler_get_mime_type (const char *path)
   LOG_OUT
   }
 
+/*============================================================================
+
+  request_handler_make_int_uris
+
+  Give each built-in file a URI with a hash of its contents, e.g.,
+  /int/main.0123456789ab.css. Any change to the file changes the URI, so
+  the file can be cached by the browser for as long as it likes
+
+============================================================================*/
+static void request_handler_make_int_uris (void)
+  {
+  LOG_IN
+  for (FileData *fd = fileData; fd->filename; fd++)
+    {
+    uint64_t h = request_handler_hash (REQUEST_HANDLER_HASH_INIT, 
+      fd->start, fd->end - fd->start);
+    const char *ext = strrchr (fd->filename, '.');
+    if (!ext) ext = fd->filename + strlen (fd->filename);
+    int len = strlen (INT_FILE_BASE) + strlen (fd->filename) + 14;
+    fd->uri = malloc (len);
+    snprintf (fd->uri, len, "%s%.*s.%012llx%s", INT_FILE_BASE, 
+      (int)(ext - fd->filename), fd->filename, 
+      (unsigned long long)(h >> 16), ext);
+    }
+  LOG_OUT
+  }
+
+/*============================================================================
+
+  request_handler_get_int_uri
+
+============================================================================*/
+const char *request_handler_get_int_uri (const char *filename)
+  {
+  LOG_IN
+  pthread_once (&request_handler_int_uris_once, 
+    request_handler_make_int_uris);
+  const char *ret = NULL;
+  for (FileData *fd = fileData; fd->filename && !ret; fd++)
+    {
+    if (strcmp (filename, fd->filename) == 0)
+      ret = fd->uri;
+    }
+  LOG_OUT
+  return ret;
+  }
+
 /*============================================================================
 
   request_handler_get_int_file
 
+  A file can be requested by its plain name, or by the URI with its
+  hash, in which case *immutable is set TRUE. 
+  Brotli is preferred to gzip if the client will accept both -- it
+  is smaller, and costs nothing to decompress. *content_encoding is
+  set to NULL if the file is not compressed
+
 ============================================================================*/
-BOOL request_handler_get_int_file (const char *uri, const uint8_t **buff, 
-       size_t *size)
+BOOL request_handler_get_int_file (const char *uri, 
+       const char *accept_encoding, const uint8_t **buff, size_t *size, 
+       const char **content_encoding, BOOL *immutable)
   { 
   LOG_IN
+  pthread_once (&request_handler_int_uris_once, 
+    request_handler_make_int_uris);
   *buff = NULL; 
+  *content_encoding = NULL;
   BOOL ret = FALSE;
   int i = 0;
   FileData *fd = &fileData[i];
   while (fd->filename && ret == FALSE) 
    {
-   if (strcmp (uri, fd->filename) == 0)
+   *immutable = strcmp (uri, fd->uri + strlen (INT_FILE_BASE)) == 0;
+   if (*immutable || strcmp (uri, fd->filename) == 0)
      {
      ret = TRUE;
-     *buff = fd->start;
-     *size = fd->end - fd->start;
+     if (fd->br_start && accept_encoding 
+         && httputil_accepts_encoding (accept_encoding, "br"))
+       {
+       *buff = fd->br_start;
+       *size = fd->br_end - fd->br_start;
+       *content_encoding = "br";
+       }
+     else if (fd->gz_start && accept_encoding 
+         && httputil_accepts_encoding (accept_encoding, "gzip"))
+       {
+       *buff = fd->gz_start;
+       *size = fd->gz_end - fd->gz_start;
+       *content_encoding = "gzip";
+       }
+     else
+       {
+       *buff = fd->start;
+       *size = fd->end - fd->start;
+       }
      }
    i++;
    fd = &fileData[i];
@@ -220,21 +343,25 @@ BOOL request_handler_get_int_file (const char *uri, const uint8_t **buff,
 
 ============================================================================*/
 BOOL request_handler_int_file (RequestHandler *self, const char *uri, 
-        int *code, time_t if_modified, time_t *timestamp, size_t *size, 
-        const uint8_t **buff, char **content_type, char **error)
+        const char *accept_encoding, int *code, time_t if_modified, 
+        time_t *timestamp, size_t *size, const uint8_t **buff, 
+        char **content_type, const char **content_encoding, 
+        BOOL *immutable, char **error)
   {
   LOG_IN
   log_debug ("Internal file request: %s", uri);
 
   BOOL ret = TRUE;
-  if (request_handler_get_int_file (uri, buff, size))
+  if (request_handler_get_int_file (uri, accept_encoding, buff, size,
+        content_encoding, immutable))
     {
-    if  (if_modified == 0 || if_modified <= self->build_datetime)
+    // The built-in files can only change when the program is rebuilt
+    if  (if_modified == 0 || if_modified < self->build_datetime)
       {
       *content_type = strdup 
          (request_handler_get_mime_type ((char *)uri)); 
       *code = 200;
-      *timestamp = time (NULL); // TODO
+      *timestamp = self->build_datetime;
       }
     else
       {
@@ -326,6 +453,62 @@ BOOL request_handler_ext_file (RequestHandler *self, const char *uri,
   return ret;
   }
 
+/*============================================================================
+
+  request_handler_key_sort_fn
+
+============================================================================*/
+static int request_handler_key_sort_fn (const void *p1, const void *p2, 
+       void *user_data)
+  {
+  return strcmp (*(char * const *)p1, *(char * const *)p2);
+  }
+
+/*============================================================================
+
+  request_handler_sorted_keys
+
+  The order of the arguments in the URI makes no difference to the 
+  response, so they are sorted before they are used in a tag or a key
+
+============================================================================*/
+static List *request_handler_sorted_keys (const Props *arguments)
+  {
+  List *keys = props_get_keys (arguments);
+  list_sort (keys, request_handler_key_sort_fn, NULL);
+  return keys;
+  }
+
+/*============================================================================
+
+  request_handler_cache_key
+
+  uri?key=value&key=value..., with the arguments in order. The 
+  arguments are not escaped, but they are separated by characters that 
+  can't appear in a key, and the tag includes them unambiguously
+  anyway
+
+============================================================================*/
+static char *request_handler_cache_key (const char *uri, 
+       const Props *arguments)
+  {
+  String *key = string_create (uri);
+  List *keys = request_handler_sorted_keys (arguments);
+  int l = list_length (keys);
+  for (int i = 0; i < l; i++)
+    {
+    const char *name = list_get (keys, i);
+    string_append (key, i == 0 ? "?" : "&");
+    string_append (key, name);
+    string_append (key, "=");
+    string_append (key, props_get (arguments, name));
+    }
+  list_destroy (keys);
+  char *ret = strdup (string_cstr (key));
+  string_destroy (key);
+  return ret;
+  }
+
 /*============================================================================
 
   request_handler_api
@@ -347,14 +530,223 @@ void request_handler_api (RequestHandler *self, const char *uri,
 
 ============================================================================*/
 void request_handler_gui (RequestHandler *self, const char *uri, 
-       const Props *arguments, int *code, char **page)
+       const Props *arguments, const char *etag, int *code, char **page,
+       PageStream **stream)
   {
   LOG_IN
   log_debug ("GUI request: %s", uri);
   //printf ("GUI request: %s\n", uri);
-  gui_request_handler_handle (self->gui_request_handler, uri, arguments,
-         code, page);
+  char *key = NULL;
+  *page = NULL;
+  if (stream) *stream = NULL;
+  if (etag && page_cache_enabled ())
+    {
+    key = request_handler_cache_key (uri, arguments);
+    *page = page_cache_get (key, etag);
+    *code = 200;
+    }
+  if (!*page)
+    {
+    gui_request_handler_handle (self->gui_request_handler, uri, arguments,
+           code, page, stream);
+    if (key && *code == 200 && *page)
+      page_cache_put (key, etag, *page);
+    }
+  free (key);
+  LOG_OUT
+  }
+
+/*============================================================================
+
+  request_handler_warm_pages
+
+  When the index has changed, and the scanner has finished, the cached
+  pages are all out of date. They are discarded, and the first page of 
+  each browse view is made again at once, so that nobody has to wait
+  for it
+
+============================================================================*/
+void request_handler_warm_pages (RequestHandler *self)
+  {
+  LOG_IN
+  static const char *warm_uris[] = { URI_ALBUMS, URI_ARTISTS, URI_GENRES,
+    URI_COMPOSERS, URI_TRACKS, NULL };
+  uint64_t generation = request_handler_get_index_generation (self);
+  if (self->index_file && page_cache_enabled ()
+      && generation != self->warm_index_generation
+      && access (SCANNER_STATUS_FILE, F_OK) != 0)
+    {
+    log_debug ("Index has changed: warming page cache");
+    page_cache_clear ();
+    Props *arguments = props_create ();
+    for (const char **uri = warm_uris; *uri; uri++)
+      {
+      char etag[REQUEST_HANDLER_ETAG_LEN];
+      if (request_handler_gui_etag (self, *uri, arguments, etag))
+        {
+        int code;
+        char *page;
+        request_handler_gui (self, *uri, arguments, etag, &code, &page, 
+          NULL);
+        free (page);
+        }
+      }
+    props_destroy (arguments);
+    self->warm_index_generation = generation;
+    }
+  LOG_OUT
+  }
+
+/*============================================================================
+
+  request_handler_hash
+
+============================================================================*/
+uint64_t request_handler_hash (uint64_t h, const void *data, size_t len)
+  {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < len; i++)
+    {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+    }
+  return h;
+  }
+
+/*============================================================================
+
+  request_handler_get_index_generation
+
+  The index is an SQLite file, which is rewritten in place, so its
+  modification time, to the nanosecond, and size identify its contents.
+  The inode is included in case it is replaced by a copy 
+
+============================================================================*/
+uint64_t request_handler_get_index_generation (const RequestHandler *self)
+  {
+  LOG_IN
+  uint64_t ret = 0;
+  struct stat sb;
+  if (self->index_file && stat (self->index_file, &sb) == 0)
+    {
+    uint64_t v[] = { sb.st_mtim.tv_sec, sb.st_mtim.tv_nsec, sb.st_size, 
+      sb.st_ino };
+    ret = request_handler_hash (REQUEST_HANDLER_HASH_INIT, v, sizeof (v));
+    }
   LOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  request_handler_get_dir_generation
+
+============================================================================*/
+BOOL request_handler_get_dir_generation (const RequestHandler *self, 
+      const char *dir, uint64_t *generation)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  // Nothing outside the root is listed, so there's nothing to validate
+  if (!strstr (dir, ".."))
+    {
+    Path *path = path_clone (self->root);
+    path_append (path, dir);
+    char *s_path = (char *)path_to_utf8 (path);
+    struct stat sb;
+    if (stat (s_path, &sb) == 0 && S_ISDIR (sb.st_mode))
+      {
+      uint64_t v[] = { sb.st_mtim.tv_sec, sb.st_mtim.tv_nsec, sb.st_ino };
+      *generation = request_handler_hash (REQUEST_HANDLER_HASH_INIT, 
+        v, sizeof (v));
+      ret = TRUE;
+      }
+    free (s_path);
+    path_destroy (path);
+    }
+  LOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  request_handler_make_etag
+
+  The tag is a hash of the request, the build -- because the page 
+  templates are built in -- and the validator, which stands for 
+  whatever data the response is made from
+
+============================================================================*/
+static void request_handler_make_etag (const RequestHandler *self, 
+       const char *base, const char *uri, const Props *arguments, 
+       uint64_t validator, char *etag)
+  {
+  uint64_t h = REQUEST_HANDLER_HASH_INIT;
+  h = request_handler_hash (h, base, strlen (base) + 1);
+  h = request_handler_hash (h, uri, strlen (uri) + 1);
+  List *keys = request_handler_sorted_keys (arguments);
+  int l = list_length (keys);
+  for (int i = 0; i < l; i++)
+    {
+    const char *key = list_get (keys, i);
+    const char *value = props_get (arguments, key);
+    h = request_handler_hash (h, key, strlen (key) + 1);
+    h = request_handler_hash (h, value, strlen (value) + 1);
+    }
+  list_destroy (keys);
+  h = request_handler_hash (h, &self->build_datetime, 
+    sizeof (self->build_datetime));
+  h = request_handler_hash (h, &validator, sizeof (validator));
+  snprintf (etag, REQUEST_HANDLER_ETAG_LEN, "\"%016llx\"", 
+    (unsigned long long)h);
+  }
+
+/*============================================================================
+
+  request_handler_api_etag
+
+============================================================================*/
+BOOL request_handler_api_etag (RequestHandler *self, const char *uri, 
+      const Props *arguments, char *etag)
+  {
+  LOG_IN
+  uint64_t validator = 0;
+  BOOL ret = api_request_handler_validator (self->api_request_handler, 
+    uri, arguments, &validator);
+  if (ret)
+    request_handler_make_etag (self, "api", uri, arguments, validator, etag);
+  LOG_OUT
+  return ret;
+  }
+
+/*============================================================================
+
+  request_handler_api_done
+
+============================================================================*/
+void request_handler_api_done (RequestHandler *self)
+  {
+  LOG_IN
+  api_request_handler_discard (self->api_request_handler);
+  LOG_OUT
+  }
+
+/*============================================================================
+
+  request_handler_gui_etag
+
+============================================================================*/
+BOOL request_handler_gui_etag (RequestHandler *self, const char *uri, 
+       const Props *arguments, char *etag)
+  {
+  LOG_IN
+  uint64_t validator = 0;
+  BOOL ret = gui_request_handler_validator (self->gui_request_handler, 
+    uri, arguments, &validator);
+  if (ret)
+    request_handler_make_etag (self, "gui", uri, arguments, validator, etag);
+  LOG_OUT
+  return ret;
   }
 
 /*============================================================================
@@ -8,10 +8,19 @@
 
 #pragma once
 
+#include <stdint.h>
 #include "defs.h"
 #include "props.h"
+#include "page_stream.h"
 #include "program_context.h"
 
+// Starting value for request_handler_hash()
+#define REQUEST_HANDLER_HASH_INIT 14695981039346656037ULL
+
+// Room for an entity tag made by request_handler_api_etag() or
+//   request_handler_gui_etag(), with its quotes
+#define REQUEST_HANDLER_ETAG_LEN 24
+
 struct _RequestHandler;
 typedef struct _RequestHandler RequestHandler;
 
@@ -31,15 +40,74 @@ BOOL request_handler_ext_file (RequestHandler *self, const char *uri,
         int *code, time_t if_modified, time_t *timestamp, size_t *size, 
         int *fd, char **content_type, char **error);
 
+/** Handle a built-in file, in the same way as request_handler_ext_file().
+    If a compressed form of the file is built in, and accept_encoding --
+    the value of the client's Accept-Encoding header, which may be NULL --
+    allows it, that is returned instead, and *content_encoding is set
+    to the encoding. Otherwise *content_encoding is set to NULL. 
+    *immutable is set TRUE if the file was requested by the URI that
+    request_handler_get_int_uri() gives, and so can be cached forever. */
 BOOL request_handler_int_file (RequestHandler *self, const char *uri, 
-        int *code, time_t if_modified, time_t *timestamp, size_t *size, 
-        const uint8_t **buff, char **content_type, char **error);
+        const char *accept_encoding, int *code, time_t if_modified, 
+        time_t *timestamp, size_t *size, const uint8_t **buff, 
+        char **content_type, const char **content_encoding, 
+        BOOL *immutable, char **error);
+
+/** Get the URI by which the built-in file filename should be requested,
+    which includes a hash of the file's contents, or NULL if there is
+    no such file. Pages should use this, not INT_FILE_BASE + filename, 
+    so that the file can be cached. */
+const char *request_handler_get_int_uri (const char *filename);
 
 void request_handler_api (RequestHandler *self, const char *uri, 
       const Props *arguments, int *code, char **buff);
 
+/** Produce a GUI page. etag is the page's tag, from 
+    request_handler_gui_etag(), or NULL if it has none. Pages with tags
+    are cached. If stream is not NULL, a large page may be returned as
+    a stream instead, in which case buff is set to NULL -- see
+    gui_request_handler_handle(). Streamed pages are not cached. */
 void request_handler_gui (RequestHandler *self, const char *uri, 
-       const Props *arguments, int *code, char **buff);
+       const Props *arguments, const char *etag, int *code, char **buff,
+       PageStream **stream);
+
+/** If the index has changed since this was last called, and is not 
+    being scanned, discard the cached pages, and cache the first page
+    of each browse view again. This is called regularly from the main 
+    loop. */
+void request_handler_warm_pages (RequestHandler *self);
+
+/** Make an entity tag for an API or GUI request, from the things that 
+    the response depends on, without producing the response. This is 
+    cheap enough to do on every request, so that a client that already 
+    has the response can be told so before any work is done. Returns 
+    FALSE if the response can't be validated this way, and must always 
+    be sent in full. etag must have room for REQUEST_HANDLER_ETAG_LEN 
+    characters. */
+BOOL request_handler_api_etag (RequestHandler *self, const char *uri, 
+      const Props *arguments, char *etag);
+
+BOOL request_handler_gui_etag (RequestHandler *self, const char *uri, 
+       const Props *arguments, char *etag);
+
+/** Finish an API request whose tag was made by 
+    request_handler_api_etag(). The data that the tag was made from 
+    may be kept until the response is produced, so this must be called 
+    whether it was or not. */
+void request_handler_api_done (RequestHandler *self);
+
+/** Continue a 64-bit FNV-1a hash, starting from h, over len bytes. */
+uint64_t request_handler_hash (uint64_t h, const void *data, size_t len);
+
+/** A number that changes whenever the index file is written -- zero
+    if there is no index. */
+uint64_t request_handler_get_index_generation (const RequestHandler *self);
+
+/** Get a number that changes whenever an entry is added to or removed
+    from the directory dir, relative to the root. Returns FALSE if
+    dir is not a directory. */
+BOOL request_handler_get_dir_generation (const RequestHandler *self, 
+      const char *dir, uint64_t *generation);
 
 BOOL request_handler_shutdown_requested (const RequestHandler *self);
 
@@ -23,6 +23,8 @@
 #include "audio_metainfo.h" 
 #include "scanner.h" 
 #include "mimebuffer.h" 
+#include "parse_cache.h" 
+#include "tag_reader.h" 
 
 typedef struct _ScannerIteratorContext 
   {
@@ -53,6 +55,10 @@ void scanner_insert_db (Database *database, const char *path,
     audio_metainfo_get_track (ami),
     audio_metainfo_get_comment (ami),
     audio_metainfo_get_year (ami),
+    audio_metainfo_get_duration (ami),
+    audio_metainfo_get_bitrate (ami),
+    audio_metainfo_get_sample_rate (ami),
+    audio_metainfo_get_channels (ami),
     &error
     );
 
@@ -115,9 +121,9 @@ BOOL scanner_write_cover (const MimeBuffer *cover, const Path *thispath,
   scanner_scan
 
 ==========================================================================*/
-static void scanner_scan (Database *database, const Path *root, 
-       const char *dir, BOOL full_scan, int *scanned, int *added,
-       int *modified, int *extracted)
+static void scanner_scan (Database *database, ParseCache *cache,
+       const Path *root, const char *dir, BOOL full_scan, int *scanned, 
+       int *added, int *modified, int *extracted)
   {
   LOG_IN
 
@@ -212,7 +218,8 @@ static void scanner_scan (Database *database, const Path *root,
 	        {
 		char *error = NULL;
 		AudioMetaInfo *ami = audio_metainfo_create(); 
-                if (audio_metainfo_get_from_path (ami, s_p2, &error))
+                if (audio_metainfo_get_from_path_cached (ami, s_p2, cache,
+                      !has_cover, &error))
 		  {
 		  scanner_insert_db (database, s_p3, ami); 
 
@@ -258,8 +265,8 @@ static void scanner_scan (Database *database, const Path *root,
 	  } 
 	else if (path_is_directory (p2))
 	  {
-          scanner_scan (database, root, s_p3, full_scan, scanned, added,
-	    modified, extracted);
+          scanner_scan (database, cache, root, s_p3, full_scan, scanned, 
+            added, modified, extracted);
 	  }
 	path_destroy (p2); 
 	free (s_p2);
@@ -354,20 +361,49 @@ int scanner_scan_files (ProgramContext *context)
 
   if (ok)
     {
-    // Database open -- do the scan
+    // Database open -- do the scan. The parse cache is optional; if it
+    //   can't be opened, we just read every file
+    char *cachefile = NULL;
+    asprintf (&cachefile, "%s.cache", index);
+    ParseCache *cache = parse_cache_create (cachefile);
+    free (cachefile);
+    if (!parse_cache_open (cache, &error))
+      {
+      log_warning ("Not using parse cache: %s", error);
+      free (error);
+      error = NULL;
+      parse_cache_destroy (cache);
+      cache = NULL;
+      }
+
     Path *rootpath = path_create (root);
     int scanned = 0;
     int added = 0;
     int modified = 0;
     int extracted = 0;
-    scanner_scan (db, rootpath, "", full_scan, &scanned, &added,
+    scanner_scan (db, cache, rootpath, "", full_scan, &scanned, &added,
       &modified, &extracted);
     path_destroy (rootpath);
     log_info ("Files scanned: %d", scanned);
     log_info ("Entries added to index: %d", added);
     log_info ("Index entries updated: %d", modified);
     log_info ("Cover images extracted: %d", extracted);
+    const TagID3v2Counters *c = &tag_id3v2_counters;
+    log_debug ("ID3v2 tags read: %d; unsynchronised: %d, extended header: "
+      "%d, footer: %d, frames skipped: %d", c->tags, c->unsync, 
+      c->ext_header, c->footer, c->frames_skipped);
     scanner_write_status (scanned, added, modified, 0, extracted);
+
+    if (cache)
+      {
+      log_info ("Parse cache hits: %d, misses: %d", 
+        parse_cache_get_hits (cache), parse_cache_get_misses (cache));
+      // A full scan has looked at every file, so anything in the cache
+      //   that it did not use refers to a file that no longer exists,
+      //   or has changed
+      if (full_scan) parse_cache_compact (cache);
+      parse_cache_destroy (cache);
+      }
     }
 
   database_close (db);
@@ -0,0 +1,514 @@
+/*============================================================================
+
+  xine-server-x
+  status_poller.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Every page of the web interface asks for the playback status every few
+  seconds, and each request would otherwise cost two round trips to
+  xine-server. Instead, a single thread polls xine-server at a fixed
+  rate, and the result is published as a reference-counted snapshot
+  that is never modified once published. A new snapshot replaces the
+  old one by swapping a pointer; the old one is freed when the last
+  reader releases it. The mutex protects only the pointer swap and the
+  reference count increment, never the round trip to xine-server, so
+  readers are not held up by a slow poll.
+
+  Long-polling clients can block in status_poller_wait() or, if they
+  must not tie up a thread, register a callback that is called when
+  the generation changes, with status_poller_add_waiter(). 
+
+  When a transport command is sent, the status it affects will be
+  out of date until the next poll. status_poller_poke() brings the next
+  poll forward, and readers that arrive after the poke wait for it to
+  complete rather than getting the stale snapshot.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "defs.h"
+#include "log.h"
+#include "facade.h"
+#include "playlist_mirror.h"
+#include "status_poller.h"
+
+// Longest time a reader will wait for a poll it has asked for. After
+//   this, it gets whatever snapshot is current
+#define STATUS_POLLER_MAX_WAIT 5000
+
+struct _StatusSnapshot
+  {
+  int refcount;
+  uint64_t generation;
+  int error_code;
+  char *error_message;
+  PlaybackStatus *status;
+  uint64_t playlist_generation;
+  };
+
+typedef struct _StatusPollerWaiter
+  {
+  struct _StatusPollerWaiter *next;
+  uint64_t since;
+  struct timespec deadline;
+  StatusPollerWakeFn fn;
+  void *data;
+  } StatusPollerWaiter;
+
+static pthread_mutex_t status_poller_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t status_poller_wake;
+static pthread_cond_t status_poller_published;
+static pthread_t status_poller_thread;
+static BOOL status_poller_running = FALSE;
+static BOOL status_poller_stop_requested = FALSE;
+static int status_poller_interval = STATUS_POLLER_DEF_INTERVAL;
+static StatusSnapshot *status_poller_current = NULL;
+// The number of pokes so far, and the value this had when the poll
+//   whose results are current was started. A reader has an up-to-date
+//   snapshot when served catches up with the value pokes had when the
+//   reader arrived
+static uint64_t status_poller_pokes = 0;
+static uint64_t status_poller_served = 0;
+// Registered by status_poller_add_waiter(), in no particular order
+static StatusPollerWaiter *status_poller_waiters = NULL;
+// Time the playlist mirror was last compared with xine-server. Used
+//   only by the poller thread
+static time_t status_poller_last_verify = 0;
+
+/*==========================================================================
+
+  status_poller_deadline
+
+  Get the absolute time, on the monotonic clock, msec from now
+
+==========================================================================*/
+static void status_poller_deadline (struct timespec *ts, int msec)
+  {
+  clock_gettime (CLOCK_MONOTONIC, ts);
+  ts->tv_sec += msec / 1000;
+  ts->tv_nsec += (long)(msec % 1000) * 1000000L;
+  if (ts->tv_nsec >= 1000000000L)
+    {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000L;
+    }
+  }
+
+/*==========================================================================
+
+  status_poller_take_waiters
+
+  Unlink the waiters that should stop waiting -- all of them, if all is
+  TRUE -- and return them as a list, so that they can be woken once the
+  mutex has been released. Must be called with the mutex held
+
+==========================================================================*/
+static StatusPollerWaiter *status_poller_take_waiters (BOOL all)
+  {
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  uint64_t generation = status_poller_current 
+    ? status_poller_current->generation : 0;
+  StatusPollerWaiter *taken = NULL;
+  StatusPollerWaiter **link = &status_poller_waiters;
+  while (*link)
+    {
+    StatusPollerWaiter *w = *link;
+    if (all || (status_poller_current && w->since != generation)
+        || now.tv_sec > w->deadline.tv_sec 
+        || (now.tv_sec == w->deadline.tv_sec 
+          && now.tv_nsec >= w->deadline.tv_nsec))
+      {
+      *link = w->next;
+      w->next = taken;
+      taken = w;
+      }
+    else
+      link = &w->next;
+    }
+  return taken;
+  }
+
+/*==========================================================================
+
+  status_poller_wake_waiters
+
+  Call and free the waiters returned by status_poller_take_waiters()
+
+==========================================================================*/
+static void status_poller_wake_waiters (StatusPollerWaiter *w)
+  {
+  while (w)
+    {
+    StatusPollerWaiter *next = w->next;
+    w->fn (w->data);
+    free (w);
+    w = next;
+    }
+  }
+
+/*==========================================================================
+
+  status_poller_changed
+
+  Returns TRUE if the new snapshot is different enough from the old
+  one to need a new generation number
+
+==========================================================================*/
+static BOOL status_poller_changed (const StatusSnapshot *old,
+    const StatusSnapshot *new)
+  {
+  if ((old->error_code == 0) != (new->error_code == 0)) return TRUE;
+  if (old->playlist_generation != new->playlist_generation) return TRUE;
+  if (new->error_code != 0) return FALSE;
+  const PlaybackStatus *s1 = old->status;
+  const PlaybackStatus *s2 = new->status;
+  if (playback_status_get_ts (s1) != playback_status_get_ts (s2))
+    return TRUE;
+  if (playback_status_get_playlist_index (s1)
+       != playback_status_get_playlist_index (s2))
+    return TRUE;
+  if (playback_status_get_volume (s1) != playback_status_get_volume (s2))
+    return TRUE;
+  const char *t1 = playback_status_get_title (s1);
+  const char *t2 = playback_status_get_title (s2);
+  if (!t1 || !t2) return t1 != t2;
+  return strcmp (t1, t2) != 0;
+  }
+
+/*==========================================================================
+
+  status_poller_fetch
+
+  Make a new snapshot from the current xine-server status. The
+  snapshot's single reference is owned by the caller
+
+==========================================================================*/
+static StatusSnapshot *status_poller_fetch (void)
+  {
+  StatusSnapshot *self = malloc (sizeof (StatusSnapshot));
+  self->refcount = 1;
+  self->generation = 0;
+  self->error_code = 0;
+  self->error_message = NULL;
+  self->status = NULL;
+  self->playlist_generation = 0;
+  facade_get_playback_status (&self->error_code, &self->error_message,
+    &self->status);
+
+  // The playlist mirror is checked here because the status gives us
+  //   the length of xine-server's playlist for nothing. A length that
+  //   does not match, or a mirror that has never been filled, is
+  //   dealt with at once; otherwise the whole playlist is compared 
+  //   now and again
+  time_t now = time (NULL);
+  if (self->error_code == 0 
+      && (playlist_mirror_get_length () 
+          != playback_status_get_playlist_length (self->status)
+        || now - status_poller_last_verify 
+          >= PLAYLIST_MIRROR_VERIFY_INTERVAL))
+    {
+    int error_code = 0;
+    char *error_message = NULL;
+    if (!facade_verify_playlist (&error_code, &error_message))
+      free (error_message);
+    status_poller_last_verify = now;
+    }
+  self->playlist_generation = playlist_mirror_get_generation ();
+  return self;
+  }
+
+/*==========================================================================
+
+  status_poller_run
+
+  The poller thread
+
+==========================================================================*/
+static void *status_poller_run (void *arg)
+  {
+  (void)arg;
+  pthread_mutex_lock (&status_poller_mutex);
+  while (!status_poller_stop_requested)
+    {
+    uint64_t serving = status_poller_pokes;
+    pthread_mutex_unlock (&status_poller_mutex);
+
+    StatusSnapshot *snapshot = status_poller_fetch ();
+    if (snapshot->error_code != 0)
+      log_debug ("Status poll failed: %s", snapshot->error_message
+        ? snapshot->error_message : "unknown error");
+
+    pthread_mutex_lock (&status_poller_mutex);
+    StatusSnapshot *old = status_poller_current;
+    if (old)
+      snapshot->generation = old->generation
+        + (status_poller_changed (old, snapshot) ? 1 : 0);
+    else
+      snapshot->generation = 1;
+    status_poller_current = snapshot;
+    status_poller_served = serving;
+    pthread_cond_broadcast (&status_poller_published);
+    StatusPollerWaiter *waiters = status_poller_take_waiters (FALSE);
+    pthread_mutex_unlock (&status_poller_mutex);
+
+    status_poller_wake_waiters (waiters);
+    if (old) status_poller_release (old);
+
+    pthread_mutex_lock (&status_poller_mutex);
+    struct timespec deadline;
+    status_poller_deadline (&deadline, status_poller_interval);
+    int rc = 0;
+    while (!status_poller_stop_requested && rc != ETIMEDOUT
+        && status_poller_pokes == status_poller_served)
+      {
+      rc = pthread_cond_timedwait (&status_poller_wake,
+        &status_poller_mutex, &deadline);
+      }
+    }
+  pthread_mutex_unlock (&status_poller_mutex);
+  return NULL;
+  }
+
+/*==========================================================================
+
+  status_poller_start
+
+==========================================================================*/
+void status_poller_start (int interval_msec)
+  {
+  LOG_IN
+  if (interval_msec < STATUS_POLLER_MIN_INTERVAL)
+    interval_msec = STATUS_POLLER_MIN_INTERVAL;
+
+  pthread_condattr_t attr;
+  pthread_condattr_init (&attr);
+  pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+  pthread_cond_init (&status_poller_wake, &attr);
+  pthread_cond_init (&status_poller_published, &attr);
+  pthread_condattr_destroy (&attr);
+
+  status_poller_interval = interval_msec;
+  status_poller_stop_requested = FALSE;
+  // Readers wait for the first poll, rather than getting no status
+  status_poller_pokes = 1;
+  status_poller_served = 0;
+  status_poller_running = TRUE;
+  if (pthread_create (&status_poller_thread, NULL,
+        status_poller_run, NULL) == 0)
+    {
+    log_info ("Polling xine-server status every %d msec", interval_msec);
+    }
+  else
+    {
+    log_error ("Can't start status poller thread");
+    status_poller_running = FALSE;
+    }
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  status_poller_stop
+
+==========================================================================*/
+void status_poller_stop (void)
+  {
+  LOG_IN
+  if (status_poller_running)
+    {
+    pthread_mutex_lock (&status_poller_mutex);
+    status_poller_stop_requested = TRUE;
+    status_poller_running = FALSE;
+    pthread_cond_signal (&status_poller_wake);
+    pthread_cond_broadcast (&status_poller_published);
+    pthread_mutex_unlock (&status_poller_mutex);
+
+    pthread_join (status_poller_thread, NULL);
+
+    pthread_mutex_lock (&status_poller_mutex);
+    StatusSnapshot *old = status_poller_current;
+    status_poller_current = NULL;
+    StatusPollerWaiter *waiters = status_poller_take_waiters (TRUE);
+    pthread_mutex_unlock (&status_poller_mutex);
+    status_poller_wake_waiters (waiters);
+    if (old) status_poller_release (old);
+    }
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  status_poller_poke
+
+==========================================================================*/
+void status_poller_poke (void)
+  {
+  LOG_IN
+  pthread_mutex_lock (&status_poller_mutex);
+  if (status_poller_running)
+    {
+    status_poller_pokes++;
+    pthread_cond_signal (&status_poller_wake);
+    }
+  pthread_mutex_unlock (&status_poller_mutex);
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  status_poller_get
+
+==========================================================================*/
+StatusSnapshot *status_poller_get (void)
+  {
+  LOG_IN
+  StatusSnapshot *ret = NULL;
+  pthread_mutex_lock (&status_poller_mutex);
+  if (status_poller_running)
+    {
+    uint64_t wanted = status_poller_pokes;
+    if (wanted > status_poller_served)
+      {
+      struct timespec deadline;
+      status_poller_deadline (&deadline, STATUS_POLLER_MAX_WAIT);
+      int rc = 0;
+      while (status_poller_running && rc != ETIMEDOUT
+          && status_poller_served < wanted)
+        {
+        rc = pthread_cond_timedwait (&status_poller_published,
+          &status_poller_mutex, &deadline);
+        }
+      }
+    ret = status_poller_current;
+    if (ret) __atomic_add_fetch (&ret->refcount, 1, __ATOMIC_RELAXED);
+    }
+  pthread_mutex_unlock (&status_poller_mutex);
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  status_poller_wait
+
+==========================================================================*/
+StatusSnapshot *status_poller_wait (uint64_t since, int timeout_msec)
+  {
+  LOG_IN
+  StatusSnapshot *ret = NULL;
+  pthread_mutex_lock (&status_poller_mutex);
+  if (status_poller_running)
+    {
+    struct timespec deadline;
+    status_poller_deadline (&deadline, timeout_msec);
+    int rc = 0;
+    // A client that has a generation from before a restart will have
+    //   a number larger than ours; it gets the current status at once
+    while (status_poller_running && rc != ETIMEDOUT
+        && (!status_poller_current
+          || status_poller_current->generation == since))
+      {
+      rc = pthread_cond_timedwait (&status_poller_published,
+        &status_poller_mutex, &deadline);
+      }
+    ret = status_poller_current;
+    if (ret) __atomic_add_fetch (&ret->refcount, 1, __ATOMIC_RELAXED);
+    }
+  pthread_mutex_unlock (&status_poller_mutex);
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  status_poller_add_waiter
+
+==========================================================================*/
+BOOL status_poller_add_waiter (uint64_t since, int timeout_msec,
+       StatusPollerWakeFn fn, void *data)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  pthread_mutex_lock (&status_poller_mutex);
+  // If there is no snapshot yet, the first poll will wake the waiter
+  if (status_poller_running && (!status_poller_current 
+        || status_poller_current->generation == since))
+    {
+    StatusPollerWaiter *w = malloc (sizeof (StatusPollerWaiter));
+    w->since = since;
+    status_poller_deadline (&w->deadline, timeout_msec);
+    w->fn = fn;
+    w->data = data;
+    w->next = status_poller_waiters;
+    status_poller_waiters = w;
+    ret = TRUE;
+    }
+  pthread_mutex_unlock (&status_poller_mutex);
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  status_poller_release
+
+==========================================================================*/
+void status_poller_release (StatusSnapshot *self)
+  {
+  LOG_IN
+  if (__atomic_sub_fetch (&self->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+    if (self->status) playback_status_destroy (self->status);
+    free (self->error_message);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  status_snapshot_get_error_code
+
+==========================================================================*/
+int status_snapshot_get_error_code (const StatusSnapshot *self)
+  {
+  return self->error_code;
+  }
+
+/*==========================================================================
+
+  status_snapshot_get_error_message
+
+==========================================================================*/
+const char *status_snapshot_get_error_message (const StatusSnapshot *self)
+  {
+  return self->error_message;
+  }
+
+/*==========================================================================
+
+  status_snapshot_get_status
+
+==========================================================================*/
+const PlaybackStatus *status_snapshot_get_status (const StatusSnapshot *self)
+  {
+  return self->status;
+  }
+
+/*==========================================================================
+
+  status_snapshot_get_generation
+
+==========================================================================*/
+uint64_t status_snapshot_get_generation (const StatusSnapshot *self)
+  {
+  return self->generation;
+  }
+
@@ -0,0 +1,92 @@
+/*============================================================================
+
+  xine-server-x
+  status_poller.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  A background thread that fetches the playback status from xine-server
+  at a fixed rate, and publishes it as an immutable snapshot that can
+  be shared by any number of HTTP clients. See status_poller.c for
+  details.
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+#include "playback_status.h"
+
+#define STATUS_POLLER_DEF_INTERVAL 1000
+#define STATUS_POLLER_MIN_INTERVAL 100
+// Longest time a long-polling client is kept waiting for a change. This
+//   should be shorter than the client's own request timeout
+#define STATUS_POLLER_LONG_POLL_WAIT 25000
+
+struct _StatusSnapshot;
+typedef struct _StatusSnapshot StatusSnapshot;
+
+// Called by the poller thread when a waiter registered by 
+//   status_poller_add_waiter() should stop waiting
+typedef void (*StatusPollerWakeFn) (void *data);
+
+BEGIN_DECLS
+
+/** Start the poller thread, which calls facade_get_playback_status()
+    every interval_msec milliseconds. The facade must already have been
+    created. */
+void            status_poller_start (int interval_msec);
+
+/** Stop the poller thread, and release the current snapshot. This must
+    be called before the facade is destroyed. */
+void            status_poller_stop (void);
+
+/** Tell the poller that the playback status has probably changed --
+    because a transport command has been sent, for example -- so that
+    it should poll again at once. A call to status_poller_get() that
+    follows will not return a snapshot older than this call. */
+void            status_poller_poke (void);
+
+/** Get the most recent snapshot. The caller must release it by calling
+    status_poller_release(), but need not hold any lock while using it.
+    Returns NULL if the poller is not running. */
+StatusSnapshot *status_poller_get (void);
+
+/** Wait until the snapshot generation is different from since, or
+    until timeout_msec has passed, and then return the current snapshot,
+    as status_poller_get() does. This is for clients that want to know
+    when something changes, rather than asking repeatedly. */
+StatusSnapshot *status_poller_wait (uint64_t since, int timeout_msec);
+
+/** A non-blocking form of status_poller_wait(), for callers that must
+    not tie up a thread while they wait. If the poller is running and 
+    the snapshot generation is still since, fn(data) will be called
+    once, from the poller thread, when it changes, when timeout_msec
+    has passed, or when the poller stops, and the return value is TRUE.
+    Otherwise the return value is FALSE, and fn is never called. The
+    timeout is checked only at each poll, so it may be overrun by up
+    to the polling interval. fn must not call back into the poller. */
+BOOL            status_poller_add_waiter (uint64_t since, int timeout_msec,
+                   StatusPollerWakeFn fn, void *data);
+
+void            status_poller_release (StatusSnapshot *snapshot);
+
+/** Returns zero if the status was read successfully, in which case
+    status_snapshot_get_status() will not return NULL. Otherwise the
+    return value is one of the XINESERVER_X_ERR codes. */
+int             status_snapshot_get_error_code (const StatusSnapshot *self);
+
+const char     *status_snapshot_get_error_message
+                   (const StatusSnapshot *self);
+
+const PlaybackStatus *status_snapshot_get_status (const StatusSnapshot *self);
+
+/** The generation increases by one each time the transport state, the
+    playlist position, the title being played, the volume, or the
+    contents of the playlist change, or when the poller starts or stops
+    getting errors from xine-server.
+    Polls that find nothing different do not change it. */
+uint64_t        status_snapshot_get_generation (const StatusSnapshot *self);
+
+END_DECLS
+
@@ -32,6 +32,7 @@
 #include "defs.h" 
 #include "log.h" 
 #include "convertutf.h" 
+#include "utfconv.h" 
 #include "wstring.h" 
 #include "file.h" 
 #include "path.h" 
@@ -465,18 +466,7 @@ void string_trim_right (String *self)
 *==========================================================================*/
 UTF32 *string_utf8_to_utf32 (const UTF8 *_in)
   {
-  const UTF8* in = (UTF8 *)_in;
-  int max_out = strlen ((char *)_in);
-  UTF32 *out = malloc ((max_out + 1) * sizeof (UTF32));
-  memset (out, 0, max_out * sizeof (UTF32));
-  UTF32 *out_temp = out;
-
-  ConvertUTF8toUTF32 ((const UTF8 **)&in, (const UTF8 *)in+strlen((char *)in),
-      &out_temp, out + max_out, 0);
-
-  int len = out_temp - out;
-  out [len] = 0;
-  return out;
+  return utfconv_utf8_to_utf32 (_in, strlen ((char *)_in), NULL);
   }
 
 
@@ -485,15 +475,7 @@ UTF32 *string_utf8_to_utf32 (const UTF8 *_in)
 *==========================================================================*/
 UTF8 *string_utf32_to_utf8 (const UTF32 *_in)
   {
-  const UTF32 *s = _in;
-  String *temp = string_create_empty();
-  int i, l = wstring_length_utf32 (s);
-  for (i = 0; i < l; i++)
-     string_append_c (temp, s[i]);
-
-  char *ret = strdup (string_cstr (temp));
-  string_destroy (temp);
-  return (UTF8 *)ret;
+  return utfconv_utf32_to_utf8 (_in, wstring_length_utf32 (_in), NULL);
   }
 
 
@@ -550,7 +532,7 @@ BOOL string_write_to_path (const String *self, const Path *path)
 /*==========================================================================
   string_split
 
-  Returns a List of String objects. The string is split using strtok(),
+  Returns a List of String objects. The string is split using strtok_r(),
   and so this method has all the limitations that strtok() has. In 
   particular, there's no way to enter an empty token -- multiple delimiters
   are collapsed into one.
@@ -564,14 +546,16 @@ List *string_split (const String *self, const char *delim)
 
   char *s = strdup (self->str);
   
-  char *tok = strtok (s, delim);
+  // strtok_r(), not strtok() -- requests are handled by many threads
+  char *saveptr;
+  char *tok = strtok_r (s, delim, &saveptr);
 
   if (tok)
     {
     do
       {
       list_append (l, string_create (tok));
-      } while ((tok = strtok (NULL, delim)));
+      } while ((tok = strtok_r (NULL, delim, &saveptr)));
     }
 
   free (s);
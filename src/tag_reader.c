@@ -11,8 +11,12 @@ Distributed under the terms of the GNU Public Licence, v3.0
 #include <stdlib.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include "defs.h"
 #include "tag_reader.h"
+#include "utfconv.h"
 
 // Historical file open flag from the Windows days
 #define O_BINARY 0
@@ -24,151 +28,39 @@ BOOL tag_debug = FALSE;
   UNICODE SUPPORT
 *********************************************************************/
 
-/*
- * The following block of code is for converting Unicode formats, and was
- * mercilessly ripped out of the Unicode Consortium's sample code. Please
- * don't ask me how it works, because I don't know. In particular, I am
- * not sure whether we need to take further steps to deal with byte order
- * conversion
- */
-typedef unsigned int _UTF32;
 typedef unsigned short UTF16;
-typedef unsigned char UTF8;
-static const int halfShift  = 10; 
-static const _UTF32 halfBase = 0x0010000UL;
-#define UNI_REPLACEMENT_CHAR (_UTF32)0x0000FFFD
-#define UNI_SUR_HIGH_START  (_UTF32)0xD800
-#define UNI_SUR_HIGH_END    (_UTF32)0xDBFF
-#define UNI_SUR_LOW_START   (_UTF32)0xDC00
-#define UNI_SUR_LOW_END     (_UTF32)0xDFFF
-static const UTF8 firstByteMark[7] = 
-  { 0x00, 0x00, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC };
-
-typedef enum 
-  {
-  conversionOK,   /* conversion successful */
-  sourceExhausted, /* partial character in source, but hit end */
-  targetExhausted, /* insuff. room in target for conversion */
-  sourceIllegal  /* source sequence is illegal/malformed */
-  } UTFConversionResult;
-
-static UTFConversionResult _convert_utf16_to_utf8 (const UTF16** sourceStart, 
-      const UTF16* sourceEnd, UTF8** targetStart, UTF8* targetEnd) 
-{
-  UTFConversionResult result = conversionOK;
-  const UTF16* source = *sourceStart;
-  UTF8* target = *targetStart;
-  while (source < sourceEnd) 
-  {
-    _UTF32 ch;
-    unsigned short bytesToWrite = 0;
-    const _UTF32 byteMask = 0xBF;
-    const _UTF32 byteMark = 0x80; 
-    const UTF16* oldSource = source; 
-    ch = *source++;
-    if (ch >= UNI_SUR_HIGH_START && ch <= UNI_SUR_HIGH_END) 
-     {
-       if (source < sourceEnd) 
-       {
-         _UTF32 ch2 = *source;
-         if (ch2 >= UNI_SUR_LOW_START && ch2 <= UNI_SUR_LOW_END) 
-         {
-           ch = ((ch - UNI_SUR_HIGH_START) << halfShift)
-              + (ch2 - UNI_SUR_LOW_START) + halfBase;
-           ++source;
-         } 
-       } 
-       else 
-       { 
-         --source; 
-         result = sourceExhausted;
-         break;
-       }
-     } 
-     if (ch < (_UTF32)0x80) 
-     {
-         bytesToWrite = 1;
-      } 
-      else if (ch < (_UTF32)0x800) 
-      {     
-        bytesToWrite = 2;
-      } 
-      else if (ch < (_UTF32)0x10000) 
-      {   
-        bytesToWrite = 3;
-      } 
-      else if (ch < (_UTF32)0x110000) 
-      {  
-        bytesToWrite = 4;
-      } 
-      else 
-      {
-         bytesToWrite = 3;
-         ch = UNI_REPLACEMENT_CHAR;
-      }
-
-      target += bytesToWrite;
-      if (target > targetEnd) 
-      {
-        source = oldSource; 
-        target -= bytesToWrite; result = targetExhausted; 
-        break;
-      }
-      switch (bytesToWrite) 
-      { /* note: everything falls through. */
-        case 4: *--target = (UTF8)((ch | byteMark) & byteMask); ch >>= 6;
-        case 3: *--target = (UTF8)((ch | byteMark) & byteMask); ch >>= 6;
-        case 2: *--target = (UTF8)((ch | byteMark) & byteMask); ch >>= 6;
-        case 1: *--target =  (UTF8)(ch | firstByteMark[bytesToWrite]);
-      }
-      target += bytesToWrite;
-    }
-  *sourceStart = source;
-  *targetStart = target;
-  return result;
-}
 
 // Caller must free string returned
-// len is the length in bytes of the UTF16, including the BOM if present
+// len is the length in bytes of the UTF16, including the BOM if present.
+// Without a BOM, ID3v2 specifies big-endian byte order
 static char *tag_convert_utf16_to_utf8 (int has_bom, const UTF16 *s, int len)
 {
-  // Guess final UTF8 size -- not going to be 
-  // more than double the UTF16
-
-  int utf8_len = len * 2;
-  UTF8 *target = (UTF8 *) malloc (utf8_len);   
-  memset (target, 0, utf8_len);
-  UTF8 *t = target;
-
-  // Do we need to swap byte order as well as skipping the BOM? 
-  const UTF16 *start = s;
-
-  int utf16_len; 
-  if (has_bom) 
-    {
-    utf16_len = len / sizeof (UTF16) - 1;
-    start += 1;
-    //utf16_len -= 1;
-    }
-  else
+  const BYTE *b = (const BYTE *)s;
+  BOOL big_endian = !has_bom;
+  if (has_bom && len >= 2 && ((b[0] == 0xFE && b[1] == 0xFF) 
+       || (b[0] == 0xFF && b[1] == 0xFE)))
     {
-    utf16_len = len / sizeof (UTF16);
+    big_endian = (b[0] == 0xFE);
+    b += 2;
+    len -= 2;
     }
 
-  UTFConversionResult ret = _convert_utf16_to_utf8
-    (&start, start + utf16_len, 
-     &t, t + utf8_len);
-  if (ret != conversionOK )
-    strncpy ((char *)target, "Unicode error", utf8_len - 1);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  BOOL swap = !big_endian;
+#else
+  BOOL swap = big_endian;
+#endif
 
-  return (char*) target;
+  return (char *)utfconv_utf16_to_utf8 ((const uint16_t *)b, 
+    len / sizeof (UTF16), swap, NULL);
 }
 
 static unsigned char *tag_convert_iso8859_to_utf8 
   (const unsigned char *s, int len)
 {
-  unsigned char *buff = (unsigned char *) malloc (len * 2); // Worst case
-  memset (buff, 0, len * 2);
+  // Worst case, plus the terminator
+  unsigned char *buff = (unsigned char *) malloc (len * 2 + 1);
+  memset (buff, 0, len * 2 + 1);
   unsigned char *out = buff;
   
   int i = 0;
@@ -182,221 +74,478 @@ static unsigned char *tag_convert_iso8859_to_utf8
 }
 
 /**********************************************************************
-  MP3/ID3v2 SUPPORT
+  STREAM PROPERTIES 
 *********************************************************************/
 
 /*
- * Read the next frame. f is a file handle open at the start of the
- * frame. Version is the ID3v2 major version, i.e for ID3v2.3 it is 3
+ * Returns the size of the open file f, or zero if it can't be 
+ * determined
  */
-static TagResult tag_read_frame (int f, int version, int *carry_on,
-   char **frame_id_ret, unsigned char **data_ret, int *total_bytes, 
-   TagData *tag_data)
+static off_t tag_file_size (int f)
 {
-  unsigned char buff[20];
-  unsigned char frameId[5]; // leave room for a \0
-  unsigned char b1, b2, b3, b4; 
-  int frame_len = 0;
-  int header_len = 0;
-  *frame_id_ret = NULL;
-  *data_ret = NULL;
+  struct stat sb;
+  if (fstat (f, &sb) == 0) return sb.st_size;
+  return 0;
+}
 
-  memset (frameId, 0, sizeof (frameId));
+/*
+ * Work out value * mul / div, for a duration in msec or a bitrate,
+ * without overflowing, however big value is. The result is zero, 
+ * meaning unknown, if it is negative or would not fit in an int, since
+ * only a broken or crafted file could give such a value. div must be
+ * positive, and no more than 2^32
+ */
+static int tag_scale (int64_t value, int mul, int64_t div)
+{
+  if (value < 0 || div <= 0) return 0;
+  int64_t q = value / div;
+  if (q > INT_MAX / mul) return 0;
+  int64_t ret = q * mul + (value % div) * mul / div;
+  return ret > INT_MAX ? 0 : (int)ret;
+}
+
+/*
+ * Fill in the average bitrate from the amount of audio data, if the
+ * format-specific code could not work it out from the headers 
+ */
+static void tag_finish_stream_info (TagData *tag_data, off_t audio_bytes)
+{
+  if (tag_data->bitrate == 0 && tag_data->duration > 0 && audio_bytes > 0)
+    tag_data->bitrate = tag_scale (audio_bytes, 8000, tag_data->duration);
+  if (tag_debug)
+    printf ("Stream: %d msec, %d bps, %d Hz, %d channels\n", 
+      tag_data->duration, tag_data->bitrate, tag_data->sample_rate,
+      tag_data->channels);
+}
+
+static uint32_t tag_decode_32_bit_lsb (const BYTE *s)
+{
+  return (uint32_t)s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16)
+    | ((uint32_t)s[3] << 24);
+}
+
+static uint32_t tag_decode_32_bit_msb (const BYTE *s)
+{
+  return ((uint32_t)s[0] << 24) | ((uint32_t)s[1] << 16) 
+    | ((uint32_t)s[2] << 8) | (uint32_t)s[3];
+}
 
-  if (version >= 3)
+// MPEG audio bitrates in kbit/sec, indexed by the bitrate field
+//  of the frame header. Row 0-2 are MPEG1 layers I-III; row 3 is MPEG2/2.5
+//  layer I, and row 4 MPEG2/2.5 layers II and III
+static const int tag_mpeg_bitrates[5][15] = 
   {
-    // v2.3 has 4 byte ID and 4 byte size, 2 byte flags. Total
-    //  frame header size is 10 
-    header_len = 10;
+  { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+  { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+  { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+  { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+  { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+  };
 
-    if (read (f, frameId, 4) != 4) return TAG_TRUNCATED; 
+// Sample rates for MPEG1; MPEG2 halves these, and MPEG2.5 quarters them
+static const int tag_mpeg_sample_rates[3] = { 44100, 48000, 32000 };
 
-    if (frameId[0] == 0)
-    {
-      if (tag_debug)
-        printf ("Got a null frame ID in v2.3 header\n");
+typedef struct 
+  {
+  int bitrate; // bits per second
+  int sample_rate;
+  int channels;
+  int samples_per_frame;
+  int frame_len; // bytes, including the header
+  int side_len; // offset of the Xing header from the frame start
+  } TagMpegFrame;
 
-      *carry_on = 0; // We've hit something we can't process, but
-                   //  previous data should be OK
-      return TAG_OK;
+/*
+ * Decode a four-byte MPEG audio frame header. Returns FALSE if the 
+ * bytes are not a plausible header. Free-format streams are rejected,
+ * because we can't work out their frame length
+ */
+static BOOL tag_mpeg_parse_header (const BYTE *h, TagMpegFrame *frame)
+{
+  if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0) return FALSE;
+  int version = (h[1] >> 3) & 0x03; // 0 = 2.5, 2 = 2, 3 = 1
+  int layer = 4 - ((h[1] >> 1) & 0x03); // 1..3, or 4 if reserved
+  int bitrate_index = h[2] >> 4;
+  int rate_index = (h[2] >> 2) & 0x03;
+  int padding = (h[2] >> 1) & 0x01;
+  BOOL mono = (h[3] >> 6) == 3;
+
+  if (version == 1 || layer == 4 || bitrate_index == 0 
+      || bitrate_index == 15 || rate_index == 3) return FALSE;
+
+  int row;
+  if (version == 3)
+    row = layer - 1;
+  else
+    row = layer == 1 ? 3 : 4;
+  frame->bitrate = tag_mpeg_bitrates[row][bitrate_index] * 1000;
+  frame->sample_rate = tag_mpeg_sample_rates[rate_index];
+  if (version == 2) frame->sample_rate /= 2;
+  if (version == 0) frame->sample_rate /= 4;
+  frame->channels = mono ? 1 : 2;
+
+  if (layer == 1)
+    {
+    frame->samples_per_frame = 384;
+    frame->frame_len = (12 * frame->bitrate / frame->sample_rate 
+      + padding) * 4;
+    }
+  else if (layer == 2 || version == 3)
+    {
+    frame->samples_per_frame = 1152;
+    frame->frame_len = 144 * frame->bitrate / frame->sample_rate + padding;
+    }
+  else
+    {
+    frame->samples_per_frame = 576;
+    frame->frame_len = 72 * frame->bitrate / frame->sample_rate + padding;
     }
 
-    if (tag_debug)
-      printf ("Found frame of type %s\n", frameId);
+  if (version == 3)
+    frame->side_len = 4 + (mono ? 17 : 32);
+  else
+    frame->side_len = 4 + (mono ? 9 : 17);
 
-    if (read (f, buff, 6) != 6) return TAG_TRUNCATED; 
-    b1 = buff[0];
-    b2 = buff[1];
-    b3 = buff[2];
-    b4 = buff[3];
+  return frame->frame_len >= 4;
+}
+
+/*
+ * Work out the stream properties of MPEG audio data that starts at
+ * (or shortly after) audio_start. If the first frame carries a Xing/Info
+ * or VBRI header, we use its frame count, which is exact even for VBR
+ * streams. The LAME extension to the Xing header tells us how many 
+ * samples of encoder delay and padding to discount. Without any of 
+ * these headers, we have to assume a CBR stream and work out the 
+ * duration from the file size.
+ */
+static BOOL tag_mpeg_stream_info (int f, off_t audio_start, 
+    TagData *tag_data)
+{
+  // Some encoders leave junk between the tag and the first frame, so 
+  //  allow for a little searching 
+  BYTE buff[8192];
+  off_t file_size = tag_file_size (f);
+  if (lseek (f, audio_start, SEEK_SET) != audio_start) return FALSE;
+  int n = read (f, buff, sizeof (buff));
+  if (n < 4) return FALSE;
+
+  TagMpegFrame frame;
+  int pos = -1;
+  for (int i = 0; i + 4 <= n && pos < 0; i++)
+    {
+    if (buff[i] != 0xFF || !tag_mpeg_parse_header (buff + i, &frame)) 
+      continue;
+    // A single sync pattern could be chance. If the following frame 
+    //  is in the buffer, it must also look like a header
+    TagMpegFrame next;
+    int next_pos = i + frame.frame_len;
+    if (next_pos + 4 <= n && !tag_mpeg_parse_header (buff + next_pos, &next))
+      continue;
+    pos = i;
+    }
 
-    // It seems the 2.4 and above use syncsafe lengths in both
-    //  the header and the fields, while earlier versions use
-    //  then only in the header. This is not clear from the specifications.
+  if (pos < 0)
+    {
+    if (tag_debug)
+      printf ("No MPEG frame header found\n");
+    return FALSE;
+    }
 
-    if (version > 3)
-      {
-      // Is this (use of 7bit fields) all we really need to do
-      //  to support sync-safe integers
-      frame_len = (128 * 128 * 128) * b1 + 
-        (128 * 128) * b2 + 
-        (128) * b3 + 
-         b4;
-      }
-    else
+  if (tag_debug)
+    printf ("MPEG frame at %ld: %d bps, %d Hz, %d channels\n", 
+      (long)(audio_start + pos), frame.bitrate, frame.sample_rate, 
+      frame.channels);
+
+  off_t audio_bytes = file_size - audio_start - pos;
+
+  // An ID3v1 tag at the end of the file is not audio
+  BYTE v1[3];
+  if (file_size > 128 && lseek (f, file_size - 128, SEEK_SET) > 0
+      && read (f, v1, 3) == 3 && strncmp ((char *)v1, "TAG", 3) == 0)
+    audio_bytes -= 128;
+
+  tag_data->sample_rate = frame.sample_rate;
+  tag_data->channels = frame.channels;
+
+  uint32_t frames = 0;
+  uint32_t bytes = 0;
+  int delay = 0, padding = 0;
+  const BYTE *x = buff + pos + frame.side_len;
+  const BYTE *vbri = buff + pos + 36;
+  if (x + 8 <= buff + n && (strncmp ((char *)x, "Xing", 4) == 0
+      || strncmp ((char *)x, "Info", 4) == 0))
+    {
+    uint32_t flags = tag_decode_32_bit_msb (x + 4);
+    const BYTE *p = x + 8;
+    if ((flags & 0x01) && p + 4 <= buff + n) 
+      { frames = tag_decode_32_bit_msb (p); p += 4; }
+    if ((flags & 0x02) && p + 4 <= buff + n) 
+      { bytes = tag_decode_32_bit_msb (p); p += 4; }
+    if (flags & 0x04) p += 100; // Seek table
+    if (flags & 0x08) p += 4; // Quality indicator
+    // The LAME extension holds the encoder delay and padding, as two 
+    //  12-bit values, 21 bytes in
+    if (p + 24 <= buff + n && strncmp ((char *)p, "LAME", 4) == 0)
       {
-      frame_len = (256 * 256 * 256) * b1 + 
-        (256 * 256) * b2 + 
-        (256) * b3 + 
-        b4;
+      delay = (p[21] << 4) | (p[22] >> 4);
+      padding = ((p[22] & 0x0F) << 8) | p[23];
       }
-  }
+    if (tag_debug)
+      printf ("Xing header: %u frames, %u bytes, delay %d, padding %d\n", 
+        frames, bytes, delay, padding);
+    }
+  else if (vbri + 18 <= buff + n && strncmp ((char *)vbri, "VBRI", 4) == 0)
+    {
+    bytes = tag_decode_32_bit_msb (vbri + 10);
+    frames = tag_decode_32_bit_msb (vbri + 14);
+    if (tag_debug)
+      printf ("VBRI header: %u frames, %u bytes\n", frames, bytes);
+    }
+
+  if (frames > 0)
+    {
+    int64_t samples = (int64_t)frames * frame.samples_per_frame 
+      - delay - padding;
+    if (samples < 0) samples = 0;
+    tag_data->duration = tag_scale (samples, 1000, frame.sample_rate);
+    if (bytes > 0) audio_bytes = bytes;
+    }
   else
-  {
-    // v2.2 has 3 byte ID and 3 byte size, no flags. Total
-    //  frame header size is 6
-    header_len = 6;
+    {
+    tag_data->bitrate = frame.bitrate;
+    tag_data->duration = tag_scale (audio_bytes, 8000, frame.bitrate);
+    }
 
-    if (read (f, frameId, 3) != 3) return TAG_TRUNCATED; 
+  tag_finish_stream_info (tag_data, audio_bytes);
+  return TRUE;
+}
 
-    if (frameId[0] == 0)
+/*
+ * Find the granule position of the last page in an Ogg file. This is
+ * the number of samples in the stream (plus any pre-skip). A page can't 
+ * be longer than 65307 bytes, so the last page must start in the last
+ * 64kB of the file. Returns -1 if no page is found.
+ */
+static int64_t tag_ogg_last_granule (int f)
+{
+  off_t file_size = tag_file_size (f);
+  int len = file_size > 65536 ? 65536 : (int)file_size;
+  int64_t ret = -1;
+  if (len < 27) return ret;
+  BYTE *buff = malloc (len);
+  if (!buff) return ret;
+  if (lseek (f, file_size - len, SEEK_SET) >= 0 
+      && read (f, buff, len) == len)
     {
-      if (tag_debug)
-        printf ("Got a null frame ID in v2.2 header\n");
-
-      *carry_on = 0; // We've hit something we can't process, but
-                   //  previous data should be OK
-      return TAG_OK;
+    for (int i = len - 27; i >= 0 && ret < 0; i--)
+      {
+      if (buff[i] == 'O' && strncmp ((char *)buff + i, "OggS", 4) == 0
+          && buff[i + 4] == 0)
+        {
+        int64_t granule = (int64_t)((uint64_t)tag_decode_32_bit_lsb 
+          (buff + i + 6) 
+          | ((uint64_t)tag_decode_32_bit_lsb (buff + i + 10) << 32));
+        // A granule of -1 means that no packet finishes on this page
+        if (granule >= 0) ret = granule;
+        }
+      }
     }
+  free (buff);
+  return ret;
+}
 
-    if (tag_debug)
-      printf ("Found frame of type %s\n", frameId);
+/*
+ * Work out the stream properties of an Ogg Vorbis or Opus stream, 
+ * from the identification header at the start of the first page, and
+ * the granule position of the last page. payload points to the first
+ * packet of the first page.
+ */
+static void tag_ogg_stream_info (int f, const BYTE *payload, int len,
+    TagData *tag_data)
+{
+  int granule_rate = 0;
+  int64_t preskip = 0;
+  if (len >= 28 && payload[0] == 1 
+      && strncmp ((char *)payload + 1, "vorbis", 6) == 0)
+    {
+    tag_data->channels = payload[11];
+    tag_data->sample_rate = tag_decode_32_bit_lsb (payload + 12);
+    int nominal = (int)tag_decode_32_bit_lsb (payload + 20);
+    if (nominal > 0) tag_data->bitrate = nominal;
+    granule_rate = tag_data->sample_rate;
+    }
+  else if (len >= 16 && strncmp ((char *)payload, "OpusHead", 8) == 0)
+    {
+    // Opus always runs at 48kHz internally; the header records the
+    //  rate of the original input, which is what users expect to see
+    tag_data->channels = payload[9];
+    preskip = payload[10] | (payload[11] << 8);
+    tag_data->sample_rate = tag_decode_32_bit_lsb (payload + 12);
+    if (tag_data->sample_rate == 0) tag_data->sample_rate = 48000;
+    granule_rate = 48000;
+    }
 
-    if (read (f, buff, 3) != 3) return TAG_TRUNCATED; 
-    b2 = buff[0];
-    b3 = buff[1];
-    b4 = buff[2];
+  if (granule_rate > 0)
+    {
+    int64_t granule = tag_ogg_last_granule (f);
+    if (granule > preskip)
+      tag_data->duration = tag_scale (granule - preskip, 1000, granule_rate);
+    }
 
-    frame_len = (256 * 256) * b2 + 
-      (256) * b3 + 
-      b4;
-  }
+  tag_finish_stream_info (tag_data, tag_file_size (f));
+}
 
+/*
+ * Decode the FLAC STREAMINFO metadata block, which is always 34 bytes
+ */
+static void tag_flac_parse_streaminfo (const BYTE *b, TagData *tag_data)
+{
+  int sample_rate = (b[10] << 12) | (b[11] << 4) | (b[12] >> 4);
+  int64_t samples = ((int64_t)(b[13] & 0x0F) << 32) 
+    | tag_decode_32_bit_msb (b + 14);
+  tag_data->sample_rate = sample_rate;
+  tag_data->channels = ((b[12] >> 1) & 0x07) + 1;
+  if (sample_rate > 0)
+    tag_data->duration = tag_scale (samples, 1000, sample_rate);
   if (tag_debug)
-    printf ("Frame length = %d\n", frame_len);
+    printf ("FLAC STREAMINFO: %d Hz, %d channels, %lld samples\n",
+      sample_rate, tag_data->channels, (long long)samples);
+}
 
-  if (frame_len < 1)
-    return TAG_TRUNCATED; // Out-of-spec frame
+/**********************************************************************
+  MP3/ID3v2 SUPPORT
+*********************************************************************/
 
-  // Ugh... easytag writes UTF-8 tags without the terminating zero, in
-  // defiance of the spec. So we need to allocate one byte bigger and
-  // null it. :/
-  unsigned char* bigbuff = (unsigned char *) malloc (frame_len + 1); 
-  if (!bigbuff) return TAG_OUTOFMEMORY;
-  memset (bigbuff, 0, frame_len + 1); 
+/*
+ * Counts of the less common ID3v2 features that have been met. These
+ * are only for diagnostics, and are not thread-safe
+ */
+TagID3v2Counters tag_id3v2_counters;
+
+/*
+ * Decode an ID3v2 size, which is syncsafe (7 bits per byte) in the tag
+ * header, and in frame headers from v2.4
+ */
+static int tag_id3v2_decode_size (const BYTE *s, BOOL syncsafe)
+{
+  if (syncsafe)
+    return ((s[0] & 0x7F) << 21) | ((s[1] & 0x7F) << 14) 
+      | ((s[2] & 0x7F) << 7) | (s[3] & 0x7F);
+  return (int)(tag_decode_32_bit_msb (s) & 0x7FFFFFFF);
+}
 
-  if (read (f, bigbuff, frame_len) != frame_len)
+/*
+ * Reverse the unsynchronisation scheme, in place: every 0xFF 0x00 
+ * becomes 0xFF. Returns the new length, which is never greater than
+ * the old one
+ */
+static int tag_id3v2_deunsync (BYTE *b, int len)
+{
+  int j = 0;
+  for (int i = 0; i < len; i++)
   {
-    free (bigbuff); 
-    return TAG_TRUNCATED;
+    b[j++] = b[i];
+    if (b[i] == 0xFF && i + 1 < len && b[i + 1] == 0) i++;
   }
+  return j;
+}
 
-  *total_bytes += frame_len + header_len;
-    
-  if (frameId[0] == 'T')
+/*
+ * Decode the text of a frame that starts with an encoding byte, 
+ * followed by len bytes of text. Returns NULL for an unknown encoding
+ */
+static char *tag_id3v2_decode_text (int encoding, const BYTE *s, int len)
+{
+  if (len < 0) return NULL;
+  switch (encoding)
   {
-    // This is a text frame
-    int encoding = bigbuff[0];
-    char *text = NULL; // This is where decoded text will end up
-  
-    char *text_start = (char *)bigbuff;
-
-    if (encoding == 0)
-    {
-      // ISO-8859-1 string, starts after this byte
-      text_start = (char *)bigbuff + 1;
+    case 0: // ISO-8859-1
       if (tag_debug)
         printf ("Text frame is ISO-8859-1\n");
-
-      text = (char *)tag_convert_iso8859_to_utf8 ((const unsigned char *)
-         text_start, frame_len - 1);
-    }
-    else if (encoding == 1)
-    {
-      // UTF-16 with BOM
+      return (char *)tag_convert_iso8859_to_utf8 (s, len);
+    case 1: // UTF-16 with BOM
       if (tag_debug)
         printf ("Text frame is UTF-16 with BOM\n");
-
-      text_start = (char *)bigbuff + 1;
-      text = tag_convert_utf16_to_utf8 (1, (const UTF16 *)text_start, 
-        frame_len - 1); 
-    }
-    else if (encoding == 2)
-    {
-      // UTF-16 without BOM
+      return tag_convert_utf16_to_utf8 (1, (const UTF16 *)s, len); 
+    case 2: // UTF-16 without BOM
       if (tag_debug)
         printf ("Text frame is UTF-16E without BOM\n");
-
-      text_start = (char *)bigbuff + 1;
-      text = tag_convert_utf16_to_utf8 (0, (const UTF16 *)text_start, 
-        frame_len - 1); 
-    }
-    else if (encoding == 3)
-    {
+      return tag_convert_utf16_to_utf8 (0, (const UTF16 *)s, len); 
+    case 3:
       if (tag_debug)
         printf ("UTF-8 encoding\n");
+      // easytag writes UTF-8 tags without the terminating zero, in
+      // defiance of the spec, so the length has to be respected
+      return strndup ((const char *)s, len);
+  }
+  return NULL;
+}
 
-      text_start = (char *)bigbuff;
-      text = strdup (text_start + 1);
-    }
-  else
+/*
+ * Interpret the contents of one frame. data points to the frame's
+ * data, after the header, and any unsynchronisation has already been
+ * removed. The tag is returned in frame_id_ret and data_ret if the 
+ * frame is one we understand, except for APIC frames, whose image 
+ * goes straight into tag_data. 
+ */
+static void tag_parse_frame (const char *frameId, const BYTE *data, 
+   int frame_len, char **frame_id_ret, unsigned char **data_ret, 
+   TagData *tag_data)
+{
+  *frame_id_ret = NULL;
+  *data_ret = NULL;
+  char *text = NULL; // This is where decoded text will end up
+
+  if (frameId[0] == 'T')
+  {
+    // This is a text frame
+    int encoding = data[0];
+    if (encoding <= 3)
+      text = tag_id3v2_decode_text (encoding, data + 1, frame_len - 1);
+    else
     {
       if (tag_debug)
         printf ("No encoding -- assuming ISO-8859-1\n");
-      text_start = (char *)bigbuff;
-      text = (char *)tag_convert_iso8859_to_utf8 ((const unsigned char *)
-        text_start, frame_len);
-    }
-
-  if (text)
-    {
-    *frame_id_ret = strdup ((char *)frameId);
-    *data_ret = (unsigned char *)text;
+      text = tag_id3v2_decode_text (0, data, frame_len);
     }
   }
-  else if (frameId[0] == 'A' && frameId[1] == 'P' && 
-     frameId[2] == 'I' && frameId[3] == 'C')
+  else if (strcmp (frameId, "APIC") == 0)
   {
-  //  if (bigbuff[0] == 0) // I can't remember what this test was for :/
+    // Encoding byte, MIME type, picture type byte, description, image
+    const BYTE *end = data + frame_len;
+    const BYTE *mime = data + 1;
+    const BYTE *p = memchr (mime, 0, end - mime);
+    if (p && p + 2 <= end)
     {
-      char mime_type[100];
-      strncpy (mime_type, (char *)bigbuff + 1, 100);
+      p++;
+      int type = *p++;
       if (tag_debug)
-        printf ("Picture MIME %s\n", mime_type);
-
-      char *p = (char *)bigbuff + 1 + strlen (mime_type) + 1;
-      int type = (int) (*p);
-      if (tag_debug)
-        printf ("Picture type %d\n", (int) (*p));
+        printf ("Picture MIME %s type %d\n", mime, type);
       if ((type == 3 || type == 0) && !tag_data->cover) 
       // Front cover or "other"
       {
-        while (*p++); // Skip to end of pic description
-        // p now points to the start of the image data
-        int offset = p - (char *)bigbuff;
-        int to_read = frame_len - offset;
-        tag_data->cover = (unsigned char *) malloc (to_read);
-        if (tag_data->cover)
+        // The description is UTF-16 for encodings 1 and 2, and so
+        //  ends with a double null 
+        int wide = (data[0] == 1 || data[0] == 2);
+        while (p < end && (wide ? (p + 1 < end && (p[0] || p[1])) : *p))
+          p += wide ? 2 : 1;
+        p += wide ? 2 : 1;
+        if (p < end)
         {
-        memcpy (tag_data->cover, p, to_read);
-        tag_data->cover_len = to_read;
-        strncpy (tag_data->cover_mime, mime_type, 
-          sizeof (tag_data->cover_mime));
+          int to_read = end - p;
+          tag_data->cover = (unsigned char *) malloc (to_read);
+          if (tag_data->cover)
+          {
+            memcpy (tag_data->cover, p, to_read);
+            tag_data->cover_len = to_read;
+            strncpy (tag_data->cover_mime, (const char *)mime, 
+              sizeof (tag_data->cover_mime) - 1);
+          }
         }
       }
     }
   }
-  else if (strncmp ((char *)frameId, "COMM", 4) == 0)
+  else if (strcmp (frameId, "COMM") == 0)
   {
     //NOTE
     //  We assume that the 'short' comment is missing -- there will just be 
@@ -406,80 +555,51 @@ static TagResult tag_read_frame (int f, int version, int *carry_on,
     if (tag_debug)
       printf ("Found comment tag\n");
 
-    int encoding = bigbuff[0];
-    char *text = NULL; // This is where decoded text will end up
-    char *text_start = (char *)bigbuff;
-
-    if (bigbuff[4] == 0)
+    int encoding = data[0];
+    if (frame_len > 4 && data[4] == 0)
     {
-      if (encoding == 0)
+      switch (encoding)
       {
-        // ISO-8859-1 string, starts after this byte
-        text_start = (char *)bigbuff + 5;
-        if (tag_debug)
-          printf ("Text frame is ISO-8859-1\n");
-
-        text = (char *)tag_convert_iso8859_to_utf8 ((const unsigned char *)
-           text_start, frame_len - 5);
-      }
-      else if (encoding == 1)
-      {
-        // UTF-16 with BOM
-        if (tag_debug)
-          printf ("Text frame is UTF-16 with BOM\n");
-
-        text_start = (char *)bigbuff + 8;
-        text = tag_convert_utf16_to_utf8 (1, (const UTF16 *)text_start, 
-          frame_len - 8); 
-      }
-      else if (encoding == 2)
-      {
-        // UTF-16 without BOM
-        if (tag_debug)
-          printf ("Text frame is UTF-16E without BOM\n");
-
-        text_start = (char *)bigbuff + 6; 
-        text = tag_convert_utf16_to_utf8 (0, (const UTF16 *)text_start, 
-          frame_len - 6); 
-      }
-      else if (encoding == 3)
-      {
-        if (tag_debug)
-          printf ("UTF-8 encoding\n");
-
-        text_start = (char *)bigbuff;
-        text = strdup (text_start + 5); 
-      }
-    else
-      {
-        if (tag_debug)
-          printf ("No encoding -- assuming ISO-8859-1\n");
-        text_start = (char *)bigbuff;
-        text = (char *)tag_convert_iso8859_to_utf8 ((const unsigned char *)
-          text_start, frame_len);
+        case 0: 
+        case 3: 
+          text = tag_id3v2_decode_text (encoding, data + 5, frame_len - 5);
+          break;
+        case 1: 
+          // Empty description (BOM + null), then the comment with its BOM
+          text = tag_id3v2_decode_text (encoding, data + 8, frame_len - 8);
+          break;
+        case 2: 
+          text = tag_id3v2_decode_text (encoding, data + 6, frame_len - 6);
+          break;
+        default:
+          if (tag_debug)
+            printf ("No encoding -- assuming ISO-8859-1\n");
+          text = tag_id3v2_decode_text (0, data, frame_len);
       }
     }
-
-    if (text)
-    {
-      *frame_id_ret = strdup ((char *)frameId);
-      *data_ret = (unsigned char *)text;
-    }
   }
   else
   {
     // We only handle text, comment + APIC frames at present
   }
 
-  free (bigbuff); // FRIG
-  *carry_on = 1; // Should be OK to read next frame
-  return TAG_OK;
+  if (text)
+  {
+    *frame_id_ret = strdup (frameId);
+    *data_ret = (unsigned char *)text;
+  }
 }
 
 /*
  * Caller should not assume that tag_data has not been populated just
  * because this function returns an error. Call tag_free_tag_data()
  * anyway
+ *
+ * The whole tag is read into memory with a single read(), and then
+ * parsed from there. Unsynchronisation is removed in place, for the
+ * whole tag in v2.2 and v2.3, and frame-by-frame in v2.4, where frame
+ * sizes are those of the unsynchronised data. Compressed and encrypted
+ * frames are skipped; compressed v2.2 tags are not supported at all.
  */
 TagResult tag_get_id3v2_tags (const char *file, TagData **tag_data_ret)
 {
@@ -494,83 +614,240 @@ TagResult tag_get_id3v2_tags (const char *file, TagData **tag_data_ret)
   memset (tag_data, 0, sizeof (TagData));
 
   int f = open (file, O_RDONLY | O_BINARY);
-  char buff[10];
-  unsigned char b1, b2, b3, b4; 
+  BYTE header[10];
 
   if (f <= 0) return TAG_READERROR;
 
-  if (read (f, &buff, 10) != 10)
+  if (read (f, header, 10) != 10)
     {
     close (f);
     return TAG_NOID3V2;
     }
 
-  if (strncmp (buff, "ID3", 3))
+  if (strncmp ((char *)header, "ID3", 3))
     {
     close (f);
     return TAG_NOID3V2;
     }
 
-  int id3Major = buff[3];
-  int id3Minor = buff[4];
+  int id3Major = header[3];
+  int id3Minor = header[4];
+  int flags = header[5];
 
   if (tag_debug)
-    printf ("ID3v2 version = %d.%d\n", id3Major, id3Minor);
+    printf ("ID3v2 version = %d.%d, flags = %02X\n", id3Major, id3Minor, 
+      flags);
 
-  if (buff[5] & 0x80)
+  if (id3Major < 2 || id3Major > 4 || (id3Major == 2 && (flags & 0x40)))
     {
-    // We don't support extended headers yet
+    // Unknown version, or v2.2 with compression, which was never 
+    //  defined
     close (f);
     return TAG_UNSUPFORMAT;
     }
 
-  b1 = buff[6];
-  b2 = buff[7];
-  b3 = buff[8];
-  b4 = buff[9];
-
-  int id3len = (128 * 128 * 128) * b1 + 
-    (128 * 128) * b2 + 
-    (128) * b3 + 
-    b4;
+  int id3len = tag_id3v2_decode_size (header + 6, TRUE);
 
   if (tag_debug)
     printf ("ID3V2 Header length = %d\n", id3len);
 
-  TagResult r;
-  int carry_on = 1;
+  tag_id3v2_counters.tags++;
+  int footer_len = 0;
+  if (id3Major == 4 && (flags & 0x10))
+    {
+    footer_len = 10;
+    tag_id3v2_counters.footer++;
+    }
+
+  // The size in the header can be up to 256MB, so don't trust it further
+  //  than the file goes. If the file is too short, the tag is reported
+  //  as truncated, below
+  int to_read = id3len;
+  off_t file_size = tag_file_size (f);
+  if (to_read > file_size - 10) 
+    to_read = file_size > 10 ? (int)(file_size - 10) : 0;
+
+  BYTE *buff = malloc (to_read + 1);
+  if (!buff)
+    {
+    close (f);
+    return TAG_OUTOFMEMORY;
+    }
+  int len = 0;
+  while (len < to_read)
+    {
+    int n = read (f, buff + len, to_read - len);
+    if (n <= 0) break;
+    len += n;
+    }
+
+  if (tag_debug)
+    printf ("Read %d bytes of tag\n", len);
+
+  TagResult r = len == id3len ? TAG_OK : TAG_TRUNCATED;
+
+  if ((flags & 0x80) && id3Major < 4)
+    {
+    len = tag_id3v2_deunsync (buff, len);
+    tag_id3v2_counters.unsync++;
+    }
+
+  int pos = 0;
+  if ((flags & 0x40) && len >= 4)
+    {
+    // Extended header. In v2.3 its size does not include the size 
+    //  field itself; in v2.4 it does, and is syncsafe
+    int64_t ext_len = id3Major == 3 ? 
+      (int64_t)tag_decode_32_bit_msb (buff) + 4 :
+      tag_id3v2_decode_size (buff, TRUE);
+    if (tag_debug)
+      printf ("Extended header length = %lld\n", (long long)ext_len);
+    tag_id3v2_counters.ext_header++;
+    // An extended header longer than the whole tag means that the tag 
+    //  is corrupt, so none of its frames are read
+    pos = ext_len > id3len ? len : (int)ext_len;
+    }
+
+  int header_len = id3Major >= 3 ? 10 : 6;
+  BOOL frame_unsync = FALSE;
   Tag **p_current_tag = &(tag_data->tag); 
-  int total_bytes = 0;
-  do
+  while (pos >= 0 && pos + header_len <= len)
     {
-    char *frameId = NULL;
-    unsigned char *data = NULL;
-    r = tag_read_frame (f, id3Major, &carry_on, &frameId, &data, &total_bytes,
-      tag_data); // We pass tag_data here only for the APIC frame
+    BYTE *h = buff + pos;
+    char frameId[5]; 
+    int frame_len;
+    int frame_flags = 0;
+    if (h[0] == 0)
+      {
+      if (tag_debug)
+        printf ("Got a null frame ID -- end of frames\n");
+      break;
+      }
+
+    if (id3Major >= 3)
+      {
+      memcpy (frameId, h, 4);
+      frameId[4] = 0;
+      // v2.4 uses syncsafe frame sizes, while earlier versions use
+      //  them only in the tag header
+      frame_len = tag_id3v2_decode_size (h + 4, id3Major > 3);
+      frame_flags = h[9];
+      }
+    else
+      {
+      memcpy (frameId, h, 3);
+      frameId[3] = 0;
+      frame_len = (h[3] << 16) | (h[4] << 8) | h[5];
+      }
 
     if (tag_debug)
-      printf ("Read %d bytes from header\n", total_bytes);
+      printf ("Found frame of type %s, length %d\n", frameId, frame_len);
 
-    if (frameId && data)
+    if (frame_len < 1 || frame_len > len - pos - header_len)
       {
-      Tag *tag = (Tag *)malloc (sizeof (Tag));
-      memset (tag, 0, sizeof (Tag)); 
-      tag->frameId = frameId;
-      tag->data = data;
-      tag->next = NULL;
-      *p_current_tag = tag; 
-      p_current_tag = &((*p_current_tag)->next);
+      // Out-of-spec frame. Keep what we have, if anything
+      if (tag_debug)
+        printf ("Bad frame length\n");
+      if (!tag_data->tag) r = TAG_TRUNCATED;
+      break;
       }
-    } while (r == TAG_OK && carry_on && total_bytes < id3len);
- 
-  if (tag_debug)
-    printf ("Read %d bytes from header\n", total_bytes);
+
+    BYTE *data = h + header_len;
+    int data_len = frame_len;
+    BOOL skip = FALSE;
+    if (id3Major == 4)
+      {
+      // Frame format flags: grouping, compression, encryption, 
+      //  unsynchronisation, data length indicator
+      if (frame_flags & 0x40) { data++; data_len--; }
+      if (frame_flags & 0x0C) skip = TRUE;
+      if (frame_flags & 0x01) { data += 4; data_len -= 4; }
+      if ((frame_flags & 0x02) || (flags & 0x80))
+        {
+        if (data_len > 0) data_len = tag_id3v2_deunsync (data, data_len);
+        frame_unsync = TRUE;
+        }
+      }
+    else if (id3Major == 3)
+      {
+      // Compression, encryption, grouping
+      if (frame_flags & 0xC0) skip = TRUE;
+      if (frame_flags & 0x20) { data++; data_len--; }
+      }
+
+    if (skip)
+      {
+      if (tag_debug)
+        printf ("Skipping compressed or encrypted frame\n");
+      tag_id3v2_counters.frames_skipped++;
+      }
+    else if (data_len > 0)
+      {
+      char *frame_id_ret = NULL;
+      unsigned char *data_ret = NULL;
+      // The data is not null-terminated, but nothing reads past 
+      //  data_len
+      tag_parse_frame (frameId, data, data_len, &frame_id_ret, &data_ret,
+        tag_data); 
+      if (frame_id_ret && data_ret)
+        {
+        Tag *tag = (Tag *)malloc (sizeof (Tag));
+        memset (tag, 0, sizeof (Tag)); 
+        tag->frameId = frame_id_ret;
+        tag->data = data_ret;
+        tag->next = NULL;
+        *p_current_tag = tag; 
+        p_current_tag = &((*p_current_tag)->next);
+        }
+      }
+
+    pos += header_len + frame_len;
+    }
+
+  if (frame_unsync) tag_id3v2_counters.unsync++;
+  free (buff);
+
+  // The audio starts after the tag, and after the footer if there is one
+  tag_mpeg_stream_info (f, 10 + id3len + footer_len, tag_data);
 
   close (f);
   return r;
 }
 
 
+/*
+ * Caller should call tag_free_tag_data() regardless of the outcome, as
+ * for the other readers
+ */
+TagResult tag_get_mpeg_tags (const char *file, TagData **tag_data_ret)
+{
+  TagData *tag_data = (TagData*) malloc (sizeof (TagData));
+  if (!tag_data)
+    {
+    *tag_data_ret = NULL; 
+    return TAG_OUTOFMEMORY;
+    }
+
+  *tag_data_ret = tag_data; 
+  memset (tag_data, 0, sizeof (TagData));
+
+  int f = open (file, O_RDONLY | O_BINARY);
+  if (f <= 0) return TAG_READERROR;
+
+  // Only consider the file to be bare MPEG if it starts with a frame 
+  //  header -- searching for one would match all sorts of things
+  BYTE buff[4];
+  TagMpegFrame frame;
+  TagResult ret = TAG_NOMPEG;
+  if (read (f, buff, 4) == 4 && tag_mpeg_parse_header (buff, &frame)
+      && tag_mpeg_stream_info (f, 0, tag_data))
+    ret = TAG_OK;
+
+  close (f);
+  return ret;
+}
+
+
 /**********************************************************************
   FLAC/VORBIS SUPPORT 
 *********************************************************************/
@@ -672,13 +949,17 @@ TagResult tag_get_flac_tags (const char *file, TagData **tag_data_ret)
 
   BOOL got_it = FALSE;
   BOOL last_block = FALSE; 
+  TagResult ret = TAG_OK;
 
-  while (!got_it && !last_block)
+  // Carry on past the comment block, because STREAMINFO might come
+  //  later, and we need to know where the audio frames start to
+  //  work out the bitrate
+  while (!last_block)
   {
     if (read (f, buff, 4) != 4)
     {
       close (f);
-      return TAG_NOVORBIS;
+      return got_it ? ret : TAG_NOVORBIS;
     }
 
     int block_type = buff[0] & 0x7F;
@@ -689,7 +970,7 @@ TagResult tag_get_flac_tags (const char *file, TagData **tag_data_ret)
     //  printf ("size = %d, last = %d type = %d\n", block_size, 
     //   last_block, block_type);
 
-    if (block_type == 4)
+    if (block_type == 4 && !got_it)
     {
       if (tag_debug)
         printf ("Found comment block of size %d\n", block_size);
@@ -706,23 +987,35 @@ TagResult tag_get_flac_tags (const char *file, TagData **tag_data_ret)
     
       if (read (f, bigbuff, block_size) != block_size)
       {
+        free (bigbuff); 
         close (f);
         return TAG_TRUNCATED;
       }
     
       Tag **p_current_tag = &(tag_data->tag); 
-      int ret = tag_parse_vorbis_comments (bigbuff, p_current_tag);
+      ret = tag_parse_vorbis_comments (bigbuff, p_current_tag);
       
       free (bigbuff); 
-      close (f);
-      return ret;
+    }
+    else if (block_type == 0 && block_size >= 34)
+    {
+      if (read (f, buff, 34) != 34)
+      {
+        close (f);
+        return TAG_TRUNCATED;
+      }
+      tag_flac_parse_streaminfo (buff, tag_data);
+      lseek (f, block_size - 34, SEEK_CUR);
     }
   else
     lseek (f, block_size, SEEK_CUR);
   }
 
+  off_t audio_start = lseek (f, 0, SEEK_CUR);
+  tag_finish_stream_info (tag_data, tag_file_size (f) - audio_start);
+
   close (f);
-  return TAG_OK;
+  return ret;
 }
 
 
@@ -776,6 +1069,12 @@ TagResult tag_get_ogg_tags (const char *file, TagData **tag_data_ret)
    if (tag_debug)
        printf ("Ogg page size is %d\n", page_size);
 
+   // The first page holds just the identification header
+   lseek (f, page_start + 27 + segments, SEEK_SET);
+   int ident_len = read (f, buff, sizeof (buff));
+   if (ident_len > 0)
+     tag_ogg_stream_info (f, buff, ident_len, tag_data);
+
    lseek (f, page_start + page_size, SEEK_SET);
    read (f, buff, 4);
    if (strncmp ((char *)buff, "OggS", 4))
@@ -801,6 +1100,7 @@ TagResult tag_get_ogg_tags (const char *file, TagData **tag_data_ret)
   Tag **p_current_tag = &(tag_data->tag); 
   int ret = tag_parse_vorbis_comments ((unsigned char *)bigbuff, p_current_tag);
 
+  free (bigbuff);
   close (f);
 
   return ret;
@@ -857,9 +1157,10 @@ void tag_mp4_parse_ilst (const BYTE *ilist, int l, TagData *tag_data)
       {
       if (strncmp ((char*)type, "covr", 4) == 0)
         {
-        tag_data->cover = (unsigned char *) malloc (data_len);
-        memcpy (tag_data->cover, data, data_len);
-        tag_data->cover_len = data_len;
+        // As for text, data_len includes 16 bytes of header
+        tag_data->cover = (unsigned char *) malloc (data_len - 16);
+        memcpy (tag_data->cover, data, data_len - 16);
+        tag_data->cover_len = data_len - 16;
         if (data_type == 13)
           strcpy (tag_data->cover_mime, "image/jpeg");
         else
@@ -910,17 +1211,127 @@ void tag_mp4_parse_udta (const BYTE *udta, int l, TagData *tag_data)
   }
 
 
+/*
+ * Find the first child atom of the specified type in a container atom,
+ * returning a pointer to its contents (after the eight-byte atom 
+ * header), or NULL if there is no such child
+ */
+static const BYTE *tag_mp4_find_child (const BYTE *atom, int l, 
+    const char *type, int *child_len)
+  {
+  const BYTE *p = atom;
+  while (p + 8 <= atom + l)
+    {
+    int ll = tag_mp4_decode_32_bit_msb (p);
+    if (ll < 8 || ll > l - (p - atom)) return NULL; 
+    if (strncmp ((char *)p + 4, type, 4) == 0)
+      {
+      *child_len = ll - 8;
+      return p + 8;
+      }
+    p += ll;
+    }
+  return NULL;
+  }
+
+
+/*
+ * Get the timescale and duration from an mvhd or mdhd atom. They have the
+ * same layout, as far as these fields go. Returns the duration in msec,
+ * or zero if it can't be determined
+ */
+static int tag_mp4_parse_mdhd (const BYTE *p, int l, int *timescale)
+  {
+  uint32_t ts;
+  int64_t duration;
+  if (l >= 32 && p[0] == 1)
+    {
+    // Version 1 has 64-bit times and durations
+    ts = tag_decode_32_bit_msb (p + 20);
+    duration = (int64_t)(((uint64_t)tag_decode_32_bit_msb (p + 24) << 32) 
+      | tag_decode_32_bit_msb (p + 28));
+    }
+  else if (l >= 20 && p[0] == 0)
+    {
+    ts = tag_decode_32_bit_msb (p + 12);
+    duration = tag_decode_32_bit_msb (p + 16);
+    }
+  else
+    return 0;
+  if (timescale) *timescale = (int)ts;
+  return tag_scale (duration, 1000, ts);
+  }
+
+
+/*
+ * Get the stream properties from the first audio track. The track's
+ * mdhd atom gives the duration, and the first sample description in
+ * stsd gives the channel count and sample rate.
+ */
+void tag_mp4_parse_trak (const BYTE *trak, int l, TagData *tag_data)
+  {
+  int mdia_len, hdlr_len, mdhd_len, minf_len, stbl_len, stsd_len;
+  const BYTE *mdia = tag_mp4_find_child (trak, l, "mdia", &mdia_len);
+  if (!mdia || tag_data->channels > 0) return;
+
+  const BYTE *hdlr = tag_mp4_find_child (mdia, mdia_len, "hdlr", &hdlr_len);
+  if (!hdlr || hdlr_len < 12 || strncmp ((char *)hdlr + 8, "soun", 4))
+    return; 
+
+  if (tag_debug)
+    printf ("Found MP4 audio track\n");
+
+  int timescale = 0;
+  const BYTE *mdhd = tag_mp4_find_child (mdia, mdia_len, "mdhd", &mdhd_len);
+  if (mdhd)
+    {
+    int duration = tag_mp4_parse_mdhd (mdhd, mdhd_len, &timescale);
+    if (duration > 0) tag_data->duration = duration;
+    }
+  tag_data->sample_rate = timescale;
+
+  const BYTE *minf = tag_mp4_find_child (mdia, mdia_len, "minf", &minf_len);
+  const BYTE *stbl = minf ? 
+    tag_mp4_find_child (minf, minf_len, "stbl", &stbl_len) : NULL;
+  const BYTE *stsd = stbl ? 
+    tag_mp4_find_child (stbl, stbl_len, "stsd", &stsd_len) : NULL;
+  if (stsd && stsd_len >= 44)
+    {
+    // Version/flags and entry count, then the first sample entry. Its 
+    //  sample rate is 16.16 fixed point 
+    tag_data->channels = (stsd[32] << 8) | stsd[33];
+    int rate = (stsd[40] << 8) | stsd[41];
+    if (rate > 0) tag_data->sample_rate = rate;
+    }
+  }
+
+
 void tag_mp4_parse_moov (const BYTE *moov, int l, TagData *tag_data)
   {
   const BYTE *p = moov;
   while (p - moov < l)
     {
+    // As in tag_mp4_find_child(), a child that claims to go beyond the 
+    //  end of moov ends the search
+    if (l - (p - moov) < 8) break;
     int ll = tag_mp4_decode_32_bit_msb (p);
     const BYTE *type = p + 4;
+   if (ll < 8 || ll > l - (p - moov)) break;
    if (strncmp ((char *)type, "udta", 4) == 0)
      {
      tag_mp4_parse_udta (p + 8, ll - 8, tag_data);
      }
+   else if (strncmp ((char *)type, "mvhd", 4) == 0)
+     {
+     // The movie duration is only a fallback, if no audio track 
+     //  has a duration of its own
+     if (tag_data->duration == 0)
+       tag_data->duration = tag_mp4_parse_mdhd (p + 8, ll - 8, NULL);
+     }
+   else if (strncmp ((char *)type, "trak", 4) == 0)
+     {
+     tag_mp4_parse_trak (p + 8, ll - 8, tag_data);
+     }
     p += ll;
     }
   }
@@ -943,6 +1354,7 @@ TagResult tag_get_mp4_tags (const char *file, TagData **tag_data_ret)
   if (f <= 0) return TAG_READERROR;
 
   BOOL done = FALSE;
+  int moov_len = 0;
   while (!done)
     {
     BYTE buff[4];
@@ -964,6 +1376,7 @@ TagResult tag_get_mp4_tags (const char *file, TagData **tag_data_ret)
           if (n == l - 8)
             {
             read_atom = TRUE;
+            moov_len = l;
             tag_mp4_parse_moov (atom, l - 8, tag_data);
             }
           else
@@ -986,6 +1399,9 @@ TagResult tag_get_mp4_tags (const char *file, TagData **tag_data_ret)
      }
    }
 
+  // Near enough all of an MP4 file that is not the moov atom is audio
+  tag_finish_stream_info (tag_data, tag_file_size (f) - moov_len);
+
   close (f);
   return TAG_OK;
   }
@@ -1175,9 +1591,14 @@ TagResult tag_get_tags (const char *file, TagData **tag_data_ret)
       if (ret == TAG_NOVORBIS)
       {
         tag_free_tag_data (*tag_data_ret);
-        ret = tag_get_mp4_tags (file, tag_data_ret);
-        if (ret == TAG_NOMP4)
-	  ret = TAG_UNSUPFORMAT;
+        ret = tag_get_mpeg_tags (file, tag_data_ret);
+        if (ret == TAG_NOMPEG)
+        {
+          tag_free_tag_data (*tag_data_ret);
+          ret = tag_get_mp4_tags (file, tag_data_ret);
+          if (ret == TAG_NOMP4)
+            ret = TAG_UNSUPFORMAT;
+        }
       }
     }
   }
@@ -7,6 +7,11 @@ Distributed under the terms of the GNU Public Licence, v3.0
   
 #pragma once
 
+// Changed whenever a change to the tag reader means that it might get
+//  different results from the same file, so that results saved by an
+//  earlier version -- in the parse cache, for example -- are not used
+#define TAG_READER_VERSION 1
+
 /* Error codes. Methods that read tags of a particular type should
  * return TAG_NOXXX if the file is completely uninterpretable, or contains
  * no recognizable tags. These particular error codes mean that it might
@@ -26,6 +31,7 @@ typedef enum
   TAG_UNSUPFORMAT = 5, // Tag is a version we don't support
   TAG_NOVORBIS = 6, // File does not contain VORBIS comments 
   TAG_NOMP4 = 7, // File does not contain MP4 metadata 
+  TAG_NOMPEG = 8, // File does not start with an MPEG audio frame 
   } TagResult;
 
 // Tag types -- but only text is supported right now
@@ -68,8 +74,25 @@ typedef struct
   unsigned char *cover;
   int cover_len;
   char cover_mime[30];
+  // Stream properties, where they can be worked out from the file
+  //  headers. Zero means 'unknown'
+  int duration; // msec
+  int bitrate; // bits per second (average, for VBR streams)
+  int sample_rate; // Hz
+  int channels;
   } TagData;
 
+// Counts of ID3v2 tags read, and of how many of them used each of
+//  the less common features of the format
+typedef struct
+  {
+  int tags;
+  int unsync; // Unsynchronisation, of the whole tag or of any frame
+  int ext_header; // Extended header
+  int footer; // v2.4 footer
+  int frames_skipped; // Compressed or encrypted frames, which are ignored
+  } TagID3v2Counters;
+
 /* NOTE: all functions that return a **tag_data_ret allocate a structure
  * in which to store the tags. This structure will be left for the caller
  * to free, regardless of whether the function found any tags or not. It
@@ -81,6 +104,13 @@ TagResult            tag_get_ogg_tags
                         (const char *file, TagData **tag_data_ret);
 TagResult            tag_get_flac_tags 
                         (const char *file, TagData **tag_data_ret);
+TagResult            tag_get_mp4_tags 
+                        (const char *file, TagData **tag_data_ret);
+/* Reads stream properties from a file that consists of bare MPEG audio
+ * frames, with no ID3v2 tag. Such a file has no tags to report, but
+ * TAG_OK is returned if the stream properties could be read */
+TagResult            tag_get_mpeg_tags 
+                        (const char *file, TagData **tag_data_ret);
 int                  tag_get_tag_count (TagData *tag_data);
 void                 tag_free_tag_data (TagData *tag_data);
 Tag                 *tag_get_tag (const TagData *tag_data, int index);
@@ -91,4 +121,7 @@ TagResult            tag_get_tags (const char *file, TagData **tag_data_ret);
 // Set tag_debug for copious debugging output
 extern BOOL tag_debug;
 
+// Updated by tag_get_id3v2_tags(); not thread-safe
+extern TagID3v2Counters tag_id3v2_counters;
+
 
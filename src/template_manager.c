@@ -16,6 +16,8 @@
 #include "log.h" 
 #include "string.h" 
 #include "template_manager.h" 
+#include "facade.h" 
+#include "request_handler.h" 
 
 extern uint8_t generic_html_start[] asm("_binary_docroot_generic_html_start");
 extern uint8_t generic_html_end[]   asm("_binary_docroot_generic_html_end");
@@ -190,9 +192,19 @@ void template_manager_substitute_template (String *s)
       memcpy (tag, ss + start + 2, taglen - 4);
       tag [taglen - 4] = 0; 
       string_delete (s, start, (end - start));
-      String *replace = template_manager_get_template_by_tag (tag);
-      string_insert (s, start, string_cstr (replace));
-      string_destroy (replace);
+      if (strncmp (tag, INT_FILE_BASE, strlen (INT_FILE_BASE)) == 0)
+        {
+        // A built-in file, which is referred to by its URI with a hash
+        const char *uri = request_handler_get_int_uri 
+          (tag + strlen (INT_FILE_BASE));
+        string_insert (s, start, uri ? uri : tag);
+        }
+      else
+        {
+        String *replace = template_manager_get_template_by_tag (tag);
+        string_insert (s, start, string_cstr (replace));
+        string_destroy (replace);
+        }
       free (tag);
       }
     } while (got_tag);
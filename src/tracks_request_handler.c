@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
 #include "defs.h" 
 #include "log.h" 
 #include "props.h" 
@@ -22,6 +23,7 @@
 #include "tracks_request_handler.h" 
 #include "searchconstraints.h" 
 #include "audio_metainfo.h" 
+#include "page_stream.h" 
 
 /*============================================================================
 
@@ -70,6 +72,7 @@ char *tracks_request_handler_make_track_html (const char *path)
   char *artist = NULL;
   char *album = NULL;
   char *composer = NULL;
+  int duration = 0;
   int error_code = 0;
   String *html = string_create_empty();
 
@@ -87,6 +90,7 @@ char *tracks_request_handler_make_track_html (const char *path)
     if (_composer) composer = strdup (_composer);
     const char *_album = audio_metainfo_get_album (ami);
     if (_album) album = strdup (_album);
+    duration = audio_metainfo_get_duration (ami);
     audio_metainfo_destroy (ami);
     }
   else
@@ -120,6 +124,15 @@ char *tracks_request_handler_make_track_html (const char *path)
   string_append (html, "<span class=\"tracklistname\">");
   string_append (html, disp_title);
   string_append (html, "</span>\n");
+
+  if (duration > 0)
+    {
+    char *length = htmlutil_format_duration (duration);
+    string_append (html, "<span class=\"tracklistsupinfo\">");
+    string_append_printf (html, "(%s)", length);
+    string_append (html, "</span>\n");
+    free (length);
+    }
   
   char *js_path = htmlutil_escape_squote_js (path);
   char *play_uri;
@@ -223,6 +236,34 @@ char *tracks_request_handler_make_track_html (const char *path)
   }
 
 
+/*============================================================================
+
+  tracks_request_handler_track_item
+
+  Append the cell for track number index in the list of paths data
+
+============================================================================*/
+static void tracks_request_handler_track_item (void *data, int index, 
+      String *out)
+  {
+  const char *path = list_get ((List *)data, index);
+  char *trackhtml = tracks_request_handler_make_track_html (path);
+  string_append (out, "<div class=\"tracklistcell\">");
+  string_append (out, trackhtml); 
+  string_append (out, "</div>\n");
+  free (trackhtml);
+  }
+
+/*============================================================================
+
+  tracks_request_handler_free_list
+
+============================================================================*/
+static void tracks_request_handler_free_list (void *data)
+  {
+  list_destroy ((List *)data);
+  }
+
 /*============================================================================
 
   tracks_request_handler_tracklist
@@ -237,14 +278,7 @@ String *tracks_request_handler_track_list (List *list)
     {
     string_append (ret, "<div class=\"tracklist\">\n");
     for (int i = 0; i < l; i++)
-      {
-      const char *path = list_get (list, i);
-      char *trackhtml = tracks_request_handler_make_track_html (path);
-      string_append (ret, "<div class=\"tracklistcell\">");
-      string_append (ret, trackhtml); 
-      string_append (ret, "</div>\n");
-      free (trackhtml);
-      }
+      tracks_request_handler_track_item (list, i, ret);
     string_append (ret, "</div>\n");
     }
   else
@@ -258,8 +292,13 @@ String *tracks_request_handler_track_list (List *list)
 
   tracks_request_handler_page 
 
+  If stream is not NULL, and there are many tracks -- which there can be
+  if the limit is zero -- the page is returned as a stream, and the
+  track cells are made only as it is sent. Otherwise page is set
+
 ============================================================================*/
-void tracks_request_handler_page (const Props *arguments, char **page)
+void tracks_request_handler_page (const Props *arguments, char **page,
+       PageStream **stream)
   {
   LOG_IN
 
@@ -320,9 +359,31 @@ void tracks_request_handler_page (const Props *arguments, char **page)
 	asprintf (&href2, "javascript:cmd_add_matching(\'%s\')", js_args);
 	char *add_all_html = htmlutil_make_href (href2, 
 	  "[add all]");
+	// On an album's own page, show how long the whole album is
+	char *album_length = NULL;
+	const char *album = props_get (arguments, "album-is");
+	if (album)
+	  {
+	  char *error = NULL;
+	  int album_error_code = 0;
+	  int64_t duration = facade_get_album_duration (album, 
+	    &album_error_code, &error);
+	  if (duration > 0)
+	    {
+	    char *length = htmlutil_format_duration (duration);
+	    asprintf (&album_length, " &nbsp; Album length: %s", length);
+	    free (length);
+	    }
+	  else if (duration < 0)
+	    {
+	    log_warning (error);
+	    free (error);
+	    }
+	  }
 	char *addplay_all_html;
-	asprintf (&addplay_all_html, "<p>%s | %s</p>\n", 
-	   add_all_html, play_all_html);
+	asprintf (&addplay_all_html, "<p>%s | %s%s</p>\n", 
+	   add_all_html, play_all_html, album_length ? album_length : "");
+	free (album_length);
 	free (s_playall_args);
 	free (href1);
 	free (href2);
@@ -343,11 +404,6 @@ void tracks_request_handler_page (const Props *arguments, char **page)
 	template_manager_substitute_placeholder (generic, "playall", ""); 
         }
  
-      String *tracklist = tracks_request_handler_track_list (list); 
-      template_manager_substitute_placeholder (generic, "list", 
-	string_cstr (tracklist));
-      string_destroy (tracklist);
-
       String *listnav = gui_request_handler_listnav (URI_TRACKS, 
         arguments, match, FALSE);
       template_manager_substitute_placeholder (generic, "listnav", 
@@ -356,8 +412,6 @@ void tracks_request_handler_page (const Props *arguments, char **page)
       }
     else
       {
-      template_manager_substitute_placeholder (generic, "list", 
-         "<div><p>No tracks found</p></div>\n");
       template_manager_substitute_placeholder (generic, "listnav", "");
       template_manager_substitute_placeholder (generic, "playall", ""); 
       }
@@ -368,9 +422,34 @@ void tracks_request_handler_page (const Props *arguments, char **page)
       string_cstr (summary));
     string_destroy (summary);
 
-    *page = strdup (string_cstr (generic));
+    int l = list_length (list);
+    PageStream *s = page_stream_create ();
+    const char *p = page_stream_add_text_until (s, string_cstr (generic), 
+      "list");
+    if (l > 0)
+      {
+      page_stream_add_text (s, "<div class=\"tracklist\">\n");
+      page_stream_add_items (s, l, tracks_request_handler_track_item, 
+        list, tracks_request_handler_free_list);
+      page_stream_add_text (s, "</div>\n");
+      }
+    else
+      {
+      page_stream_add_text (s, "<div><p>No tracks found</p></div>\n");
+      list_destroy (list);
+      }
+    page_stream_add_text (s, p);
     string_destroy (generic);
-    list_destroy (list);
+
+    if (stream && l >= GUI_STREAM_MIN_ITEMS)
+      {
+      *stream = s;
+      }
+    else
+      {
+      *page = page_stream_read_all (s);
+      page_stream_destroy (s);
+      }
     }
   else
     {
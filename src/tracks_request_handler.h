@@ -11,10 +11,12 @@
 #include "defs.h"
 #include "props.h"
 #include "list.h"
+#include "page_stream.h"
 
 BEGIN_DECLS
 
-void    tracks_request_handler_page (const Props *arguments, char **page);
+void    tracks_request_handler_page (const Props *arguments, char **page,
+          PageStream **stream);
 String *tracks_request_handler_track_list (List *list);
 
 END_DECLS
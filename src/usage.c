@@ -21,18 +21,33 @@
 void usage_show (FILE *fout, const char *argv0)
   {
   fprintf (fout, "Usage: %s [options]\n", argv0);
+  fprintf (fout, "     --access-log=S  file to log requests to\n");
   fprintf (fout, "  -d,--debug       stay in foreground\n");
   fprintf (fout, "  -g,--gxsradio=S  directory for radio station lists\n");
   fprintf (fout, "  -h,--help        show this message\n");
+  fprintf (fout, "     --http-threads=N  HTTP worker threads, 0 for one per connection (0)\n");
+  fprintf (fout, "     --http-connections=N  most HTTP connections, 0 for default (0)\n");
+  fprintf (fout, "     --http-timeout=N  idle HTTP connection timeout, sec (60)\n");
+  fprintf (fout, "     --http-gzip-min=N compress responses of N bytes or more (1024)\n");
   fprintf (fout, "  -i,--index       index (database) file\n");
   fprintf (fout, "  -l,--log-level=N log level, 0-5 (default 2)\n");
+  fprintf (fout, "     --log-file=S  file to log messages to\n");
+  fprintf (fout, "     --log-keep=N  rotated log files kept (4)\n");
+  fprintf (fout, "     --log-size=N  KB at which log files are rotated, 0 for never (10240)\n");
+  fprintf (fout, "     --metrics     record request times, for /api/metrics\n");
+  fprintf (fout, "     --page-cache=N  KB of rendered pages to cache, 0 for none (4096)\n");
   fprintf (fout, "  -p,--port=N      port number for this server (30000)\n");
   fprintf (fout, "  -q,--quickscan   scan changed files and build index\n");
   fprintf (fout, "  -r,--root=N      audio root directory\n");
   fprintf (fout, "  -s,--scan        scan files and build index\n");
+  fprintf (fout, "     --status-interval=N  msec between status polls (1000)\n");
   fprintf (fout, "  -v,--version     show version\n");
   fprintf (fout, "     --xsport=S    xine-server port (30001)\n");
   fprintf (fout, "     --xshost=S    xine-server host (localhost)\n");
+  fprintf (fout, "     --xspool=N    idle xine-server connections kept (4)\n");
+  fprintf (fout, "     --xstimeout=N xine-server response timeout, msec (5000)\n");
+  fprintf (fout, "     --xsconnecttimeout=N  xine-server connect timeout, msec (2000)\n");
+  fprintf (fout, "     --xsbreaker=N failures before xine-server is skipped (3)\n");
   fprintf (fout, "  -x,--xslaunch=S  xine-server launch command\n");
   }
 
@@ -0,0 +1,345 @@
+/*============================================================================
+
+  xine-server-x
+  utfconv.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Most of the text this program handles -- file paths, tags -- is
+  entirely or largely ASCII, so each conversion first copies as long a run
+  of ASCII characters as it can, sixteen at a time, using vector
+  instructions. Anything else is handed to a scalar conversion, which
+  processes only as far as the next ASCII character before returning
+  to the fast path.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "defs.h"
+#include "convertutf.h"
+#include "utfconv.h"
+
+#if defined(__SSE2__) && !defined(UTFCONV_SCALAR)
+#define UTFCONV_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && !defined(UTFCONV_SCALAR)
+#define UTFCONV_NEON
+#include <arm_neon.h>
+#endif
+
+#define UTFCONV_REPLACEMENT 0xFFFD
+
+#ifdef UTFCONV_NEON
+/*==========================================================================
+
+  utfconv_neon_any_bits
+
+  Returns non-zero if any bit in mask is set in any lane of v. This
+  avoids vmaxvq_u8(), which is not available on 32-bit ARM
+
+==========================================================================*/
+static inline uint64_t utfconv_neon_any_bits (uint8x16_t v, uint64_t mask)
+  {
+  uint8x8_t folded = vorr_u8 (vget_low_u8 (v), vget_high_u8 (v));
+  return vget_lane_u64 (vreinterpret_u64_u8 (folded), 0) & mask;
+  }
+#endif
+
+/*==========================================================================
+
+  utfconv_widen_ascii
+
+  Copy the leading ASCII bytes of in[0..len) to out as UTF-32 values.
+  Returns the number of bytes copied, which will be less than len if
+  a non-ASCII byte is found
+
+==========================================================================*/
+static size_t utfconv_widen_ascii (const UTF8 *in, size_t len, UTF32 *out)
+  {
+  size_t i = 0;
+#if defined(UTFCONV_SSE2)
+  const __m128i zero = _mm_setzero_si128 ();
+  for (; i + 16 <= len; i += 16)
+    {
+    __m128i v = _mm_loadu_si128 ((const __m128i *)(in + i));
+    if (_mm_movemask_epi8 (v)) break;
+    __m128i lo = _mm_unpacklo_epi8 (v, zero);
+    __m128i hi = _mm_unpackhi_epi8 (v, zero);
+    _mm_storeu_si128 ((__m128i *)(out + i), _mm_unpacklo_epi16 (lo, zero));
+    _mm_storeu_si128 ((__m128i *)(out + i + 4),
+      _mm_unpackhi_epi16 (lo, zero));
+    _mm_storeu_si128 ((__m128i *)(out + i + 8),
+      _mm_unpacklo_epi16 (hi, zero));
+    _mm_storeu_si128 ((__m128i *)(out + i + 12),
+      _mm_unpackhi_epi16 (hi, zero));
+    }
+#elif defined(UTFCONV_NEON)
+  for (; i + 16 <= len; i += 16)
+    {
+    uint8x16_t v = vld1q_u8 (in + i);
+    if (utfconv_neon_any_bits (v, 0x8080808080808080ULL)) break;
+    uint16x8_t lo = vmovl_u8 (vget_low_u8 (v));
+    uint16x8_t hi = vmovl_u8 (vget_high_u8 (v));
+    uint32_t *o = (uint32_t *)out + i;
+    vst1q_u32 (o, vmovl_u16 (vget_low_u16 (lo)));
+    vst1q_u32 (o + 4, vmovl_u16 (vget_high_u16 (lo)));
+    vst1q_u32 (o + 8, vmovl_u16 (vget_low_u16 (hi)));
+    vst1q_u32 (o + 12, vmovl_u16 (vget_high_u16 (hi)));
+    }
+#endif
+  for (; i < len && in[i] < 0x80; i++)
+    out[i] = in[i];
+  return i;
+  }
+
+/*==========================================================================
+
+  utfconv_narrow_ascii_32
+
+  Copy the leading UTF-32 values of in[0..len) that are ASCII to out as
+  bytes. Returns the number of characters copied
+
+==========================================================================*/
+static size_t utfconv_narrow_ascii_32 (const UTF32 *in, size_t len, UTF8 *out)
+  {
+  size_t i = 0;
+#if defined(UTFCONV_SSE2)
+  const __m128i high = _mm_set1_epi32 (~0x7F);
+  const __m128i zero = _mm_setzero_si128 ();
+  for (; i + 16 <= len; i += 16)
+    {
+    __m128i a = _mm_loadu_si128 ((const __m128i *)(in + i));
+    __m128i b = _mm_loadu_si128 ((const __m128i *)(in + i + 4));
+    __m128i c = _mm_loadu_si128 ((const __m128i *)(in + i + 8));
+    __m128i d = _mm_loadu_si128 ((const __m128i *)(in + i + 12));
+    __m128i any = _mm_or_si128 (_mm_or_si128 (a, b), _mm_or_si128 (c, d));
+    any = _mm_cmpeq_epi32 (_mm_and_si128 (any, high), zero);
+    if (_mm_movemask_epi8 (any) != 0xFFFF) break;
+    __m128i packed = _mm_packus_epi16 (_mm_packs_epi32 (a, b),
+      _mm_packs_epi32 (c, d));
+    _mm_storeu_si128 ((__m128i *)(out + i), packed);
+    }
+#elif defined(UTFCONV_NEON)
+  for (; i + 16 <= len; i += 16)
+    {
+    const uint32_t *p = (const uint32_t *)in + i;
+    uint32x4_t a = vld1q_u32 (p);
+    uint32x4_t b = vld1q_u32 (p + 4);
+    uint32x4_t c = vld1q_u32 (p + 8);
+    uint32x4_t d = vld1q_u32 (p + 12);
+    uint32x4_t any = vorrq_u32 (vorrq_u32 (a, b), vorrq_u32 (c, d));
+    if (utfconv_neon_any_bits (vreinterpretq_u8_u32 (any),
+         0xFFFFFF80FFFFFF80ULL)) break;
+    uint16x8_t ab = vcombine_u16 (vmovn_u32 (a), vmovn_u32 (b));
+    uint16x8_t cd = vcombine_u16 (vmovn_u32 (c), vmovn_u32 (d));
+    vst1q_u8 (out + i, vcombine_u8 (vmovn_u16 (ab), vmovn_u16 (cd)));
+    }
+#endif
+  for (; i < len && in[i] >= 0 && in[i] < 0x80; i++)
+    out[i] = (UTF8)in[i];
+  return i;
+  }
+
+/*==========================================================================
+
+  utfconv_narrow_ascii_16
+
+  As utfconv_narrow_ascii_32, for UTF-16 input that might be unaligned,
+  and might need byte-swapping
+
+==========================================================================*/
+static size_t utfconv_narrow_ascii_16 (const uint16_t *in, size_t len,
+    BOOL swap, UTF8 *out)
+  {
+  size_t i = 0;
+#if defined(UTFCONV_SSE2)
+  const __m128i high = _mm_set1_epi16 ((short)0xFF80);
+  const __m128i zero = _mm_setzero_si128 ();
+  for (; i + 16 <= len; i += 16)
+    {
+    __m128i a = _mm_loadu_si128 ((const __m128i *)(in + i));
+    __m128i b = _mm_loadu_si128 ((const __m128i *)(in + i + 8));
+    if (swap)
+      {
+      a = _mm_or_si128 (_mm_slli_epi16 (a, 8), _mm_srli_epi16 (a, 8));
+      b = _mm_or_si128 (_mm_slli_epi16 (b, 8), _mm_srli_epi16 (b, 8));
+      }
+    __m128i any = _mm_cmpeq_epi16 (_mm_and_si128 (_mm_or_si128 (a, b),
+      high), zero);
+    if (_mm_movemask_epi8 (any) != 0xFFFF) break;
+    _mm_storeu_si128 ((__m128i *)(out + i), _mm_packus_epi16 (a, b));
+    }
+#elif defined(UTFCONV_NEON)
+  for (; i + 16 <= len; i += 16)
+    {
+    uint8x16_t a = vld1q_u8 ((const uint8_t *)(in + i));
+    uint8x16_t b = vld1q_u8 ((const uint8_t *)(in + i + 8));
+    if (swap)
+      {
+      a = vrev16q_u8 (a);
+      b = vrev16q_u8 (b);
+      }
+    if (utfconv_neon_any_bits (vorrq_u8 (a, b), 0xFF80FF80FF80FF80ULL))
+      break;
+    vst1q_u8 (out + i, vcombine_u8 (vmovn_u16 (vreinterpretq_u16_u8 (a)),
+      vmovn_u16 (vreinterpretq_u16_u8 (b))));
+    }
+#endif
+  for (; i < len; i++)
+    {
+    uint16_t c;
+    memcpy (&c, in + i, sizeof (c));
+    if (swap) c = (uint16_t)((c << 8) | (c >> 8));
+    if (c >= 0x80) break;
+    out[i] = (UTF8)c;
+    }
+  return i;
+  }
+
+/*==========================================================================
+
+  utfconv_put
+
+  Write ch as UTF-8 at out, and return a pointer to the next byte
+
+==========================================================================*/
+static inline UTF8 *utfconv_put (UTF8 *out, uint32_t ch)
+  {
+  if (ch > 0x10FFFF) ch = UTFCONV_REPLACEMENT;
+  if (ch < 0x80)
+    {
+    *out++ = (UTF8)ch;
+    }
+  else if (ch < 0x0800)
+    {
+    *out++ = (UTF8)((ch >> 6) | 0xC0);
+    *out++ = (UTF8)((ch & 0x3F) | 0x80);
+    }
+  else if (ch < 0x10000)
+    {
+    *out++ = (UTF8)((ch >> 12) | 0xE0);
+    *out++ = (UTF8)(((ch >> 6) & 0x3F) | 0x80);
+    *out++ = (UTF8)((ch & 0x3F) | 0x80);
+    }
+  else
+    {
+    *out++ = (UTF8)((ch >> 18) | 0xF0);
+    *out++ = (UTF8)(((ch >> 12) & 0x3F) | 0x80);
+    *out++ = (UTF8)(((ch >> 6) & 0x3F) | 0x80);
+    *out++ = (UTF8)((ch & 0x3F) | 0x80);
+    }
+  return out;
+  }
+
+/*==========================================================================
+
+  utfconv_utf8_to_utf32
+
+==========================================================================*/
+UTF32 *utfconv_utf8_to_utf32 (const UTF8 *in, size_t len, size_t *out_len)
+  {
+  UTF32 *ret = malloc ((len + 1) * sizeof (UTF32));
+  UTF32 *out = ret;
+  const UTF8 *p = in;
+  const UTF8 *end = in + len;
+  while (p < end)
+    {
+    size_t n = utfconv_widen_ascii (p, end - p, out);
+    p += n;
+    out += n;
+    if (p == end) break;
+
+    // Bytes of a multi-byte sequence are never ASCII, so the non-ASCII
+    //  run can be converted in isolation
+    const UTF8 *run_end = p;
+    while (run_end < end && *run_end >= 0x80) run_end++;
+    if (ConvertUTF8toUTF32 (&p, run_end, &out, ret + len,
+         strictConversion) != conversionOK)
+      break;
+    }
+  *out = 0;
+  if (out_len) *out_len = out - ret;
+  return ret;
+  }
+
+/*==========================================================================
+
+  utfconv_utf32_to_utf8
+
+==========================================================================*/
+UTF8 *utfconv_utf32_to_utf8 (const UTF32 *in, size_t len, size_t *out_len)
+  {
+  UTF8 *ret = malloc (len * 4 + 1);
+  UTF8 *out = ret;
+  size_t i = 0;
+  while (i < len)
+    {
+    size_t n = utfconv_narrow_ascii_32 (in + i, len - i, out);
+    i += n;
+    out += n;
+    while (i < len && (in[i] < 0 || in[i] >= 0x80))
+      {
+      out = utfconv_put (out, in[i] < 0 ? UTFCONV_REPLACEMENT : in[i]);
+      i++;
+      }
+    }
+  *out = 0;
+  if (out_len) *out_len = out - ret;
+  return ret;
+  }
+
+/*==========================================================================
+
+  utfconv_utf16_to_utf8
+
+==========================================================================*/
+UTF8 *utfconv_utf16_to_utf8 (const uint16_t *in, size_t len, BOOL swap,
+    size_t *out_len)
+  {
+  // Three bytes of UTF-8 per unit is the worst case; a surrogate pair is
+  //  two units, and produces four bytes
+  UTF8 *ret = malloc (len * 3 + 1);
+  UTF8 *out = ret;
+  size_t i = 0;
+  while (i < len)
+    {
+    size_t n = utfconv_narrow_ascii_16 (in + i, len - i, swap, out);
+    i += n;
+    out += n;
+    while (i < len)
+      {
+      uint16_t c;
+      memcpy (&c, in + i, sizeof (c));
+      if (swap) c = (uint16_t)((c << 8) | (c >> 8));
+      if (c < 0x80) break;
+      i++;
+      uint32_t ch = c;
+      if (c >= 0xD800 && c <= 0xDBFF)
+        {
+        uint16_t c2 = 0;
+        if (i < len)
+          {
+          memcpy (&c2, in + i, sizeof (c2));
+          if (swap) c2 = (uint16_t)((c2 << 8) | (c2 >> 8));
+          }
+        if (c2 >= 0xDC00 && c2 <= 0xDFFF)
+          {
+          ch = ((c - 0xD800) << 10) + (c2 - 0xDC00) + 0x10000;
+          i++;
+          }
+        else
+          ch = UTFCONV_REPLACEMENT;
+        }
+      else if (c >= 0xDC00 && c <= 0xDFFF)
+        ch = UTFCONV_REPLACEMENT;
+      out = utfconv_put (out, ch);
+      }
+    }
+  *out = 0;
+  if (out_len) *out_len = out - ret;
+  return ret;
+  }
+
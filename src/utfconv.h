@@ -0,0 +1,46 @@
+/*============================================================================
+
+  xine-server-x
+  utfconv.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Conversions between UTF-8, UTF-16, and UTF-32. These functions are used
+  wherever text is converted -- tag reading, paths, and wide strings --
+  and have a vectorized fast path (SSE2 or NEON, where the compiler
+  supports them) for the common case of long runs of ASCII characters.
+  Defining UTFCONV_SCALAR at build time disables the vector code.
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "defs.h"
+
+BEGIN_DECLS
+
+/** Convert len bytes of UTF-8 to a newly-allocated, zero-terminated UTF-32
+    string. Conversion stops at the first malformed sequence. If out_len
+    is not NULL, it receives the number of characters converted. The
+    caller must free the result. */
+UTF32   *utfconv_utf8_to_utf32 (const UTF8 *in, size_t len, size_t *out_len);
+
+/** Convert len characters of UTF-32 to a newly-allocated, zero-terminated
+    UTF-8 string. Values outside the Unicode range are replaced with
+    U+FFFD. If out_len is not NULL, it receives the number of bytes
+    in the result, not including the terminator. The caller must free
+    the result. */
+UTF8    *utfconv_utf32_to_utf8 (const UTF32 *in, size_t len, size_t *out_len);
+
+/** Convert len 16-bit units of UTF-16 to a newly-allocated,
+    zero-terminated UTF-8 string. If swap is TRUE, the input is in the
+    opposite byte order to the host. The input need not be aligned.
+    Unpaired surrogates are replaced with U+FFFD. If out_len is not NULL,
+    it receives the number of bytes in the result, not including the
+    terminator. The caller must free the result. */
+UTF8    *utfconv_utf16_to_utf8 (const uint16_t *in, size_t len, BOOL swap,
+           size_t *out_len);
+
+END_DECLS
+
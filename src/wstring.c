@@ -23,6 +23,7 @@
 #include "defs.h" 
 #include "log.h" 
 #include "convertutf.h" 
+#include "utfconv.h" 
 
 struct _WString
   {
@@ -353,7 +354,8 @@ BOOL wstring_ends_with (const WString *self, const UTF32 *test)
 *==========================================================================*/
 UTF8 *wstring_to_utf8 (const WString *self)
   {
-  return string_utf32_to_utf8 (self->str); 
+  return utfconv_utf32_to_utf8 (self->str, 
+    wstring_length_utf32 (self->str), NULL); 
   }
 
 
@@ -15,12 +15,19 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
 #include <getopt.h>
 #include <wchar.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <errno.h>
 #include <ctype.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "xine-server-api.h" 
 
 /*==========================================================================
@@ -32,6 +39,8 @@ struct _XSPlaylist
   {
   int nentries;
   char **entries;
+  // The text that the entries point into
+  char *buff;
   };
 
 struct _XSStatus
@@ -97,33 +106,61 @@ struct _XSMetaInfo
 // Hash comment
 #define CHAR_HASH 4
 
-// Helper to maintain a variable-length string. This really ought to
-//  be optimized to allocate memory in blocks.
-static char *buff_append (char *buff, char c)
+// Helper to record the start of a token. The token array grows
+//  geometrically, so the cost of recording tokens is linear in their
+//  number
+static void xineserver_push_token (char *token, int *ntokens, int *cap,
+         char ***tokens)
   {
-  int l = strlen (buff);
-  char *buff2 = realloc (buff, l + 2);
-  buff2[l] = c;
-  buff2[l+1] = 0;
-  return buff2;
+  if (*ntokens == *cap)
+    {
+    *cap = *cap ? *cap * 2 : 16;
+    *tokens = realloc (*tokens, *cap * sizeof (char *));
+    }
+  (*tokens)[(*ntokens)++] = token;
+  }
+
+// Helper to finish the token that runs from start to *w. Empty tokens
+//  are dropped, as they always have been
+static void xineserver_end_token (char *start, char **w, int *ntokens, 
+         int *cap, char ***tokens)
+  {
+  if (*w > start)
+    {
+    **w = 0;
+    (*w)++;
+    xineserver_push_token (start, ntokens, cap, tokens);
+    }
   }
 
-static void xineserver_tokenize_response (const char *s, 
+/*
+  The tokens are unescaped in place: each token is copied down over the
+  part of s that has already been read, and terminated with a zero. No
+  token can be longer than the text it came from, and each token but
+  the last is followed by at least one character that is not copied -- a
+  space or a quote -- so there is always room for the zero. The
+  elements of the returned array point into s, which must therefore be
+  writable, and must outlive the tokens. Only the array itself needs
+  to be freed.
+*/
+static void xineserver_tokenize_response (char *s, 
          int *_ntokens, char ***_tokens)
   {
   int ntokens = 0;
-  char **tokens = malloc (ntokens * sizeof (char *)); 
-  int i, l = strlen (s);
+  int cap = 0;
+  char **tokens = NULL; 
 
-  char *buff = malloc (1);
-  buff[0] = 0; 
+  // w is where the next character of the current token will be
+  //  written, and start is where that token began
+  char *w = s;
+  char *start = s;
 
   int state = STATE_DUNNO;
   int last_state = STATE_DUNNO;
 
-  for (i = 0; i < l; i++)
+  for (const char *r = s; *r; r++)
     {
-    char c = s[i];
+    char c = *r;
     int chartype = CHAR_GENERAL;
     switch (c)
       {
@@ -147,14 +184,12 @@ static void xineserver_tokenize_response (const char *s,
         chartype = CHAR_GENERAL;
       }
 
-    //printf ("Got char %c of type %d in state %d\n", c, chartype, state);
-
     // Note: the number of cases should be num_state * num_char_types
     switch (1000 * state + chartype)
       {
       // --- Dunno states ---
       case 1000 * STATE_DUNNO + CHAR_GENERAL:
-        buff = buff_append (buff, c);
+        *w++ = c;
         state = STATE_GENERAL;
         break;
 
@@ -181,7 +216,7 @@ static void xineserver_tokenize_response (const char *s,
       // --- White states ---
       case 1000 * STATE_WHITE + CHAR_GENERAL:
         // Got a char while in ws
-        buff = buff_append (buff, c); 
+        *w++ = c;
         state = STATE_GENERAL;
         break;
 
@@ -207,19 +242,13 @@ static void xineserver_tokenize_response (const char *s,
       // --- General states ---
       case 1000 * STATE_GENERAL + CHAR_GENERAL:
         // Eat normal char 
-        buff = buff_append (buff, c);
+        *w++ = c;
         break;
 
       case 1000 * STATE_GENERAL + CHAR_WHITE:
         //Hit ws while eating characters -- this is a token
-        if (strlen (buff) > 0)
-          {
-          tokens = realloc (tokens, (ntokens + 1) * sizeof (char *));     
-          tokens[ntokens] = buff;
-          ntokens++;
-          }
-        buff = malloc (1);
-        buff[0] = 0;
+        xineserver_end_token (start, &w, &ntokens, &cap, &tokens);
+        start = w;
         state = STATE_WHITE;
         break;
 
@@ -235,75 +264,47 @@ static void xineserver_tokenize_response (const char *s,
 
       case 1000 * STATE_GENERAL + CHAR_HASH:
         //Hit hash while eating characters -- this is a token
-        if (strlen (buff) > 0)
-          {
-          tokens = realloc (tokens, (ntokens + 1) * sizeof (char *));     
-          tokens[ntokens] = buff;
-          ntokens++;
-          }
-        buff = malloc (1);
-        buff[0] = 0;
+        xineserver_end_token (start, &w, &ntokens, &cap, &tokens);
+        start = w;
         state = STATE_COMMENT;
         break;
 
       // --- Dquote states ---
       case 1000 * STATE_DQUOTE + CHAR_GENERAL:
         // Store the char, but remain in dquote mode
-        buff = buff_append (buff, c);
+        *w++ = c;
         break;
 
       case 1000 * STATE_DQUOTE + CHAR_WHITE:
         // Store the ws, and remain in dquote mode
-        buff = buff_append (buff, c);
+        *w++ = c;
         break;
 
       case 1000 * STATE_DQUOTE + CHAR_DQUOTE:
         // Leave dquote mode and store token (which might be empty) 
-        if (strlen (buff) > 0)
-          {
-          tokens = realloc (tokens, (ntokens + 1) * sizeof (char *));     
-          tokens[ntokens] = buff;
-          ntokens++;
-          }
-        buff = malloc (1);
-        buff[0] = 0;
+        xineserver_end_token (start, &w, &ntokens, &cap, &tokens);
+        start = w;
         state = STATE_DUNNO;
         break;
 
       case 1000 * STATE_DQUOTE + CHAR_ESC:
         last_state = state;
         state = STATE_ESC;
-        //string_append_byte (buff, c);
         break;
 
       case 1000 * STATE_DQUOTE + CHAR_HASH:
         // Keep this hash char -- it is quoted 
-        buff = buff_append (buff, c);
+        *w++ = c;
         break;
 
       // --- Esc states ---
       case 1000 * STATE_ESC + CHAR_GENERAL:
-        buff = buff_append (buff, c);
-        state = last_state; 
-        break;
-
       case 1000 * STATE_ESC + CHAR_WHITE:
-        buff = buff_append (buff, c);
-        state = last_state; 
-        break;
-
       case 1000 * STATE_ESC + CHAR_DQUOTE:
-        buff = buff_append (buff, '"');
-        state = last_state; 
-        break;
-
       case 1000 * STATE_ESC + CHAR_ESC:
-        buff = buff_append (buff, '\\');
-        state = last_state; 
-        break;
-
       case 1000 * STATE_ESC + CHAR_HASH:
-        buff = buff_append (buff, '#');
+        // The escaped character is stored as it is
+        *w++ = c;
         state = last_state; 
         break;
 
@@ -330,94 +331,812 @@ static void xineserver_tokenize_response (const char *s,
       }
     }
 
-  if (strlen (buff) > 0)
+  // The last token, if any, ends at the terminating zero of s, or
+  //  before it
+  xineserver_end_token (start, &w, &ntokens, &cap, &tokens);
+
+  *_ntokens = ntokens;
+  *_tokens = tokens;
+  }
+
+
+
+/*==========================================================================
+
+  Connection pool
+
+  xine-server handles any number of commands on a connection, one line
+  in and one line out, so connections are kept open after use and
+  handed to the next caller for the same host and port. The pool holds
+  idle connections only; a connection in use belongs to one thread.
+  Before an idle connection is reused, it is checked: one that has been
+  idle too long, or has become readable -- which means the server has
+  closed it, or sent something we did not ask for -- is discarded.
+
+==========================================================================*/
+typedef struct _XSConnection
+  {
+  char *host;
+  int port;
+  int sock;
+  time_t last_used;
+  } XSConnection;
+
+static pthread_mutex_t xineserver_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static XSConnection xineserver_pool[XINESERVER_POOL_MAX];
+static int xineserver_pool_nidle = 0;
+static int xineserver_pool_max_idle = XINESERVER_POOL_DEF_SIZE;
+static int xineserver_pool_idle_timeout = XINESERVER_POOL_DEF_IDLE_TIMEOUT;
+static int xineserver_pool_connects = 0;
+static int xineserver_pool_reuses = 0;
+static int xineserver_pool_stale = 0;
+
+// Responses are read in chunks of this size. Most fit in one
+#define XINESERVER_READ_CHUNK 4096
+
+static int xineserver_connect_timeout = XINESERVER_DEF_CONNECT_TIMEOUT;
+static int xineserver_io_timeout = XINESERVER_DEF_IO_TIMEOUT;
+static XSRequestObserver xineserver_request_observer = NULL;
+
+/*==========================================================================
+
+  Circuit breaker
+
+  If xine-server stops responding, every command would otherwise wait
+  for the full timeout, and every HTTP client would tie up a thread for
+  that long. Once the breaker opens, commands fail at once. 
+
+==========================================================================*/
+static pthread_mutex_t xineserver_breaker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static XSBreakerState xineserver_breaker_state = XINESERVER_BREAKER_CLOSED;
+static int xineserver_breaker_failures = 0;
+static int xineserver_breaker_threshold = XINESERVER_BREAKER_DEF_THRESHOLD;
+static int xineserver_breaker_cooldown = XINESERVER_BREAKER_DEF_COOLDOWN;
+static int64_t xineserver_breaker_open_until = 0;
+
+/*==========================================================================
+
+  xineserver_now_msec
+
+  Monotonic time in msec
+
+==========================================================================*/
+static int64_t xineserver_now_msec (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  }
+
+/*==========================================================================
+
+  xineserver_now_usec
+
+==========================================================================*/
+static int64_t xineserver_now_usec (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+/*==========================================================================
+
+  xineserver_set_request_observer
+
+==========================================================================*/
+void xineserver_set_request_observer (XSRequestObserver observer)
+  {
+  xineserver_request_observer = observer;
+  }
+
+/*==========================================================================
+
+  xineserver_set_timeouts
+
+==========================================================================*/
+void xineserver_set_timeouts (int connect_msec, int io_msec)
+  {
+  if (connect_msec > 0) xineserver_connect_timeout = connect_msec;
+  if (io_msec > 0) xineserver_io_timeout = io_msec;
+  }
+
+/*==========================================================================
+
+  xineserver_breaker_set_limits
+
+==========================================================================*/
+void xineserver_breaker_set_limits (int threshold, int cooldown_msec)
+  {
+  pthread_mutex_lock (&xineserver_breaker_mutex);
+  xineserver_breaker_threshold = threshold < 0 ? 0 : threshold;
+  xineserver_breaker_cooldown = cooldown_msec;
+  xineserver_breaker_state = XINESERVER_BREAKER_CLOSED;
+  xineserver_breaker_failures = 0;
+  pthread_mutex_unlock (&xineserver_breaker_mutex);
+  }
+
+/*==========================================================================
+
+  xineserver_breaker_get_state
+
+==========================================================================*/
+void xineserver_breaker_get_state (XSBreakerState *state, int *failures)
+  {
+  pthread_mutex_lock (&xineserver_breaker_mutex);
+  XSBreakerState s = xineserver_breaker_state;
+  // Report an open breaker whose cooldown has expired as half-open, 
+  //   since the next command will be let through
+  if (s == XINESERVER_BREAKER_OPEN 
+      && xineserver_now_msec () >= xineserver_breaker_open_until)
+    s = XINESERVER_BREAKER_HALF_OPEN;
+  if (state) *state = s;
+  if (failures) *failures = xineserver_breaker_failures;
+  pthread_mutex_unlock (&xineserver_breaker_mutex);
+  }
+
+/*==========================================================================
+
+  xineserver_breaker_state_name
+
+==========================================================================*/
+const char *xineserver_breaker_state_name (XSBreakerState state)
+  {
+  switch (state)
     {
-    tokens = realloc (tokens, (ntokens + 1) * sizeof (char *));     
-    tokens[ntokens] = buff;
-    ntokens++;
+    case XINESERVER_BREAKER_CLOSED: return "closed";
+    case XINESERVER_BREAKER_OPEN: return "open";
+    case XINESERVER_BREAKER_HALF_OPEN: return "half-open";
+    }
+  return "unknown";
+  }
+
+/*==========================================================================
+
+  xineserver_breaker_allow
+
+  Returns TRUE if a command may be sent. If the cooldown has expired,
+  the caller becomes the probe, and others are turned away until it
+  reports its result
+
+==========================================================================*/
+static BOOL xineserver_breaker_allow (void)
+  {
+  BOOL ret = TRUE;
+  pthread_mutex_lock (&xineserver_breaker_mutex);
+  if (xineserver_breaker_threshold > 0)
+    {
+    if (xineserver_breaker_state == XINESERVER_BREAKER_OPEN)
+      {
+      if (xineserver_now_msec () >= xineserver_breaker_open_until)
+        xineserver_breaker_state = XINESERVER_BREAKER_HALF_OPEN;
+      else
+        ret = FALSE;
+      }
+    else if (xineserver_breaker_state == XINESERVER_BREAKER_HALF_OPEN)
+      ret = FALSE;
+    }
+  pthread_mutex_unlock (&xineserver_breaker_mutex);
+  return ret;
+  }
+
+/*==========================================================================
+
+  xineserver_breaker_report
+
+  Record the result of a command that was allowed through
+
+==========================================================================*/
+static void xineserver_breaker_report (BOOL ok)
+  {
+  pthread_mutex_lock (&xineserver_breaker_mutex);
+  if (ok)
+    {
+    xineserver_breaker_failures = 0;
+    xineserver_breaker_state = XINESERVER_BREAKER_CLOSED;
     }
   else
     {
-    if (buff) free (buff); 
+    xineserver_breaker_failures++;
+    if (xineserver_breaker_threshold > 0 
+        && (xineserver_breaker_state == XINESERVER_BREAKER_HALF_OPEN
+        || xineserver_breaker_failures >= xineserver_breaker_threshold))
+      {
+      xineserver_breaker_state = XINESERVER_BREAKER_OPEN;
+      xineserver_breaker_open_until = xineserver_now_msec () 
+        + xineserver_breaker_cooldown;
+      }
     }
+  pthread_mutex_unlock (&xineserver_breaker_mutex);
+  }
 
-  *_ntokens = ntokens;
-  *_tokens = tokens;
+/*==========================================================================
+
+  xineserver_wait
+
+  Wait until sock is ready for events, or until the deadline (monotonic
+  msec) passes. Returns FALSE with errno set on timeout or error
+
+==========================================================================*/
+static BOOL xineserver_wait (int sock, short events, int64_t deadline)
+  {
+  for (;;)
+    {
+    int64_t remaining = deadline - xineserver_now_msec ();
+    if (remaining <= 0)
+      {
+      errno = ETIMEDOUT;
+      return FALSE;
+      }
+    struct pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = events;
+    pfd.revents = 0;
+    int n = poll (&pfd, 1, (int)remaining);
+    if (n > 0) return TRUE;
+    if (n < 0 && errno != EINTR) return FALSE;
+    }
+  }
+
+/*==========================================================================
+
+  xineserver_pool_set_limits
+
+==========================================================================*/
+void xineserver_pool_set_limits (int max_idle, int idle_timeout)
+  {
+  if (max_idle < 0) max_idle = 0;
+  if (max_idle > XINESERVER_POOL_MAX) max_idle = XINESERVER_POOL_MAX;
+  pthread_mutex_lock (&xineserver_pool_mutex);
+  xineserver_pool_max_idle = max_idle;
+  xineserver_pool_idle_timeout = idle_timeout;
+  pthread_mutex_unlock (&xineserver_pool_mutex);
+  // Drop any connections beyond the new limit
+  if (max_idle == 0) xineserver_pool_close_all ();
+  }
+
+/*==========================================================================
+
+  xineserver_pool_close_all
+
+==========================================================================*/
+void xineserver_pool_close_all (void)
+  {
+  pthread_mutex_lock (&xineserver_pool_mutex);
+  for (int i = 0; i < xineserver_pool_nidle; i++)
+    {
+    close (xineserver_pool[i].sock);
+    free (xineserver_pool[i].host);
+    }
+  xineserver_pool_nidle = 0;
+  pthread_mutex_unlock (&xineserver_pool_mutex);
+  }
+
+/*==========================================================================
+
+  xineserver_pool_get_stats
+
+==========================================================================*/
+void xineserver_pool_get_stats (int *connects, int *reuses, int *stale)
+  {
+  pthread_mutex_lock (&xineserver_pool_mutex);
+  if (connects) *connects = xineserver_pool_connects;
+  if (reuses) *reuses = xineserver_pool_reuses;
+  if (stale) *stale = xineserver_pool_stale;
+  pthread_mutex_unlock (&xineserver_pool_mutex);
+  }
+
+/*==========================================================================
+
+  xineserver_connection_is_alive
+
+  An idle connection should have nothing to read. If poll() says that
+  it is readable, it is either at end-of-file, or out of step with
+  the server. Either way, it is no use
+
+==========================================================================*/
+static BOOL xineserver_connection_is_alive (int sock)
+  {
+  struct pollfd pfd;
+  pfd.fd = sock;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  int n = poll (&pfd, 1, 0);
+  return n == 0;
+  }
+
+/*==========================================================================
+
+  Address cache
+
+  Host names are resolved with getaddrinfo() -- which, unlike 
+  gethostbyname(), is safe to call from several threads -- and the
+  addresses kept for a while, so that commands do not have to wait for
+  the resolver. The addresses for a host are looked up again when they
+  expire, or when none of them will accept a connection, in case the
+  server has moved.
+
+  A host name that begins with '/' is the path of a Unix-domain socket;
+  the port is then ignored.
+
+==========================================================================*/
+#define XINESERVER_RESOLVE_MAX_ADDRS 8
+#define XINESERVER_RESOLVE_CACHE     4
+
+typedef struct _XSResolved
+  {
+  char *host;
+  int port;
+  int64_t expires;
+  int naddrs;
+  struct sockaddr_storage addrs[XINESERVER_RESOLVE_MAX_ADDRS];
+  socklen_t lens[XINESERVER_RESOLVE_MAX_ADDRS];
+  } XSResolved;
+
+static pthread_mutex_t xineserver_resolve_mutex = PTHREAD_MUTEX_INITIALIZER;
+static XSResolved xineserver_resolved[XINESERVER_RESOLVE_CACHE];
+static int xineserver_resolve_ttl = XINESERVER_DEF_RESOLVE_TTL;
+
+/*==========================================================================
+
+  xineserver_set_resolve_ttl
+
+==========================================================================*/
+void xineserver_set_resolve_ttl (int seconds)
+  {
+  pthread_mutex_lock (&xineserver_resolve_mutex);
+  xineserver_resolve_ttl = seconds < 0 ? 0 : seconds;
+  pthread_mutex_unlock (&xineserver_resolve_mutex);
+  }
+
+/*==========================================================================
+
+  xineserver_resolve_forget
+
+  Discard any cached addresses for host:port
+
+==========================================================================*/
+static void xineserver_resolve_forget (const char *host, int port)
+  {
+  pthread_mutex_lock (&xineserver_resolve_mutex);
+  for (int i = 0; i < XINESERVER_RESOLVE_CACHE; i++)
+    {
+    XSResolved *r = &xineserver_resolved[i];
+    if (r->host && r->port == port && strcmp (r->host, host) == 0)
+      r->expires = 0;
+    }
+  pthread_mutex_unlock (&xineserver_resolve_mutex);
+  }
+
+/*==========================================================================
+
+  xineserver_lookup
+
+  Fill in r->addrs with the addresses of host:port, from the cache if
+  possible. r->host is not set. Returns FALSE with error set if the
+  host can't be resolved
+
+==========================================================================*/
+static BOOL xineserver_lookup (const char *host, int port, XSResolved *r,
+      char **error)
+  {
+  r->naddrs = 0;
+
+  if (host[0] == '/')
+    {
+    struct sockaddr_un *sun = (struct sockaddr_un *)&r->addrs[0];
+    if (strlen (host) >= sizeof (sun->sun_path))
+      {
+      if (error) asprintf (error, "Socket path too long: %s", host);
+      return FALSE;
+      }
+    memset (sun, 0, sizeof (*sun));
+    sun->sun_family = AF_UNIX;
+    strcpy (sun->sun_path, host);
+    r->lens[0] = sizeof (*sun);
+    r->naddrs = 1;
+    return TRUE;
+    }
+
+  int64_t now = xineserver_now_msec ();
+  pthread_mutex_lock (&xineserver_resolve_mutex);
+  for (int i = 0; i < XINESERVER_RESOLVE_CACHE && r->naddrs == 0; i++)
+    {
+    XSResolved *c = &xineserver_resolved[i];
+    if (c->host && c->port == port && c->expires > now
+        && strcmp (c->host, host) == 0)
+      {
+      r->naddrs = c->naddrs;
+      memcpy (r->addrs, c->addrs, sizeof (r->addrs));
+      memcpy (r->lens, c->lens, sizeof (r->lens));
+      }
+    }
+  int ttl = xineserver_resolve_ttl;
+  pthread_mutex_unlock (&xineserver_resolve_mutex);
+  if (r->naddrs > 0) return TRUE;
+
+  struct addrinfo hints, *res = NULL;
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV;
+  char service[16];
+  snprintf (service, sizeof (service), "%d", port);
+  int rc = getaddrinfo (host, service, &hints, &res);
+  if (rc != 0)
+    {
+    if (error) asprintf (error, "Can't resolve hostname %s: %s", host, 
+      gai_strerror (rc));
+    return FALSE;
+    }
+  for (struct addrinfo *ai = res; ai && r->naddrs 
+         < XINESERVER_RESOLVE_MAX_ADDRS; ai = ai->ai_next)
+    {
+    if (ai->ai_addrlen > sizeof (struct sockaddr_storage)) continue;
+    memcpy (&r->addrs[r->naddrs], ai->ai_addr, ai->ai_addrlen);
+    r->lens[r->naddrs] = ai->ai_addrlen;
+    r->naddrs++;
+    }
+  freeaddrinfo (res);
+  if (r->naddrs == 0)
+    {
+    if (error) asprintf (error, "No usable address for %s", host);
+    return FALSE;
+    }
+
+  // Store in the cache, replacing the same host, an empty slot, or
+  //   the entry that expires first
+  pthread_mutex_lock (&xineserver_resolve_mutex);
+  XSResolved *slot = &xineserver_resolved[0];
+  for (int i = 0; i < XINESERVER_RESOLVE_CACHE; i++)
+    {
+    XSResolved *c = &xineserver_resolved[i];
+    if (!c->host || (c->port == port && strcmp (c->host, host) == 0))
+      {
+      slot = c;
+      break;
+      }
+    if (c->expires < slot->expires) slot = c;
+    }
+  free (slot->host);
+  slot->host = strdup (host);
+  slot->port = port;
+  slot->expires = xineserver_now_msec () + (int64_t)ttl * 1000;
+  slot->naddrs = r->naddrs;
+  memcpy (slot->addrs, r->addrs, sizeof (slot->addrs));
+  memcpy (slot->lens, r->lens, sizeof (slot->lens));
+  pthread_mutex_unlock (&xineserver_resolve_mutex);
+  return TRUE;
+  }
+
+/*==========================================================================
+
+  xineserver_resolve
+
+==========================================================================*/
+BOOL xineserver_resolve (const char *host, int port, char **error)
+  {
+  XSResolved r;
+  return xineserver_lookup (host, port, &r, error);
+  }
+
+/*==========================================================================
+
+  xineserver_connect_addr
+
+  Connect to one address, waiting no longer than the connect timeout.
+  Returns the socket, or -1 with errno set
+
+==========================================================================*/
+static int xineserver_connect_addr (const struct sockaddr *addr, 
+      socklen_t len)
+  {
+  // Non-blocking, so that neither connect() nor any later read or
+  //   write can wait longer than the timeouts
+  int sock = socket (addr->sa_family, 
+    SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);  
+  if (sock < 0) return -1;
+
+  int rc = connect (sock, addr, len);
+  if (rc != 0 && errno == EINPROGRESS)
+    {
+    if (xineserver_wait (sock, POLLOUT, xineserver_now_msec () 
+          + xineserver_connect_timeout))
+      {
+      int so_error = 0;
+      socklen_t so_len = sizeof (so_error);
+      getsockopt (sock, SOL_SOCKET, SO_ERROR, &so_error, &so_len);
+      errno = so_error;
+      rc = so_error == 0 ? 0 : -1;
+      }
+    }
+  if (rc != 0)
+    {
+    int e = errno;
+    close (sock);
+    errno = e;
+    return -1;
+    }
+
+  if (addr->sa_family != AF_UNIX)
+    {
+    // Commands and responses are short, and we always wait for the
+    //   response, so there's nothing to gain from Nagle
+    int one = 1;
+    setsockopt (sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+    }
+  return sock;
+  }
+
+/*==========================================================================
+
+  xineserver_connect
+
+  Returns a new connected socket, or -1 with error set. Each address
+  of the host is tried in turn. If none accepts a connection, the
+  cached addresses are discarded, so the next attempt will look them
+  up again
+
+==========================================================================*/
+static int xineserver_connect (const char *host, int port, char **error)
+  {
+  XSResolved r;
+  if (!xineserver_lookup (host, port, &r, error))
+    return -1;
+
+  int sock = -1;
+  for (int i = 0; i < r.naddrs && sock < 0; i++)
+    sock = xineserver_connect_addr ((struct sockaddr *)&r.addrs[i], 
+      r.lens[i]);
+
+  if (sock >= 0)
+    {
+    pthread_mutex_lock (&xineserver_pool_mutex);
+    xineserver_pool_connects++;
+    pthread_mutex_unlock (&xineserver_pool_mutex);
+    }
+  else
+    {
+    if (host[0] == '/')
+      asprintf (error, "Can't connect to xine-server at %s: %s", 
+        host, strerror (errno));
+    else
+      asprintf (error, "Can't connect to xine-server at %s:%d: %s", 
+        host, port, strerror (errno));
+    xineserver_resolve_forget (host, port);
+    }
+
+  return sock;
   }
 
+/*==========================================================================
+
+  xineserver_pool_acquire
 
+  Get a connection to the server, reusing an idle one if possible.
+  *reused is set if the connection came from the pool. Returns -1 
+  with error set if no connection can be made
+
+==========================================================================*/
+static int xineserver_pool_acquire (const char *host, int port, 
+      BOOL *reused, char **error)
+  {
+  int sock = -1;
+  time_t now = time (NULL);
+  pthread_mutex_lock (&xineserver_pool_mutex);
+  // Most recently used first -- it is the least likely to have been
+  //   closed by the server
+  for (int i = xineserver_pool_nidle - 1; i >= 0 && sock < 0; i--)
+    {
+    XSConnection *c = &xineserver_pool[i];
+    if (c->port != port || strcmp (c->host, host) != 0) continue;
+    int candidate = c->sock;
+    BOOL usable = now - c->last_used < xineserver_pool_idle_timeout
+      && xineserver_connection_is_alive (candidate);
+    free (c->host);
+    xineserver_pool[i] = xineserver_pool[--xineserver_pool_nidle];
+    if (usable)
+      {
+      sock = candidate;
+      xineserver_pool_reuses++;
+      }
+    else
+      {
+      close (candidate);
+      xineserver_pool_stale++;
+      }
+    }
+  pthread_mutex_unlock (&xineserver_pool_mutex);
+
+  *reused = (sock >= 0);
+  if (sock < 0)
+    sock = xineserver_connect (host, port, error);
+  return sock;
+  }
+
+/*==========================================================================
+
+  xineserver_pool_release
+
+  Return a connection that is in a good state to the pool, or close
+  it if the pool is full
+
+==========================================================================*/
+static void xineserver_pool_release (const char *host, int port, int sock)
+  {
+  pthread_mutex_lock (&xineserver_pool_mutex);
+  if (xineserver_pool_nidle < xineserver_pool_max_idle)
+    {
+    XSConnection *c = &xineserver_pool[xineserver_pool_nidle++];
+    c->host = strdup (host);
+    c->port = port;
+    c->sock = sock;
+    c->last_used = time (NULL);
+    sock = -1;
+    }
+  pthread_mutex_unlock (&xineserver_pool_mutex);
+  if (sock >= 0) close (sock);
+  }
+
+/*==========================================================================
+
+  xineserver_send_all
+
+==========================================================================*/
+static BOOL xineserver_send_all (int sock, const char *data, size_t len,
+      int flags, int64_t deadline)
+  {
+  while (len > 0)
+    {
+    // MSG_NOSIGNAL -- a connection closed by the server must produce
+    //   an error here, not kill the program with SIGPIPE
+    ssize_t n = send (sock, data, len, flags | MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+      if (!xineserver_wait (sock, POLLOUT, deadline)) return FALSE;
+      continue;
+      }
+    if (n <= 0) return FALSE;
+    data += n;
+    len -= n;
+    }
+  return TRUE;
+  }
+
+/*==========================================================================
+
+  xineserver_read_line
+
+  Read one line from the server, in large chunks, into a buffer that 
+  grows geometrically. On success, *line is set to the line, without
+  the newline, for the caller to free, and the length is returned.
+  *extra is set if more data arrived after the newline -- something a
+  well-behaved server will never send. 
+  
+  Returns -1 if the connection was closed before anything was received,
+  and -2, with errno set, for any other failure, including the whole
+  line not arriving before the deadline.
+
+==========================================================================*/
+static int xineserver_read_line (int sock, char **line, BOOL *extra,
+      int64_t deadline)
+  {
+  size_t size = XINESERVER_READ_CHUNK;
+  size_t len = 0;
+  char *buff = malloc (size);
+  char *nl = NULL;
+  *extra = FALSE;
+
+  while (!nl)
+    {
+    // Always leave room for a chunk, and a terminating null
+    if (size - len < XINESERVER_READ_CHUNK + 1)
+      {
+      size *= 2;
+      buff = realloc (buff, size);
+      }
+    ssize_t n = recv (sock, buff + len, size - len - 1, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)
+        && xineserver_wait (sock, POLLIN, deadline))
+      continue;
+    if (n <= 0)
+      {
+      free (buff);
+      if (n == 0 && len == 0) return -1;
+      if (n == 0) errno = ECONNRESET; // Closed in mid-line
+      return -2;
+      }
+    // Only the new data needs to be searched
+    nl = memchr (buff + len, '\n', n);
+    len += n;
+    }
+
+  size_t line_len = nl - buff;
+  *extra = (line_len + 1 < len);
+  buff[line_len] = 0;
+  *line = buff;
+  return (int)line_len;
+  }
 
 /*==========================================================================
 
   xineserver_send_and_receive
 
+  Send one command and read the one-line response, on a pooled 
+  connection. If a connection from the pool fails before any of the
+  response has been read, the server most likely closed it while it 
+  was idle, and never saw the command, so the command is sent once 
+  more on a new connection.
+
+  Each attempt must get its complete response within the IO timeout.
+  Failures count towards opening the circuit breaker.
+
 ==========================================================================*/
 BOOL xineserver_send_and_receive (const char *host, 
        int port, const char *command, char **response, char **error)
   {
   BOOL ret = FALSE;
+  BOOL retry;
 
-  int sock = socket (AF_INET, SOCK_STREAM, 0);  
+  if (!xineserver_breaker_allow ())
+    {
+    asprintf (error, "xine-server at %s:%d is not responding", host, port);
+    return FALSE;
+    }
 
-  if (sock >= 0)
+  int64_t started = xineserver_request_observer ? xineserver_now_usec () : 0;
+  do
     {
-    struct hostent *hostent = gethostbyname (host);
-    if (hostent)
+    retry = FALSE;
+    BOOL reused = FALSE;
+    char *e = NULL;
+    int sock = xineserver_pool_acquire (host, port, &reused, &e);
+    if (sock < 0)
       {
-      struct sockaddr_in sin;
-      memcpy (&sin.sin_addr.s_addr, hostent->h_addr, hostent->h_length);
-      sin.sin_family = AF_INET;
-      sin.sin_port = htons (port);
-      if (connect (sock, (struct sockaddr *)&sin, sizeof (sin)) == 0)
-        {
-        static char *buff = "\r\n";
-        send (sock, command, strlen (command), 0);
-        send (sock, buff, 2, 0);
-        int n;
-        BOOL got_line = FALSE;
-        char *rbuff = malloc (1);
-        rbuff[0] = 0;
-        int i = 0;
-        do
-          {
-          char buf[1];
-          n = read (sock, &buf, 1);
-          if (buf[0] == '\n')
-            got_line = TRUE;
-          else
-            {
-            rbuff = realloc (rbuff, i + 2);
-            rbuff[i] = buf[0];
-            rbuff[i + 1] = 0;
-            //printf ("got %c\n", buf[0]); 
-            }
-          i++;
-          } while (n > 0 && !got_line); 
-
-        *response = strdup (rbuff);
-        free (rbuff);
-        ret = TRUE;
-        }
+      *error = e;
+      break;
+      }
+
+    int64_t deadline = xineserver_now_msec () + xineserver_io_timeout;
+    BOOL sent = xineserver_send_all (sock, command, strlen (command), 
+        MSG_MORE, deadline)
+      && xineserver_send_all (sock, "\r\n", 2, 0, deadline);
+    // A failed send is treated like a connection closed before the
+    //   response -- the server can't have seen the command
+    int n = -1;
+    BOOL extra = FALSE;
+    char *rbuff = NULL;
+    if (sent)
+      n = xineserver_read_line (sock, &rbuff, &extra, deadline);
+    BOOL got_line = (n >= 0);
+
+    if (got_line)
+      {
+      *response = rbuff;
+      // Anything after the newline means that we're out of step with
+      //   the server, and the connection can't be reused 
+      if (extra)
+        close (sock);
       else
-        {
-        asprintf (error, "Can't connect to xine-server at %s:%d: %s", 
-	  host, port, strerror (errno));
-        ret = FALSE;
-        }
+        xineserver_pool_release (host, port, sock);
+      ret = TRUE;
       }
     else
       {
-      ret = FALSE;
-      asprintf (error, "Can't resolve hostname: %s", hstrerror (h_errno));
+      close (sock);
+      if (reused && n == -1)
+        retry = TRUE;
+      else
+        asprintf (error, "Lost connection to xine-server at %s:%d: %s", 
+	  host, port, n == -1 ? "connection closed" : strerror (errno));
       }
-    close (sock);
-    }
-  else
-   {
-   ret = FALSE;
-   asprintf (error, "Can't open socket");
-   }
+    } while (retry);
 
+  xineserver_breaker_report (ret);
+  if (xineserver_request_observer)
+    xineserver_request_observer (xineserver_now_usec () - started);
   return ret;
   }
 
@@ -427,14 +1146,14 @@ BOOL xineserver_send_and_receive (const char *host,
   xineserver_get_text_response
 
 ==========================================================================*/
-static const char *xineserver_get_text_response (const char *response)
+static char *xineserver_get_text_response (char *response)
   {
-  const char *ret;
+  char *ret;
   char *sp = strchr (response, ' ');
   if (sp)
     ret = sp + 1;
   else
-    ret = "";
+    ret = response + strlen (response);
   return ret;
   }
 
@@ -542,7 +1261,6 @@ BOOL xineserver_status (const char *host, int port, XSStatus **status,
         {
         *error_code = XINESERVER_ERR_RESPONSE;
         }
-      for (int i = 0; i < ntokens; i++) free (tokens[i]);
       free (tokens);
       }
     free (response);
@@ -600,7 +1318,6 @@ BOOL xineserver_get_eq (const char *host, int port, int eq[10],
         *error = strdup ("Incorrect number of tokens in response from server");
         ret = FALSE;
         }
-      for (int i = 0; i < ntokens; i++) free (tokens[i]);
       free (tokens);
       }
     free (response);
@@ -706,7 +1423,6 @@ BOOL xineserver_meta_info (const char *host, int port, XSMetaInfo **mi,
         *error = strdup ("Incorrect number of tokens in response from server");
         ret = FALSE;
         }
-      for (int i = 0; i < ntokens; i++) free (tokens[i]);
       free (tokens);
       }
     free (response);
@@ -751,10 +1467,14 @@ BOOL xineserver_playlist (const char *host, int port, XSPlaylist **playlist,
       int ntokens = 0;
       xineserver_tokenize_response 
         (xineserver_get_text_response (response), &ntokens, &tokens); 
+      // The entries point into the response, so the playlist takes
+      //  ownership of it
       XSPlaylist *pl = malloc (sizeof (XSPlaylist)); 
       pl->nentries = ntokens;
       pl->entries = tokens;
+      pl->buff = response;
       *playlist = pl;
+      response = NULL;
       ret = TRUE;
       }
     free (response);
@@ -768,28 +1488,135 @@ BOOL xineserver_playlist (const char *host, int port, XSPlaylist **playlist,
 
 /*==========================================================================
 
-  xineserver_add_single 
+  Command buffer
+
+  A growable buffer for building long commands. Capacity doubles as
+  needed, so building a command is linear in its length
+
+==========================================================================*/
+typedef struct _XSCommandBuffer
+  {
+  char *data;
+  size_t len;
+  size_t cap;
+  } XSCommandBuffer;
+
+/*==========================================================================
+
+  xscmd_append
+
+==========================================================================*/
+static void xscmd_append (XSCommandBuffer *self, const char *s, size_t n)
+  {
+  if (self->len + n + 1 > self->cap)
+    {
+    size_t cap = self->cap ? self->cap : 256;
+    while (self->len + n + 1 > cap) cap *= 2;
+    self->data = realloc (self->data, cap);
+    self->cap = cap;
+    }
+  memcpy (self->data + self->len, s, n);
+  self->len += n;
+  self->data[self->len] = 0;
+  }
+
+/*==========================================================================
+
+  xscmd_append_quoted
+
+  Append a space, and then s in double quotes, escaping any quote or
+  backslash, as the xine-server tokenizer expects. A line break can't
+  be escaped, and would end the command, so it is replaced with a 
+  space -- such a file can't be played, but at least the rest can
+
+==========================================================================*/
+static void xscmd_append_quoted (XSCommandBuffer *self, const char *s)
+  {
+  xscmd_append (self, " \"", 2);
+  const char *run = s;
+  for (; *s; s++)
+    {
+    if (*s == '"' || *s == '\\' || *s == '\n' || *s == '\r')
+      {
+      xscmd_append (self, run, s - run);
+      if (*s == '\n' || *s == '\r')
+        xscmd_append (self, " ", 1);
+      else
+        {
+        char esc[2] = { '\\', *s };
+        xscmd_append (self, esc, 2);
+        }
+      run = s + 1;
+      }
+    }
+  xscmd_append (self, run, s - run);
+  xscmd_append (self, "\"", 1);
+  }
+
+/*==========================================================================
+
+  xineserver_add_range
+
+  Add streams[from] to streams[to - 1] to the playlist, in as few 
+  commands as possible, without letting any command grow beyond the 
+  chunk limits
+
+==========================================================================*/
+static BOOL xineserver_add_range (const char *host, int port, 
+       const char *const *streams, int from, int to, 
+       int *error_code, char **error)
+  {
+  BOOL ret = TRUE;
+  XSCommandBuffer cmd = { NULL, 0, 0 };
+  int i = from;
+  while (i < to && ret)
+    {
+    cmd.len = 0;
+    xscmd_append (&cmd, XINESERVER_CMD_ADD, strlen (XINESERVER_CMD_ADD));
+    int n = 0;
+    // Always at least one stream, however long
+    while (i < to && (n == 0 || (n < XINESERVER_ADD_CHUNK_STREAMS
+         && cmd.len < XINESERVER_ADD_CHUNK_BYTES)))
+      {
+      xscmd_append_quoted (&cmd, streams[i]);
+      i++;
+      n++;
+      }
+    ret = xineserver_gen_command (host, port, cmd.data, error_code, error);
+    }
+  free (cmd.data);
+  return ret;
+  }
+
+/*==========================================================================
+
+  xineserver_add
 
 ==========================================================================*/
 BOOL xineserver_add (const char *host, int port, int nstreams, 
                             const char *const *streams, 
                             int *error_code, char **error)
   {
-  BOOL ret = FALSE;
-  char *command = strdup (XINESERVER_CMD_ADD); 
-  for (int i = 0; i < nstreams; i++)
-    {
-    const char *stream = streams[i]; // TODO -- escape
+  return xineserver_add_range (host, port, streams, 0, nstreams, 
+    error_code, error);
+  }
 
-    command = realloc (command, strlen (command) + strlen(stream) + 10);   
+/*==========================================================================
 
-    strcat (command, " \"");
-    strcat (command, stream);
-    strcat (command, "\"");
-    }
+  xineserver_play_streams
 
-  ret = xineserver_gen_command (host, port, command, error_code, error);
-  free (command);
+==========================================================================*/
+BOOL xineserver_play_streams (const char *host, int port, int nstreams, 
+        const char *const *streams, int *error_code, char **error)
+  {
+  int first = nstreams < XINESERVER_ADD_FIRST_CHUNK 
+    ? nstreams : XINESERVER_ADD_FIRST_CHUNK;
+  BOOL ret = xineserver_clear (host, port, error_code, error)
+    && xineserver_add_range (host, port, streams, 0, first, 
+         error_code, error)
+    && xineserver_play (host, port, 0, error_code, error)
+    && xineserver_add_range (host, port, streams, first, nstreams, 
+         error_code, error);
   return ret;
   }
 
@@ -801,13 +1628,8 @@ BOOL xineserver_add (const char *host, int port, int nstreams,
 BOOL xineserver_add_single (const char *host, int port, const char *stream, 
         int *error_code, char **error)
   {
-  BOOL ret = FALSE;
-  char *command = NULL;
-  // TODO -- escape quotes in stream
-  asprintf (&command, "%s \"%s\"", XINESERVER_CMD_ADD, stream);
-  ret = xineserver_gen_command (host, port, command, error_code, error);
-  free (command);
-  return ret;
+  return xineserver_add_range (host, port, &stream, 0, 1, 
+    error_code, error);
   }
 
 /*==========================================================================
@@ -1092,12 +1914,8 @@ void xsplaylist_destroy  (XSPlaylist *self)
   {
   if (self)
     {
-    if (self->entries)
-      {
-      for (int i = 0; i < self->nentries; i++)
-        free (self->entries[i]);
-      free (self->entries);
-      }
+    free (self->entries);
+    free (self->buff);
     free (self);
     }
   }
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 // Boolean -- define these if nobody else has
 
 #ifndef TRUE
@@ -27,6 +29,30 @@ typedef int BOOL;
 // Default server port
 #define XINESERVER_DEF_PORT 30001
 
+// Connection pool limits -- see xineserver_pool_set_limits()
+#define XINESERVER_POOL_MAX              32
+#define XINESERVER_POOL_DEF_SIZE         4
+#define XINESERVER_POOL_DEF_IDLE_TIMEOUT 30
+
+// Limits on the size of each command sent by xineserver_add(), and the
+//   number of streams added before playback starts in
+//   xineserver_play_streams()
+#define XINESERVER_ADD_CHUNK_STREAMS     256
+#define XINESERVER_ADD_CHUNK_BYTES       32768
+#define XINESERVER_ADD_FIRST_CHUNK       8
+
+// Default timeouts, in msec -- see xineserver_set_timeouts()
+#define XINESERVER_DEF_CONNECT_TIMEOUT   2000
+#define XINESERVER_DEF_IO_TIMEOUT        5000
+
+// Default time for which resolved addresses are kept, in seconds -- see
+//   xineserver_set_resolve_ttl()
+#define XINESERVER_DEF_RESOLVE_TTL       300
+
+// Circuit breaker defaults -- see xineserver_breaker_set_limits()
+#define XINESERVER_BREAKER_DEF_THRESHOLD 3
+#define XINESERVER_BREAKER_DEF_COOLDOWN  5000
+
 // Error codes
 
 // No error
@@ -95,6 +121,24 @@ typedef struct _XSMetaInfo XSMetaInfo;
 
 typedef struct _XSStatus XSStatus;
 
+// State of the circuit breaker, which stops commands being sent to a
+//  server that is not responding
+
+typedef enum _XSBreakerState
+  {
+  // Commands are sent as usual
+  XINESERVER_BREAKER_CLOSED = 0,
+  // Too many failures -- commands fail at once, without being sent
+  XINESERVER_BREAKER_OPEN = 1,
+  // Cooldown has expired, and one command has been let through to find
+  //   out whether the server has recovered 
+  XINESERVER_BREAKER_HALF_OPEN = 2
+  } XSBreakerState;
+
+// Called after each command sent to xine-server, with the time taken to
+//   get the response, or to fail, in microseconds
+typedef void (*XSRequestObserver) (int64_t usec);
+
 typedef enum _XSTransportStatus
   {
   XINESERVER_TRANSPORT_STOPPED = 0,
@@ -138,12 +182,23 @@ exetern "C" {
 // Add the specific streams (or local files) to the playlist. They won't
 //  be played, and the existing playlist contents are retained.
 // Clients are advised to use this method to add multiple items, rather
-//  than add_single, because only one notification will be sent for
-//  the playlist change
+//  than add_single, because fewer notifications will be sent for
+//  the playlist change. Streams are sent in chunks of at most
+//  XINESERVER_ADD_CHUNK_STREAMS, or a little over 
+//  XINESERVER_ADD_CHUNK_BYTES, so that no command is huge; there is
+//  a notification for each chunk. If a chunk fails, the streams 
+//  in earlier chunks will already have been added
 BOOL   xineserver_add      (const char *host, int port, int nstreams, 
                             const char *const *streams, 
                             int *error_code, char **error);
 
+// Replace the playlist with the specified streams, and start playing
+//  the first. Playback starts as soon as the first few streams have 
+//  been added, and the rest are added while it plays
+BOOL   xineserver_play_streams (const char *host, int port, int nstreams, 
+                            const char *const *streams, 
+                            int *error_code, char **error);
+
 // Add the specific single stream (or local file) to the playlist. It won't
 //  be played, and the existing playlist contents are retained.
 BOOL   xineserver_add_single (const char *host, int port, 
@@ -248,6 +303,55 @@ BOOL   xineserver_version (const char *host, int port, int *major,
 //   function does not require a round-trip to the server
 BOOL   xineserver_is_playable_ext (const char *ext);
 
+// Connection pooling. Every function above sends its commands on a 
+//   connection taken from a pool of idle connections, if there is one 
+//   for the same host and port, and returns it to the pool afterwards.
+//   At most max_idle connections are kept, and a connection that has been
+//   idle for more than idle_timeout seconds is closed rather than reused.
+//   max_idle of zero disables pooling. These functions are thread-safe.
+void   xineserver_pool_set_limits (int max_idle, int idle_timeout);
+// Close all idle connections 
+void   xineserver_pool_close_all (void);
+// Get the number of connections made, the number of times a pooled 
+//   connection was reused, and the number of pooled connections that
+//   were found to be unusable. Any argument may be NULL
+void   xineserver_pool_get_stats (int *connects, int *reuses, int *stale);
+
+// Host names are resolved once, and the addresses kept for ttl seconds,
+//   or until none of them accepts a connection. A host name that begins
+//   with '/' is the path of a Unix-domain socket, and the port is 
+//   ignored. xineserver_resolve() resolves a host in advance, so that 
+//   errors can be reported early, and the first command is not slowed
+//   down. Returns FALSE, with error set, if the host can't be resolved.
+//   error may be NULL
+BOOL   xineserver_resolve (const char *host, int port, char **error);
+void   xineserver_set_resolve_ttl (int seconds);
+
+// Set the time allowed for a connection to be made, and for a complete
+//   response to be received after a command is sent, in msec. A command
+//   that times out fails with XINESERVER_ERR_COMM
+void   xineserver_set_timeouts (int connect_msec, int io_msec);
+
+// Circuit breaker. After threshold consecutive commands have failed to
+//   get a response, further commands fail at once, without contacting
+//   the server, for cooldown_msec. After that, one command is let 
+//   through as a probe: if it succeeds, commands are sent as usual 
+//   again; if it fails, the cooldown starts again. A threshold of 
+//   zero disables the breaker. There is one breaker for all servers, 
+//   since a program will rarely talk to more than one. Error responses 
+//   from the server do not count as failures
+void   xineserver_breaker_set_limits (int threshold, int cooldown_msec);
+// Get the state of the breaker, and the number of consecutive failures.
+//   Either argument may be NULL
+void   xineserver_breaker_get_state (XSBreakerState *state, int *failures);
+// Get a printable name for a breaker state
+const char *xineserver_breaker_state_name (XSBreakerState state);
+
+// Set a function to be told how long each command takes, or NULL for
+//   none, which is the default. The time is only measured if there is
+//   an observer. This must be set before any commands are sent
+void   xineserver_set_request_observer (XSRequestObserver observer);
+
 // Operations on opaque data structures 
 
 // Destroy the XSPlaylist structure allocated by xineserver__playlist()
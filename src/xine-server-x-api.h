@@ -125,6 +125,9 @@ typedef enum _XSSTransportStatus
 #define XINESERVER_X_FN_ADD_MATCHING   "add_matching"
 #define XINESERVER_X_FN_PLAY_MATCHING  "play_matching"
 #define XINESERVER_X_FN_CLEAR          "clear"
+#define XINESERVER_X_FN_LIST_PLAYLIST  "list_playlist"
+#define XINESERVER_X_FN_METRICS        "metrics"
+#define XINESERVER_X_FN_BATCH          "batch"
 
 #ifdef __cplusplus
 exetern "C" { 
@@ -0,0 +1,479 @@
+/*============================================================================
+
+  xine-server-x
+  fake_xs.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  A stand-in for xine-server, for load-testing XSX without audio
+  hardware. It speaks the xine-server line protocol, and keeps enough
+  state -- a playlist, a playback position, a volume -- that status,
+  playlist and meta-info responses are plausible and change when
+  transport commands are sent. Nothing is actually played: the position
+  of the current track just advances with the clock.
+
+  Every response can be delayed, to simulate a slow or busy server.
+  Each connection is handled by its own thread, so XSX's connection pool
+  and concurrent requests are exercised as they would be with the real
+  server.
+
+  Usage: fake_xs [-p port] [-l latency_msec] [-j jitter_msec]
+                 [-n playlist_entries] [-t track_msec]
+
+  -p  TCP port to listen on (default 30001, as xine-server)
+  -l  delay before every response (default 0)
+  -j  extra random delay, up to this many msec (default 0)
+  -n  number of entries in the initial playlist (default 100)
+  -t  length of every track (default 240000)
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define TRANSPORT_STOPPED 0
+#define TRANSPORT_PLAYING 1
+#define TRANSPORT_PAUSED 2
+
+typedef struct _Buf
+  {
+  char *data;
+  size_t len;
+  size_t cap;
+  } Buf;
+
+static int latency = 0;
+static int jitter = 0;
+static int track_msec = 240000;
+
+// Player state, protected by the mutex
+static pthread_mutex_t state_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char **playlist = NULL;
+static int playlist_len = 0;
+static int playlist_cap = 0;
+static int playlist_index = 0;
+static int transport = TRANSPORT_STOPPED;
+// Position of the current track when it was last started, paused or
+//  seeked, and the time at which that happened
+static int64_t position_base = 0;
+static int64_t position_time = 0;
+static int volume = 50;
+static int eq[10];
+
+/*==========================================================================
+
+  now_msec
+
+==========================================================================*/
+static int64_t now_msec (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  }
+
+/*==========================================================================
+
+  buf_* -- a growable text buffer
+
+==========================================================================*/
+static void buf_put (Buf *b, const char *s, size_t len)
+  {
+  if (b->len + len + 1 > b->cap)
+    {
+    b->cap = (b->len + len + 1) * 2;
+    b->data = realloc (b->data, b->cap);
+    }
+  memcpy (b->data + b->len, s, len);
+  b->len += len;
+  b->data[b->len] = 0;
+  }
+
+static void buf_printf (Buf *b, const char *fmt, ...)
+  {
+  char *s = NULL;
+  va_list ap;
+  va_start (ap, fmt);
+  int n = vasprintf (&s, fmt, ap);
+  va_end (ap);
+  if (n > 0) buf_put (b, s, n);
+  free (s);
+  }
+
+// Append a string in double quotes, escaped as xine-server does
+static void buf_put_quoted (Buf *b, const char *s)
+  {
+  buf_put (b, " \"", 2);
+  for (; *s; s++)
+    {
+    if (*s == '"' || *s == '\\') buf_put (b, "\\", 1);
+    buf_put (b, s, 1);
+    }
+  buf_put (b, "\"", 1);
+  }
+
+/*==========================================================================
+
+  parse_args
+
+  Split the arguments of a command into words, which may be quoted, and
+  may contain escaped characters. The words are unescaped in place
+
+==========================================================================*/
+static int parse_args (char *s, char **words, int max)
+  {
+  int n = 0;
+  char *w = s;
+  while (*s && n < max)
+    {
+    while (*s == ' ' || *s == '\t') s++;
+    if (!*s) break;
+    words[n++] = w;
+    int quoted = 0;
+    while (*s && (quoted || (*s != ' ' && *s != '\t')))
+      {
+      if (*s == '"')
+        quoted = !quoted;
+      else if (*s == '\\' && s[1])
+        *w++ = *++s;
+      else
+        *w++ = *s;
+      s++;
+      }
+    if (*s) s++;
+    *w++ = 0;
+    }
+  return n;
+  }
+
+/*==========================================================================
+
+  current_position
+
+  Must be called with the mutex held. Moves on to the next track when
+  the current one ends, as a real player would
+
+==========================================================================*/
+static int current_position (void)
+  {
+  if (transport != TRANSPORT_PLAYING) return (int)position_base;
+  int64_t now = now_msec ();
+  int64_t pos = position_base + now - position_time;
+  while (pos >= track_msec && transport == TRANSPORT_PLAYING)
+    {
+    pos -= track_msec;
+    if (playlist_index + 1 < playlist_len)
+      playlist_index++;
+    else
+      {
+      transport = TRANSPORT_STOPPED;
+      pos = 0;
+      }
+    }
+  position_base = pos;
+  position_time = now;
+  return (int)pos;
+  }
+
+/*==========================================================================
+
+  start_playing
+
+  Must be called with the mutex held
+
+==========================================================================*/
+static void start_playing (int index)
+  {
+  if (index >= 0 && index < playlist_len)
+    {
+    playlist_index = index;
+    transport = TRANSPORT_PLAYING;
+    position_base = 0;
+    position_time = now_msec ();
+    }
+  }
+
+/*==========================================================================
+
+  playlist_add
+
+  Must be called with the mutex held
+
+==========================================================================*/
+static void playlist_add (const char *entry)
+  {
+  if (playlist_len == playlist_cap)
+    {
+    playlist_cap = playlist_cap ? playlist_cap * 2 : 64;
+    playlist = realloc (playlist, playlist_cap * sizeof (char *));
+    }
+  playlist[playlist_len++] = strdup (entry);
+  }
+
+/*==========================================================================
+
+  handle_command
+
+  Execute one command, and put the response, without the line ending,
+  into out
+
+==========================================================================*/
+static void handle_command (char *line, Buf *out)
+  {
+  char *args = strchr (line, ' ');
+  if (args) *args++ = 0; else args = line + strlen (line);
+
+  pthread_mutex_lock (&state_mutex);
+  if (strcmp (line, "status") == 0)
+    {
+    static const char *names[] = { "stopped", "playing", "paused" };
+    int pos = current_position ();
+    buf_printf (out, "0 %s %d %d", names[transport], pos,
+      playlist_len ? track_msec : 0);
+    // XSX's tokenizer drops empty tokens, so "" would not do here
+    buf_put_quoted (out, playlist_len ? playlist[playlist_index] : "none");
+    buf_printf (out, " %d %d", playlist_index, playlist_len);
+    }
+  else if (strcmp (line, "playlist") == 0)
+    {
+    buf_put (out, "0", 1);
+    for (int i = 0; i < playlist_len; i++)
+      buf_put_quoted (out, playlist[i]);
+    }
+  else if (strcmp (line, "meta-info") == 0)
+    {
+    char title[64];
+    snprintf (title, sizeof (title), "Track %d", playlist_index + 1);
+    buf_put (out, "0 320 1", 7);
+    buf_put_quoted (out, playlist_len ? title : "Unknown");
+    buf_put_quoted (out, "Some Artist");
+    buf_put_quoted (out, "Some Genre");
+    buf_put_quoted (out, "Some Album");
+    buf_put_quoted (out, "Some Composer");
+    }
+  else if (strcmp (line, "add") == 0)
+    {
+    // Entries are unescaped in place, so there can't be more of them
+    //  than half the length of the line
+    int max = strlen (args) / 2 + 1;
+    char **words = malloc (max * sizeof (char *));
+    int n = parse_args (args, words, max);
+    for (int i = 0; i < n; i++)
+      playlist_add (words[i]);
+    free (words);
+    buf_put (out, "0", 1);
+    }
+  else if (strcmp (line, "clear") == 0)
+    {
+    for (int i = 0; i < playlist_len; i++)
+      free (playlist[i]);
+    playlist_len = 0;
+    playlist_index = 0;
+    transport = TRANSPORT_STOPPED;
+    position_base = 0;
+    buf_put (out, "0", 1);
+    }
+  else if (strcmp (line, "play") == 0)
+    {
+    if (*args)
+      start_playing (atoi (args));
+    else if (transport == TRANSPORT_PAUSED)
+      {
+      transport = TRANSPORT_PLAYING;
+      position_time = now_msec ();
+      }
+    else if (transport == TRANSPORT_STOPPED)
+      start_playing (playlist_index);
+    buf_put (out, "0", 1);
+    }
+  else if (strcmp (line, "pause") == 0)
+    {
+    position_base = current_position ();
+    if (transport == TRANSPORT_PLAYING) transport = TRANSPORT_PAUSED;
+    buf_put (out, "0", 1);
+    }
+  else if (strcmp (line, "stop") == 0)
+    {
+    transport = TRANSPORT_STOPPED;
+    position_base = 0;
+    buf_put (out, "0", 1);
+    }
+  else if (strcmp (line, "next") == 0 || strcmp (line, "prev") == 0)
+    {
+    int index = playlist_index + (line[0] == 'n' ? 1 : -1);
+    if (index >= 0 && index < playlist_len)
+      start_playing (index);
+    buf_put (out, "0", 1);
+    }
+  else if (strcmp (line, "seek") == 0)
+    {
+    current_position ();
+    position_base = atoi (args);
+    buf_put (out, "0", 1);
+    }
+  else if (strcmp (line, "volume") == 0)
+    {
+    if (*args) volume = atoi (args);
+    buf_printf (out, "0 %d", volume);
+    }
+  else if (strcmp (line, "eq") == 0)
+    {
+    char *words[10];
+    int n = parse_args (args, words, 10);
+    for (int i = 0; i < n; i++)
+      eq[i] = atoi (words[i]);
+    buf_put (out, "0", 1);
+    for (int i = 0; i < 10; i++)
+      buf_printf (out, " %d", eq[i]);
+    }
+  else if (strcmp (line, "version") == 0)
+    {
+    buf_put (out, "0 0.1", 5);
+    }
+  else if (strcmp (line, "shutdown") == 0)
+    {
+    buf_put (out, "0", 1);
+    }
+  else
+    {
+    buf_printf (out, "1 Unknown command: %s", line);
+    }
+  pthread_mutex_unlock (&state_mutex);
+  }
+
+/*==========================================================================
+
+  serve_connection
+
+  Answer commands on one connection until the client closes it
+
+==========================================================================*/
+static void *serve_connection (void *arg)
+  {
+  int sock = (int)(intptr_t)arg;
+  FILE *in = fdopen (sock, "r");
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t n;
+  Buf out = { NULL, 0, 0 };
+  unsigned int seed = (unsigned int)sock;
+
+  while ((n = getline (&line, &line_cap, in)) > 0)
+    {
+    while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+      line[--n] = 0;
+    if (n == 0) continue;
+
+    out.len = 0;
+    handle_command (line, &out);
+    buf_put (&out, "\n", 1);
+
+    int delay = latency + (jitter ? rand_r (&seed) % (jitter + 1) : 0);
+    if (delay > 0) usleep (delay * 1000);
+
+    size_t off = 0;
+    while (off < out.len)
+      {
+      ssize_t sent = send (sock, out.data + off, out.len - off,
+        MSG_NOSIGNAL);
+      if (sent <= 0) break;
+      off += sent;
+      }
+    if (off < out.len) break;
+    }
+
+  free (out.data);
+  free (line);
+  fclose (in);
+  return NULL;
+  }
+
+/*==========================================================================
+
+  main
+
+==========================================================================*/
+int main (int argc, char **argv)
+  {
+  int port = 30001;
+  int entries = 100;
+  int opt;
+  while ((opt = getopt (argc, argv, "p:l:j:n:t:")) != -1)
+    {
+    switch (opt)
+      {
+      case 'p': port = atoi (optarg); break;
+      case 'l': latency = atoi (optarg); break;
+      case 'j': jitter = atoi (optarg); break;
+      case 'n': entries = atoi (optarg); break;
+      case 't': track_msec = atoi (optarg); break;
+      default:
+        fprintf (stderr, "Usage: %s [-p port] [-l latency_msec] "
+          "[-j jitter_msec] [-n playlist_entries] [-t track_msec]\n",
+          argv[0]);
+        return 1;
+      }
+    }
+  if (track_msec < 1) track_msec = 1;
+
+  for (int i = 0; i < entries; i++)
+    {
+    char *entry = NULL;
+    asprintf (&entry,
+      "/srv/music/Some Artist/Some Album/%02d - Track number %d.flac",
+      i % 100 + 1, i + 1);
+    playlist_add (entry);
+    free (entry);
+    }
+  if (entries > 0) start_playing (0);
+
+  int listener = socket (AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt (listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+  struct sockaddr_in sin;
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sin.sin_port = htons (port);
+  if (bind (listener, (struct sockaddr *)&sin, sizeof (sin)) != 0
+      || listen (listener, 128) != 0)
+    {
+    perror ("listen");
+    return 1;
+    }
+  signal (SIGPIPE, SIG_IGN);
+  fprintf (stderr, "fake_xs: listening on port %d, %d entries, "
+    "latency %d+%d msec\n", port, entries, latency, jitter);
+
+  for (;;)
+    {
+    int sock = accept (listener, NULL, NULL);
+    if (sock < 0)
+      {
+      if (errno != EINTR) perror ("accept");
+      continue;
+      }
+    setsockopt (sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init (&attr);
+    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create (&thread, &attr, serve_connection,
+          (void *)(intptr_t)sock) != 0)
+      close (sock);
+    pthread_attr_destroy (&attr);
+    }
+  return 0;
+  }
+
@@ -0,0 +1,432 @@
+/*============================================================================
+
+  xine-server-x
+  http_bench.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  End-to-end load generator for XSX. A number of client threads request
+  a set of URLs, one after another, for a fixed time, and the latency
+  of each request is recorded. At the end, the number of requests,
+  errors, throughput, and the median, 99th percentile and worst
+  latency are reported for each URL, and for all URLs together.
+
+  Connections are kept alive by default, as a browser would, so the
+  figures measure request handling rather than TCP set-up. Chunked and
+  unsized responses are read to the end, so streamed pages are timed
+  to their last byte.
+
+  This is normally run by 'make e2e_bench', against XSX talking to
+  fake_xs, but it can be pointed at any XSX instance.
+
+  Usage: http_bench [-h host] [-p port] [-c clients] [-d seconds] [-K]
+                    [url...]
+
+  -h  XSX host (default localhost)
+  -p  XSX port (default 30000)
+  -c  number of concurrent clients (default 8)
+  -d  test duration in seconds (default 10)
+  -K  make a new connection for each request
+
+  With no URLs, a mix of API and GUI requests is used.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+typedef struct _Samples
+  {
+  double *msec;
+  int n;
+  int cap;
+  int errors;
+  } Samples;
+
+typedef struct _Reader
+  {
+  int sock;
+  char buf[16384];
+  int pos;
+  int len;
+  } Reader;
+
+typedef struct _Client
+  {
+  pthread_t thread;
+  int id;
+  Samples *samples; // One for each URL
+  } Client;
+
+static const char *default_urls[] =
+  {
+  "/api/status",
+  "/api/list_playlist",
+  "/gui/playlist",
+  "/gui/files",
+  };
+
+static const char *host = "localhost";
+static int port = 30000;
+static int keep_alive = 1;
+static const char **urls = default_urls;
+static int nurls = sizeof (default_urls) / sizeof (default_urls[0]);
+static double end_time = 0;
+static struct addrinfo *address = NULL;
+
+/*==========================================================================
+
+  now_msec
+
+==========================================================================*/
+static double now_msec (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+  }
+
+/*==========================================================================
+
+  samples_add
+
+==========================================================================*/
+static void samples_add (Samples *s, double msec)
+  {
+  if (s->n == s->cap)
+    {
+    s->cap = s->cap ? s->cap * 2 : 1024;
+    s->msec = realloc (s->msec, s->cap * sizeof (double));
+    }
+  s->msec[s->n++] = msec;
+  }
+
+/*==========================================================================
+
+  reader_* -- buffered reading of the response
+
+==========================================================================*/
+static int reader_fill (Reader *r)
+  {
+  if (r->pos < r->len) return 1;
+  ssize_t n = recv (r->sock, r->buf, sizeof (r->buf), 0);
+  if (n <= 0) return 0;
+  r->pos = 0;
+  r->len = n;
+  return 1;
+  }
+
+// Read a line, without its line ending. Returns 0 at end of input
+static int reader_line (Reader *r, char *line, int max)
+  {
+  int n = 0;
+  for (;;)
+    {
+    if (!reader_fill (r)) return 0;
+    char c = r->buf[r->pos++];
+    if (c == '\n') break;
+    if (c != '\r' && n < max - 1) line[n++] = c;
+    }
+  line[n] = 0;
+  return 1;
+  }
+
+// Discard count bytes, or everything up to the end of input if
+//  count is negative. Returns 0 if the input ended too soon
+static int reader_skip (Reader *r, int64_t count)
+  {
+  while (count != 0)
+    {
+    if (!reader_fill (r)) return count < 0;
+    int64_t avail = r->len - r->pos;
+    if (count > 0 && avail > count) avail = count;
+    r->pos += avail;
+    if (count > 0) count -= avail;
+    }
+  return 1;
+  }
+
+/*==========================================================================
+
+  open_connection
+
+==========================================================================*/
+static int open_connection (void)
+  {
+  int sock = socket (address->ai_family, SOCK_STREAM, 0);
+  if (sock < 0) return -1;
+  if (connect (sock, address->ai_addr, address->ai_addrlen) != 0)
+    {
+    close (sock);
+    return -1;
+    }
+  int one = 1;
+  setsockopt (sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+  return sock;
+  }
+
+/*==========================================================================
+
+  do_request
+
+  Make one request, and read the whole response. Returns the HTTP
+  status, or -1 on a communication error. *sock is set to -1 if the
+  connection can't be used again
+
+==========================================================================*/
+static int do_request (Reader *r, int *sock, const char *url)
+  {
+  if (*sock < 0)
+    {
+    *sock = open_connection ();
+    if (*sock < 0) return -1;
+    r->pos = r->len = 0;
+    }
+  r->sock = *sock;
+
+  char request[1024];
+  int len = snprintf (request, sizeof (request),
+    "GET %s HTTP/1.1\r\nHost: %s:%d\r\nConnection: %s\r\n\r\n",
+    url, host, port, keep_alive ? "keep-alive" : "close");
+  if (send (*sock, request, len, MSG_NOSIGNAL) != len)
+    goto fail;
+
+  char line[1024];
+  if (!reader_line (r, line, sizeof (line))) goto fail;
+  int status = 0;
+  int minor = 1;
+  if (sscanf (line, "HTTP/1.%d %d", &minor, &status) != 2) goto fail;
+  int reuse = keep_alive && minor >= 1;
+
+  int64_t content_length = -1;
+  int chunked = 0;
+  for (;;)
+    {
+    if (!reader_line (r, line, sizeof (line))) goto fail;
+    if (line[0] == 0) break;
+    if (strncasecmp (line, "Content-Length:", 15) == 0)
+      content_length = strtoll (line + 15, NULL, 10);
+    else if (strncasecmp (line, "Transfer-Encoding:", 18) == 0
+        && strcasestr (line + 18, "chunked"))
+      chunked = 1;
+    else if (strncasecmp (line, "Connection:", 11) == 0
+        && strcasestr (line + 11, "close"))
+      reuse = 0;
+    }
+
+  if (chunked)
+    {
+    for (;;)
+      {
+      if (!reader_line (r, line, sizeof (line))) goto fail;
+      int64_t size = strtoll (line, NULL, 16);
+      if (size == 0)
+        {
+        // Trailers, if any, end with an empty line
+        do
+          {
+          if (!reader_line (r, line, sizeof (line))) goto fail;
+          } while (line[0]);
+        break;
+        }
+      if (!reader_skip (r, size)) goto fail;
+      if (!reader_line (r, line, sizeof (line))) goto fail;
+      }
+    }
+  else if (content_length >= 0)
+    {
+    if (!reader_skip (r, content_length)) goto fail;
+    }
+  else
+    {
+    reader_skip (r, -1);
+    reuse = 0;
+    }
+
+  if (!reuse)
+    {
+    close (*sock);
+    *sock = -1;
+    }
+  return status;
+
+fail:
+  close (*sock);
+  *sock = -1;
+  return -1;
+  }
+
+/*==========================================================================
+
+  run_client
+
+==========================================================================*/
+static void *run_client (void *arg)
+  {
+  Client *self = arg;
+  Reader *r = malloc (sizeof (Reader));
+  int sock = -1;
+  // Clients start at different URLs, so that each URL is requested
+  //  concurrently with each of the others
+  for (int i = self->id; now_msec () < end_time; i++)
+    {
+    int u = i % nurls;
+    double t0 = now_msec ();
+    int status = do_request (r, &sock, urls[u]);
+    double t1 = now_msec ();
+    if (status >= 200 && status < 400)
+      samples_add (&self->samples[u], t1 - t0);
+    else
+      {
+      self->samples[u].errors++;
+      // Don't spin if XSX is not there at all
+      if (status < 0) usleep (10000);
+      }
+    }
+  if (sock >= 0) close (sock);
+  free (r);
+  return NULL;
+  }
+
+/*==========================================================================
+
+  compare_double
+
+==========================================================================*/
+static int compare_double (const void *a, const void *b)
+  {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+  }
+
+/*==========================================================================
+
+  report
+
+  Sorts the samples
+
+==========================================================================*/
+static void report (const char *name, Samples *s, double seconds)
+  {
+  qsort (s->msec, s->n, sizeof (double), compare_double);
+  double p50 = 0, p99 = 0, max = 0;
+  if (s->n > 0)
+    {
+    p50 = s->msec[(int)(0.50 * (s->n - 1))];
+    p99 = s->msec[(int)(0.99 * (s->n - 1))];
+    max = s->msec[s->n - 1];
+    }
+  printf ("%-28s %8d %6d %9.1f %9.2f %9.2f %9.2f\n", name, s->n,
+    s->errors, s->n / seconds, p50, p99, max);
+  }
+
+/*==========================================================================
+
+  main
+
+==========================================================================*/
+int main (int argc, char **argv)
+  {
+  int nclients = 8;
+  int duration = 10;
+  int opt;
+  while ((opt = getopt (argc, argv, "h:p:c:d:K")) != -1)
+    {
+    switch (opt)
+      {
+      case 'h': host = optarg; break;
+      case 'p': port = atoi (optarg); break;
+      case 'c': nclients = atoi (optarg); break;
+      case 'd': duration = atoi (optarg); break;
+      case 'K': keep_alive = 0; break;
+      default:
+        fprintf (stderr, "Usage: %s [-h host] [-p port] [-c clients] "
+          "[-d seconds] [-K] [url...]\n", argv[0]);
+        return 1;
+      }
+    }
+  if (nclients < 1) nclients = 1;
+  if (duration < 1) duration = 1;
+  if (optind < argc)
+    {
+    urls = (const char **)argv + optind;
+    nurls = argc - optind;
+    }
+
+  char service[16];
+  snprintf (service, sizeof (service), "%d", port);
+  struct addrinfo hints;
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_socktype = SOCK_STREAM;
+  int rc = getaddrinfo (host, service, &hints, &address);
+  if (rc != 0)
+    {
+    fprintf (stderr, "%s: %s\n", host, gai_strerror (rc));
+    return 1;
+    }
+  signal (SIGPIPE, SIG_IGN);
+
+  printf ("%d clients, %d seconds, %s connections, %s:%d\n", nclients,
+    duration, keep_alive ? "keep-alive" : "new", host, port);
+
+  Client *clients = calloc (nclients, sizeof (Client));
+  double start = now_msec ();
+  end_time = start + duration * 1000.0;
+  for (int i = 0; i < nclients; i++)
+    {
+    clients[i].id = i;
+    clients[i].samples = calloc (nurls, sizeof (Samples));
+    pthread_create (&clients[i].thread, NULL, run_client, &clients[i]);
+    }
+  for (int i = 0; i < nclients; i++)
+    pthread_join (clients[i].thread, NULL);
+  double seconds = (now_msec () - start) / 1e3;
+
+  printf ("%-28s %8s %6s %9s %9s %9s %9s\n", "url", "requests", "errors",
+    "req/s", "p50 ms", "p99 ms", "max ms");
+  Samples all = { NULL, 0, 0, 0 };
+  int total_errors = 0;
+  for (int u = 0; u < nurls; u++)
+    {
+    Samples merged = { NULL, 0, 0, 0 };
+    for (int i = 0; i < nclients; i++)
+      {
+      Samples *s = &clients[i].samples[u];
+      for (int j = 0; j < s->n; j++)
+        {
+        samples_add (&merged, s->msec[j]);
+        samples_add (&all, s->msec[j]);
+        }
+      merged.errors += s->errors;
+      }
+    all.errors += merged.errors;
+    total_errors += merged.errors;
+    report (urls[u], &merged, seconds);
+    free (merged.msec);
+    }
+  report ("all", &all, seconds);
+  free (all.msec);
+
+  for (int i = 0; i < nclients; i++)
+    {
+    for (int u = 0; u < nurls; u++)
+      free (clients[i].samples[u].msec);
+    free (clients[i].samples);
+    }
+  free (clients);
+  freeaddrinfo (address);
+  return total_errors ? 2 : 0;
+  }
+
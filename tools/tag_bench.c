@@ -0,0 +1,219 @@
+/*============================================================================
+
+  xine-server-x
+  tag_bench.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Benchmark for tag_get_tags(). Reads every file in a directory --
+  usually one made by tag_corpus -- and reports, for each format, the
+  number of files read per second, and the average number of bytes
+  read and file-related system calls made per file. Files are grouped
+  by the part of their names before the first '-', which is how
+  tag_corpus names them; for other files, the extension is used.
+
+  The system calls are counted by linking with --wrap for open, read,
+  lseek, fstat and close, so this program must be built by 'make bench'.
+
+  Usage: tag_bench [-r repeats] directory
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "../src/defs.h"
+#include "../src/tag_reader.h"
+
+#define MAX_FORMATS 32
+
+typedef struct _FormatStats
+  {
+  char name[32];
+  int files;
+  int failures;
+  double ns;
+  uint64_t bytes;
+  uint64_t syscalls;
+  } FormatStats;
+
+static uint64_t count_bytes = 0;
+static uint64_t count_syscalls = 0;
+
+/*==========================================================================
+
+  System call wrappers
+
+==========================================================================*/
+int __real_open (const char *path, int flags, ...);
+ssize_t __real_read (int fd, void *buf, size_t count);
+off_t __real_lseek (int fd, off_t offset, int whence);
+int __real_fstat (int fd, struct stat *sb);
+int __real_close (int fd);
+
+int __wrap_open (const char *path, int flags, ...)
+  {
+  mode_t mode = 0;
+  if (flags & O_CREAT)
+    {
+    va_list ap;
+    va_start (ap, flags);
+    mode = va_arg (ap, mode_t);
+    va_end (ap);
+    }
+  count_syscalls++;
+  return __real_open (path, flags, mode);
+  }
+
+ssize_t __wrap_read (int fd, void *buf, size_t count)
+  {
+  ssize_t n = __real_read (fd, buf, count);
+  count_syscalls++;
+  if (n > 0) count_bytes += n;
+  return n;
+  }
+
+off_t __wrap_lseek (int fd, off_t offset, int whence)
+  {
+  count_syscalls++;
+  return __real_lseek (fd, offset, whence);
+  }
+
+int __wrap_fstat (int fd, struct stat *sb)
+  {
+  count_syscalls++;
+  return __real_fstat (fd, sb);
+  }
+
+int __wrap_close (int fd)
+  {
+  count_syscalls++;
+  return __real_close (fd);
+  }
+
+/*==========================================================================
+
+  now_ns
+
+==========================================================================*/
+static double now_ns (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+  }
+
+/*==========================================================================
+
+  get_stats
+
+  Find or add the stats entry for the format of the named file
+
+==========================================================================*/
+static FormatStats *get_stats (FormatStats *stats, int *nstats,
+    const char *file)
+  {
+  char name[32];
+  const char *dash = strchr (file, '-');
+  const char *dot = strrchr (file, '.');
+  if (dash)
+    snprintf (name, sizeof (name), "%.*s", (int)(dash - file), file);
+  else
+    snprintf (name, sizeof (name), "%s", dot ? dot + 1 : "other");
+
+  for (int i = 0; i < *nstats; i++)
+    if (strcmp (stats[i].name, name) == 0) return &stats[i];
+  if (*nstats == MAX_FORMATS) return NULL;
+  FormatStats *s = &stats[(*nstats)++];
+  memset (s, 0, sizeof (FormatStats));
+  strcpy (s->name, name);
+  return s;
+  }
+
+/*==========================================================================
+
+  main
+
+==========================================================================*/
+int main (int argc, char **argv)
+  {
+  int repeats = 5;
+  int opt;
+  while ((opt = getopt (argc, argv, "r:")) != -1)
+    {
+    switch (opt)
+      {
+      case 'r': repeats = atoi (optarg); break;
+      default:
+        fprintf (stderr, "Usage: %s [-r repeats] directory\n", argv[0]);
+        return 1;
+      }
+    }
+  if (optind >= argc)
+    {
+    fprintf (stderr, "%s: no directory\n", argv[0]);
+    return 1;
+    }
+  if (repeats < 1) repeats = 1;
+  const char *dir = argv[optind];
+
+  FormatStats stats[MAX_FORMATS];
+  int nstats = 0;
+
+  DIR *d = opendir (dir);
+  if (!d)
+    {
+    perror (dir);
+    return 1;
+    }
+  struct dirent *de;
+  while ((de = readdir (d)))
+    {
+    if (de->d_name[0] == '.') continue;
+    char *path;
+    asprintf (&path, "%s/%s", dir, de->d_name);
+    FormatStats *s = get_stats (stats, &nstats, de->d_name);
+    if (s)
+      {
+      for (int r = 0; r < repeats; r++)
+        {
+        uint64_t bytes = count_bytes;
+        uint64_t syscalls = count_syscalls;
+        TagData *tag_data = NULL;
+        double t0 = now_ns ();
+        TagResult ret = tag_get_tags (path, &tag_data);
+        if (tag_data) tag_free_tag_data (tag_data);
+        s->ns += now_ns () - t0;
+        s->files++;
+        if (ret != TAG_OK) s->failures++;
+        s->bytes += count_bytes - bytes;
+        s->syscalls += count_syscalls - syscalls;
+        }
+      }
+    free (path);
+    }
+  closedir (d);
+
+  printf ("%-10s %8s %12s %14s %14s %8s\n", "format", "files",
+    "files/sec", "bytes/file", "syscalls/file", "failed");
+  for (int i = 0; i < nstats; i++)
+    {
+    FormatStats *s = &stats[i];
+    printf ("%-10s %8d %12.0f %14.0f %14.1f %8d\n", s->name, s->files,
+      s->files / (s->ns / 1e9), (double)s->bytes / s->files,
+      (double)s->syscalls / s->files, s->failures);
+    }
+  const TagID3v2Counters *c = &tag_id3v2_counters;
+  printf ("ID3v2 tags %d: unsync %d, extended header %d, footer %d, "
+    "frames skipped %d\n", c->tags, c->unsync, c->ext_header, c->footer,
+    c->frames_skipped);
+  return 0;
+  }
+
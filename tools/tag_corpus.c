@@ -0,0 +1,841 @@
+/*============================================================================
+
+  xine-server-x
+  tag_corpus.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Generates a synthetic corpus of tagged audio files, for benchmarking
+  and fuzzing the tag reader. For each format, the files contain the
+  usual text tags and, where the format supports it, a cover image, of
+  configurable sizes. The audio data is just silence in a plausible
+  container, so the files are small, but the tag structures are
+  realistic.
+
+  Usage: tag_corpus [-n files] [-t tag_bytes] [-a art_bytes]
+                    [-m moov_bytes] directory
+
+  -n  number of files of each format (default 20)
+  -t  approximate length of each text tag (default 32)
+  -a  size of the cover image, zero for none (default 65536)
+  -m  size of the padding sample table in the MP4 moov atom (default
+      262144), to simulate the moov of a long track
+
+  Formats: ID3v2.2, ID3v2.3 (UTF-16) and ID3v2.4 (UTF-8) MP3; the 
+  'id3v23x' and 'id3v24x' variants add unsynchronisation and an 
+  extended header, and for v2.4 a footer. FLAC with a PICTURE block, 
+  Ogg Vorbis, and MP4 with the tags at the end of a large moov atom. 
+  There are also MP4 files that are cut off part way through the moov
+  atom, or through an mvhd, trak, mdia or mdhd atom in it, where one of
+  those atoms claims to be longer than the atom that contains it, or 
+  where an mvhd or mdhd atom is too short for its fields. The reader 
+  must survive these.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+typedef struct _Buf
+  {
+  unsigned char *data;
+  size_t len;
+  size_t cap;
+  } Buf;
+
+static int tag_size = 32;
+static int art_size = 65536;
+static int moov_size = 262144;
+
+/*==========================================================================
+
+  buf_* -- a growable byte buffer
+
+==========================================================================*/
+static void buf_put (Buf *b, const void *data, size_t len)
+  {
+  if (b->len + len > b->cap)
+    {
+    b->cap = (b->len + len) * 2;
+    b->data = realloc (b->data, b->cap);
+    }
+  memcpy (b->data + b->len, data, len);
+  b->len += len;
+  }
+
+static void buf_put_zeros (Buf *b, size_t len)
+  {
+  unsigned char z[1024];
+  memset (z, 0, sizeof (z));
+  while (len > 0)
+    {
+    size_t n = len > sizeof (z) ? sizeof (z) : len;
+    buf_put (b, z, n);
+    len -= n;
+    }
+  }
+
+static void buf_put_str (Buf *b, const char *s)
+  {
+  buf_put (b, s, strlen (s));
+  }
+
+static void buf_put_byte (Buf *b, int c)
+  {
+  unsigned char x = (unsigned char)c;
+  buf_put (b, &x, 1);
+  }
+
+static void buf_put_be (Buf *b, uint32_t v, int bytes)
+  {
+  for (int i = bytes - 1; i >= 0; i--)
+    buf_put_byte (b, (v >> (8 * i)) & 0xFF);
+  }
+
+static void buf_put_le (Buf *b, uint32_t v, int bytes)
+  {
+  for (int i = 0; i < bytes; i++)
+    buf_put_byte (b, (v >> (8 * i)) & 0xFF);
+  }
+
+static void buf_put_syncsafe (Buf *b, uint32_t v)
+  {
+  buf_put_byte (b, (v >> 21) & 0x7F);
+  buf_put_byte (b, (v >> 14) & 0x7F);
+  buf_put_byte (b, (v >> 7) & 0x7F);
+  buf_put_byte (b, v & 0x7F);
+  }
+
+// Patch a big-endian 32-bit value at a given offset
+static void buf_set_be32 (Buf *b, size_t pos, uint32_t v)
+  {
+  b->data[pos] = v >> 24;
+  b->data[pos + 1] = (v >> 16) & 0xFF;
+  b->data[pos + 2] = (v >> 8) & 0xFF;
+  b->data[pos + 3] = v & 0xFF;
+  }
+
+static void buf_free (Buf *b)
+  {
+  free (b->data);
+  memset (b, 0, sizeof (Buf));
+  }
+
+/*==========================================================================
+
+  make_text
+
+  Make a tag value of about tag_size characters, mostly ASCII but with
+  a few accented characters, so the Unicode conversions get exercised
+
+==========================================================================*/
+static char *make_text (const char *label, int n)
+  {
+  char *s = malloc (tag_size + 64);
+  int l = snprintf (s, tag_size + 64, "%s %d Caf\xc3\xa9 ", label, n);
+  while (l < tag_size)
+    {
+    s[l] = 'a' + (l % 26);
+    l++;
+    }
+  s[l] = 0;
+  return s;
+  }
+
+/*==========================================================================
+
+  put_art
+
+  A cover image of art_size bytes, with a JPEG signature
+
+==========================================================================*/
+static void put_art (Buf *b)
+  {
+  static const unsigned char soi[] = { 0xFF, 0xD8, 0xFF, 0xE0 };
+  buf_put (b, soi, sizeof (soi));
+  buf_put_zeros (b, art_size - sizeof (soi));
+  }
+
+/*==========================================================================
+
+  put_mpeg_frames
+
+  MPEG1 layer III, 128 kbit/sec, 44.1kHz, stereo -- 417 bytes per frame
+
+==========================================================================*/
+static void put_mpeg_frames (Buf *b, int frames)
+  {
+  for (int i = 0; i < frames; i++)
+    {
+    buf_put_be (b, 0xFFFB9064, 4);
+    buf_put_zeros (b, 417 - 4);
+    }
+  }
+
+/*==========================================================================
+
+  put_unsync
+
+  Appends data with the ID3v2 unsynchronisation scheme applied: a zero
+  is inserted after every 0xFF. The specification only requires this
+  where the 0xFF is followed by a byte that could be mistaken for part
+  of a sync pattern, but doing it everywhere is legal, and makes the
+  reader work harder
+
+==========================================================================*/
+static void put_unsync (Buf *b, const unsigned char *data, size_t len)
+  {
+  for (size_t i = 0; i < len; i++)
+    {
+    buf_put_byte (b, data[i]);
+    if (data[i] == 0xFF) buf_put_byte (b, 0);
+    }
+  }
+
+/*==========================================================================
+
+  put_id3v2_frame
+
+  Writes a frame header and body. In v2.4, unsynchronisation is applied
+  to each frame separately, and the frame size is that of the 
+  unsynchronised data
+
+==========================================================================*/
+static void put_id3v2_frame (Buf *b, int version, const char *id,
+    const Buf *body, int unsync)
+  {
+  Buf data = { 0 };
+  if (unsync && version == 4)
+    put_unsync (&data, body->data, body->len);
+  else
+    buf_put (&data, body->data, body->len);
+
+  if (version == 2)
+    {
+    buf_put (b, id, 3);
+    buf_put_be (b, data.len, 3);
+    }
+  else
+    {
+    buf_put (b, id, 4);
+    if (version == 4)
+      buf_put_syncsafe (b, data.len);
+    else
+      buf_put_be (b, data.len, 4);
+    // Flags: in v2.4, 0x0002 marks an unsynchronised frame 
+    buf_put_be (b, unsync && version == 4 ? 0x0002 : 0, 2); 
+    }
+  buf_put (b, data.data, data.len);
+  buf_free (&data);
+  }
+
+/*==========================================================================
+
+  put_id3v2_text_frame
+
+  Writes a text frame with encoding 0 (for v2.2), 1 (UTF-16 with BOM,
+  v2.3) or 3 (UTF-8, v2.4)
+
+==========================================================================*/
+static void put_id3v2_text_frame (Buf *b, int version, const char *id,
+    const char *text, int unsync)
+  {
+  Buf body = { 0 };
+  if (version == 3)
+    {
+    // Encode UTF-8 as UTF-16LE with a BOM. The text only has BMP
+    //  characters, which makes this simple
+    buf_put_byte (&body, 1);
+    buf_put_byte (&body, 0xFF);
+    buf_put_byte (&body, 0xFE);
+    const unsigned char *p = (const unsigned char *)text;
+    while (*p)
+      {
+      uint32_t c = *p++;
+      if (c >= 0xE0)
+        { c = ((c & 0x0F) << 12) | ((p[0] & 0x3F) << 6) | (p[1] & 0x3F);
+          p += 2; }
+      else if (c >= 0xC0)
+        { c = ((c & 0x1F) << 6) | (p[0] & 0x3F); p++; }
+      buf_put_le (&body, c, 2);
+      }
+    buf_put_le (&body, 0, 2);
+    }
+  else if (version == 4)
+    {
+    buf_put_byte (&body, 3);
+    buf_put (&body, text, strlen (text) + 1);
+    }
+  else
+    {
+    // ISO-8859-1. The text is good enough for benchmarking, even
+    //  if the accented characters come out wrong
+    buf_put_byte (&body, 0);
+    buf_put (&body, text, strlen (text) + 1);
+    }
+
+  put_id3v2_frame (b, version, id, &body, unsync);
+  buf_free (&body);
+  }
+
+/*==========================================================================
+
+  make_mp3
+
+  features is a combination of the ID3_XXX flags, which select the less
+  common parts of the ID3v2 format
+
+==========================================================================*/
+#define ID3_UNSYNC 0x01
+#define ID3_EXT_HEADER 0x02
+#define ID3_FOOTER 0x04
+
+static void make_mp3 (Buf *b, int version, int features, int n)
+  {
+  static const char *ids22[] = { "TT2", "TAL", "TP1", "TCO", "TCM", "TRK" };
+  static const char *ids23[] = { "TIT2", "TALB", "TPE1", "TCON", "TCOM",
+    "TRCK" };
+  static const char *labels[] = { "Title", "Album", "Artist", "Genre",
+    "Composer", "Track" };
+  int unsync = (features & ID3_UNSYNC) != 0;
+
+  Buf tag = { 0 };
+  if (features & ID3_EXT_HEADER)
+    {
+    if (version == 3)
+      {
+      // Size (excluding itself), flags with CRC present, padding size, CRC
+      buf_put_be (&tag, 10, 4);
+      buf_put_be (&tag, 0x8000, 2);
+      buf_put_be (&tag, 256, 4);
+      buf_put_be (&tag, 0x12345678, 4);
+      }
+    else
+      {
+      // Size (including itself), one flag byte, 'tag is an update' set
+      buf_put_syncsafe (&tag, 6);
+      buf_put_byte (&tag, 1);
+      buf_put_byte (&tag, 0x40);
+      }
+    }
+
+  for (int i = 0; i < 6; i++)
+    {
+    char *text = make_text (labels[i], n);
+    put_id3v2_text_frame (&tag, version, version == 2 ? ids22[i] : ids23[i],
+      text, unsync);
+    free (text);
+    }
+
+  if (art_size > 0)
+    {
+    Buf pic = { 0 };
+    buf_put_byte (&pic, 0);
+    if (version == 2)
+      buf_put_str (&pic, "JPG"); // v2.2 has a 3-char format, not a MIME type
+    else
+      buf_put (&pic, "image/jpeg", 11);
+    buf_put_byte (&pic, 3); // Front cover
+    buf_put (&pic, "", 1); // Description
+    put_art (&pic);
+    put_id3v2_frame (&tag, version, version == 2 ? "PIC" : "APIC", &pic,
+      unsync);
+    buf_free (&pic);
+    }
+
+  // Some padding, as taggers usually leave. A tag with a footer must
+  //  not have padding
+  if (!(features & ID3_FOOTER))
+    buf_put_zeros (&tag, 256);
+
+  int flags = 0;
+  if (unsync) flags |= 0x80;
+  if (features & ID3_EXT_HEADER) flags |= 0x40;
+  if (features & ID3_FOOTER) flags |= 0x10;
+
+  // In v2.2 and v2.3, unsynchronisation applies to the whole tag 
+  //  after the header
+  Buf body = { 0 };
+  if (unsync && version < 4)
+    put_unsync (&body, tag.data, tag.len);
+  else
+    buf_put (&body, tag.data, tag.len);
+  buf_free (&tag);
+
+  buf_put (b, "ID3", 3);
+  buf_put_byte (b, version);
+  buf_put_byte (b, 0);
+  buf_put_byte (b, flags);
+  buf_put_syncsafe (b, body.len);
+  buf_put (b, body.data, body.len);
+  if (features & ID3_FOOTER)
+    {
+    buf_put (b, "3DI", 3);
+    buf_put_byte (b, version);
+    buf_put_byte (b, 0);
+    buf_put_byte (b, flags);
+    buf_put_syncsafe (b, body.len);
+    }
+  buf_free (&body);
+
+  put_mpeg_frames (b, 100);
+  }
+
+/*==========================================================================
+
+  put_vorbis_comments
+
+  The body of a Vorbis comment block, as used by both FLAC and Ogg
+
+==========================================================================*/
+static void put_vorbis_comments (Buf *b, int n)
+  {
+  static const char *keys[] = { "TITLE", "ALBUM", "ARTIST", "GENRE",
+    "COMPOSER", "TRACKNUMBER" };
+  const char *vendor = "tag_corpus";
+  buf_put_le (b, strlen (vendor), 4);
+  buf_put_str (b, vendor);
+  buf_put_le (b, 6, 4);
+  for (int i = 0; i < 6; i++)
+    {
+    char *text = make_text (keys[i], n);
+    buf_put_le (b, strlen (keys[i]) + 1 + strlen (text), 4);
+    buf_put_str (b, keys[i]);
+    buf_put_str (b, "=");
+    buf_put_str (b, text);
+    free (text);
+    }
+  }
+
+/*==========================================================================
+
+  make_flac
+
+==========================================================================*/
+static void make_flac (Buf *b, int n)
+  {
+  buf_put_str (b, "fLaC");
+
+  // STREAMINFO: 44.1kHz, stereo, 16 bits, one minute
+  buf_put_byte (b, 0);
+  buf_put_be (b, 34, 3);
+  buf_put_be (b, 4096, 2);
+  buf_put_be (b, 4096, 2);
+  buf_put_zeros (b, 6);
+  uint64_t total = 44100 * 60;
+  uint64_t v = ((uint64_t)44100 << 44) | ((uint64_t)1 << 41)
+    | ((uint64_t)15 << 36) | total;
+  buf_put_be (b, v >> 32, 4);
+  buf_put_be (b, v & 0xFFFFFFFF, 4);
+  buf_put_zeros (b, 16);
+
+  Buf vc = { 0 };
+  put_vorbis_comments (&vc, n);
+  buf_put_byte (b, 4);
+  buf_put_be (b, vc.len, 3);
+  buf_put (b, vc.data, vc.len);
+  buf_free (&vc);
+
+  if (art_size > 0)
+    {
+    Buf pic = { 0 };
+    buf_put_be (&pic, 3, 4); // Front cover
+    buf_put_be (&pic, 10, 4);
+    buf_put_str (&pic, "image/jpeg");
+    buf_put_be (&pic, 0, 4); // Description
+    buf_put_be (&pic, 500, 4);
+    buf_put_be (&pic, 500, 4);
+    buf_put_be (&pic, 24, 4);
+    buf_put_be (&pic, 0, 4);
+    buf_put_be (&pic, art_size, 4);
+    put_art (&pic);
+    buf_put_byte (b, 6);
+    buf_put_be (b, pic.len, 3);
+    buf_put (b, pic.data, pic.len);
+    buf_free (&pic);
+    }
+
+  buf_put_byte (b, 0x80 | 1); // Last block: padding
+  buf_put_be (b, 4096, 3);
+  buf_put_zeros (b, 4096);
+
+  buf_put_zeros (b, 40000); // Audio
+  }
+
+/*==========================================================================
+
+  put_ogg_page
+
+==========================================================================*/
+static void put_ogg_page (Buf *b, const Buf *payload, int64_t granule,
+    int seq, int type)
+  {
+  buf_put_str (b, "OggS");
+  buf_put_byte (b, 0);
+  buf_put_byte (b, type);
+  buf_put_le (b, granule & 0xFFFFFFFF, 4);
+  buf_put_le (b, (uint64_t)granule >> 32, 4);
+  buf_put_le (b, 1, 4); // Serial
+  buf_put_le (b, seq, 4);
+  buf_put_le (b, 0, 4); // CRC -- the reader does not check it
+  size_t n = payload->len;
+  int segments = n / 255 + 1;
+  buf_put_byte (b, segments);
+  for (int i = 0; i < segments - 1; i++)
+    buf_put_byte (b, 255);
+  buf_put_byte (b, n % 255);
+  buf_put (b, payload->data, payload->len);
+  }
+
+/*==========================================================================
+
+  make_ogg
+
+  The tag reader only looks at the first 4kB of the comment header,
+  so the comments are not allowed to be bigger than that. Cover art
+  is not supported in Ogg files
+
+==========================================================================*/
+static void make_ogg (Buf *b, int n)
+  {
+  Buf ident = { 0 };
+  buf_put_byte (&ident, 1);
+  buf_put_str (&ident, "vorbis");
+  buf_put_le (&ident, 0, 4);
+  buf_put_byte (&ident, 2);
+  buf_put_le (&ident, 44100, 4);
+  buf_put_le (&ident, 0, 4);
+  buf_put_le (&ident, 128000, 4);
+  buf_put_le (&ident, 0, 4);
+  buf_put_byte (&ident, 0xB8);
+  buf_put_byte (&ident, 1);
+  put_ogg_page (b, &ident, 0, 0, 2);
+  buf_free (&ident);
+
+  Buf comments = { 0 };
+  buf_put_byte (&comments, 3);
+  buf_put_str (&comments, "vorbis");
+  put_vorbis_comments (&comments, n);
+  buf_put_byte (&comments, 1);
+  put_ogg_page (b, &comments, 0, 1, 0);
+  buf_free (&comments);
+
+  Buf audio = { 0 };
+  buf_put_zeros (&audio, 4000);
+  for (int i = 0; i < 10; i++)
+    put_ogg_page (b, &audio, (int64_t)44100 * 6 * (i + 1), i + 2,
+      i == 9 ? 4 : 0);
+  buf_free (&audio);
+  }
+
+/*==========================================================================
+
+  mp4 atom helpers
+
+==========================================================================*/
+static size_t mp4_begin (Buf *b, const char *type)
+  {
+  size_t pos = b->len;
+  buf_put_be (b, 0, 4);
+  buf_put (b, type, 4);
+  return pos;
+  }
+
+static void mp4_end (Buf *b, size_t pos)
+  {
+  buf_set_be32 (b, pos, b->len - pos);
+  }
+
+static void mp4_text_item (Buf *b, const char *type, const char *text)
+  {
+  size_t item = mp4_begin (b, type);
+  size_t data = mp4_begin (b, "data");
+  buf_put_be (b, 1, 4); // Text
+  buf_put_be (b, 0, 4); // Locale
+  buf_put_str (b, text);
+  mp4_end (b, data);
+  mp4_end (b, item);
+  }
+
+/*==========================================================================
+
+  make_mp4
+
+==========================================================================*/
+static void make_mp4 (Buf *b, int n)
+  {
+  size_t a = mp4_begin (b, "ftyp");
+  buf_put_str (b, "M4A ");
+  buf_put_be (b, 0, 4);
+  mp4_end (b, a);
+
+  size_t moov = mp4_begin (b, "moov");
+
+  a = mp4_begin (b, "mvhd");
+  buf_put_be (b, 0, 4); // Version, flags
+  buf_put_be (b, 0, 8); // Times
+  buf_put_be (b, 1000, 4);
+  buf_put_be (b, 60000, 4);
+  buf_put_zeros (b, 80);
+  mp4_end (b, a);
+
+  size_t trak = mp4_begin (b, "trak");
+  size_t mdia = mp4_begin (b, "mdia");
+  // hdlr comes first, so that a broken file that ends in mdhd still
+  //  has an audio track
+  a = mp4_begin (b, "hdlr");
+  buf_put_be (b, 0, 8);
+  buf_put_str (b, "soun");
+  buf_put_zeros (b, 13);
+  mp4_end (b, a);
+  a = mp4_begin (b, "mdhd");
+  buf_put_be (b, 0, 4);
+  buf_put_be (b, 0, 8);
+  buf_put_be (b, 44100, 4);
+  buf_put_be (b, 44100 * 60, 4);
+  buf_put_be (b, 0, 4);
+  mp4_end (b, a);
+  size_t minf = mp4_begin (b, "minf");
+  size_t stbl = mp4_begin (b, "stbl");
+  a = mp4_begin (b, "stsd");
+  buf_put_be (b, 0, 4);
+  buf_put_be (b, 1, 4);
+  size_t entry = mp4_begin (b, "mp4a");
+  buf_put_zeros (b, 6);
+  buf_put_be (b, 1, 2);
+  buf_put_zeros (b, 8);
+  buf_put_be (b, 2, 2);
+  buf_put_be (b, 16, 2);
+  buf_put_be (b, 0, 4);
+  buf_put_be (b, 44100 << 16, 4);
+  mp4_end (b, entry);
+  mp4_end (b, a);
+  // A sample size table, of the size a long track would have
+  a = mp4_begin (b, "stsz");
+  buf_put_zeros (b, moov_size);
+  mp4_end (b, a);
+  mp4_end (b, stbl);
+  mp4_end (b, minf);
+  mp4_end (b, mdia);
+  mp4_end (b, trak);
+
+  size_t udta = mp4_begin (b, "udta");
+  size_t meta = mp4_begin (b, "meta");
+  buf_put_be (b, 0, 4);
+  size_t ilst = mp4_begin (b, "ilst");
+  static const char *types[] = { "\xa9nam", "\xa9""alb", "\xa9""ART",
+    "\xa9gen", "\xa9wrt" };
+  static const char *labels[] = { "Title", "Album", "Artist", "Genre",
+    "Composer" };
+  for (int i = 0; i < 5; i++)
+    {
+    char *text = make_text (labels[i], n);
+    mp4_text_item (b, types[i], text);
+    free (text);
+    }
+  if (art_size > 0)
+    {
+    size_t item = mp4_begin (b, "covr");
+    size_t data = mp4_begin (b, "data");
+    buf_put_be (b, 13, 4); // JPEG
+    buf_put_be (b, 0, 4);
+    put_art (b);
+    mp4_end (b, data);
+    mp4_end (b, item);
+    }
+  mp4_end (b, ilst);
+  mp4_end (b, meta);
+  mp4_end (b, udta);
+  mp4_end (b, moov);
+
+  a = mp4_begin (b, "mdat");
+  buf_put_zeros (b, 40000);
+  mp4_end (b, a);
+  }
+
+/*==========================================================================
+
+  mp4_find
+
+  Find the atom at path, such as "moov/trak", in the MP4 file in b, and
+  return its offset, or zero if there is no such atom
+
+==========================================================================*/
+static size_t mp4_find (const Buf *b, const char *path)
+  {
+  size_t start = 0, end = b->len;
+  while (*path)
+    {
+    size_t pos = start;
+    while (pos + 8 <= end && memcmp (b->data + pos + 4, path, 4) != 0)
+      pos += (b->data[pos] << 24) | (b->data[pos + 1] << 16) 
+        | (b->data[pos + 2] << 8) | b->data[pos + 3];
+    if (pos + 8 > end) return 0;
+    path += 4;
+    if (*path == '/') path++;
+    start = pos + 8;
+    end = pos + ((b->data[pos] << 24) | (b->data[pos + 1] << 16) 
+        | (b->data[pos + 2] << 8) | b->data[pos + 3]);
+    if (!*path) return pos;
+    }
+  return 0;
+  }
+
+/*==========================================================================
+
+  make_mp4_broken
+
+  An MP4 file that ends keep bytes into the atom at path, as a 
+  truncated file would, but whose atoms that contain that one have 
+  sizes that end there. The atom itself claims its full size plus 
+  extra bytes, which may be negative
+
+==========================================================================*/
+static void make_mp4_broken (Buf *b, const char *path, int keep, int extra)
+  {
+  make_mp4 (b, 0);
+  size_t pos = mp4_find (b, path);
+  size_t end = pos + keep;
+  buf_set_be32 (b, pos, ((b->data[pos] << 24) | (b->data[pos + 1] << 16) 
+    | (b->data[pos + 2] << 8) | b->data[pos + 3]) + extra);
+  // Each containing atom's path is a prefix of path
+  char *parent = strdup (path);
+  char *slash;
+  while ((slash = strrchr (parent, '/')))
+    {
+    *slash = 0;
+    size_t ppos = mp4_find (b, parent);
+    buf_set_be32 (b, ppos, end - ppos);
+    }
+  free (parent);
+  b->len = end;
+  }
+
+/*==========================================================================
+
+  write_file
+
+==========================================================================*/
+static int write_file (const char *dir, const char *name, int n,
+    const char *ext, const Buf *b)
+  {
+  char *path;
+  asprintf (&path, "%s/%s-%04d.%s", dir, name, n, ext);
+  FILE *f = fopen (path, "wb");
+  if (!f)
+    {
+    fprintf (stderr, "Can't write %s: %s\n", path, strerror (errno));
+    free (path);
+    return -1;
+    }
+  fwrite (b->data, 1, b->len, f);
+  fclose (f);
+  free (path);
+  return 0;
+  }
+
+/*==========================================================================
+
+  main
+
+==========================================================================*/
+int main (int argc, char **argv)
+  {
+  int files = 20;
+  int opt;
+  while ((opt = getopt (argc, argv, "n:t:a:m:")) != -1)
+    {
+    switch (opt)
+      {
+      case 'n': files = atoi (optarg); break;
+      case 't': tag_size = atoi (optarg); break;
+      case 'a': art_size = atoi (optarg); break;
+      case 'm': moov_size = atoi (optarg); break;
+      default:
+        fprintf (stderr, "Usage: %s [-n files] [-t tag_bytes] "
+          "[-a art_bytes] [-m moov_bytes] directory\n", argv[0]);
+        return 1;
+      }
+    }
+  if (optind >= argc)
+    {
+    fprintf (stderr, "%s: no output directory\n", argv[0]);
+    return 1;
+    }
+  const char *dir = argv[optind];
+  mkdir (dir, 0755);
+
+  if (art_size > 0 && art_size < 4) art_size = 4;
+  if (tag_size < 1) tag_size = 1;
+  if (tag_size > 500)
+    {
+    // Six comments of this size must fit in the 4kB the Ogg reader
+    //  examines
+    fprintf (stderr, "%s: limiting Ogg tags to 500 bytes\n", argv[0]);
+    }
+
+  int ret = 0;
+  for (int n = 0; n < files && ret == 0; n++)
+    {
+    Buf b = { 0 };
+    make_mp3 (&b, 2, 0, n);
+    ret |= write_file (dir, "id3v22", n, "mp3", &b);
+    buf_free (&b);
+    make_mp3 (&b, 3, 0, n);
+    ret |= write_file (dir, "id3v23", n, "mp3", &b);
+    buf_free (&b);
+    make_mp3 (&b, 4, 0, n);
+    ret |= write_file (dir, "id3v24", n, "mp3", &b);
+    buf_free (&b);
+    make_mp3 (&b, 3, ID3_UNSYNC | ID3_EXT_HEADER, n);
+    ret |= write_file (dir, "id3v23x", n, "mp3", &b);
+    buf_free (&b);
+    make_mp3 (&b, 4, ID3_UNSYNC | ID3_EXT_HEADER | ID3_FOOTER, n);
+    ret |= write_file (dir, "id3v24x", n, "mp3", &b);
+    buf_free (&b);
+    make_flac (&b, n);
+    ret |= write_file (dir, "flac", n, "flac", &b);
+    buf_free (&b);
+    int saved = tag_size;
+    if (tag_size > 500) tag_size = 500;
+    make_ogg (&b, n);
+    tag_size = saved;
+    ret |= write_file (dir, "vorbis", n, "ogg", &b);
+    buf_free (&b);
+    make_mp4 (&b, n);
+    ret |= write_file (dir, "mp4", n, "m4a", &b);
+    buf_free (&b);
+    }
+
+  // Broken files, which need only one of each
+  static const struct { const char *path; int keep; int extra; 
+      const char *name; } broken[] = 
+    { 
+      { "moov", 64, 0, "mp4-moov-cut" },
+      { "moov/mvhd", 16, 0, "mp4-mvhd-cut" },
+      { "moov/mvhd", 108, 4096, "mp4-mvhd-long" },
+      { "moov/mvhd", 24, -84, "mp4-mvhd-short" },
+      { "moov/trak", 16, 0, "mp4-trak-cut" },
+      { "moov/trak/mdia", 16, 0, "mp4-mdia-cut" },
+      { "moov/trak/mdia/mdhd", 8, 0, "mp4-mdhd-empty" },
+      { "moov/trak/mdia/mdhd", 24, 0, "mp4-mdhd-cut" },
+      { "moov/trak/mdia/mdhd", 32, 4096, "mp4-mdhd-long" },
+      { "moov/trak/mdia/mdhd", 24, -8, "mp4-mdhd-short" },
+    };
+  for (int i = 0; i < (int)(sizeof (broken) / sizeof (broken[0])) 
+       && ret == 0; i++)
+    {
+    Buf b = { 0 };
+    make_mp4_broken (&b, broken[i].path, broken[i].keep, broken[i].extra);
+    ret |= write_file (dir, broken[i].name, 0, "m4a", &b);
+    buf_free (&b);
+    }
+
+  return ret == 0 ? 0 : 1;
+  }
+
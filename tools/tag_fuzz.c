@@ -0,0 +1,99 @@
+/*============================================================================
+
+  xine-server-x
+  tag_fuzz.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  libFuzzer entry point for the tag reader. The parser under test is
+  chosen at build time by defining TAG_FUZZ_PARSER as the name of one of
+  the tag_get_xxx_tags() functions; 'make fuzz' builds one fuzzer for
+  each. Since the parsers read from files, each input is written to an
+  in-memory file first.
+
+  With TAG_FUZZ_STANDALONE defined, this file has its own main(), which
+  runs each file named on the command line through the parser. This is
+  useful for reproducing crashes, or with compilers that do not support
+  libFuzzer.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../src/defs.h"
+#include "../src/tag_reader.h"
+
+#ifndef TAG_FUZZ_PARSER
+#define TAG_FUZZ_PARSER tag_get_tags
+#endif
+
+/*==========================================================================
+
+  LLVMFuzzerTestOneInput
+
+==========================================================================*/
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size)
+  {
+  static int fd = -1;
+  static char path[64];
+  if (fd < 0)
+    {
+    fd = memfd_create ("tag_fuzz", 0);
+    if (fd < 0) abort ();
+    snprintf (path, sizeof (path), "/proc/self/fd/%d", fd);
+    }
+
+  if (ftruncate (fd, 0) != 0 || pwrite (fd, data, size, 0) != (ssize_t)size)
+    abort ();
+
+  TagData *tag_data = NULL;
+  TAG_FUZZ_PARSER (path, &tag_data);
+  if (tag_data)
+    {
+    // Touch the results, so that bad pointers are found here, rather
+    //  than in the scanner
+    for (int i = 0; i < tag_get_tag_count (tag_data); i++)
+      {
+      Tag *tag = tag_get_tag (tag_data, i);
+      if (tag->frameId) (void)strlen (tag->frameId);
+      if (tag->data) (void)strlen ((char *)tag->data);
+      }
+    tag_free_tag_data (tag_data);
+    }
+  return 0;
+  }
+
+#ifdef TAG_FUZZ_STANDALONE
+/*==========================================================================
+
+  main
+
+==========================================================================*/
+int main (int argc, char **argv)
+  {
+  for (int i = 1; i < argc; i++)
+    {
+    FILE *f = fopen (argv[i], "rb");
+    if (!f)
+      {
+      perror (argv[i]);
+      continue;
+      }
+    fseek (f, 0, SEEK_END);
+    long size = ftell (f);
+    fseek (f, 0, SEEK_SET);
+    uint8_t *data = malloc (size > 0 ? size : 1);
+    size_t n = fread (data, 1, size, f);
+    fclose (f);
+    LLVMFuzzerTestOneInput (data, n);
+    free (data);
+    printf ("%s: OK\n", argv[i]);
+    }
+  return 0;
+  }
+#endif
+
@@ -0,0 +1,212 @@
+/*============================================================================
+
+  xine-server-x
+  utfconv_bench.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Microbenchmark for the UTF conversions in utfconv.c, compared with the
+  scalar Unicode Consortium routines that they wrap. Build with
+  'make bench'; this produces utfconv_bench, which uses the vector fast
+  paths if the target has them (SSE2 on x86-64, NEON on ARM), and
+  utfconv_bench_scalar, which does not. For an ARM build, set CC to a
+  suitable cross-compiler, e.g.,
+
+  make CC=aarch64-linux-gnu-gcc bench
+
+  Usage: utfconv_bench [iterations]
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "../src/defs.h"
+#include "../src/convertutf.h"
+#include "../src/utfconv.h"
+
+// Each corpus is a typical string, repeated to make up a sample of
+//  roughly this many bytes
+#define SAMPLE_SIZE 4096
+
+typedef struct _Corpus
+  {
+  const char *name;
+  const char *text;
+  } Corpus;
+
+static const Corpus corpora[] =
+  {
+  { "ascii", "/srv/music/Pink Floyd/Wish You Were Here/"
+       "01 - Shine On You Crazy Diamond (Parts I-V).flac " },
+  { "latin", "/srv/music/Beyonc\xc3\xa9/D\xc3\xa9j\xc3\xa0 Vu/"
+       "03 - Caf\xc3\xa9 Se\xc3\xb1or \xc3\x85ngstr\xc3\xb6m.mp3 " },
+  { "cjk", "/srv/music/\xe5\x9d\x82\xe6\x9c\xac\xe9\xbe\x8d\xe4\xb8\x80/"
+       "\xe6\x88\xa6\xe5\xa0\xb4\xe3\x81\xae\xe3\x83\xa1\xe3\x83\xaa\xe3"
+       "\x83\xbc\xe3\x82\xaf\xe3\x83\xaa\xe3\x82\xb9\xe3\x83\x9e\xe3\x82"
+       "\xb9.ogg " },
+  { NULL, NULL }
+  };
+
+/*==========================================================================
+
+  now_ns
+
+==========================================================================*/
+static double now_ns (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+  }
+
+/*==========================================================================
+
+  report
+
+==========================================================================*/
+static void report (const char *corpus, const char *what, double base_ns,
+    double fast_ns, size_t bytes, int iterations)
+  {
+  double mb = (double)bytes * iterations / (1024 * 1024);
+  printf ("%-6s %-12s baseline %8.1f MB/s  utfconv %8.1f MB/s  x%.2f\n",
+    corpus, what, mb / (base_ns / 1e9), mb / (fast_ns / 1e9),
+    base_ns / fast_ns);
+  }
+
+/*==========================================================================
+
+  bench_corpus
+
+==========================================================================*/
+static BOOL bench_corpus (const Corpus *corpus, int iterations)
+  {
+  BOOL ok = TRUE;
+  size_t unit = strlen (corpus->text);
+  size_t reps = SAMPLE_SIZE / unit + 1;
+  size_t len8 = unit * reps;
+  UTF8 *utf8 = malloc (len8 + 1);
+  for (size_t i = 0; i < reps; i++)
+    memcpy (utf8 + i * unit, corpus->text, unit);
+  utf8[len8] = 0;
+
+  // Reference conversions, used to check utfconv's results and as the
+  //  inputs to the other directions
+  UTF32 *utf32 = malloc ((len8 + 1) * sizeof (UTF32));
+  const UTF8 *s8 = utf8;
+  UTF32 *t32 = utf32;
+  ConvertUTF8toUTF32 (&s8, utf8 + len8, &t32, utf32 + len8, 
+    strictConversion);
+  size_t len32 = t32 - utf32;
+  UTF16 *utf16 = malloc ((len32 * 2 + 1) * sizeof (UTF16));
+  const UTF32 *s32 = utf32;
+  UTF16 *t16 = utf16;
+  ConvertUTF32toUTF16 (&s32, utf32 + len32, &t16, utf16 + len32 * 2,
+    strictConversion);
+  size_t len16 = t16 - utf16;
+
+  UTF32 *out32 = malloc ((len8 + 1) * sizeof (UTF32));
+  UTF8 *out8 = malloc (len32 * 4 + 1);
+
+  // UTF-8 to UTF-32
+  double t0 = now_ns ();
+  for (int i = 0; i < iterations; i++)
+    {
+    const UTF8 *s = utf8;
+    UTF32 *t = out32;
+    ConvertUTF8toUTF32 (&s, utf8 + len8, &t, out32 + len8, strictConversion);
+    }
+  double t1 = now_ns ();
+  for (int i = 0; i < iterations; i++)
+    free (utfconv_utf8_to_utf32 (utf8, len8, NULL));
+  double t2 = now_ns ();
+  report (corpus->name, "utf8->utf32", t1 - t0, t2 - t1, len8, iterations);
+  size_t check_len;
+  UTF32 *check32 = utfconv_utf8_to_utf32 (utf8, len8, &check_len);
+  if (check_len != len32 || memcmp (check32, utf32, len32 * sizeof (UTF32)))
+    {
+    printf ("%s: utf8->utf32 mismatch\n", corpus->name);
+    ok = FALSE;
+    }
+  free (check32);
+
+  // UTF-32 to UTF-8
+  t0 = now_ns ();
+  for (int i = 0; i < iterations; i++)
+    {
+    const UTF32 *s = utf32;
+    UTF8 *t = out8;
+    ConvertUTF32toUTF8 (&s, utf32 + len32, &t, out8 + len32 * 4,
+      strictConversion);
+    }
+  t1 = now_ns ();
+  for (int i = 0; i < iterations; i++)
+    free (utfconv_utf32_to_utf8 (utf32, len32, NULL));
+  t2 = now_ns ();
+  report (corpus->name, "utf32->utf8", t1 - t0, t2 - t1, len8, iterations);
+  UTF8 *check = utfconv_utf32_to_utf8 (utf32, len32, NULL);
+  if (strcmp ((char *)check, (char *)utf8))
+    {
+    printf ("%s: utf32->utf8 mismatch\n", corpus->name);
+    ok = FALSE;
+    }
+  free (check);
+
+  // UTF-16 to UTF-8
+  t0 = now_ns ();
+  for (int i = 0; i < iterations; i++)
+    {
+    const UTF16 *s = utf16;
+    UTF8 *t = out8;
+    ConvertUTF16toUTF8 (&s, utf16 + len16, &t, out8 + len32 * 4,
+      strictConversion);
+    }
+  t1 = now_ns ();
+  for (int i = 0; i < iterations; i++)
+    free (utfconv_utf16_to_utf8 (utf16, len16, FALSE, NULL));
+  t2 = now_ns ();
+  report (corpus->name, "utf16->utf8", t1 - t0, t2 - t1, len8, iterations);
+  check = utfconv_utf16_to_utf8 (utf16, len16, FALSE, NULL);
+  if (strcmp ((char *)check, (char *)utf8))
+    {
+    printf ("%s: utf16->utf8 mismatch\n", corpus->name);
+    ok = FALSE;
+    }
+  free (check);
+
+  free (out8);
+  free (out32);
+  free (utf16);
+  free (utf32);
+  free (utf8);
+  return ok;
+  }
+
+/*==========================================================================
+
+  main
+
+==========================================================================*/
+int main (int argc, char **argv)
+  {
+  int iterations = argc > 1 ? atoi (argv[1]) : 20000;
+  if (iterations <= 0) iterations = 1;
+
+#if defined(UTFCONV_SCALAR)
+  printf ("utfconv: scalar build\n");
+#elif defined(__SSE2__)
+  printf ("utfconv: SSE2 build\n");
+#elif defined(__ARM_NEON)
+  printf ("utfconv: NEON build\n");
+#else
+  printf ("utfconv: scalar build (no vector unit)\n");
+#endif
+
+  BOOL ok = TRUE;
+  for (const Corpus *c = corpora; c->name; c++)
+    ok &= bench_corpus (c, iterations);
+  return ok ? 0 : 1;
+  }
+
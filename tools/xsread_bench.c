@@ -0,0 +1,272 @@
+/*============================================================================
+
+  xine-server-x
+  xsread_bench.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Microbenchmark for reading xine-server responses. A fake server,
+  running in a child process, answers every command with a playlist
+  response of a configurable number of entries. The client side
+  compares the original reader, which made a new connection for each
+  command and read the response one byte at a time, with
+  xineserver_send_and_receive(), with and without connection pooling.
+
+  The number of read() and recv() calls is counted by linking with
+  --wrap, so this program must be built by 'make bench'.
+
+  Usage: xsread_bench [-n entries] [-r repeats]
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "../src/xine-server-api.h"
+
+// Not in the public header
+BOOL xineserver_send_and_receive (const char *host, int port,
+       const char *command, char **response, char **error);
+
+static uint64_t count_syscalls = 0;
+
+/*==========================================================================
+
+  System call wrappers
+
+==========================================================================*/
+ssize_t __real_read (int fd, void *buf, size_t count);
+ssize_t __real_recv (int fd, void *buf, size_t count, int flags);
+
+ssize_t __wrap_read (int fd, void *buf, size_t count)
+  {
+  count_syscalls++;
+  return __real_read (fd, buf, count);
+  }
+
+ssize_t __wrap_recv (int fd, void *buf, size_t count, int flags)
+  {
+  count_syscalls++;
+  return __real_recv (fd, buf, count, flags);
+  }
+
+/*==========================================================================
+
+  now_ns
+
+==========================================================================*/
+static double now_ns (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+  }
+
+/*==========================================================================
+
+  run_server
+
+  Answer every line received with the same response, until the client
+  closes the connection. One connection at a time is enough here
+
+==========================================================================*/
+static void run_server (int listener, const char *response)
+  {
+  size_t response_len = strlen (response);
+  for (;;)
+    {
+    int sock = accept (listener, NULL, NULL);
+    if (sock < 0) continue;
+    FILE *in = fdopen (sock, "r");
+    char line[256];
+    while (fgets (line, sizeof (line), in))
+      {
+      size_t off = 0;
+      while (off < response_len)
+        {
+        ssize_t n = send (sock, response + off, response_len - off,
+          MSG_NOSIGNAL);
+        if (n <= 0) break;
+        off += n;
+        }
+      }
+    fclose (in);
+    }
+  }
+
+/*==========================================================================
+
+  legacy_send_and_receive
+
+  The original implementation, for comparison
+
+==========================================================================*/
+static BOOL legacy_send_and_receive (const char *host,
+       int port, const char *command, char **response)
+  {
+  BOOL ret = FALSE;
+  int sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (sock >= 0)
+    {
+    struct hostent *hostent = gethostbyname (host);
+    if (hostent)
+      {
+      struct sockaddr_in sin;
+      memcpy (&sin.sin_addr.s_addr, hostent->h_addr, hostent->h_length);
+      sin.sin_family = AF_INET;
+      sin.sin_port = htons (port);
+      if (connect (sock, (struct sockaddr *)&sin, sizeof (sin)) == 0)
+        {
+        static char *buff = "\r\n";
+        send (sock, command, strlen (command), 0);
+        send (sock, buff, 2, 0);
+        int n;
+        BOOL got_line = FALSE;
+        char *rbuff = malloc (1);
+        rbuff[0] = 0;
+        int i = 0;
+        do
+          {
+          char buf[1];
+          n = read (sock, &buf, 1);
+          if (buf[0] == '\n')
+            got_line = TRUE;
+          else
+            {
+            rbuff = realloc (rbuff, i + 2);
+            rbuff[i] = buf[0];
+            rbuff[i + 1] = 0;
+            }
+          i++;
+          } while (n > 0 && !got_line);
+        *response = strdup (rbuff);
+        free (rbuff);
+        ret = TRUE;
+        }
+      }
+    close (sock);
+    }
+  return ret;
+  }
+
+/*==========================================================================
+
+  report
+
+==========================================================================*/
+static void report (const char *name, double ns, uint64_t syscalls,
+    int repeats, size_t response_len)
+  {
+  printf ("%-20s %10.1f us/cmd %10.1f reads/cmd %8.1f MB/s\n", name,
+    ns / repeats / 1e3, (double)syscalls / repeats,
+    (double)response_len * repeats / (ns / 1e9) / (1024 * 1024));
+  }
+
+/*==========================================================================
+
+  main
+
+==========================================================================*/
+int main (int argc, char **argv)
+  {
+  int entries = 500;
+  int repeats = 200;
+  int opt;
+  while ((opt = getopt (argc, argv, "n:r:")) != -1)
+    {
+    switch (opt)
+      {
+      case 'n': entries = atoi (optarg); break;
+      case 'r': repeats = atoi (optarg); break;
+      default:
+        fprintf (stderr, "Usage: %s [-n entries] [-r repeats]\n", argv[0]);
+        return 1;
+      }
+    }
+  if (repeats < 1) repeats = 1;
+
+  // A playlist response, with entries that look like typical paths
+  size_t cap = 64 + (size_t)entries * 80;
+  char *response = malloc (cap);
+  size_t len = sprintf (response, "0");
+  for (int i = 0; i < entries; i++)
+    len += sprintf (response + len,
+      " \"/srv/music/Some Artist/Some Album/%02d - Track number %d.flac\"",
+      i % 100, i);
+  strcpy (response + len, "\n");
+  len++;
+
+  int listener = socket (AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sin;
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sin.sin_port = 0;
+  socklen_t sin_len = sizeof (sin);
+  if (bind (listener, (struct sockaddr *)&sin, sizeof (sin)) != 0
+      || listen (listener, 16) != 0
+      || getsockname (listener, (struct sockaddr *)&sin, &sin_len) != 0)
+    {
+    perror ("listen");
+    return 1;
+    }
+  int port = ntohs (sin.sin_port);
+
+  pid_t pid = fork ();
+  if (pid == 0)
+    {
+    run_server (listener, response);
+    _exit (0);
+    }
+  close (listener);
+
+  printf ("%d entries, %lu bytes per response\n", entries,
+    (unsigned long)len);
+
+  BOOL ok = TRUE;
+  char *r = NULL;
+  uint64_t syscalls = count_syscalls;
+  double t0 = now_ns ();
+  for (int i = 0; i < repeats && ok; i++)
+    {
+    ok = legacy_send_and_receive ("localhost", port, "playlist", &r);
+    if (ok && strlen (r) != len - 1) ok = FALSE;
+    free (r);
+    }
+  report ("legacy", now_ns () - t0, count_syscalls - syscalls, repeats, len);
+
+  for (int pooled = 0; pooled <= 1 && ok; pooled++)
+    {
+    xineserver_pool_set_limits (pooled ? XINESERVER_POOL_DEF_SIZE : 0,
+      XINESERVER_POOL_DEF_IDLE_TIMEOUT);
+    syscalls = count_syscalls;
+    t0 = now_ns ();
+    for (int i = 0; i < repeats && ok; i++)
+      {
+      char *error = NULL;
+      ok = xineserver_send_and_receive ("localhost", port, "playlist",
+        &r, &error);
+      if (ok && strlen (r) != len - 1) ok = FALSE;
+      if (ok) free (r);
+      else fprintf (stderr, "%s\n", error ? error : "bad response");
+      free (error);
+      }
+    report (pooled ? "buffered, pooled" : "buffered", now_ns () - t0,
+      count_syscalls - syscalls, repeats, len);
+    }
+
+  xineserver_pool_close_all ();
+  kill (pid, SIGTERM);
+  waitpid (pid, NULL, 0);
+  free (response);
+  if (!ok) fprintf (stderr, "Response mismatch\n");
+  return ok ? 0 : 1;
+  }